@@ -43,19 +43,8 @@ try
 	pinba_options_t options = {};
 	auto globals = pinba_globals_init(&options);
 
-	collector_conf_t collector_conf = {
-		.address       = "0.0.0.0",
-		.port          = "3002",
-		.nn_output     = "inproc://udp-collector",
-		.nn_shutdown   = "inproc://udp-collector/shutdown",
-		.n_threads     = 2,
-		.batch_size    = 128,
-		.batch_timeout = 10 * d_millisecond,
-	};
-	auto collector = create_collector(globals, &collector_conf);
-
 	repacker_conf_t repacker_conf = {
-		.nn_input        = collector_conf.nn_output,
+		.nn_input        = "inproc://repacker/input",
 		.nn_output       = "inproc://repacker",
 		.nn_shutdown     = "inproc://repacker/shutdown",
 		.nn_input_buffer = 2 * 1024,
@@ -65,6 +54,17 @@ try
 	};
 	auto repacker = create_repacker(globals, &repacker_conf);
 
+	collector_conf_t collector_conf = {
+		.address       = "0.0.0.0",
+		.port          = "3002",
+		.nn_shutdown   = "inproc://udp-collector/shutdown",
+		.n_threads     = 2,
+		.batch_size    = 128,
+		.batch_timeout = 10 * d_millisecond,
+		.repacker      = repacker.get(),
+	};
+	auto collector = create_collector(globals, &collector_conf);
+
 	coordinator_conf_t coordinator_conf = {
 		.nn_input                = repacker_conf.nn_output,
 		.nn_input_buffer         = 16,
@@ -0,0 +1,257 @@
+#ifndef PINBA__EXPERIMENTS__LOADGEN_DATAGRAM_H_
+#define PINBA__EXPERIMENTS__LOADGEN_DATAGRAM_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "proto/pinba.pb-c.h"
+
+#include "pinba/collector.h" // PINBA_NET_DATAGRAM_FLAG___*
+
+#ifdef PINBA_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// random Pinba.Request datagrams, shared by pinba2-loadgen and pinba2-engine-bench
+//
+// requests have a configurable number of timers and tags, tag values are drawn from a window of
+// `cardinality` distinct strings, callers slide the window forward to get churn
+// (so old values go away and dictionaries have something to forget)
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct loadgen_request_conf_t
+{
+	uint32_t     n_timers       = 10;     // per request
+	uint32_t     n_timer_tags   = 2;      // per timer
+	uint32_t     n_request_tags = 0;      // per request
+	uint32_t     cardinality    = 1000;   // distinct values per tag (and script names)
+	uint32_t     n_nested       = 0;      // nested requests per datagram
+	bool         lz4            = false;
+};
+
+// xorshift64*
+inline uint64_t loadgen_next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+// builds datagrams, reuses all the memory between them
+struct loadgen_datagram_builder_t
+{
+	enum word_kind_t : uint64_t
+	{
+		timer_tag_name    = 0,
+		timer_tag_value   = 1,
+		request_tag_name  = 2,
+		request_tag_value = 3,
+	};
+
+	struct request_storage_t
+	{
+		char                  hostname[32];
+		char                  server_name[32];
+		char                  script_name[64];
+
+		std::vector<uint32_t> timer_hit_count;
+		std::vector<float>    timer_value;
+		std::vector<uint32_t> timer_tag_count;
+		std::vector<uint32_t> timer_tag_name;
+		std::vector<uint32_t> timer_tag_value;
+		std::vector<uint32_t> tag_name;
+		std::vector<uint32_t> tag_value;
+	};
+
+	loadgen_request_conf_t const&       opts_;
+	uint64_t                            rng_;
+
+	// dictionary of current datagram, shared by outer and nested requests
+	std::string                         dict_arena_;
+	std::vector<std::pair<size_t, size_t>> dict_words_;  // offset, length in arena
+	std::unordered_map<uint64_t, uint32_t> dict_index_;  // (kind, id) -> dictionary index
+	std::vector<ProtobufCBinaryData>    dict_;
+
+	std::vector<request_storage_t>      storage_;
+	std::vector<Pinba__Request>         requests_;
+	std::vector<Pinba__Request*>        nested_;
+
+	std::string                         packed_;
+
+	loadgen_datagram_builder_t(loadgen_request_conf_t const& opts, uint64_t seed)
+		: opts_(opts)
+		, rng_(seed | 1)
+		, storage_(1 + opts.n_nested)
+		, requests_(1 + opts.n_nested)
+		, nested_(opts.n_nested)
+	{
+	}
+
+	// value id within current cardinality window
+	uint64_t random_value_id(uint64_t window_start)
+	{
+		return window_start + loadgen_next_random(&rng_) % opts_.cardinality;
+	}
+
+	float random_float(float max)
+	{
+		return float(loadgen_next_random(&rng_) % 1000000) * max / 1000000.0f;
+	}
+
+	uint32_t word(word_kind_t kind, uint64_t id)
+	{
+		uint64_t const key = (uint64_t(kind) << 56) | id;
+
+		auto const it = dict_index_.find(key);
+		if (it != dict_index_.end())
+			return it->second;
+
+		static char const *prefix[] = { "tag", "value", "rtag", "rvalue" };
+
+		char buf[64];
+		int const len = snprintf(buf, sizeof(buf), "%s%llu", prefix[kind], (unsigned long long)id);
+
+		uint32_t const index = (uint32_t)dict_words_.size();
+		dict_words_.emplace_back(dict_arena_.size(), size_t(len));
+		dict_arena_.append(buf, len);
+		dict_index_.emplace(key, index);
+		return index;
+	}
+
+	void fill_request(size_t i, uint64_t window_start)
+	{
+		request_storage_t& s = storage_[i];
+		Pinba__Request&    r = requests_[i];
+
+		r = PINBA__REQUEST__INIT;
+
+		snprintf(s.hostname, sizeof(s.hostname), "host%llu", (unsigned long long)(loadgen_next_random(&rng_) % 32));
+		snprintf(s.server_name, sizeof(s.server_name), "server%llu", (unsigned long long)(loadgen_next_random(&rng_) % 4));
+		snprintf(s.script_name, sizeof(s.script_name), "/script%llu.php", (unsigned long long)this->random_value_id(window_start));
+
+		r.hostname      = ProtobufCBinaryData { .len = strlen(s.hostname),    .data = (uint8_t*)s.hostname };
+		r.server_name   = ProtobufCBinaryData { .len = strlen(s.server_name), .data = (uint8_t*)s.server_name };
+		r.script_name   = ProtobufCBinaryData { .len = strlen(s.script_name), .data = (uint8_t*)s.script_name };
+		r.request_count = 1;
+		r.document_size = loadgen_next_random(&rng_) % 100000;
+		r.memory_peak   = loadgen_next_random(&rng_) % (16 * 1024 * 1024);
+		r.request_time  = this->random_float(0.5f);
+		r.ru_utime      = this->random_float(0.1f);
+		r.ru_stime      = this->random_float(0.01f);
+		r.has_status    = 1;
+		r.status        = (loadgen_next_random(&rng_) % 100 == 0) ? 500 : 200;
+
+		s.timer_hit_count.clear();
+		s.timer_value.clear();
+		s.timer_tag_count.clear();
+		s.timer_tag_name.clear();
+		s.timer_tag_value.clear();
+
+		for (uint32_t t = 0; t < opts_.n_timers; t++)
+		{
+			s.timer_hit_count.push_back(1 + loadgen_next_random(&rng_) % 3);
+			s.timer_value.push_back(this->random_float(0.05f));
+			s.timer_tag_count.push_back(opts_.n_timer_tags);
+
+			for (uint32_t g = 0; g < opts_.n_timer_tags; g++)
+			{
+				s.timer_tag_name.push_back(this->word(timer_tag_name, g));
+				s.timer_tag_value.push_back(this->word(timer_tag_value, this->random_value_id(window_start)));
+			}
+		}
+
+		s.tag_name.clear();
+		s.tag_value.clear();
+
+		for (uint32_t g = 0; g < opts_.n_request_tags; g++)
+		{
+			s.tag_name.push_back(this->word(request_tag_name, g));
+			s.tag_value.push_back(this->word(request_tag_value, this->random_value_id(window_start)));
+		}
+
+		r.n_timer_hit_count = s.timer_hit_count.size();
+		r.timer_hit_count   = s.timer_hit_count.data();
+		r.n_timer_value     = s.timer_value.size();
+		r.timer_value       = s.timer_value.data();
+		r.n_timer_tag_count = s.timer_tag_count.size();
+		r.timer_tag_count   = s.timer_tag_count.data();
+		r.n_timer_tag_name  = s.timer_tag_name.size();
+		r.timer_tag_name    = s.timer_tag_name.data();
+		r.n_timer_tag_value = s.timer_tag_value.size();
+		r.timer_tag_value   = s.timer_tag_value.data();
+		r.n_tag_name        = s.tag_name.size();
+		r.tag_name          = s.tag_name.data();
+		r.n_tag_value       = s.tag_value.size();
+		r.tag_value         = s.tag_value.data();
+	}
+
+	// build next datagram into dst (cleared first), returns number of requests in it
+	size_t build(uint64_t window_start, std::string *dst)
+	{
+		dict_arena_.clear();
+		dict_words_.clear();
+		dict_index_.clear();
+
+		for (size_t i = 0; i < requests_.size(); i++)
+			this->fill_request(i, window_start);
+
+		// all words are in, arena won't move anymore
+		dict_.clear();
+		for (auto const& w : dict_words_)
+			dict_.push_back(ProtobufCBinaryData { .len = w.second, .data = (uint8_t*)&dict_arena_[w.first] });
+
+		// dictionary goes into outer request only, nested ones use it
+		Pinba__Request& outer = requests_[0];
+		outer.n_dictionary = dict_.size();
+		outer.dictionary   = dict_.data();
+
+		for (size_t i = 0; i < nested_.size(); i++)
+			nested_[i] = &requests_[i + 1];
+
+		outer.n_requests = nested_.size();
+		outer.requests   = nested_.data();
+
+		size_t const packed_size = pinba__request__get_packed_size(&outer);
+
+		if (!opts_.lz4)
+		{
+			dst->resize(packed_size);
+			pinba__request__pack(&outer, (uint8_t*)&(*dst)[0]);
+			return requests_.size();
+		}
+
+#ifdef PINBA_HAVE_LZ4
+		packed_.resize(packed_size);
+		pinba__request__pack(&outer, (uint8_t*)&packed_[0]);
+
+		// v1 header: <version:4><flags:12><original_data_len:16>
+		dst->resize(4 + LZ4_compressBound(packed_size));
+
+		uint32_t const flags = PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4;
+		(*dst)[0] = char((1 << 4) | ((flags >> 8) & 0x0f));
+		(*dst)[1] = char(flags & 0xff);
+		(*dst)[2] = char((packed_size >> 8) & 0xff);
+		(*dst)[3] = char(packed_size & 0xff);
+
+		int const n = LZ4_compress_default(packed_.data(), &(*dst)[4], (int)packed_size, (int)dst->size() - 4);
+		if (n <= 0)
+			throw std::runtime_error("LZ4_compress_default() failed");
+
+		dst->resize(4 + n);
+#endif
+		return requests_.size();
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__EXPERIMENTS__LOADGEN_DATAGRAM_H_
@@ -0,0 +1,594 @@
+#include "pinba_config.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>      // getopt
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/engine.h"
+#include "pinba/capture.h"
+#include "pinba/dictionary.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+
+#include "loadgen_datagram.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// engine benchmark, no network involved
+// datagrams are injected straight into repacker input (see collector_injector_t), at increasing rates
+// and pinba_stats_t counters tell where drops begin, i.e. capacity of repackers, coordinator and reports
+//
+// stages, as seen through the counters
+//  - repacker input: udp.packet_send_err, repackers (or coordinator, as repackers block on it) can't keep up
+//                    in fused mode (-F) there is no such queue, injecting threads just slow down
+//  - reports input:  coordinator.batch_send_err, report threads can't keep up
+//
+// datagrams are generated (see loadgen_datagram.h) or taken from capture / pcap file
+// and are injected as is (collector parses and decompresses them), or in pre-built batches (-B)
+// that skip collector completely, repackers decode them from protobuf bytes
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct options_t : public loadgen_request_conf_t
+	{
+		uint32_t     n_threads        = 1;       // injecting threads
+		uint32_t     repacker_threads = 4;
+		uint32_t     batch_size       = 256;     // datagrams per injected batch (and collector batches)
+		uint64_t     start_rate       = 100000;  // datagrams per second, all threads, first step
+		uint32_t     step_percent     = 25;      // rate increase per step
+		uint32_t     step_sec         = 5;       // measure every step for this long
+		uint32_t     max_steps        = 30;
+		uint32_t     n_datagrams      = 64 * 1024;  // distinct datagrams to cycle through
+		std::string  capture_file;               // take datagrams from this file, instead of generating
+		bool         prebuilt_batches = false;
+		bool         fused            = false;   // see pinba_options_t::repacker_fused
+	};
+
+	void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  -t <n>      injecting threads (default: 1)\n"
+			"  -P <n>      repacker threads (default: 4)\n"
+			"  -b <n>      datagrams per batch (default: 256)\n"
+			"  -r <n>      datagrams per second to start with, all threads together (default: 100000)\n"
+			"  -s <pct>    rate increase per step, percent (default: 25)\n"
+			"  -d <sec>    step duration (default: 5)\n"
+			"  -m <n>      max steps (default: 30)\n"
+			"  -N <n>      distinct datagrams to cycle through (default: 65536)\n"
+			"  -f <file>   take datagrams from capture or pcap file (see pinba_capture_file), instead of generating\n"
+			"  -B          inject pre-built batches of protobuf bytes, bypassing collector parsing\n"
+			"              (compressed datagrams are skipped, v1 header is stripped)\n"
+			"  -F          fused mode, injecting threads repack datagrams themselves, -P is ignored\n"
+			"generated datagrams:\n"
+			"  -T <n>      timers per request (default: 10)\n"
+			"  -g <n>      tags per timer (default: 2)\n"
+			"  -R <n>      tags per request (default: 0)\n"
+			"  -c <n>      distinct values per tag, also distinct script names (default: 1000)\n"
+			"  -n <n>      nested requests per datagram, datagram carries n+1 requests (default: 0)\n"
+			"  -z          compress datagrams with lz4 (v1 framing)\n"
+			, argv0);
+	}
+
+	std::atomic<bool> stop_flag = { false };
+
+	void on_stop_signal(int)
+	{
+		stop_flag = true;
+	}
+
+	uint64_t monotonic_ns()
+	{
+		return duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+	}
+
+	void sleep_ns(uint64_t ns)
+	{
+		struct timespec const ts = { .tv_sec = time_t(ns / nsec_in_sec), .tv_nsec = long(ns % nsec_in_sec) };
+		nanosleep(&ts, NULL);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct datagram_set_t
+	{
+		std::vector<std::string> datagrams;
+		uint64_t                 n_skipped = 0;  // compressed ones in pre-built batches mode, pcap frames that are not udp
+	};
+
+	// protobuf bytes of the datagram, the way collector gets them from parse_network_datagram()
+	// empty if datagram is compressed
+	str_ref datagram_request_bytes(str_ref dgram)
+	{
+		if (dgram.size() == 0 || (uint8_t(dgram[0]) >> 4) != 1 || dgram.size() < 4)
+			return dgram;
+
+		uint32_t const flags = uint32_t(dgram[0] & 0x0f) | uint8_t(dgram[1]);
+		if (flags & (PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4 | PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT))
+			return {};
+
+		return str_ref { dgram.begin() + 4, dgram.end() };
+	}
+
+	datagram_set_t load_datagrams(options_t const& opts)
+	{
+		datagram_set_t result;
+
+		auto const add = [&](str_ref dgram)
+		{
+			if (opts.prebuilt_batches)
+			{
+				dgram = datagram_request_bytes(dgram);
+				if (dgram.size() == 0)
+				{
+					result.n_skipped++;
+					return;
+				}
+			}
+
+			result.datagrams.emplace_back(dgram.data(), dgram.size());
+		};
+
+		if (!opts.capture_file.empty())
+		{
+			capture_reader_ptr reader = capture_reader_open(opts.capture_file, 0);
+
+			capture_packet_t packet;
+			while (result.datagrams.size() < opts.n_datagrams && reader->next(&packet))
+				add(packet.data);
+
+			result.n_skipped += reader->n_skipped();
+			return result;
+		}
+
+		loadgen_datagram_builder_t builder { opts, 0x9e3779b97f4a7c15ULL };
+
+		std::string buf;
+		while (result.datagrams.size() < opts.n_datagrams)
+		{
+			builder.build(0, &buf);
+			add(buf);
+		}
+
+		return result;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// rate all injecting threads should keep together, changed by main thread between steps
+	// threads restart their schedules when step number changes, rate = 0 means pause
+	struct step_control_t
+	{
+		std::atomic<uint32_t> step = {0};
+		std::atomic<uint64_t> rate = {0};
+
+		void set(uint64_t new_rate)
+		{
+			rate.store(new_rate);
+			step.fetch_add(1);
+		}
+	};
+
+	struct alignas(64) thread_stats_t
+	{
+		std::atomic<uint64_t> datagrams = {0};
+	};
+
+	void injector_thread(options_t const& opts, pinba_engine_t *engine, datagram_set_t const& dset, step_control_t const& control, uint32_t thread_id, thread_stats_t *stats)
+	{
+		collector_injector_ptr injector = engine->create_injector();
+
+		// pre-built batches come back here, when repackers are done with them
+		nmsg_pool_ptr<raw_request_t> req_pool = nmsg_pool_t<raw_request_t>::create();
+
+		size_t   const n_datagrams = dset.datagrams.size();
+		size_t         dgram_idx   = (n_datagrams / opts.n_threads) * thread_id;
+
+		uint32_t step     = UINT32_MAX;
+		uint64_t rate     = 0;
+		uint64_t start_ns = 0;
+		uint64_t n_sent   = 0;
+
+		while (!stop_flag)
+		{
+			uint32_t const curr_step = control.step.load();
+			if (curr_step != step)
+			{
+				step     = curr_step;
+				rate     = control.rate.load();
+				start_ns = monotonic_ns();
+				n_sent   = 0;
+
+				if (rate == 0)
+					injector->flush();
+			}
+
+			if (rate == 0)
+			{
+				sleep_ns(1 * 1000 * 1000);
+				continue;
+			}
+
+			// pace against the schedule, not against the last batch, so that short stalls are caught up on
+			double   const ns_per_datagram = 1e9 * opts.n_threads / rate;
+			uint64_t const due_ns          = start_ns + uint64_t(n_sent * ns_per_datagram);
+			uint64_t const now_ns          = monotonic_ns();
+
+			if (due_ns > now_ns)
+			{
+				sleep_ns(std::min<uint64_t>(due_ns - now_ns, 1 * 1000 * 1000));
+				continue;
+			}
+
+			if (opts.prebuilt_batches)
+			{
+				// datagram storage outlives all batches, no need to copy
+				constexpr size_t nmpa_block_size = 4 * 1024;
+				raw_request_ptr req = req_pool->get(opts.batch_size, nmpa_block_size, true);
+
+				for (uint32_t i = 0; i < opts.batch_size; i++)
+				{
+					std::string const& dgram = dset.datagrams[dgram_idx++ % n_datagrams];
+					req->request_data[req->request_count++] = ProtobufCBinaryData { .len = dgram.size(), .data = (uint8_t*)dgram.data() };
+				}
+
+				injector->inject_batch(std::move(req));
+			}
+			else
+			{
+				for (uint32_t i = 0; i < opts.batch_size; i++)
+				{
+					std::string const& dgram = dset.datagrams[dgram_idx++ % n_datagrams];
+					injector->inject_datagram(str_ref { dgram.data(), dgram.size() });
+				}
+			}
+
+			n_sent += opts.batch_size;
+			stats->datagrams += opts.batch_size;
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct counters_t
+	{
+		uint64_t  injected;
+		uint64_t  udp_send_total;      // packets in batches sent to repackers
+		uint64_t  udp_send_err;        // repacker input full
+		uint64_t  udp_decode_err;
+		uint64_t  repacker_recv;       // requests, including nested
+		uint64_t  repacker_batches;
+		uint64_t  coordinator_batches;
+		uint64_t  coordinator_send_err;  // report input full
+		uint64_t  repacker_cpu_ns;     // all threads
+		uint64_t  coordinator_cpu_ns;
+	};
+
+	counters_t get_counters(pinba_stats_t *stats, thread_stats_t const *thread_stats, uint32_t n_threads)
+	{
+		counters_t c = {};
+
+		for (uint32_t i = 0; i < n_threads; i++)
+			c.injected += thread_stats[i].datagrams;
+
+		c.udp_send_total       = stats->udp.packet_send_total;
+		c.udp_send_err         = stats->udp.packet_send_err;
+		c.udp_decode_err       = stats->udp.packet_decode_err;
+		c.repacker_recv        = stats->repacker.recv_packets;
+		c.repacker_batches     = stats->repacker.batch_send_total;
+		c.coordinator_batches  = stats->coordinator.batches_received;
+		c.coordinator_send_err = stats->coordinator.batch_send_err;
+
+		std::lock_guard<std::mutex> lk_(stats->mtx);
+
+		for (auto const& thr : stats->repacker_threads)
+			c.repacker_cpu_ns += duration_from_timeval(thr.ru_utime + thr.ru_stime).nsec;
+
+		c.coordinator_cpu_ns = duration_from_timeval(stats->coordinator.ru_utime + stats->coordinator.ru_stime).nsec;
+
+		return c;
+	}
+
+	// highest rate a stage has sustained without drops, and the one drops began at
+	struct stage_result_t
+	{
+		char const *name;
+		uint64_t    sustained = 0;   // datagrams per second
+		uint64_t    drops_at  = 0;   // datagrams per second offered, 0 = never dropped
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+try
+{
+	aux::options_t opts;
+
+	int c;
+	while (-1 != (c = getopt(argc, argv, "t:P:b:r:s:d:m:N:f:BFT:g:R:c:n:zh")))
+	{
+		switch (c)
+		{
+			case 't': opts.n_threads        = strtoul(optarg, NULL, 10); break;
+			case 'P': opts.repacker_threads = strtoul(optarg, NULL, 10); break;
+			case 'b': opts.batch_size       = strtoul(optarg, NULL, 10); break;
+			case 'r': opts.start_rate       = strtoull(optarg, NULL, 10); break;
+			case 's': opts.step_percent     = strtoul(optarg, NULL, 10); break;
+			case 'd': opts.step_sec         = strtoul(optarg, NULL, 10); break;
+			case 'm': opts.max_steps        = strtoul(optarg, NULL, 10); break;
+			case 'N': opts.n_datagrams      = strtoul(optarg, NULL, 10); break;
+			case 'f': opts.capture_file     = optarg; break;
+			case 'B': opts.prebuilt_batches = true; break;
+			case 'F': opts.fused            = true; break;
+			case 'T': opts.n_timers         = strtoul(optarg, NULL, 10); break;
+			case 'g': opts.n_timer_tags     = strtoul(optarg, NULL, 10); break;
+			case 'R': opts.n_request_tags   = strtoul(optarg, NULL, 10); break;
+			case 'c': opts.cardinality      = strtoul(optarg, NULL, 10); break;
+			case 'n': opts.n_nested         = strtoul(optarg, NULL, 10); break;
+			case 'z': opts.lz4              = true; break;
+			default:
+				aux::usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (opts.n_threads == 0 || opts.repacker_threads == 0 || opts.batch_size == 0 || opts.start_rate == 0 ||
+		opts.step_sec == 0 || opts.n_datagrams == 0 || opts.cardinality == 0)
+	{
+		aux::usage(argv[0]);
+		return 1;
+	}
+
+#ifndef PINBA_HAVE_LZ4
+	if (opts.lz4)
+		throw std::runtime_error("built without lz4 support");
+#endif
+
+	aux::datagram_set_t const dset = aux::load_datagrams(opts);
+	if (dset.datagrams.empty())
+		throw std::runtime_error(ff::fmt_str("no datagrams to inject, {0} skipped", dset.n_skipped));
+
+	ff::fmt(stdout, "{0} distinct datagrams ({1} skipped), {2} injecting threads, {3}\n",
+		dset.datagrams.size(), dset.n_skipped, opts.n_threads,
+		(opts.prebuilt_batches) ? "pre-built batches" : "datagrams through collector");
+
+	pinba_options_t options = {
+		.net_address              = "",
+		.net_port                 = "",
+
+		.udp_threads              = 1,
+		.udp_batch_messages       = opts.batch_size,
+		.udp_batch_timeout        = 10 * d_millisecond,
+		.udp_idle_spin_count      = 0,
+		.udp_idle_yield_count     = 0,
+		.udp_idle_park_min        = 1 * d_millisecond,
+		.udp_idle_park_max        = 1 * d_millisecond,
+		.udp_busy_poll_usec       = 0,
+		.udp_rcvbuf_absorb_time   = {0},
+		.udp_rcvbuf_absorb_mbps   = 0,
+		.udp_gro                  = false,
+		.udp_recv_max_dgrams      = 0,
+		.udp_recv_slot_size       = 0,
+		.udp_recv_hugepages       = false,
+		.udp_reuseport_cpu_steering = false,
+		.udp_zstd_dictionaries    = "",
+
+		.stream_listen            = "",
+		.stream_threads           = 1,
+
+		.admission_rate           = 0,
+		.admission_burst          = 0,
+		.admission_sample_n       = 0,
+		.admission_slots          = 0,
+
+		.capture_file             = "",
+		.capture_sample_n         = 1,
+		.replay_file              = "",
+		.replay_speed             = 100,
+		.replay_loops             = 1,
+		.inject_only              = true,
+
+		.repacker_threads         = opts.repacker_threads,
+		.repacker_input_buffer    = 16 * 1024,
+		.repacker_batch_messages  = 1024,
+		.repacker_batch_timeout   = 100 * d_millisecond,
+		.repacker_fast_decode     = true,
+		.repacker_fused           = opts.fused,
+
+		.coordinator_input_buffer = 128,
+		.report_input_buffer      = 32,
+
+		.numa_node                = "none",
+		.udp_cpu_list             = "",
+		.udp_nice                 = 0,
+		.repacker_cpu_list        = "",
+		.repacker_nice            = 0,
+		.coordinator_cpu_list     = "",
+		.coordinator_nice         = 0,
+		.report_cpu_list          = "",
+		.report_nice              = 0,
+
+		.logger                   = {},
+	};
+
+	auto pinba = pinba_engine_init(&options);
+	pinba->startup();
+
+	// typical reports, one of each kind that matters: per-request and per-timer (timer tags from loadgen_datagram.h)
+	{
+		static report_conf___by_request_t conf = {
+			.name            = "scripts",
+			.time_window     = 60 * d_second,
+			.tick_count      = 60,
+			.hv_bucket_count = 1 * 1000 * 1000,
+			.hv_bucket_d     = 1 * d_microsecond,
+			.hv_min_value    = {0},
+
+			.filters = {},
+
+			.keys = {
+				report_conf___by_request_t::key_descriptor_by_request_field("script_name", &packet_t::script_id),
+			},
+		};
+		pinba->add_report(create_report_by_request(pinba->globals(), conf));
+	}
+
+	{
+		static report_conf___by_timer_t conf = {
+			.name            = "tag0+tag1",
+			.time_window     = 60 * d_second,
+			.tick_count      = 60,
+			.hv_bucket_count = 1 * 1000 * 1000,
+			.hv_bucket_d     = 1 * d_microsecond,
+			.hv_min_value    = {0},
+
+			.filters = {},
+
+			.timertag_filters = {},
+
+			.keys = {
+				report_conf___by_timer_t::key_descriptor_by_timer_tag("tag0", pinba->globals()->dictionary()->get_or_add("tag0")),
+				report_conf___by_timer_t::key_descriptor_by_timer_tag("tag1", pinba->globals()->dictionary()->get_or_add("tag1")),
+			},
+		};
+		pinba->add_report(create_report_by_timer(pinba->globals(), conf));
+	}
+
+	signal(SIGINT, aux::on_stop_signal);
+	signal(SIGTERM, aux::on_stop_signal);
+
+	aux::step_control_t control;
+	std::unique_ptr<aux::thread_stats_t[]> thread_stats { new aux::thread_stats_t[opts.n_threads] };
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < opts.n_threads; i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			try
+			{
+				aux::injector_thread(opts, pinba.get(), dset, control, i, &thread_stats[i]);
+			}
+			catch (std::exception const& e)
+			{
+				ff::fmt(stderr, "thread {0}: error: {1}\n", i, e.what());
+				aux::stop_flag = true;
+			}
+		});
+	}
+
+	pinba_stats_t *stats = pinba->globals()->stats();
+
+	aux::stage_result_t repacker_stage = { .name = "repacker input" };
+	aux::stage_result_t report_stage   = { .name = "reports input" };
+	uint32_t            n_starved      = 0;   // steps in a row injectors couldn't keep up
+
+	fprintf(stdout, "%10s %10s %10s %12s %12s %8s %8s %8s\n",
+		"offered/s", "injected/s", "repacked/s", "repack_drops", "report_drops", "decode_e", "rp_cpu%", "coord%");
+
+	for (uint32_t step = 0; step < opts.max_steps && !aux::stop_flag; step++)
+	{
+		uint64_t const rate = uint64_t(opts.start_rate * std::pow(1.0 + opts.step_percent / 100.0, step));
+
+		// let the queues fill up to their steady state, before measuring
+		control.set(rate);
+		aux::sleep_ns(1 * nsec_in_sec);
+
+		aux::counters_t const c0 = aux::get_counters(stats, thread_stats.get(), opts.n_threads);
+		uint64_t        const t0 = aux::monotonic_ns();
+
+		for (uint32_t i = 0; i < opts.step_sec && !aux::stop_flag; i++)
+			aux::sleep_ns(1 * nsec_in_sec);
+
+		aux::counters_t const c1 = aux::get_counters(stats, thread_stats.get(), opts.n_threads);
+		double          const elapsed = double(aux::monotonic_ns() - t0) / nsec_in_sec;
+
+		// drain, batch timeouts are way less than that
+		control.set(0);
+		aux::sleep_ns(1 * nsec_in_sec);
+
+		uint64_t const injected     = uint64_t((c1.injected - c0.injected) / elapsed);
+		uint64_t const repacked     = uint64_t((c1.repacker_recv - c0.repacker_recv) / elapsed);
+		uint64_t const repack_drops = c1.udp_send_err - c0.udp_send_err;
+		uint64_t const report_drops = c1.coordinator_send_err - c0.coordinator_send_err;
+
+		fprintf(stdout, "%10llu %10llu %10llu %12llu %12llu %8llu %8llu %8llu\n",
+			(unsigned long long)rate,
+			(unsigned long long)injected,
+			(unsigned long long)repacked,
+			(unsigned long long)repack_drops,
+			(unsigned long long)report_drops,
+			(unsigned long long)(c1.udp_decode_err - c0.udp_decode_err),
+			(unsigned long long)((c1.repacker_cpu_ns - c0.repacker_cpu_ns) / elapsed / nsec_in_sec * 100),
+			(unsigned long long)((c1.coordinator_cpu_ns - c0.coordinator_cpu_ns) / elapsed / nsec_in_sec * 100));
+		fflush(stdout);
+
+		for (aux::stage_result_t *stage : { &repacker_stage, &report_stage })
+		{
+			uint64_t const drops = (stage == &repacker_stage) ? repack_drops : report_drops;
+
+			if (stage->drops_at != 0)
+				continue;
+
+			if (drops > 0)
+				stage->drops_at = rate;
+			else
+				stage->sustained = std::max(stage->sustained, injected);
+		}
+
+		// nothing more to learn, everything downstream of repackers is starved when they drop
+		if (repacker_stage.drops_at != 0)
+			break;
+
+		// can't push harder, need more injecting threads
+		n_starved = (injected < rate * 97 / 100) ? n_starved + 1 : 0;
+		if (n_starved >= 2)
+		{
+			ff::fmt(stdout, "injecting threads can't keep up with {0} datagrams/s, try more of them (-t)\n", rate);
+			break;
+		}
+	}
+
+	aux::stop_flag = true;
+	for (auto& t : threads)
+		t.join();
+
+	ff::fmt(stdout, "\nmax sustained datagrams/s before drops (requests per datagram: {0}):\n",
+		(opts.capture_file.empty()) ? ff::fmt_str("{0}", 1 + opts.n_nested) : std::string("unknown, captured traffic"));
+
+	for (aux::stage_result_t const *stage : { &repacker_stage, &report_stage })
+	{
+		if (stage->drops_at != 0)
+			ff::fmt(stdout, "  {0}: {1}, drops began at {2}\n", stage->name, stage->sustained, stage->drops_at);
+		else
+			ff::fmt(stdout, "  {0}: {1}, no drops\n", stage->name, stage->sustained);
+	}
+
+	pinba->shutdown();
+	pinba.reset();
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -0,0 +1,328 @@
+#include "pinba_config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>      // getopt
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "pinba/globals.h"
+
+#include "loadgen_datagram.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// pinba traffic generator, sends random Pinba.Request datagrams from multiple threads at a target rate
+//
+// see loadgen_datagram.h for what requests look like, tag value window slides forward by `churn` strings per second
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct options_t : public loadgen_request_conf_t
+	{
+		std::string  address        = "127.0.0.1";
+		std::string  port           = "3002";
+		uint32_t     n_threads      = 1;
+		uint64_t     rate           = 10000;  // datagrams per second, all threads, 0 = as fast as possible
+		uint32_t     duration_sec   = 0;      // 0 = till interrupted
+		uint32_t     churn          = 0;      // new values per tag per second
+		uint32_t     batch_size     = 64;     // datagrams per sendmmsg() call
+	};
+
+	void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  -a <host>   pinba address (default: 127.0.0.1)\n"
+			"  -p <port>   pinba port (default: 3002)\n"
+			"  -t <n>      sending threads (default: 1)\n"
+			"  -r <n>      datagrams per second, all threads together, 0 = as fast as possible (default: 10000)\n"
+			"  -d <sec>    run for this long, 0 = till interrupted (default: 0)\n"
+			"  -T <n>      timers per request (default: 10)\n"
+			"  -g <n>      tags per timer (default: 2)\n"
+			"  -R <n>      tags per request (default: 0)\n"
+			"  -c <n>      distinct values per tag, also distinct script names (default: 1000)\n"
+			"  -C <n>      new values per tag per second, old ones go away (default: 0)\n"
+			"  -n <n>      nested requests per datagram, datagram carries n+1 requests (default: 0)\n"
+			"  -b <n>      datagrams per sendmmsg() call (default: 64)\n"
+			"  -z          compress datagrams with lz4 (v1 framing)\n"
+			, argv0);
+	}
+
+	std::atomic<bool> stop_flag = { false };
+
+	void on_stop_signal(int)
+	{
+		stop_flag = true;
+	}
+
+	uint64_t monotonic_ns()
+	{
+		return duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// per-thread counters, read by main thread for reporting
+	struct alignas(64) thread_stats_t
+	{
+		std::atomic<uint64_t> datagrams = {0};
+		std::atomic<uint64_t> requests  = {0};
+		std::atomic<uint64_t> bytes     = {0};
+		std::atomic<uint64_t> send_err  = {0};
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	int connect_udp(options_t const& opts)
+	{
+		struct addrinfo hints = {};
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		struct addrinfo *ai = NULL;
+		int const gai_r = getaddrinfo(opts.address.c_str(), opts.port.c_str(), &hints, &ai);
+		if (gai_r != 0)
+			throw std::runtime_error(ff::fmt_str("can't resolve {0}:{1}: {2}", opts.address, opts.port, gai_strerror(gai_r)));
+		MEOW_DEFER(freeaddrinfo(ai););
+
+		int const fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			throw std::runtime_error(ff::fmt_str("socket() failed: {0}:{1}", errno, strerror(errno)));
+
+		if (0 != connect(fd, ai->ai_addr, ai->ai_addrlen))
+		{
+			int const e = errno;
+			close(fd);
+			throw std::runtime_error(ff::fmt_str("connect({0}:{1}) failed: {2}:{3}", opts.address, opts.port, e, strerror(e)));
+		}
+
+		int const sndbuf = 4 * 1024 * 1024;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)); // best effort
+
+		return fd;
+	}
+
+	void sender_thread(options_t const& opts, uint32_t thread_id, uint64_t start_ns, thread_stats_t *stats)
+	{
+		int const fd = connect_udp(opts);
+		MEOW_DEFER(close(fd););
+
+		loadgen_datagram_builder_t builder { opts, 0x9e3779b97f4a7c15ULL * (thread_id + 1) };
+
+		std::vector<std::string>    bufs(opts.batch_size);
+		std::vector<struct iovec>   iov(opts.batch_size);
+		std::vector<struct mmsghdr> hdr(opts.batch_size);
+		std::vector<size_t>         n_requests(opts.batch_size); // in each datagram
+
+		// this thread's share of the rate
+		double const ns_per_datagram = (opts.rate > 0) ? (1e9 * opts.n_threads / opts.rate) : 0.0;
+
+		uint64_t n_sent = 0;
+
+		while (!stop_flag)
+		{
+			uint64_t const now_ns = monotonic_ns();
+
+			// pace against the schedule, not against the last send, so that short stalls are caught up on
+			if (ns_per_datagram > 0)
+			{
+				uint64_t const due_ns = start_ns + uint64_t(n_sent * ns_per_datagram);
+				if (due_ns > now_ns)
+				{
+					uint64_t const sleep_ns = std::min<uint64_t>(due_ns - now_ns, 10 * 1000 * 1000);
+					struct timespec const ts = { .tv_sec = 0, .tv_nsec = long(sleep_ns) };
+					nanosleep(&ts, NULL);
+					continue;
+				}
+			}
+
+			uint64_t const window_start = (now_ns - start_ns) / nsec_in_sec * opts.churn;
+
+			for (uint32_t i = 0; i < opts.batch_size; i++)
+			{
+				n_requests[i] = builder.build(window_start, &bufs[i]);
+
+				iov[i] = { .iov_base = &bufs[i][0], .iov_len = bufs[i].size() };
+				hdr[i] = {};
+				hdr[i].msg_hdr.msg_iov    = &iov[i];
+				hdr[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			uint32_t n_done = 0;
+			while (n_done < opts.batch_size)
+			{
+				int const n = sendmmsg(fd, &hdr[n_done], opts.batch_size - n_done, 0);
+				if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+
+					stats->send_err++;
+					n_done++; // skip the one that failed
+					continue;
+				}
+
+				// only what has actually been sent, failed ones are counted in send_err
+				uint64_t sent_bytes = 0, sent_requests = 0;
+				for (int i = 0; i < n; i++)
+				{
+					sent_bytes    += hdr[n_done + i].msg_len;
+					sent_requests += n_requests[n_done + i];
+				}
+
+				stats->bytes     += sent_bytes;
+				stats->requests  += sent_requests;
+				stats->datagrams += n;
+				n_done += n;
+			}
+
+			n_sent += opts.batch_size; // schedule position, failed sends are not retried
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+try
+{
+	aux::options_t opts;
+
+	int c;
+	while (-1 != (c = getopt(argc, argv, "a:p:t:r:d:T:g:R:c:C:n:b:zh")))
+	{
+		switch (c)
+		{
+			case 'a': opts.address        = optarg; break;
+			case 'p': opts.port           = optarg; break;
+			case 't': opts.n_threads      = strtoul(optarg, NULL, 10); break;
+			case 'r': opts.rate           = strtoull(optarg, NULL, 10); break;
+			case 'd': opts.duration_sec   = strtoul(optarg, NULL, 10); break;
+			case 'T': opts.n_timers       = strtoul(optarg, NULL, 10); break;
+			case 'g': opts.n_timer_tags   = strtoul(optarg, NULL, 10); break;
+			case 'R': opts.n_request_tags = strtoul(optarg, NULL, 10); break;
+			case 'c': opts.cardinality    = strtoul(optarg, NULL, 10); break;
+			case 'C': opts.churn          = strtoul(optarg, NULL, 10); break;
+			case 'n': opts.n_nested       = strtoul(optarg, NULL, 10); break;
+			case 'b': opts.batch_size     = strtoul(optarg, NULL, 10); break;
+			case 'z': opts.lz4            = true; break;
+			default:
+				aux::usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (opts.n_threads == 0 || opts.cardinality == 0 || opts.batch_size == 0 || opts.batch_size > 1024)
+	{
+		aux::usage(argv[0]);
+		return 1;
+	}
+
+#ifndef PINBA_HAVE_LZ4
+	if (opts.lz4)
+		throw std::runtime_error("built without lz4 support");
+#endif
+
+	signal(SIGINT, aux::on_stop_signal);
+	signal(SIGTERM, aux::on_stop_signal);
+
+	std::unique_ptr<aux::thread_stats_t[]> stats { new aux::thread_stats_t[opts.n_threads] };
+
+	uint64_t const start_ns = aux::monotonic_ns();
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < opts.n_threads; i++)
+	{
+		threads.emplace_back([&opts, &stats, i, start_ns]()
+		{
+			try
+			{
+				aux::sender_thread(opts, i, start_ns, &stats[i]);
+			}
+			catch (std::exception const& e)
+			{
+				ff::fmt(stderr, "thread {0}: error: {1}\n", i, e.what());
+				aux::stop_flag = true;
+			}
+		});
+	}
+
+	struct totals_t { uint64_t datagrams, requests, bytes, send_err; };
+
+	auto const get_totals = [&]()
+	{
+		totals_t t = {};
+		for (uint32_t i = 0; i < opts.n_threads; i++)
+		{
+			t.datagrams += stats[i].datagrams;
+			t.requests  += stats[i].requests;
+			t.bytes     += stats[i].bytes;
+			t.send_err  += stats[i].send_err;
+		}
+		return t;
+	};
+
+	totals_t prev     = {};
+	uint64_t prev_ns  = start_ns;
+	uint32_t seconds  = 0;
+
+	while (!aux::stop_flag)
+	{
+		sleep(1);
+		seconds++;
+
+		totals_t const curr    = get_totals();
+		uint64_t const curr_ns = aux::monotonic_ns();
+		double   const elapsed = double(curr_ns - prev_ns) / nsec_in_sec;
+
+		ff::fmt(stdout, "{0}s: {1} datagrams/s, {2} requests/s, {3} Mbit/s, {4} send errors\n",
+			seconds,
+			uint64_t((curr.datagrams - prev.datagrams) / elapsed),
+			uint64_t((curr.requests - prev.requests) / elapsed),
+			uint64_t((curr.bytes - prev.bytes) * 8 / elapsed / 1000 / 1000),
+			curr.send_err - prev.send_err);
+		fflush(stdout);
+
+		prev    = curr;
+		prev_ns = curr_ns;
+
+		if (opts.duration_sec > 0 && seconds >= opts.duration_sec)
+			aux::stop_flag = true;
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	totals_t const total   = get_totals();
+	double   const elapsed = double(aux::monotonic_ns() - start_ns) / nsec_in_sec;
+
+	ff::fmt(stdout, "total: {0} datagrams, {1} requests, {2} bytes in {3}s; average {4} datagrams/s, {5} requests/s, {6} bytes per datagram\n",
+		total.datagrams, total.requests, total.bytes, elapsed,
+		uint64_t(total.datagrams / elapsed),
+		uint64_t(total.requests / elapsed),
+		(total.datagrams > 0) ? total.bytes / total.datagrams : 0);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
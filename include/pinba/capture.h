@@ -0,0 +1,121 @@
+#ifndef PINBA__CAPTURE_H_
+#define PINBA__CAPTURE_H_
+
+#include <string>
+#include <memory>
+#include <mutex>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// traffic capture files, raw datagrams exactly as collector gets them (after GRO split, before decompression)
+//
+// file is a header followed by records, everything is 8 byte aligned and in host byte order
+// so that it can be mmap()-ed and walked in place
+// records are appended by all collector threads at once (each one appends a buffer of whole records at a time)
+// so timestamps are ordered within a thread, but not strictly between threads
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define PINBA_CAPTURE_FILE_MAGIC   "PINBACAP"
+#define PINBA_CAPTURE_FILE_VERSION 1
+
+struct capture_file_header_t
+{
+	char      magic[8];     // PINBA_CAPTURE_FILE_MAGIC
+	uint32_t  version;      // PINBA_CAPTURE_FILE_VERSION
+	uint32_t  header_size;  // sizeof(capture_file_header_t), records start here
+	uint64_t  reserved[2];
+};
+static_assert(sizeof(capture_file_header_t) == 32, "capture_file_header_t must be 32 bytes");
+
+struct capture_record_header_t
+{
+	uint64_t  ts_ns;   // receive time, CLOCK_REALTIME
+	uint32_t  size;    // datagram size, data follows the header and is padded to 8 bytes
+	uint32_t  reserved;
+};
+static_assert(sizeof(capture_record_header_t) == 16, "capture_record_header_t must be 16 bytes");
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// capture file, opened for appending, shared by all threads
+// creates the file (or appends to an existing capture), throws on errors
+struct capture_writer_t : private boost::noncopyable
+{
+	capture_writer_t(std::string const& path);
+	~capture_writer_t();
+
+	std::string const& path() const { return path_; }
+
+	// append whole records, atomic with regards to other threads using this writer
+	// (i.e. a short write is completed before anyone else appends, so records from different threads never interleave)
+	// other processes must not append to the same file
+	// returns false on error, errno is set
+	// error in the middle of a buffer leaves a partial record at the end of file, all writes fail after that (EIO)
+	bool write(char const *data, size_t size);
+
+private:
+	std::string  path_;
+	int          fd_;
+	std::mutex   write_mtx_;
+	bool         truncated_;  // see write()
+};
+
+// per-thread record buffer, written out when it gets large or old enough (and on destruction)
+struct capture_buffer_t : private boost::noncopyable
+{
+	static constexpr size_t   const flush_size   = 256 * 1024;
+	static constexpr uint64_t const flush_age_ns = 1000 * 1000 * 1000;
+
+	capture_buffer_t(capture_writer_t *writer);
+	~capture_buffer_t();
+
+	void append(uint64_t ts_ns, str_ref data);
+
+	// write buffered records out, returns false if write has failed (buffer is dropped anyway)
+	bool flush();
+
+	uint64_t n_write_errors() const { return n_write_errors_; }
+
+private:
+	capture_writer_t  *writer_;
+	std::string       buf_;
+	uint64_t          first_ts_ns_;
+	uint64_t          n_write_errors_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct capture_packet_t
+{
+	uint64_t  ts_ns;   // receive (or pcap) time
+	str_ref   data;    // udp payload, points into mmap()-ed file
+};
+
+// reads capture files written by capture_writer_t, and pcap files (not pcapng)
+// pcap link types supported: ethernet, linux cooked (tcpdump -i any) and raw ip; ipv4 and ipv6 udp datagrams only
+struct capture_reader_t : private boost::noncopyable
+{
+	virtual ~capture_reader_t() {}
+
+	virtual char const* format() const = 0;
+
+	// false at the end of file (or when a record has been cut short)
+	virtual bool next(capture_packet_t*) = 0;
+
+	// start from the first packet again
+	virtual void rewind() = 0;
+
+	// pcap frames skipped (not udp, wrong port, fragments, truncated by snaplen, etc.)
+	virtual uint64_t n_skipped() const = 0;
+};
+typedef std::unique_ptr<capture_reader_t> capture_reader_ptr;
+
+// udp_port != 0 takes only pcap datagrams sent to that port, throws on errors
+capture_reader_ptr capture_reader_open(std::string const& path, uint16_t udp_port);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__CAPTURE_H_
@@ -2,17 +2,25 @@
 #define PINBA__COLLECTOR_H_
 
 #include <string>
+#include <vector>
 #include <meow/std_unique_ptr.hpp>
 #include <meow/unix/time.hpp>
 
 #include "pinba/globals.h"
-#include "pinba/nmsg_socket.h" // nmsg_message_ex_t
+#include "pinba/cpu_affinity.h"
+#include "pinba/nmsg_pool.h"   // nmsg_pooled_message_t
+
+#include "proto/pinba.pb-c.h" // ProtobufCBinaryData
 
 #include "misc/nmpa.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct repacker_t;
+
 #define PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4 (1 << 0)
+#define PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT (1 << 1) // zstd frame, compressed with one of collector_conf_t::zstd_dictionaries
+                                                                // dictionary is picked by id from zstd frame header (so it must be kept there)
 
 struct net_datagram_t // network datagram
 {
@@ -24,20 +32,47 @@ struct net_datagram_t // network datagram
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // these are sent over PUSH/PULL channel
+// and are recycled by udp reader threads, see pinba/nmsg_pool.h
 struct raw_request_t
-	: public nmsg_message_ex_t<raw_request_t>
+	: public nmsg_pooled_message_t<raw_request_t>
 {
-	struct nmpa_s   nmpa;
-	uint32_t        request_count;
-	Pinba__Request **requests;
-
-	raw_request_t(uint32_t max_requests, size_t nmpa_block_sz)
+	struct nmpa_s        nmpa;
+	uint32_t             request_count;
+	Pinba__Request       **requests;       // unpacked requests
+	ProtobufCBinaryData  *request_data;    // or protobuf bytes, to be decoded by repacker (see collector_conf_t::raw_requests)
+	                                       // exactly one of these is non-NULL
+	uint32_t             max_requests;
+	bool                 raw;
+
+	raw_request_t(uint32_t max_requests, size_t nmpa_block_sz, bool raw = false)
+		: max_requests(max_requests)
+		, raw(raw)
 	{
 		PINBA_STATS_(objects).n_raw_batches++;
 
 		nmpa_init(&nmpa, nmpa_block_sz);
+		this->alloc_requests();
+	}
+
+	// back from the pool, on the udp reader thread that has allocated all the memory
+	// nmpa_empty() keeps the first block, so that typical batch doesn't need any malloc()
+	void pool_reuse()
+	{
+		PINBA_STATS_(objects).n_raw_batches_reused++;
+
+		nmpa_empty(&nmpa);
+		this->alloc_requests();
+	}
+
+	void pool_return()
+	{
+	}
+
+	void alloc_requests()
+	{
 		request_count = 0;
-		requests = (Pinba__Request**)nmpa_alloc(&nmpa, sizeof(requests[0]) * max_requests);
+		requests      = (raw) ? NULL : (Pinba__Request**)nmpa_alloc(&nmpa, sizeof(requests[0]) * max_requests);
+		request_data  = (raw) ? (ProtobufCBinaryData*)nmpa_alloc(&nmpa, sizeof(request_data[0]) * max_requests) : NULL;
 	}
 
 	~raw_request_t()
@@ -54,21 +89,134 @@ struct collector_conf_t
 	std::string  address;
 	std::string  port;
 
-	std::string  nn_output;      // parsed udp packets are avilable here (as raw_request_t)
 	std::string  nn_shutdown;    // used for graceful shutdown
 
 	uint32_t     n_threads;      // reader threads to start
 
 	uint32_t     batch_size;     // max number of messages to return in batch
 	duration_t   batch_timeout;  // max time to wait to assemble a batch
+
+	// what reader threads do when sockets are drained (got EAGAIN)
+	// spin -> yield -> park (sleep before polling again), see udp_idle_policy_t in collector.cpp
+	// spin_count = yield_count = 0 and park_min = park_max = 1ms is the old fixed 1ms sleep
+	uint32_t     idle_spin_count;   // recv retries right away, only after busy wakeups
+	uint32_t     idle_yield_count;  // recv retries after sched_yield(), only after busy wakeups
+	duration_t   idle_park_min;     // park time, doubles from min to max while wakeups bring few packets
+	duration_t   idle_park_max;     //  and drops back to min after a busy one
+
+	uint32_t     busy_poll_usec;    // SO_BUSY_POLL + SO_PREFER_BUSY_POLL on sockets, 0 = disabled
+
+	// size SO_RCVBUF so that all sockets together can absorb rcvbuf_absorb_time worth of traffic at rcvbuf_absorb_mbps
+	// (i.e. survive a stall that long without kernel drops), either one = 0 - keep kernel defaults
+	duration_t   rcvbuf_absorb_time;
+	uint32_t     rcvbuf_absorb_mbps;
+
+	// UDP_GRO on sockets, kernel coalesces same-flow datagrams into a single buffer (up to 64k)
+	// delivering many of them per recv call, these are split back by segment size from the control message
+	bool         gro;
+
+	// recvmmsg receive ring, datagrams are received into compact slots of recv_slot_size bytes
+	// bigger ones overflow into per-datagram 64k areas, that are backed by memory on demand (see recv_ring.h)
+	uint32_t     recv_max_dgrams;   // datagrams per recvmmsg call, 0 = batch_size
+	uint32_t     recv_slot_size;    // typical datagram size, 0 = 64k slots for everything (no overflow needed)
+	bool         recv_hugepages;    // back receive buffers with huge pages (recvmmsg and io_uring loops), if available
+
+	// classic bpf program on SO_REUSEPORT group, that picks reader socket by cpu packet is received on
+	// so that each reader gets packets from its own rx queues (cpus that serve their interrupts)
+	// readers bound to single cpus (affinity) get packets from these cpus, reader N gets (cpu % n_threads == N) otherwise
+	// should be paired with reader pinning, see udp affinity setup in globals.cpp
+	bool         reuseport_cpu_steering;
+
+	// comma separated list of zstd dictionary files, for PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT datagrams
+	// every one must have a unique id (zstd --train, or pinba2_train_dict tool), empty = no dictionaries
+	std::string  zstd_dictionaries;
+
+	// length-prefixed datagram streams, a lossless alternative to udp for local agents
+	// comma separated endpoints: tcp:<host>:<port>, unix:<path>, unix-seqpacket:<path>, empty = disabled
+	// every datagram is prefixed with its length (4 bytes, network byte order) and is handled exactly like udp one
+	std::string  stream_listen;
+	uint32_t     stream_threads;    // stream reader threads, connections are spread between them
+
+	// per-source admission, token bucket for every udp sender address, checked right after receive
+	// packets over the limit are dropped, except for random 1 in admission_sample_n, that are let through
+	// so that a single flooding host can't push everyone else out (drops further down the pipeline are indiscriminate)
+	// buckets live in a fixed size table shared by all readers, colliding sources evict least recently seen ones
+	// stream connections are trusted and are not limited
+	uint32_t     admission_rate;      // packets per second per source address, 0 = disabled
+	uint32_t     admission_burst;     // bucket size in packets, 0 = same as admission_rate (1 second worth)
+	uint32_t     admission_sample_n;  // let 1 in N packets over the limit through, 0 = drop them all
+	uint32_t     admission_slots;     // table size (max sources tracked), rounded up to power of 2
+
+	// raw datagram capture, with receive timestamps (see pinba/capture.h for file format)
+	std::string  capture_file;        // append datagrams to this file, empty = disabled
+	uint32_t     capture_sample_n;    // capture random 1 in N datagrams, 0 or 1 = all of them
+
+	// replay mode, no sockets are opened, datagrams come from capture (or pcap) file instead
+	// and go through the same path as received ones (from parse_network_datagram() on)
+	// every reader thread replays its share of the file (every n_threads-th datagram)
+	std::string  replay_file;         // empty = normal mode
+	uint32_t     replay_speed;        // percent of original rate (100 = as captured, 1000 = 10x), 0 = as fast as possible
+	uint32_t     replay_loops;        // times to replay the file, 0 = forever
+
+	// no sockets and no reader threads at all, data comes only from injectors (see collector_t::create_injector())
+	// to measure repacker, coordinator and reports capacity, without kernel udp limits getting in the way
+	bool         inject_only;
+
+	// do not unpack protobuf, send datagram bytes to repacker as is
+	// (repacker decodes them straight into packets, see pinba/packet_decoder.h)
+	bool         raw_requests;
+
+	// parsed udp packets (as raw_request_t batches) go here, see repacker_t::dispatch(), must be started before collector
+	// in fused mode (see repacker_t::is_fused()), every reader thread repacks datagrams with its own repacker worker instead
+	// and sends packet batches straight to repacker output (raw_requests is ignored then)
+	// batches are sent when full (repacker_conf_t::batch_size) or after batch_timeout, udp batch_size is not used
+	repacker_t   *repacker;
+
+	thread_affinity_t affinity;     // cpus + priority for reader threads
 };
 
+// per-source admission state, see collector_conf_t::admission_*
+struct collector_source_stats_t
+{
+	std::string  address;
+	uint64_t     packets_passed;   // within the limit
+	uint64_t     packets_sampled;  // over the limit, let through by sampling
+	uint64_t     packets_dropped;  // over the limit
+	duration_t   idle_time;        // since last packet
+};
+
+// in-process injection, straight into collector output (i.e. repacker input), bypassing sockets
+// injected data is counted in udp stats, as if it has been received, batch send errors included
+// not thread safe, every thread needs its own injector, injectors must be destroyed before collector
+struct collector_injector_t : private boost::noncopyable
+{
+	virtual ~collector_injector_t() {}
+
+	// pre-built batch, sent as is, either kind (requests or request_data) is fine, regardless of collector_conf_t::raw_requests
+	// batch must not be modified after this call, returns false if repackers can't keep up (batch is dropped)
+	virtual bool inject_batch(raw_request_ptr) = 0;
+
+	// datagram bytes, exactly as they come from the network (v1 header, compression, etc.)
+	// these are batched, current batch is sent when full (returns true then) or on flush()
+	virtual bool inject_datagram(str_ref) = 0;
+
+	// send current batch, if not empty (destructor does that as well)
+	virtual void flush() = 0;
+};
+typedef std::unique_ptr<collector_injector_t> collector_injector_ptr;
+
 struct collector_t
 {
 	virtual ~collector_t() {}
 
 	virtual void startup() = 0;
 	virtual void shutdown() = 0;
+
+	// empty if admission is disabled
+	virtual std::vector<collector_source_stats_t> get_source_stats() = 0;
+
+	// can be called from any thread, before or after startup()
+	virtual collector_injector_ptr create_injector() = 0;
 };
 
 typedef std::unique_ptr<collector_t> collector_ptr;
@@ -2,6 +2,7 @@
 #define PINBA__COORDINATOR_H_
 
 #include "pinba/globals.h"
+#include "pinba/cpu_affinity.h"
 #include "pinba/report.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,6 +14,9 @@ struct coordinator_conf_t
 
 	std::string  nn_control;              // control messages received here (binds, REP)
 	size_t       nn_report_input_buffer;  // report_handler uses this as NN_RCVBUF
+
+	thread_affinity_t relay_affinity;     // packet-relay thread cpus + priority
+	thread_affinity_t report_affinity;    // report host threads cpus + priority, indexed by report id
 };
 
 struct coordinator_t : private boost::noncopyable
@@ -0,0 +1,45 @@
+#ifndef PINBA__CPU_AFFINITY_H_
+#define PINBA__CPU_AFFINITY_H_
+
+#include <sched.h> // cpu_set_t
+
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// cpu placement and priority for a group of same-purpose threads (udp readers, repackers, etc.)
+struct thread_affinity_t
+{
+	std::vector<cpu_set_t> cpusets;  // thread N is bound to cpusets[N % size], empty = not bound
+	int                    nice;     // setpriority() for each thread, 0 = keep inherited
+};
+
+// parse cpu list like "0-3,8,10-11" (same format as taskset -c and sysfs cpulist files)
+// returns single-cpu sets for every listed cpu, in order, throws on bad input
+std::vector<cpu_set_t> pinba_cpu_list___parse(str_ref);
+
+// all cpus of the given numa node (from sysfs), throws if node is unknown
+cpu_set_t pinba_numa_node___cpuset(int node);
+
+// numa node that owns the network device serving given listen address, -1 if unknown or not numa
+// wildcard addresses resolve only if all physical network devices are on the same node
+int pinba_numa_node___for_address(pinba_globals_t*, str_ref address, str_ref port);
+
+// "0-3,8" style representation, for logging
+std::string pinba_cpuset___to_string(cpu_set_t const&);
+
+// split cpuset between n_threads, thread N gets cpus with (cpu % n_threads == N)
+// (the ones SO_REUSEPORT cpu steering sends it packets from, see collector_conf_t::reuseport_cpu_steering)
+// some sets might be empty, if cpuset has less than n_threads cpus or these are not spread evenly
+std::vector<cpu_set_t> pinba_cpuset___split_modulo(cpu_set_t const&, uint32_t n_threads);
+
+// bind calling thread to cpus and set its priority, thread_idx = thread number within its group
+// errors are logged and otherwise ignored, thread just runs where the scheduler puts it
+void pinba_thread_affinity___apply(pinba_globals_t*, thread_affinity_t const&, uint32_t thread_idx, str_ref thread_name);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__CPU_AFFINITY_H_
@@ -1,9 +1,15 @@
 #ifndef PINBA__DICTIONARY_H_
 #define PINBA__DICTIONARY_H_
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <new>       // bad_alloc
+#include <memory>
+#include <mutex>
 #include <string>
 #include <deque>
+#include <vector>
 
 #include <pthread.h>
 
@@ -98,6 +104,93 @@ struct scoped_write_lock_t : private boost::noncopyable
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// append-only array, that never moves elements once allocated
+// so elements can be read without any locks, while (a single) writer appends
+// it's a list of segments of doubling size (to keep small arrays small), segment N holds (1 << (FirstSegmentBits + N)) elements
+// segment pointers and size are published with release stores, and read with acquire
+template<class T, uint32_t FirstSegmentBits>
+struct segmented_array_t : private boost::noncopyable
+{
+	static constexpr uint32_t const max_segments = 32 - FirstSegmentBits; // enough for uint32_t offsets
+
+	segmented_array_t()
+		: size_(0)
+	{
+		for (auto& segment : segments_)
+			segment.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~segmented_array_t()
+	{
+		for (auto& segment : segments_)
+			delete [] segment.load(std::memory_order_relaxed);
+	}
+
+	size_t size() const
+	{
+		return size_.load(std::memory_order_acquire);
+	}
+
+	// elements allocated, including not yet used
+	size_t capacity() const
+	{
+		size_t const sz = this->size();
+		if (sz == 0)
+			return 0;
+
+		uint32_t const last_segment = segment_for_offset(sz - 1).first;
+		return (size_t(1) << (last_segment + FirstSegmentBits + 1)) - (size_t(1) << FirstSegmentBits);
+	}
+
+	T& operator[](size_t offset)
+	{
+		auto const pos = segment_for_offset(offset);
+		return segments_[pos.first].load(std::memory_order_acquire)[pos.second];
+	}
+
+	T const& operator[](size_t offset) const
+	{
+		return const_cast<segmented_array_t*>(this)->operator[](offset);
+	}
+
+	// single writer only (i.e. under external lock)
+	// returned element is default constructed (or whatever was left there), and is counted in size() already
+	T& emplace_back()
+	{
+		size_t const offset = size_.load(std::memory_order_relaxed);
+		auto const pos = segment_for_offset(offset);
+
+		assert((pos.first < max_segments) && "segmented_array_t is out of segments");
+
+		T *segment = segments_[pos.first].load(std::memory_order_relaxed);
+		if (segment == nullptr)
+		{
+			segment = new T[size_t(1) << (pos.first + FirstSegmentBits)];
+			segments_[pos.first].store(segment, std::memory_order_release);
+		}
+
+		size_.store(offset + 1, std::memory_order_release);
+		return segment[pos.second];
+	}
+
+private:
+
+	// offset + (1 << FirstSegmentBits) has segment number in it's highest bit
+	static std::pair<uint32_t, size_t> segment_for_offset(size_t offset)
+	{
+		size_t   const i       = offset + (size_t(1) << FirstSegmentBits);
+		uint32_t const top_bit = 63 - __builtin_clzll(i);
+
+		return { top_bit - FirstSegmentBits, i - (size_t(1) << top_bit) };
+	}
+
+private:
+	std::array<std::atomic<T*>, max_segments>  segments_;
+	std::atomic<size_t>                        size_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 struct dictionary_word_hasher_t
 {
 	inline uint64_t operator()(str_ref const& key) const
@@ -111,16 +204,36 @@ inline uint64_t hash_dictionary_word(str_ref word)
 	return dictionary_word_hasher_t()(word);
 }
 
+// hash a bunch of words in one tight loop, lets the cpu overlap independent hash computations
+// (short strings are latency bound on t1ha0 finalization otherwise)
+// all dictionary layers accept precomputed hashes, so that words are hashed once on the whole repack path
+inline void hash_dictionary_words(str_ref const *words, size_t n_words, uint64_t *hashes)
+{
+	dictionary_word_hasher_t const hasher;
+
+	for (size_t i = 0; i < n_words; i++)
+		hashes[i] = hasher(words[i]);
+}
+
 struct dictionary_memory_t
 {
 	uint64_t hash_bytes;
 	uint64_t wordlist_bytes;
 	uint64_t freelist_bytes;
-	uint64_t strings_bytes;
+	uint64_t strings_bytes;  // everything taken for string storage, incl. free arena slots and empty slabs kept around
 };
 
 
-struct nameword_dictionary_t : public meow::ref_counted_t
+// tag names, these are never removed
+// append-only, lookups are lock-free and see new names as soon as insert returns, inserts are O(1) amortized
+// ids are dense, [1, size()], and are not related to dictionary_t word ids (those have shard number in high bits)
+// so reports can index arrays by them directly (see tag_name_slots_t)
+//
+// names live in a segmented array (pointers to them stay valid for dictionary lifetime)
+// index is an open addressing table (linear probing, load factor <= 1/2), slots are only ever filled, never changed
+// when table gets full - a twice larger one is built and published through an atomic pointer, like RCU
+// old tables are kept till dictionary is destroyed (readers might still be probing them), that's < 1x of current table size total
+struct nameword_dictionary_t : private boost::noncopyable
 {
 	struct nameword_t
 	{
@@ -128,107 +241,389 @@ struct nameword_dictionary_t : public meow::ref_counted_t
 		uint64_t id_hash  = 0;
 		uint64_t str_hash = 0;
 	};
-	static_assert(std::is_nothrow_move_constructible<nameword_t>::value);
-
-	struct nameword_equal_t
-	{
-		using is_transparent = void;
 
-		inline bool operator()(std::string const& l, str_ref const& r) const
-		{
-			return str_ref {l} == r;
-		}
+private:
 
-		inline bool operator()(str_ref const& l, std::string const& r) const
-		{
-			return l == str_ref{r};
-		}
+	struct entry_t
+	{
+		nameword_t   nw;
+		std::string  str;
+	};
 
-		inline bool operator()(std::string const& l, std::string const& r) const
+	struct table_t
+	{
+		uint32_t                                  mask;
+		uint32_t                                  n_used;  // writer only
+		std::unique_ptr<std::atomic<uint32_t>[]>  slots;   // entry offset + 1, 0 = empty
+
+		explicit table_t(uint32_t size)
+			: mask(size - 1)
+			, n_used(0)
+			, slots(new std::atomic<uint32_t>[size])
 		{
-			return l == r;
+			for (uint32_t i = 0; i < size; i++)
+				slots[i].store(0, std::memory_order_relaxed);
 		}
 	};
 
-	using hashtable_t = tsl::robin_map<
-							  std::string
-							, nameword_t
-							, dictionary_word_hasher_t
-							, nameword_equal_t
-							, std::allocator<std::pair<std::string, nameword_t>>
-							, /*StoreHash=*/ true>;
+	static constexpr uint32_t const initial_table_size = 64;
 
-	hashtable_t          hash;
-	uint64_t             mem_used_by_word_strings;
+	segmented_array_t<entry_t, 6>          entries_;
+	std::atomic<table_t*>                  table_;                    // current one
+	std::vector<std::unique_ptr<table_t>>  tables_;                   // current one + all the previous ones, writer only
+	std::atomic<uint64_t>                  mem_used_by_word_strings_;
+	std::atomic<uint64_t>                  mem_used_by_tables_;
 
 public:
 
 	nameword_dictionary_t()
-		: mem_used_by_word_strings(0)
+		: mem_used_by_word_strings_(0)
+		, mem_used_by_tables_(0)
 	{
-	}
-
-	void clone_from(nameword_dictionary_t const& other)
-	{
-		hash = other.hash;
-		mem_used_by_word_strings = other.mem_used_by_word_strings;
+		table_.store(this->add_table(initial_table_size), std::memory_order_relaxed);
 	}
 
 	size_t size() const
 	{
-		return hash.size();
+		return entries_.size();
 	}
 
 	dictionary_memory_t memory_used() const
 	{
 		return dictionary_memory_t {
-			.hash_bytes     = hash.bucket_count() * sizeof(*hash.begin()),
-			.wordlist_bytes = 0,
+			.hash_bytes     = mem_used_by_tables_.load(std::memory_order_relaxed),
+			.wordlist_bytes = entries_.capacity() * sizeof(entry_t),
 			.freelist_bytes = 0,
-			.strings_bytes  = mem_used_by_word_strings,
+			.strings_bytes  = mem_used_by_word_strings_.load(std::memory_order_relaxed),
 		};
 	}
 
-	// get a word without synchronisation
-	// note that this function returns a pointer,
-	// so you must retain a reference to this dictionary for the desired lifetime of the word
+	// get a word without synchronisation, can be called concurrently with insert_with_external_locking()
+	// returned pointer is valid for the lifetime of this dictionary
 	nameword_t const* get(str_ref word) const
 	{
-		uint64_t const word_hash = hash_dictionary_word(word);
+		return this->get(word, hash_dictionary_word(word));
+	}
 
-		auto const it = hash.find(word, word_hash);
-		if (it == hash.end())
-			return {};
+	// same as above, with precalculated word_hash (see hash_dictionary_words())
+	nameword_t const* get(str_ref word, uint64_t word_hash) const
+	{
+		table_t const *table = table_.load(std::memory_order_acquire);
+
+		for (uint32_t i = word_hash & table->mask; ; i = (i + 1) & table->mask)
+		{
+			uint32_t const slot = table->slots[i].load(std::memory_order_acquire);
+			if (slot == 0)
+				return {};
 
-		return &it->second;
+			entry_t const& e = entries_[slot - 1];
+			if (e.nw.str_hash == word_hash && str_ref { e.str } == word)
+				return &e.nw;
+		}
 	}
 
-	// inserts a word into the dictionary,
-	// WARNING: can't be called concurrently with get() on the same instance, call clone() first
-	// WARNING: returns a pointer like get, be careful with lifetime
+	// inserts a word into the dictionary (or returns existing one)
+	// WARNING: must not be called concurrently with itself, use external lock
 	nameword_t const* insert_with_external_locking(str_ref word)
 	{
-		uint64_t const word_hash = hash_dictionary_word(word);
+		if (nameword_t const *existing = this->get(word))
+			return existing;
 
-		uint32_t const word_id = hash.size() + 1;
+		uint64_t const word_hash = hash_dictionary_word(word);
+		uint32_t const offset    = entries_.size();
+		uint32_t const word_id   = offset + 1;
 
-		nameword_t nw = {
+		// fill the entry first, it's not reachable by readers till it's in the table
+		entry_t& e = entries_.emplace_back();
+		e.nw = {
 			.id       = word_id,
 			.id_hash  = pinba::hash_number(word_id),
 			.str_hash = word_hash,
 		};
+		e.str = word.str();
+
+		mem_used_by_word_strings_.fetch_add(word.size(), std::memory_order_relaxed);
+
+		table_t *table = table_.load(std::memory_order_relaxed);
+		if ((table->n_used + 1) * 2 > (table->mask + 1))
+		{
+			// rebuild, with all the entries but this one, and publish
+			table_t *new_table = this->add_table((table->mask + 1) * 2);
+
+			for (uint32_t i = 0; i < offset; i++)
+				insert_slot(new_table, entries_[i].nw.str_hash, i + 1);
+
+			table_.store(new_table, std::memory_order_release);
+			table = new_table;
+		}
+
+		insert_slot(table, word_hash, offset + 1);
+		return &e.nw;
+	}
+
+private:
+
+	table_t* add_table(uint32_t size)
+	{
+		tables_.emplace_back(new table_t(size));
+		mem_used_by_tables_.fetch_add(size * sizeof(std::atomic<uint32_t>), std::memory_order_relaxed);
+
+		return tables_.back().get();
+	}
+
+	static void insert_slot(table_t *table, uint64_t word_hash, uint32_t value)
+	{
+		uint32_t i = word_hash & table->mask;
+		while (table->slots[i].load(std::memory_order_relaxed) != 0)
+			i = (i + 1) & table->mask;
+
+		table->slots[i].store(value, std::memory_order_release); // entry is visible to readers after this
+		table->n_used++;
+	}
+};
+
+// string storage for dictionary_t words, one per shard, must be externally locked (shard write lock)
+// strings never move once allocated, so readers holding a word reference need no locks (see dictionary_t::get_word())
+//
+// size classes are powers of 2, from 16 to 2048 bytes, larger strings are malloc()-ed one by one
+// every class allocates slabs of slab_size bytes aligned to slab_size (so slab header is found from string pointer)
+// freed slots go to per-slab freelist and are reused before carving new ones
+// a slab that becomes empty is given back (one spare empty slab per class is kept, to not ping-pong on malloc/free)
+// that's all the compaction there is, moving live strings is not possible, repacker caches point to them directly
+struct dictionary_word_arena_t : private boost::noncopyable
+{
+	static constexpr size_t   const slab_size        = 32 * 1024;
+	static constexpr size_t   const slab_header_size = 64;  // sizeof(slab_t), rounded up, keeps slots 16 byte aligned
+	static constexpr uint32_t const min_class_bits   = 4;   // 16 bytes
+	static constexpr uint32_t const n_classes        = 8;   // up to 2048 bytes
+	static constexpr size_t   const max_class_size   = size_t(1) << (min_class_bits + n_classes - 1);
+
+	dictionary_word_arena_t()
+		: n_slabs_(0)
+		, large_bytes_(0)
+		, string_bytes_(0)
+	{
+	}
+
+	~dictionary_word_arena_t()
+	{
+		for (auto& cl : classes_)
+		{
+			free_slab_list(cl.partial);
+			free_slab_list(cl.full);
+			free(cl.spare);
+		}
+	}
+
+	// copy string into the arena
+	str_ref allocate(str_ref const s)
+	{
+		size_t const sz = s.size();
+
+		char *data = (sz > max_class_size)
+						? (char*)malloc(sz)
+						: this->allocate_slot(class_for_size(sz));
+
+		if (data == nullptr)
+			throw std::bad_alloc();
+
+		if (sz > max_class_size)
+			large_bytes_ += sz;
+
+		string_bytes_ += sz;
+
+		memcpy(data, s.data(), sz);
+		return str_ref { data, sz };
+	}
+
+	// returns memory that is not needed anymore (or NULL), caller must free() it
+	// the idea is to do that outside of shard lock
+	void* deallocate(str_ref const s)
+	{
+		string_bytes_ -= s.size();
+
+		if (s.size() > max_class_size)
+		{
+			large_bytes_ -= s.size();
+			return (void*)s.data();
+		}
+
+		return this->deallocate_slot((char*)s.data());
+	}
+
+	// all memory taken from the system
+	uint64_t mem_allocated() const { return n_slabs_ * slab_size + large_bytes_; }
+
+	// of that - occupied by strings themselves, the rest is slot rounding, free slots and slab headers
+	uint64_t mem_used_by_strings() const { return string_bytes_; }
+
+private:
+
+	struct slab_t
+	{
+		slab_t    *prev;
+		slab_t    *next;
+		char      *freelist;     // next pointer is stored in the free slot itself
+		uint32_t  n_used;
+		uint32_t  n_carved;      // slots [0, n_carved) have been handed out at least once
+		uint32_t  size_class;
+	};
+	static_assert(sizeof(slab_t) <= slab_header_size, "slab_t must fit into slab header");
+
+	struct class_t
+	{
+		slab_t  *partial = nullptr;  // have free slots
+		slab_t  *full    = nullptr;
+		slab_t  *spare   = nullptr;  // empty, kept around
+	};
+
+	static uint32_t class_for_size(size_t sz)
+	{
+		if (sz <= (size_t(1) << min_class_bits))
+			return 0;
+
+		uint32_t const bits = 64 - __builtin_clzll(sz - 1);
+		return bits - min_class_bits;
+	}
+
+	static size_t slot_size(uint32_t size_class)
+	{
+		return size_t(1) << (size_class + min_class_bits);
+	}
+
+	static uint32_t slots_per_slab(uint32_t size_class)
+	{
+		return (slab_size - slab_header_size) / slot_size(size_class);
+	}
+
+	static void list_push(slab_t **head, slab_t *slab)
+	{
+		slab->prev = nullptr;
+		slab->next = *head;
+		if (*head)
+			(*head)->prev = slab;
+		*head = slab;
+	}
+
+	static void list_remove(slab_t **head, slab_t *slab)
+	{
+		if (slab->prev)
+			slab->prev->next = slab->next;
+		else
+			*head = slab->next;
+
+		if (slab->next)
+			slab->next->prev = slab->prev;
+	}
+
+	static void free_slab_list(slab_t *slab)
+	{
+		while (slab)
+		{
+			slab_t *next = slab->next;
+			free(slab);
+			slab = next;
+		}
+	}
+
+	char* allocate_slot(uint32_t size_class)
+	{
+		class_t& cl = classes_[size_class];
+
+		slab_t *slab = cl.partial;
+		if (slab == nullptr)
+		{
+			if (cl.spare)
+			{
+				slab = cl.spare;
+				cl.spare = nullptr;
+			}
+			else
+			{
+				void *mem = nullptr;
+				if (0 != posix_memalign(&mem, slab_size, slab_size))
+					return nullptr;
+
+				slab = (slab_t*)mem;
+				slab->freelist   = nullptr;
+				slab->n_used     = 0;
+				slab->n_carved   = 0;
+				slab->size_class = size_class;
+
+				n_slabs_++;
+			}
+
+			list_push(&cl.partial, slab);
+		}
+
+		char *slot;
+		if (slab->freelist)
+		{
+			slot = slab->freelist;
+			slab->freelist = *(char**)slot;
+		}
+		else
+		{
+			slot = (char*)slab + slab_header_size + slab->n_carved * slot_size(size_class);
+			slab->n_carved++;
+		}
+
+		slab->n_used++;
+
+		if (slab->n_used == slots_per_slab(size_class))
+		{
+			list_remove(&cl.partial, slab);
+			list_push(&cl.full, slab);
+		}
+
+		return slot;
+	}
+
+	void* deallocate_slot(char *slot)
+	{
+		slab_t *slab = (slab_t*)((uintptr_t)slot & ~(uintptr_t)(slab_size - 1));
+		class_t& cl = classes_[slab->size_class];
+
+		if (slab->n_used == slots_per_slab(slab->size_class))
+		{
+			list_remove(&cl.full, slab);
+			list_push(&cl.partial, slab);
+		}
+
+		*(char**)slot  = slab->freelist;
+		slab->freelist = slot;
+		slab->n_used--;
 
-		auto const inserted_pair = hash.emplace_hash(word_hash, word.str(), nw);
-		auto const& it = inserted_pair.first;
+		if (slab->n_used > 0)
+			return nullptr;
 
-		if (inserted_pair.second) // inserted
-			mem_used_by_word_strings += word.size();
+		list_remove(&cl.partial, slab);
 
-		return &it->second;
+		if (cl.spare == nullptr)
+		{
+			slab->freelist = nullptr;
+			slab->n_carved = 0;
+			cl.spare = slab;
+			return nullptr;
+		}
+
+		n_slabs_--;
+		return slab;
 	}
+
+private:
+	std::array<class_t, n_classes>  classes_;
+	uint64_t                        n_slabs_;
+	uint64_t                        large_bytes_;
+	uint64_t                        string_bytes_;
 };
-using nameword_dictionary_ptr = boost::intrusive_ptr<nameword_dictionary_t>;
 
+// global words dictionary, word_id <-> string, refcounted (repacker_dictionary_t and reports hold references)
+// 32 shards, each with it's own rwlock, that guards the hashtable and freelist
+//
+// lock-free read paths: get_word() (caller holds a reference) and dropping a reference that is not the last one
+// existing word lookups (get_or_add___ref() hit) take shard READ lock, i.e. these run in parallel
+// inserts and last reference erases change the hashtable, and still take shard WRITE lock
 struct dictionary_t : private boost::noncopyable
 {
 /*
@@ -257,27 +652,25 @@ struct dictionary_t : private boost::noncopyable
 
 	struct word_t : private boost::noncopyable
 	{
-		union {
-			uint32_t  refcount;
-			uint32_t  next_freelist_offset;
-		};
+		// atomic, as references are taken under shard READ lock and dropped without any lock
+		// (unless it's the last one), see get_or_add___ref() and erase_word___ref()
+		std::atomic<uint32_t> refcount;
 
 		uint32_t    id;
 		uint64_t    hash;
-		std::string str;
+		str_ref     str;                  // in shard string arena, see dictionary_word_arena_t
+
+		uint32_t    next_freelist_offset; // only meaningful when word is in freelist (id == 0)
 
 		word_t() noexcept
 			: refcount(0)
 			, id(0)
 			, hash(0)
 			, str()
+			, next_freelist_offset(0)
 		{
 		}
-
-		word_t(word_t&& other) = default;
-		word_t& operator=(word_t&& other) = default;
 	};
-	static_assert((sizeof(word_t) == (2*sizeof(uint32_t) + sizeof(uint64_t) + sizeof(std::string))), "word_t should have no padding");
 
 	// str_ref key   - references words_t content
 	// word_t* value - references the same word as the key
@@ -292,18 +685,186 @@ struct dictionary_t : private boost::noncopyable
 							, std::allocator<std::pair<str_ref, word_t*>>
 							, /*StoreHash=*/ true>;
 
-	// word -> word_ptr
-	struct hash_t : public hashtable_t
+	// word -> word_t*, must be externally locked (shard lock)
+	//
+	// hashtable_t rehashes everything at once when it grows, and that happens under shard write lock
+	// at tens of millions of words that's tens of milliseconds of all repackers and snapshots waiting
+	// so instead, when a (large enough) table is full, new one - twice as large - is allocated
+	// and words are moved over a few at a time, on every write, while lookups check both tables
+	//
+	// old table is never inserted into or erased from while moving (iteration position must stay valid)
+	// words that are moved or erased there are replaced with tombstones (empty key, nullptr value)
+	// a word is live in exactly one of the tables
+	//
+	// still O(n) under lock: allocating and initializing new table buckets in start_migration() (no rehash, no word access)
+	// old table, when all words are moved, is not destroyed here, callers take it with take_retired() and destroy outside lock
+	struct hash_t
 	{
+		static constexpr size_t const incremental_min_size = 64 * 1024; // smaller tables just grow the usual way
+		static constexpr size_t const migrate_per_write    = 64;        // must be > 1 (see emplace_hash())
+
+		word_t* find(str_ref const word, uint64_t word_hash) const
+		{
+			auto const it = curr_.find(word, word_hash);
+			if (it != curr_.end())
+				return it->second;
+
+			if (!this->is_migrating())
+				return nullptr;
+
+			auto const prev_it = prev_.find(word, word_hash);
+			if (prev_it != prev_.end())
+				return prev_it->second; // nullptr for tombstones
+
+			return nullptr;
+		}
+
+		// same contract as hashtable_t::emplace_hash(), but the word might be found in old table
+		// (returned iterator is only good for reading it->second in that case)
+		std::pair<hashtable_t::iterator, bool> emplace_hash(uint64_t word_hash, str_ref const word, word_t *value)
+		{
+			if (this->is_migrating())
+			{
+				auto const prev_it = prev_.find(word, word_hash);
+				if (prev_it != prev_.end() && prev_it->second != nullptr)
+					return { prev_it, false };
+			}
+
+			// migration must be done here, returned iterator must stay valid till the caller is done with it
+			this->migrate_some();
+
+			if (curr_.size() >= incremental_min_size && curr_.will_grow_on_next_insert())
+			{
+				// existing word would be moved to old table by start_migration(), and then inserted again into new one
+				auto const it = curr_.find(word, word_hash);
+				if (it != curr_.end())
+					return { it, false };
+
+				this->start_migration();
+			}
+
+			// no growth here while migrating, as new table is twice as large, and we move at least 2 words per insert
+			assert(!this->is_migrating() || !curr_.will_grow_on_next_insert());
+
+			return curr_.emplace_hash(word_hash, word, value);
+		}
+
+		size_t erase(str_ref const word, uint64_t word_hash)
+		{
+			size_t n_erased = curr_.erase(word, word_hash);
+
+			if (n_erased == 0 && this->is_migrating())
+			{
+				auto prev_it = prev_.find(word, word_hash);
+				if (prev_it != prev_.end() && prev_it->second != nullptr)
+				{
+					make_tombstone(prev_it);
+					n_erased = 1;
+				}
+			}
+
+			this->migrate_some();
+
+			return n_erased;
+		}
+
+		// old table that has been fully moved (if any) is swapped into *to, destroy it after releasing the lock
+		void take_retired(hashtable_t *to)
+		{
+			retired_.swap(*to);
+		}
+
+		size_t bucket_count() const
+		{
+			return curr_.bucket_count() + prev_.bucket_count() + retired_.bucket_count();
+		}
+
+		static constexpr size_t bucket_size()
+		{
+			return sizeof(hashtable_t::value_type);
+		}
+
+	private:
+
+		bool is_migrating() const
+		{
+			return !prev_.empty();
+		}
+
+		static void make_tombstone(hashtable_t::iterator it)
+		{
+			const_cast<str_ref&>(it->first) = str_ref {};
+			it.value() = nullptr;
+		}
+
+		void start_migration()
+		{
+			// finish the previous one first, should never happen, just being careful
+			while (this->is_migrating())
+				this->migrate_some();
+
+			// new table is allocated (and initialized) here, under lock, but that's way cheaper than rehash
+			hashtable_t next;
+			next.reserve(curr_.size() * 2);
+
+			prev_.swap(curr_);
+			curr_.swap(next);
+
+			prev_cursor_ = prev_.begin();
+		}
+
+		void migrate_some()
+		{
+			if (!this->is_migrating())
+				return;
+
+			size_t n_moved = 0;
+			for (; prev_cursor_ != prev_.end() && n_moved < migrate_per_write; ++prev_cursor_)
+			{
+				word_t *w = prev_cursor_->second;
+				if (w == nullptr)
+					continue;
+
+				auto res = curr_.emplace_hash(w->hash, prev_cursor_->first, w);
+
+				// can't happen, emplace_hash() never adds a word that is live in old table
+				// if it does anyway - keep whichever copy is not a placeholder, to not lose the word
+				assert(res.second && "word is live in both tables");
+				if (!res.second && res.first->second == nullptr)
+				{
+					const_cast<str_ref&>(res.first->first) = prev_cursor_->first;
+					res.first.value() = w;
+				}
+
+				make_tombstone(prev_cursor_);
+				n_moved++;
+			}
+
+			if (prev_cursor_ == prev_.end())
+			{
+				// previous retired table (if caller did not take it) is freed here, under lock, should not happen
+				hashtable_t().swap(retired_);
+				retired_.swap(prev_);
+			}
+		}
+
+	private:
+		hashtable_t            curr_;
+		hashtable_t            prev_;        // words are being moved from here, empty when not migrating
+		hashtable_t::iterator  prev_cursor_; // next word to move
+		hashtable_t            retired_;     // fully moved old table, see take_retired()
 	};
 
-	// id -> word_t,
-	// deque is critical here, since `hash` stores pointers to it's elements,
-	// appends must not invalidate them
-	struct words_t : public std::deque<word_t>
+	// id -> word_t, appends must not move elements, since `hash` stores pointers to them
+	// and readers access elements without any locks (see get_word()), while writer appends
+	struct words_t : public segmented_array_t<word_t, 6>
 	{
 	};
 
+	// log2 buckets in microseconds: [0], [1], [2,3], [4,7], ..., [512ms, inf)
+	static constexpr size_t const insert_latency_hist_buckets = 21;
+	using insert_latency_hist_t = std::array<uint64_t, insert_latency_hist_buckets>;
+
 private:
 
 	struct shard_t
@@ -312,16 +873,45 @@ private:
 
 		uint32_t      id;
 		uint32_t      freelist_head; // (offset+1) of the first elt in freelist, aka 0 -> unset, 1 -> offset == 0
-		hash_t        hash;          // TODO: shard this as well, to amortize the cost of rehash
+		hash_t        hash;          // grows incrementally, see hash_t
 		words_t       words;
 
-		uint64_t      mem_used_by_word_strings = 0;
+		dictionary_word_arena_t  strings;
+
+		// see dictionary_t::insert_latency_histogram()
+		insert_latency_hist_t  insert_latency_hist = {};
+
+		~shard_t()
+		{
+			// large strings are not owned by arena
+			for (size_t i = 0; i < words.size(); i++)
+			{
+				if (words[i].id != 0)
+					free(strings.deallocate(words[i].str));
+			}
+		}
 	};
 
 	mutable std::array<shard_t, shard_count> shards_;
 
 public:
 
+	// write-locked inserts, from taking the lock till word is in place, see insert_latency_hist_t
+	insert_latency_hist_t insert_latency_histogram() const
+	{
+		insert_latency_hist_t result = {};
+
+		for (auto const& shard : shards_)
+		{
+			scoped_read_lock_t lock_(shard.mtx);
+
+			for (size_t i = 0; i < insert_latency_hist_buckets; i++)
+				result[i] += shard.insert_latency_hist[i];
+		}
+
+		return result;
+	}
+
 	dictionary_t()
 	{
 		for (uint32_t i = 0; i < shard_count; ++i)
@@ -343,10 +933,7 @@ public:
 			result += shard.words.size();
 		}
 
-		{
-			auto const nwd_sz = load_nameword_dict()->size();
-			result += nwd_sz;
-		}
+		result += nameword_dictionary_.size();
 
 		return result;
 	}
@@ -359,15 +946,16 @@ public:
 		{
 			scoped_read_lock_t lock_(shard.mtx);
 
-			result.hash_bytes     += shard.hash.bucket_count() * sizeof(*shard.hash.begin());
-			result.wordlist_bytes += shard.words.size() * sizeof(*shard.words.begin());
-			result.strings_bytes  += shard.mem_used_by_word_strings;
+			result.hash_bytes     += shard.hash.bucket_count() * hash_t::bucket_size();
+			result.wordlist_bytes += shard.words.capacity() * sizeof(word_t);
+			result.strings_bytes  += shard.strings.mem_allocated();
 		}
 
 		{
-			auto const nwd_mu = load_nameword_dict()->memory_used();
-			result.hash_bytes += nwd_mu.hash_bytes;
-			result.strings_bytes += nwd_mu.strings_bytes;
+			auto const nwd_mu = nameword_dictionary_.memory_used();
+			result.hash_bytes     += nwd_mu.hash_bytes;
+			result.wordlist_bytes += nwd_mu.wordlist_bytes;
+			result.strings_bytes  += nwd_mu.strings_bytes;
 		}
 
 		return result;
@@ -375,49 +963,28 @@ public:
 
 private:
 
-	mutable nameword_dictionary_ptr  nameword_dictionary_;
-	mutable std::mutex               nameword_update_mtx_;
-	mutable std::mutex               nameword_load_and_store_mtx_;
-
-	void store_nameword_dict(nameword_dictionary_ptr nwd)
-	{
-		std::lock_guard<std::mutex> lock_(nameword_load_and_store_mtx_); // sync with load_nameword_dict()
-		nameword_dictionary_ = nwd;
-	}
+	nameword_dictionary_t  nameword_dictionary_;
+	std::mutex             nameword_update_mtx_;
 
 public:
 
 	nameword_dictionary_t::nameword_t add_nameword(str_ref word)
 	{
-		std::lock_guard<std::mutex> lock_(nameword_update_mtx_); // sync with other writers
+		std::lock_guard<std::mutex> lock_(nameword_update_mtx_); // sync with other writers, readers don't need it
 
-		auto const existing_nwd = this->load_nameword_dict();
-
-		auto nwd = meow::make_intrusive<nameword_dictionary_t>();
-		nwd->clone_from(*existing_nwd);
-
-		nameword_dictionary_t::nameword_t const *nw = nwd->insert_with_external_locking(word);
-
-		this->store_nameword_dict(nwd);
-
-		return *nw;
+		return *nameword_dictionary_.insert_with_external_locking(word);
 	}
 
-	nameword_dictionary_ptr load_nameword_dict() const
+	// lock-free for lookups, see nameword_dictionary_t::get()
+	nameword_dictionary_t const* nameword_dictionary() const
 	{
-		std::lock_guard<std::mutex> lock_(nameword_load_and_store_mtx_); // sync with store_nameword_dict()
-
-		// FIXME: move this to ctor
-		//  this assignment should be fin in a 'read-type' function, due to full mutex here
-		if (!nameword_dictionary_)
-			nameword_dictionary_ = meow::make_intrusive<nameword_dictionary_t>();
-
-		return nameword_dictionary_;
+		return &nameword_dictionary_;
 	}
 
 public:
 
 	// get transient word, caller must make sure it stays valid while using
+	// i.e. holds a reference to it (directly or through a repacker_dictionary_t wordslice)
 	str_ref get_word(uint32_t word_id) const
 	{
 		if (word_id == 0)
@@ -426,15 +993,15 @@ public:
 		shard_t const *shard   = get_shard_for_word_id(word_id);
 		uint32_t const word_offset = (word_id & word_id_mask) - 1;
 
-		// can use only READ lock, here, since word refcount is not incremented
-		scoped_read_lock_t lock_(shard->mtx);
+		// no lock at all, words never move (see words_t) and this one can't be erased, as caller holds a reference
+		// all other words in the same shard might be changing, but that's fine as we don't touch them
 
 		assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
 
 		word_t const *w = &shard->words[word_offset];
-		assert((w && !w->str.empty()) && "got empty word ptr from wordlist, dangling word_id reference");
+		assert((w && w->str.size() > 0) && "got empty word ptr from wordlist, dangling word_id reference");
 
-		return str_ref { w->str }; // TODO: optimize pointer deref here (string::size(), etc.)
+		return w->str;
 	}
 
 	void erase_word___ref(uint32_t word_id) // pair to get_or_add___ref()
@@ -445,29 +1012,44 @@ public:
 		shard_t *shard = get_shard_for_word_id(word_id);
 		uint32_t const word_offset = (word_id & word_id_mask) - 1;
 
-		// a tmp string to use in case we're freeing the word
+		assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
+
+		word_t *w = &shard->words[word_offset];
+
+		// fastpath, not the last reference -> word stays, no need to touch the hash, so no lock
+		// release, so that whatever we've read from the word happens before it's cleared by whoever drops the last reference
+		{
+			uint32_t refcount = w->refcount.load(std::memory_order_relaxed);
+			while (refcount > 1)
+			{
+				if (w->refcount.compare_exchange_weak(refcount, refcount - 1, std::memory_order_release, std::memory_order_relaxed))
+					return;
+			}
+		}
+
+		// memory to give back in case we're freeing the word (large string or empty slab, see dictionary_word_arena_t)
 		// the idea is to free memory outside of lock in that case
-		std::string to_release_tmp;
+		void *to_release = nullptr;
+		hashtable_t retired_hash; // same for old hash table, see hash_t
 
-		// TODO: not worth using rlock just for quick assert that should never fire
-		//       but might be worth using it for refcount check (in case it's atomic) and upgrade only after
+		// might be the last reference, but new ones can still be taken (under read lock) till we get exclusive access
 		{
 			scoped_write_lock_t lock_(shard->mtx);
 
-			assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
-
-			word_t *w = &shard->words[word_offset];
 			assert(w->id == word_id);
-			assert(!w->str.empty() && "got empty word ptr from wordlist, dangling word_id reference");
+			assert((w->str.size() > 0) && "got empty word ptr from wordlist, dangling word_id reference");
 
 			// LOG_DEBUG(PINBA_LOOGGER_, "{0}; erasing {1} {2} {3}", __func__, w->str, w->id, w->refcount);
 
-			if (0 == --w->refcount)
+			// acquire pairs with lock-free unrefs above, they might have been the last ones to read the word
+			if (1 == w->refcount.fetch_sub(1, std::memory_order_acq_rel))
 			{
-				size_t const n_erased = shard->hash.erase(str_ref { w->str }, w->hash);
+				size_t const n_erased = shard->hash.erase(w->str, w->hash);
 				assert((n_erased == 1) && "must have erased something here");
 
-				shard->mem_used_by_word_strings -= w->str.size();
+				shard->hash.take_retired(&retired_hash);
+
+				to_release = shard->strings.deallocate(w->str);
 
 				// clear the word, and put it to shard's freelist
 				w->next_freelist_offset = shard->freelist_head;
@@ -475,11 +1057,11 @@ public:
 
 				w->id       = 0;
 				w->hash     = 0;
-				w->str.swap(to_release_tmp);
+				w->str      = {};
 			}
 		}
 
-		// to_release_tmp is destroyed, freeing memory
+		free(to_release);
 	}
 
 	// get or add a word that is never supposed to be removed
@@ -488,7 +1070,15 @@ public:
 		if (!word)
 			return {};
 
-		uint64_t const word_hash = hash_dictionary_word(word);
+		return this->get_or_add___permanent(word, hash_dictionary_word(word));
+	}
+
+	// same as above, but with precalculated word_hash
+	word_t const* get_or_add___permanent(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return {};
+
 		shard_t *shard = get_shard_for_word_hash(word_hash);
 
 		// MUST make word permanent here (aka increment refcount) -> no fastpath
@@ -497,14 +1087,17 @@ public:
 		// also if word already exists as permanent, we still increment refcount by 2
 		// this is not an issue, since permanent words are not to be removed anyway (any refcount would work)
 
-		// pre-copy the word for locked insert
-		std::string word_str = word.str();
-
+		hashtable_t retired_hash; // destroyed after the lock is released, see hash_t
 
+		uint64_t const start_ns = monotonic_now_ns();
 		scoped_write_lock_t lock_(shard->mtx);
 
-		word_t *w = this->get_or_add___wrlocked(shard, std::move(word_str), word_hash);
-		w->refcount += 2;
+		word_t *w = this->get_or_add___wrlocked(shard, word, word_hash);
+		w->refcount.fetch_add(2, std::memory_order_relaxed);
+
+		shard->hash.take_retired(&retired_hash);
+
+		this->record_insert_latency___wrlocked(shard, start_ns);
 
 		return w;
 	}
@@ -518,6 +1111,14 @@ public:
 		return this->get_or_add___permanent(word)->id;
 	}
 
+	uint32_t get_or_add(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return 0;
+
+		return this->get_or_add___permanent(word, word_hash)->id;
+	}
+
 	// get or add a word that might get removed with erase_word___ref() later
 	word_t const* get_or_add___ref(str_ref const word)
 	{
@@ -535,18 +1136,33 @@ public:
 
 		shard_t *shard = get_shard_for_word_hash(word_hash);
 
-		// TODO: not sure how to build fastpath here, since we need to increment refcount on return
-
-		// NOTE: now this is very likely to be an insert (as we're called from repacker here on it's cache-miss)
-		//  so to reduce the amount of time spent under write lock, we'll do some hax here
-		std::string word_str = word.str();
+		// fastpath, word exists (repacker cache miss, but some other repacker has added it already)
+		// refcount is atomic, and the word can't be erased while we hold READ lock, erasing the last reference needs WRITE lock
+		{
+			scoped_read_lock_t lock_(shard->mtx);
 
+			word_t *w = shard->hash.find(word, word_hash);
+			if (w != nullptr)
+			{
+				w->refcount.fetch_add(1, std::memory_order_relaxed);
+				return w;
+			}
+		}
 
+		// NOTE: now this is very likely to be an insert
+		//  string copy happens under write lock, but that's a memcpy into shard arena (no malloc in steady state)
+		//  word might've been added between the locks, that's handled by get_or_add___wrlocked()
+		hashtable_t retired_hash; // destroyed after the lock is released, see hash_t
 
+		uint64_t const start_ns = monotonic_now_ns();
 		scoped_write_lock_t lock_(shard->mtx);
 
-		word_t *w = this->get_or_add___wrlocked(shard, std::move(word_str), word_hash);
-		w->refcount += 1;
+		word_t *w = this->get_or_add___wrlocked(shard, word, word_hash);
+		w->refcount.fetch_add(1, std::memory_order_relaxed);
+
+		shard->hash.take_retired(&retired_hash);
+
+		this->record_insert_latency___wrlocked(shard, start_ns);
 
 		return w;
 	}
@@ -568,22 +1184,35 @@ private:
 		return &shards_[word_hash >> (64 - shard_id_bits)];
 	}
 
+	static uint64_t monotonic_now_ns()
+	{
+		return duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+	}
+
+	void record_insert_latency___wrlocked(shard_t *shard, uint64_t start_ns)
+	{
+		uint64_t const us = (monotonic_now_ns() - start_ns) / 1000;
+
+		size_t const bucket = (us == 0) ? 0 : (64 - __builtin_clzll(us));
+		shard->insert_latency_hist[std::min(bucket, insert_latency_hist_buckets - 1)]++;
+	}
+
 	// get or create a word, REFCOUNT IS NOT MODIFIED, i.e. even if just created -> refcount == 0
-	word_t* get_or_add___wrlocked(shard_t *shard, std::string word, uint64_t word_hash)
+	word_t* get_or_add___wrlocked(shard_t *shard, str_ref word, uint64_t word_hash)
 	{
 		// potential SLOW things here (like alloc/free)
 		//  1. wordlist push_back (should be rare in steady state, freelist should be non-empty)
 		//  2. freelist pop_back (possible, and probably the most frequent one)
 		//      TODO: try pop_front here, to amortize the cost of alloc/free to once per chunk
 		//  3. hash growth (should be very rare in steady state) - but this is SUPER SLOW
-		//  4. std::string move doing alloc+copy (no sane impl would do this, but small string optimization is fine)
+		//  4. string arena getting a new slab (rare, freed slots are reused first) or a large string malloc()
 
 		// to avoid extra hash lookup (find) - do some hax
 		//
 		// just insert right away, with the word we've got
-		// it's going to "stay alive", as we'll move it into the final word object
+		// key is replaced with the arena copy below, before the lock is released
 		// we've got no word yet, so just insert nullptr for now
-		auto insert_res = shard->hash.emplace_hash(word_hash, str_ref { word }, nullptr);
+		auto insert_res = shard->hash.emplace_hash(word_hash, word, nullptr);
 		auto& it = insert_res.first;
 
 		// word already exists
@@ -591,7 +1220,6 @@ private:
 			return it->second;
 
 		// slower path, need to actually fix newly inserted word
-		shard->mem_used_by_word_strings += word.size();
 
 		word_t *w = [&]()
 		{
@@ -616,8 +1244,7 @@ private:
 				uint32_t const word_id = static_cast<uint32_t>(shard->words.size() + 1) | (shard->id << (32 - shard_id_bits));
 
 				// XXX(antoxa): if this throws, we're screwed - hash value (the inconsistent one at that :) )  is not removed
-				shard->words.emplace_back();
-				word_t *w = &shard->words.back();
+				word_t *w = &shard->words.emplace_back();
 
 				w->next_freelist_offset = 0; // never in freelist
 				w->id = word_id;
@@ -627,13 +1254,13 @@ private:
 		}();
 
 		// finish initializing word
+		// XXX: same as above, if arena allocation throws - hash is inconsistent
 		w->hash = word_hash;
-		w->str  = std::move(word);
+		w->str  = shard->strings.allocate(word);
 
 		// fixup the key to point to long-living data now
-		// this is not always required, but needed to for small string optimization for example
 		str_ref& key_ref = const_cast<str_ref&>(it->first);
-		key_ref = str_ref { w->str };
+		key_ref = w->str;
 
 		// commit value
 		it.value() = w;
@@ -3,6 +3,7 @@
 
 #include "pinba/globals.h"
 #include "pinba/report.h"
+#include "pinba/collector.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -23,6 +24,12 @@ struct pinba_engine_t : private boost::noncopyable
 	virtual pinba_error_t       delete_report(str_ref name) = 0;
 	virtual report_state_ptr    get_report_state(str_ref name) = 0;
 	virtual report_snapshot_ptr get_report_snapshot(str_ref name) = 0;
+
+	// per-source admission state, see collector_conf_t::admission_*
+	virtual std::vector<collector_source_stats_t> get_source_stats() = 0;
+
+	// in-process injection into the pipeline, see collector_injector_t
+	virtual collector_injector_ptr create_injector() = 0;
 };
 typedef std::unique_ptr<pinba_engine_t> pinba_engine_ptr;
 
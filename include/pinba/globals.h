@@ -64,12 +64,25 @@ struct collector_stats_t
 {
 	timeval_t ru_utime = {0,0};
 	timeval_t ru_stime = {0,0};
+
+	// packets received per single wakeup (poll return), log2 buckets: [0], [1], [2,3], [4,7], ..., [32K, inf)
+	static constexpr size_t const wakeup_hist_buckets = 17;
+	uint64_t  packets_per_wakeup[wakeup_hist_buckets] = {};
+
+	// time spent spinning, yielding and parked, waiting for packets (not including time blocked in poll)
+	duration_t idle_time = {0};
+
+	// datagrams dropped by the kernel on this thread sockets (receive buffer full, SO_RXQ_OVFL)
+	uint64_t   kernel_drops = 0;
 };
 
 struct repacker_stats_t
 {
 	timeval_t ru_utime = {0,0};
 	timeval_t ru_stime = {0,0};
+
+	uint32_t  queue_depth    = 0;  // raw batches waiting in this thread's input queue (gauge, updated every second)
+	uint64_t  batches_stolen = 0;  // raw batches this thread took from other threads' queues
 };
 
 // this one is updated from multiple threads
@@ -86,6 +99,8 @@ struct pinba_stats_t
 	struct {
 		std::atomic<uint64_t> n_raw_batches         = {0};
 		std::atomic<uint64_t> n_packet_batches      = {0};
+		std::atomic<uint64_t> n_raw_batches_reused  = {0};  // taken from recycling pool instead of allocating
+		std::atomic<uint64_t> n_packet_batches_reused = {0};
 		std::atomic<uint64_t> n_repacker_dict_words = {0};
 		std::atomic<uint64_t> n_repacker_dict_ws    = {0};
 		std::atomic<uint64_t> n_report_snapshots    = {0};
@@ -101,13 +116,28 @@ struct pinba_stats_t
 		std::atomic<uint64_t> recv_eagain       = {0};      // EAGAIN errors from recv* calls
 		std::atomic<uint64_t> recv_bytes        = {0};      // bytes received
 		std::atomic<uint64_t> recv_packets      = {0};      // total udp packets received
+		std::atomic<uint64_t> recv_kernel_drops = {0};      // udp packets dropped by the kernel before we could read them
+		std::atomic<uint64_t> recv_gro_segments = {0};      // udp packets that came coalesced by UDP_GRO (included in recv_packets)
+		std::atomic<uint64_t> recv_truncated    = {0};      // udp packets lost due to not fitting into receive buffers
 		std::atomic<uint64_t> packet_decode_err = {0};      // number of times we've failed to decode incoming message
+		std::atomic<uint64_t> packet_decompress_err = {0};  // failed to decompress, unknown dictionary, etc. (these are counted in packet_decode_err as well)
+		std::atomic<uint64_t> admission_dropped = {0};      // packets over per-source limit, dropped (see collector_conf_t::admission_*)
+		std::atomic<uint64_t> admission_sampled = {0};      // packets over per-source limit, let through by sampling
 		std::atomic<uint64_t> batch_send_total  = {0};      // batch send attempts (to repacker)
 		std::atomic<uint64_t> batch_send_err    = {0};      // batch sends that failed
 		std::atomic<uint64_t> packet_send_total = {0};      // n packets in batches we attempted to send (to repacker)
 		std::atomic<uint64_t> packet_send_err   = {0};      // n packets that were lost to batch send fails
 	} udp;
 
+	// stream readers (see collector_conf_t::stream_listen)
+	// datagrams go through the same path as udp ones after that, so decode and batch send errors are in udp stats
+	struct {
+		std::atomic<uint64_t> connections_total = {0};      // accepted connections
+		std::atomic<uint64_t> connections_err   = {0};      // connections closed due to errors (bad datagram length, reset, etc.)
+		std::atomic<uint64_t> recv_bytes        = {0};      // bytes received, including length prefixes
+		std::atomic<uint64_t> recv_packets      = {0};      // datagrams received
+	} stream;
+
 	std::vector<collector_stats_t> collector_threads;
 
 	struct {
@@ -115,10 +145,14 @@ struct pinba_stats_t
 		std::atomic<uint64_t> recv_total          = {0};
 		std::atomic<uint64_t> recv_eagain         = {0};
 		std::atomic<uint64_t> recv_packets        = {0};
+		std::atomic<uint64_t> recv_nested_packets = {0};  // nested requests (Request.requests), included in recv_packets
+		std::atomic<uint64_t> decode_fallback     = {0};  // fast decode was not possible, went through protobuf-c unpack
+		std::atomic<uint64_t> packet_decode_err   = {0};  // protobuf-c unpack failed too (fused mode and raw requests, see collector_conf_t::raw_requests)
 		std::atomic<uint64_t> packet_validate_err = {0};
 		std::atomic<uint64_t> batch_send_total    = {0};
 		std::atomic<uint64_t> batch_send_by_timer = {0};
 		std::atomic<uint64_t> batch_send_by_size  = {0};
+		std::atomic<uint64_t> batches_stolen      = {0};  // raw batches taken from other threads' queues (see repacker_t::dispatch())
 	} repacker;
 
 	std::vector<repacker_stats_t> repacker_threads;
@@ -147,15 +181,58 @@ struct pinba_options_t
 	uint32_t    udp_threads;
 	uint32_t    udp_batch_messages;
 	duration_t  udp_batch_timeout;
+	uint32_t    udp_idle_spin_count;    // see collector_conf_t for these
+	uint32_t    udp_idle_yield_count;
+	duration_t  udp_idle_park_min;
+	duration_t  udp_idle_park_max;
+	uint32_t    udp_busy_poll_usec;
+	duration_t  udp_rcvbuf_absorb_time; // see collector_conf_t::rcvbuf_absorb_*
+	uint32_t    udp_rcvbuf_absorb_mbps;
+	bool        udp_gro;                // see collector_conf_t::gro
+	uint32_t    udp_recv_max_dgrams;    // see collector_conf_t::recv_*
+	uint32_t    udp_recv_slot_size;
+	bool        udp_recv_hugepages;
+	bool        udp_reuseport_cpu_steering; // see collector_conf_t::reuseport_cpu_steering
+	std::string udp_zstd_dictionaries;  // see collector_conf_t::zstd_dictionaries
+
+	std::string stream_listen;          // see collector_conf_t::stream_*
+	uint32_t    stream_threads;
+
+	uint32_t    admission_rate;         // see collector_conf_t::admission_*
+	uint32_t    admission_burst;
+	uint32_t    admission_sample_n;
+	uint32_t    admission_slots;
+
+	std::string capture_file;           // see collector_conf_t::capture_*
+	uint32_t    capture_sample_n;
+	std::string replay_file;            // see collector_conf_t::replay_*
+	uint32_t    replay_speed;
+	uint32_t    replay_loops;
+	bool        inject_only;            // see collector_conf_t::inject_only
 
 	uint32_t    repacker_threads;
 	uint32_t    repacker_input_buffer;
 	uint32_t    repacker_batch_messages;
 	duration_t  repacker_batch_timeout;
+	bool        repacker_fast_decode;   // decode protobuf in repacker, straight into packets (see collector_conf_t::raw_requests)
+	bool        repacker_fused;         // repack on udp reader threads, no repacker threads (see repacker_conf_t::fused)
 
 	uint32_t    coordinator_input_buffer;
 	uint32_t    report_input_buffer;
 
+	// thread placement, cpu lists are in taskset -c format ("0-3,8"), thread N gets Nth cpu (round-robin)
+	// empty list = not bound, nice = 0 - keep inherited priority
+	std::string numa_node;              // "auto" = node of the nic serving net_address, "none" or node number
+	                                    // udp readers and repackers with empty cpu lists are confined to this node cpus
+	std::string udp_cpu_list;           // udp_reader/N
+	int32_t     udp_nice;
+	std::string repacker_cpu_list;      // repacker/N
+	int32_t     repacker_nice;
+	std::string coordinator_cpu_list;   // packet-relay
+	int32_t     coordinator_nice;
+	std::string report_cpu_list;        // rh/N (N = report id)
+	int32_t     report_nice;
+
 	pinba_logger_ptr logger;
 
 	bool        packet_debug;           // dump arriving packets to log (at info level)
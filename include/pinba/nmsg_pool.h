@@ -0,0 +1,180 @@
+#ifndef PINBA__NMSG__POOL_H_
+#define PINBA__NMSG__POOL_H_
+
+#include <atomic>
+#include <memory>
+#include <utility>   // forward
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/intrusive_ptr.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// recycling pool for messages that are created by one thread and released by others
+// (raw_request_t from udp readers, packet_batch_t from repackers)
+//
+// last reference drop returns the message to its pool, instead of deleting it on consumer thread
+// and producer picks it up and reuses, along with all the memory it has allocated (nmpa arena, etc.)
+// so that both malloc and free of message memory happen on the producer thread
+//
+//  - returned messages go to a lock-free stack, pushed by any thread
+//  - producer takes the whole stack at once (exchange), when its private free list is empty
+//    single consumer of the stack + taking everything at once means there is no ABA problem
+//
+// pooled message type T must
+//  - derive from nmsg_pooled_message_t<T>
+//  - have void pool_reuse(), called on producer thread, before message is handed out again
+//  - have void pool_return(), called on releasing thread, to drop references to other objects early
+//
+// pool is closed when owner drops nmsg_pool_ptr, messages still in flight are deleted on release after that
+
+template<class T> struct nmsg_pool_t;
+
+template<class Derived>
+struct nmsg_pooled_message_t : private boost::noncopyable
+{
+	template<class> friend struct nmsg_pool_t;
+
+	friend void intrusive_ptr_add_ref(nmsg_pooled_message_t const *p)
+	{
+		p->refcount_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_release(nmsg_pooled_message_t const *p)
+	{
+		if (1 != p->refcount_.fetch_sub(1, std::memory_order_acq_rel))
+			return;
+
+		Derived *obj = static_cast<Derived*>(const_cast<nmsg_pooled_message_t*>(p));
+
+		if (p->pool_ == nullptr)
+			delete obj;
+		else
+			p->pool_->put(obj);
+	}
+
+private:
+	mutable std::atomic<uint32_t>  refcount_  = {0};
+	nmsg_pool_t<Derived>           *pool_     = nullptr;  // not pooled if NULL
+	Derived                        *pool_next_ = nullptr; // free list link
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<class T>
+struct nmsg_pool_t : private boost::noncopyable
+{
+	struct closer_t
+	{
+		void operator()(nmsg_pool_t *pool) const { pool->close(); }
+	};
+	using ptr = std::unique_ptr<nmsg_pool_t, closer_t>;
+
+	static ptr create()
+	{
+		return ptr { new nmsg_pool_t() };
+	}
+
+	// owner thread only
+	// returns recycled message (after pool_reuse()) or a new one, constructed with args
+	// args must be the same for all calls, as recycled messages have been constructed with the first ones
+	template<class... A>
+	boost::intrusive_ptr<T> get(A&&... args)
+	{
+		if (free_ == nullptr)
+			free_ = returned_.exchange(nullptr, std::memory_order_acquire);
+
+		T *obj = free_;
+		if (obj != nullptr)
+		{
+			free_ = obj->pool_next_;
+			obj->pool_next_ = nullptr;
+			obj->pool_reuse();
+		}
+		else
+		{
+			obj = new T(std::forward<A>(args)...);
+			obj->pool_ = this;
+		}
+
+		refcount_.fetch_add(1, std::memory_order_relaxed); // message in flight keeps the pool alive
+		return boost::intrusive_ptr<T>(obj);
+	}
+
+	// any thread, message refcount has dropped to zero (see intrusive_ptr_release() above)
+	void put(T *obj)
+	{
+		obj->pool_return();
+
+		if (closed_.load(std::memory_order_acquire))
+		{
+			delete obj;
+		}
+		else
+		{
+			// might still race with close(), such messages are deleted in destructor
+			T *head = returned_.load(std::memory_order_relaxed);
+			do {
+				obj->pool_next_ = head;
+			} while (!returned_.compare_exchange_weak(head, obj, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		this->release();
+	}
+
+private:
+
+	nmsg_pool_t()
+		: returned_(nullptr)
+		, free_(nullptr)
+		, refcount_(1) // owner
+		, closed_(false)
+	{
+	}
+
+	~nmsg_pool_t()
+	{
+		delete_list(returned_.exchange(nullptr, std::memory_order_acquire));
+		delete_list(free_);
+	}
+
+	void close()
+	{
+		closed_.store(true, std::memory_order_release);
+
+		delete_list(returned_.exchange(nullptr, std::memory_order_acquire));
+		delete_list(free_);
+		free_ = nullptr;
+
+		this->release();
+	}
+
+	void release()
+	{
+		if (1 == refcount_.fetch_sub(1, std::memory_order_acq_rel))
+			delete this;
+	}
+
+	static void delete_list(T *obj)
+	{
+		while (obj != nullptr)
+		{
+			T *next = obj->pool_next_;
+			delete obj;
+			obj = next;
+		}
+	}
+
+private:
+	std::atomic<T*>        returned_;  // pushed by releasing threads
+	T                      *free_;     // owner thread only
+	std::atomic<uint32_t>  refcount_;  // owner + messages in flight
+	std::atomic<bool>      closed_;
+};
+
+template<class T>
+using nmsg_pool_ptr = typename nmsg_pool_t<T>::ptr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__NMSG__POOL_H_
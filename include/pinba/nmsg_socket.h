@@ -23,6 +23,10 @@ struct nmsg_message_ex_t
 {
 };
 
+// recycled messages, see pinba/nmsg_pool.h
+template<class Derived>
+struct nmsg_pooled_message_t;
+
 struct nmsg_message_t : public nmsg_message_ex_t<nmsg_message_t>
 {
 	virtual ~nmsg_message_t() {} // an absolute must have, to properly delete children
@@ -279,7 +283,9 @@ public:
 	bool send_message(boost::intrusive_ptr<T> const& value, int flags = 0)
 	{
 		static_assert(
-			(std::is_base_of<nmsg_message_ex_t<T>, T>::value || std::is_base_of<nmsg_message_t, T>::value),
+			(std::is_base_of<nmsg_message_ex_t<T>, T>::value
+				|| std::is_base_of<nmsg_pooled_message_t<T>, T>::value
+				|| std::is_base_of<nmsg_message_t, T>::value),
 			"send_message expects an intrusive_ptr to something derived from nmsg_message_t");
 
 		return this->send(value, flags);
@@ -37,6 +37,10 @@ struct pinba_os_symbols_t : private boost::noncopyable
 	using funcp___recvmmsg_t = int (*)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const struct timespec *timeout);
 	virtual int  recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const struct timespec *timeout) = 0;
 	virtual bool has_recvmmsg() const = 0;
+
+	// not a symbol, but a kernel feature, probed once on init
+	// true if built with liburing and kernel supports multishot recvmsg with provided buffer rings (linux 6.0+)
+	virtual bool has_io_uring_recvmsg_multishot() const = 0;
 };
 using pinba_os_symbols_ptr = std::unique_ptr<pinba_os_symbols_t>;
 
@@ -138,6 +138,9 @@ MEOW_DEFINE_SMART_ENUM(request_validate_result,
 
 					((bad_float_timer_ru_stime,       "bad_float_timer_ru_stime"))
 					// ((negative_float_timer_ru_stime,  "negative_float_timer_ru_stime"))
+
+					((not_enough_request_tag_values,  "not_enough_request_tag_values"))
+					((bad_dictionary_offset,          "bad_dictionary_offset"))
 					);
 
 // validate that request makes sense and can be used further,
@@ -0,0 +1,722 @@
+#ifndef PINBA__PACKET_DECODER_H_
+#define PINBA__PACKET_DECODER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/packet.h"
+#include "pinba/packet_impl.h"
+#include "pinba/packet_simd.h"
+#include "pinba/dictionary.h"
+
+#include "proto/pinba.pb-c.h"
+
+#include "misc/nmpa.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// single pass Pinba.Request decoder
+//
+// generic path is pinba__request__unpack() -> pinba_validate_request() -> pinba_request_to_packet()
+// which goes over the data 3 times and materializes every repeated field as an array in between
+//
+// this one scans protobuf bytes once, remembering where repeated fields are (without copying anything)
+// and then builds packet_t right from the wire data, validating as it goes
+// packed varints are decoded in small chunks and packed floats converted in bulk, with simd kernels
+// dictionary strings are resolved through the same repacker caches as in pinba_request_to_packet()
+//
+// only handles the layout real clients produce, i.e.
+//  - every repeated field occupies a single contiguous range in the message (packed or not)
+//  - no nested requests
+// everything else, including malformed data, is reported as 'fallback'
+// and caller is expected to go the generic path, that deals with it (or reports an error)
+//
+// NOTE: on validation errors dictionary words for fields decoded so far are already added to the repacker dictionary
+//       this is fine, as they're released along with the batch wordslice, just like all the others
+
+struct packet_decode_result_t
+{
+	packet_t                   *packet;    // non-NULL = success
+	request_validate_result_t  validate;   // packet == NULL && validate != okay - request is invalid
+	                                       // packet == NULL && validate == okay - use generic decoder
+};
+
+// per-thread storage for pinba_decode_request_to_packet(), reused between calls
+// dictionary can be large (tens of thousands of entries in a 64k datagram), so it's not on stack
+struct packet_decoder_scratch_t
+{
+	// dictionary entries, with translation caches (see pinba_request_to_packet() for details)
+	struct dict_entry_t
+	{
+		enum : uint8_t { not_checked = 0, not_found = 1, ok = 2 };
+
+		char const  *word_data;
+		uint64_t    word_hash;
+		uint32_t    word_len;
+		uint8_t     name_status;
+		uint8_t     bloom_added;
+		uint8_t     value_status;   // not_checked or ok
+		uint32_t    name_id;
+		uint32_t    value_id;
+		uint64_t    bloom_hashed;
+	};
+
+	std::vector<dict_entry_t>  dict;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace pinba { namespace { namespace packet_decoder_detail {
+
+	enum : uint32_t
+	{
+		wire_varint  = 0,
+		wire_fixed64 = 1,
+		wire_bytes   = 2,
+		wire_fixed32 = 5,
+	};
+
+	// read varint, truncating to 32 bits, like protobuf-c does for uint32 fields
+	// returns NULL on truncated input or if varint is longer than 5 bytes (not worth handling here)
+	inline uint8_t const* read_varint32(uint8_t const *p, uint8_t const *end, uint32_t *result)
+	{
+		uint32_t v = 0;
+
+		for (unsigned shift = 0; shift < 35; shift += 7)
+		{
+			if (p >= end)
+				return NULL;
+
+			uint8_t const b = *p++;
+			v |= uint32_t(b & 0x7f) << shift;
+
+			if ((b & 0x80) == 0)
+			{
+				*result = v;
+				return p;
+			}
+		}
+
+		return NULL;
+	}
+
+	// unchecked version, only for data that has been validated by read_varint32() already
+	inline uint32_t next_varint32(uint8_t const *& p)
+	{
+		uint32_t v = 0;
+		for (unsigned shift = 0; ; shift += 7)
+		{
+			uint8_t const b = *p++;
+			v |= uint32_t(b & 0x7f) << shift;
+
+			if ((b & 0x80) == 0)
+				return v;
+		}
+	}
+
+	inline float next_float(uint8_t const *& p)
+	{
+		float f;
+		memcpy(&f, p, sizeof(f)); // little endian on the wire, same as x86
+		p += sizeof(f);
+		return f;
+	}
+
+	// same checks as pinba_validate_request()
+	inline bool float_is_valid(float f)
+	{
+		int const c = std::fpclassify(f);
+		return (c == FP_ZERO) || (c == FP_NORMAL);
+	}
+
+	// repeated field location in the message
+	//  packed   - [begin, end) is the payload, elements follow each other
+	//  unpacked - [begin, end) is a sequence of (tag, element) pairs, all with the same tag
+	struct repeated_t
+	{
+		uint8_t const  *begin;
+		uint8_t const  *end;
+		uint32_t       count;
+		bool           packed;
+	};
+
+	// sequential reader over repeated_t, no checks, scan has validated everything
+	struct repeated_reader_t
+	{
+		uint8_t const  *p;
+		uint8_t const  *end;
+		bool           packed;
+
+		// packed varints are decoded ahead, a chunk at a time
+		uint32_t       buf_pos;
+		uint32_t       buf_n;
+		uint32_t       buf[32];
+
+		explicit repeated_reader_t(repeated_t const& r)
+			: p(r.begin)
+			, end(r.end)
+			, packed(r.packed)
+			, buf_pos(0)
+			, buf_n(0)
+		{
+		}
+
+		uint32_t next_uint32()
+		{
+			if (!packed)
+			{
+				next_varint32(p); // tag
+				return next_varint32(p);
+			}
+
+			if (buf_pos == buf_n)
+			{
+				buf_n   = pinba_simd()->decode_varint32(&p, end, buf, sizeof(buf) / sizeof(buf[0]));
+				buf_pos = 0;
+			}
+			return buf[buf_pos++];
+		}
+
+		float next_float()
+		{
+			if (!packed)
+				next_varint32(p); // tag
+			return packet_decoder_detail::next_float(p);
+		}
+
+		str_ref next_bytes()
+		{
+			next_varint32(p); // tag, bytes are never packed
+			uint32_t const len = next_varint32(p);
+
+			str_ref const result = { (char const*)p, (size_t)len };
+			p += len;
+			return result;
+		}
+	};
+
+	// convert first n elements of repeated float field to durations, dst_stride bytes apart
+	inline void repeated_floats_to_durations(repeated_t const& rep, uint32_t n, duration_t *dst, size_t dst_stride)
+	{
+		if (rep.packed)
+		{
+			pinba_simd()->floats_to_durations(rep.begin, n, dst, dst_stride);
+			return;
+		}
+
+		repeated_reader_t rd { rep };
+		for (uint32_t i = 0; i < n; i++)
+		{
+			duration_t const d = pinba_duration_from_float(rd.next_float());
+			memcpy((char*)dst + i * dst_stride, &d, sizeof(d));
+		}
+	}
+
+	struct scanned_request_t
+	{
+		str_ref     hostname;
+		str_ref     server_name;
+		str_ref     script_name;
+		str_ref     schema;
+		uint32_t    document_size;
+		uint32_t    memory_footprint;
+		uint32_t    status;
+		float       request_time;
+		float       ru_utime;
+		float       ru_stime;
+
+		repeated_t  timer_hit_count;
+		repeated_t  timer_value;
+		repeated_t  timer_tag_count;
+		repeated_t  timer_tag_name;
+		repeated_t  timer_tag_value;
+		repeated_t  dictionary;
+		repeated_t  tag_name;
+		repeated_t  tag_value;
+		repeated_t  timer_ru_utime;
+		repeated_t  timer_ru_stime;
+	};
+
+	// the scan pass, returns false if generic decoder should be used
+	inline bool scan_request(str_ref data, scanned_request_t *r)
+	{
+		memset(r, 0, sizeof(*r));
+
+		uint8_t const *p   = (uint8_t const*)data.data();
+		uint8_t const *end = p + data.size();
+
+		uint32_t required_seen = 0;      // bit per required field (1..9)
+		uint32_t last_field    = 0;
+
+		while (p < end)
+		{
+			uint8_t const *field_begin = p;
+
+			uint32_t tag;
+			if (NULL == (p = read_varint32(p, end, &tag)))
+				return false;
+
+			uint32_t const field     = tag >> 3;
+			uint32_t const wire_type = tag & 0x7;
+
+			// value, depending on wire type
+			uint32_t       v32         = 0;
+			uint8_t const *bytes_begin = NULL;
+			uint8_t const *bytes_end   = NULL;
+
+			switch (wire_type)
+			{
+				case wire_varint:
+					if (NULL == (p = read_varint32(p, end, &v32)))
+						return false;
+				break;
+
+				case wire_fixed32:
+					if (end - p < 4)
+						return false;
+					memcpy(&v32, p, sizeof(v32));
+					p += 4;
+				break;
+
+				case wire_fixed64:
+					if (end - p < 8)
+						return false;
+					p += 8;
+				break;
+
+				case wire_bytes:
+				{
+					uint32_t len;
+					if (NULL == (p = read_varint32(p, end, &len)))
+						return false;
+					if (uint32_t(end - p) < len)
+						return false;
+
+					bytes_begin = p;
+					bytes_end   = p + len;
+					p += len;
+				}
+				break;
+
+				default: // groups are not used by our schema
+					return false;
+			}
+
+			auto const as_float = [&]()
+			{
+				float f;
+				memcpy(&f, &v32, sizeof(f));
+				return f;
+			};
+
+			// append element(s) to repeated field, element_wire_type is the wire type of unpacked elements
+			auto const add_repeated = [&](repeated_t *rep, uint32_t element_wire_type) -> bool
+			{
+				bool const packed = (wire_type == wire_bytes) && (element_wire_type != wire_bytes);
+
+				if (!packed && (wire_type != element_wire_type))
+					return false;
+
+				uint32_t n_elements = 1;
+				if (packed)
+				{
+					if (element_wire_type == wire_fixed32)
+					{
+						if ((bytes_end - bytes_begin) % 4 != 0)
+							return false;
+						n_elements = (bytes_end - bytes_begin) / 4;
+					}
+					else
+					{
+						// count varint terminators, and check that all of them fit into 32 bits
+						n_elements = 0;
+						unsigned run = 0;
+						for (uint8_t const *b = bytes_begin; b < bytes_end; b++)
+						{
+							if (*b & 0x80) {
+								if (++run >= 5)
+									return false;
+							} else {
+								n_elements++;
+								run = 0;
+							}
+						}
+						if (run != 0)
+							return false;
+					}
+
+					if (n_elements == 0) // empty packed array, as good as absent
+						return true;
+				}
+
+				if (rep->count == 0)
+				{
+					rep->begin  = (packed) ? bytes_begin : field_begin;
+					rep->end    = (packed) ? bytes_end : p;
+					rep->count  = n_elements;
+					rep->packed = packed;
+					return true;
+				}
+
+				// field continues, only allowed for unpacked fields, without anything in between
+				if (packed || rep->packed || (last_field != field))
+					return false;
+
+				rep->end    = p;
+				rep->count += n_elements;
+				return true;
+			};
+
+			auto const as_bytes = [&](str_ref *dst) -> bool
+			{
+				if (wire_type != wire_bytes)
+					return false;
+				*dst = str_ref { (char const*)bytes_begin, size_t(bytes_end - bytes_begin) };
+				return true;
+			};
+
+			auto const as_uint32 = [&](uint32_t *dst) -> bool
+			{
+				if (wire_type != wire_varint)
+					return false;
+				*dst = v32;
+				return true;
+			};
+
+			auto const as_float_field = [&](float *dst) -> bool
+			{
+				if (wire_type != wire_fixed32)
+					return false;
+				*dst = as_float();
+				return true;
+			};
+
+			uint32_t unused_u32;
+			bool ok = true;
+
+			switch (field)
+			{
+				case 1:  ok = as_bytes(&r->hostname);                             break;
+				case 2:  ok = as_bytes(&r->server_name);                          break;
+				case 3:  ok = as_bytes(&r->script_name);                          break;
+				case 4:  ok = as_uint32(&unused_u32);                             break; // request_count
+				case 5:  ok = as_uint32(&r->document_size);                       break;
+				case 6:  ok = as_uint32(&unused_u32);                             break; // memory_peak
+				case 7:  ok = as_float_field(&r->request_time);                   break;
+				case 8:  ok = as_float_field(&r->ru_utime);                       break;
+				case 9:  ok = as_float_field(&r->ru_stime);                       break;
+				case 10: ok = add_repeated(&r->timer_hit_count, wire_varint);     break;
+				case 11: ok = add_repeated(&r->timer_value, wire_fixed32);        break;
+				case 12: ok = add_repeated(&r->timer_tag_count, wire_varint);     break;
+				case 13: ok = add_repeated(&r->timer_tag_name, wire_varint);      break;
+				case 14: ok = add_repeated(&r->timer_tag_value, wire_varint);     break;
+				case 15: ok = add_repeated(&r->dictionary, wire_bytes);           break;
+				case 16: ok = as_uint32(&r->status);                              break;
+				case 17: ok = as_uint32(&r->memory_footprint);                    break;
+				case 18: ok = false;                                              break; // nested requests
+				case 19: ok = as_bytes(&r->schema);                               break;
+				case 20: ok = add_repeated(&r->tag_name, wire_varint);            break;
+				case 21: ok = add_repeated(&r->tag_value, wire_varint);           break;
+				case 22: ok = add_repeated(&r->timer_ru_utime, wire_fixed32);     break;
+				case 23: ok = add_repeated(&r->timer_ru_stime, wire_fixed32);     break;
+				default: // unknown field, skipped by protobuf-c as well
+				break;
+			}
+
+			if (!ok)
+				return false;
+
+			if (field >= 1 && field <= 9)
+				required_seen |= (1u << field);
+
+			last_field = field;
+		}
+
+		// all of the required fields must be present, generic decoder reports the error
+		uint32_t const required_mask = 0x3fe; // bits 1..9
+		return (required_seen & required_mask) == required_mask;
+	}
+
+}}} // namespace pinba { namespace { namespace packet_decoder_detail {
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<class D>
+inline packet_decode_result_t pinba_decode_request_to_packet(str_ref data, nameword_dictionary_t const *nw_d, D *d, struct nmpa_s *nmpa, packet_decoder_scratch_t *scratch)
+{
+	using namespace pinba::packet_decoder_detail;
+
+	auto const fallback = []() { return packet_decode_result_t { NULL, request_validate_result::okay }; };
+	auto const invalid  = [](request_validate_result_t vr) { return packet_decode_result_t { NULL, vr }; };
+
+	scanned_request_t r;
+	if (!scan_request(data, &r))
+		return fallback();
+
+	// validate everything that doesn't need walking arrays, same order as pinba_validate_request()
+	if (r.status >= PINBA_INTERNAL___STATUS_MAX)
+		return invalid(request_validate_result::status_is_too_large);
+
+	if (r.timer_value.count != r.timer_hit_count.count)
+		return invalid(request_validate_result::bad_hit_count);
+
+	if (r.timer_value.count != r.timer_tag_count.count)
+		return invalid(request_validate_result::bad_tag_count);
+
+	// timer tag counts are checked while walking timers below
+	// but it's still known that there can't be more tags than names and values
+	if (r.timer_tag_name.count != r.timer_tag_value.count)
+	{
+		return (r.timer_tag_name.count < r.timer_tag_value.count)
+				? invalid(request_validate_result::not_enough_tag_names)
+				: invalid(request_validate_result::not_enough_tag_values);
+	}
+
+	if (r.tag_value.count < r.tag_name.count)
+		return invalid(request_validate_result::not_enough_request_tag_values);
+
+	if (!float_is_valid(r.request_time))
+		return invalid(request_validate_result::bad_float_request_time);
+	if (!float_is_valid(r.ru_utime))
+		return invalid(request_validate_result::bad_float_ru_utime);
+	if (!float_is_valid(r.ru_stime))
+		return invalid(request_validate_result::bad_float_ru_stime);
+
+	using dict_entry_t = packet_decoder_scratch_t::dict_entry_t;
+
+	uint32_t const n_dictionary = r.dictionary.count;
+
+	scratch->dict.resize(n_dictionary);
+	dict_entry_t *dict = scratch->dict.data();
+	memset(dict, 0, sizeof(dict_entry_t) * n_dictionary);
+	{
+		// in chunks, every string is hashed exactly once, and hashes are passed down to all dictionaries
+		constexpr uint32_t const chunk_size = 32;
+		str_ref  words[chunk_size];
+		uint64_t hashes[chunk_size];
+
+		repeated_reader_t rd { r.dictionary };
+		for (uint32_t chunk_begin = 0; chunk_begin < n_dictionary; chunk_begin += chunk_size)
+		{
+			uint32_t const n = std::min(chunk_size, n_dictionary - chunk_begin);
+
+			for (uint32_t i = 0; i < n; i++)
+				words[i] = rd.next_bytes();
+
+			hash_dictionary_words(words, n, hashes);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				dict_entry_t& e = dict[chunk_begin + i];
+				e.word_data = words[i].data();
+				e.word_hash = hashes[i];
+				e.word_len  = words[i].size();
+			}
+		}
+	}
+
+	auto const name_by_offset = [&](uint32_t offset) -> dict_entry_t&
+	{
+		dict_entry_t& e = dict[offset];
+
+		if (e.name_status == dict_entry_t::not_checked)
+		{
+			nameword_dictionary_t::nameword_t const *nw = nw_d->get(str_ref { e.word_data, e.word_len }, e.word_hash);
+
+			e.name_status += (nw != nullptr) + 1;
+			if (e.name_status == dict_entry_t::ok)
+			{
+				e.name_id      = nw->id;
+				e.bloom_hashed = nw->id_hash;
+			}
+		}
+		return e;
+	};
+
+	auto const value_id_by_offset = [&](uint32_t offset) -> uint32_t
+	{
+		dict_entry_t& e = dict[offset];
+
+		if (e.value_status == dict_entry_t::not_checked)
+		{
+			e.value_id     = d->get_or_add(str_ref { e.word_data, e.word_len }, e.word_hash);
+			e.value_status = dict_entry_t::ok;
+		}
+		return e.value_id;
+	};
+
+	auto *p = (packet_t*)nmpa_calloc(nmpa, sizeof(packet_t)); // NOTE: no ctor is called here!
+
+	{
+		str_ref const fields[] = { r.hostname, r.server_name, r.script_name, r.schema, pinba_request_status_to_str_ref_tmp(r.status) };
+		uint64_t field_hashes[sizeof(fields) / sizeof(fields[0])];
+		hash_dictionary_words(fields, sizeof(fields) / sizeof(fields[0]), field_hashes);
+
+		p->host_id      = d->get_or_add(fields[0], field_hashes[0]);
+		p->server_id    = d->get_or_add(fields[1], field_hashes[1]);
+		p->script_id    = d->get_or_add(fields[2], field_hashes[2]);
+		p->schema_id    = d->get_or_add(fields[3], field_hashes[3]);
+		p->status       = d->get_or_add(fields[4], field_hashes[4]);
+	}
+	p->traffic      = r.document_size;
+	p->mem_used     = r.memory_footprint;
+	p->request_time = pinba_duration_from_float(std::signbit(r.request_time) ? 0.0f : r.request_time);
+	p->ru_utime     = pinba_duration_from_float(std::signbit(r.ru_utime) ? 0.0f : r.ru_utime);
+	p->ru_stime     = pinba_duration_from_float(std::signbit(r.ru_stime) ? 0.0f : r.ru_stime);
+
+	// timers
+	p->timer_count = r.timer_value.count;
+	if (p->timer_count > 0)
+	{
+		uint32_t const n_timers   = r.timer_value.count;
+		uint32_t const n_src_tags = r.timer_tag_name.count;
+
+		p->timers_blooms = (timer_bloom_t*)nmpa_calloc(nmpa, sizeof(timer_bloom_t) * n_timers);
+		p->timers        = (packed_timer_t*)nmpa_alloc(nmpa, sizeof(packed_timer_t) * n_timers);
+
+		// contiguous storage for all timer tag names/values
+		uint32_t *timer_tag_name_ids  = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * n_src_tags);
+		uint32_t *timer_tag_value_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * n_src_tags);
+
+		// float -> duration for all timers at once, straight into timer structs
+		// validation is done in the loop below, that also zeroes negative and missing ru values
+		uint32_t const n_ru_utime = std::min(n_timers, r.timer_ru_utime.count);
+		uint32_t const n_ru_stime = std::min(n_timers, r.timer_ru_stime.count);
+
+		repeated_floats_to_durations(r.timer_value, n_timers, &p->timers[0].value, sizeof(packed_timer_t));
+		repeated_floats_to_durations(r.timer_ru_utime, n_ru_utime, &p->timers[0].ru_utime, sizeof(packed_timer_t));
+		repeated_floats_to_durations(r.timer_ru_stime, n_ru_stime, &p->timers[0].ru_stime, sizeof(packed_timer_t));
+
+		repeated_reader_t hit_count_r { r.timer_hit_count };
+		repeated_reader_t value_r     { r.timer_value };
+		repeated_reader_t tag_count_r { r.timer_tag_count };
+		repeated_reader_t tag_name_r  { r.timer_tag_name };
+		repeated_reader_t tag_value_r { r.timer_tag_value };
+		repeated_reader_t ru_utime_r  { r.timer_ru_utime };
+		repeated_reader_t ru_stime_r  { r.timer_ru_stime };
+
+		uint32_t src_tag_offset = 0;
+		uint32_t dst_tag_offset = 0;
+
+		for (uint32_t timer_i = 0; timer_i < n_timers; timer_i++)
+		{
+			uint32_t const hit_count = hit_count_r.next_uint32();
+			if (hit_count == 0)
+				return invalid(request_validate_result::bad_timer_hit_count);
+
+			float const value = value_r.next_float();
+			if (!float_is_valid(value))
+				return invalid(request_validate_result::bad_float_timer_value);
+			if (std::signbit(value))
+				return invalid(request_validate_result::negative_float_timer_value);
+
+			packed_timer_t *t = &p->timers[timer_i];
+
+			if (timer_i < n_ru_utime)
+			{
+				float const ru_utime = ru_utime_r.next_float();
+				if (!float_is_valid(ru_utime))
+					return invalid(request_validate_result::bad_float_timer_ru_utime);
+				if (std::signbit(ru_utime))
+					t->ru_utime = duration_t{0};
+			}
+			else
+			{
+				t->ru_utime = duration_t{0};
+			}
+
+			if (timer_i < n_ru_stime)
+			{
+				float const ru_stime = ru_stime_r.next_float();
+				if (!float_is_valid(ru_stime))
+					return invalid(request_validate_result::bad_float_timer_ru_stime);
+				if (std::signbit(ru_stime))
+					t->ru_stime = duration_t{0};
+			}
+			else
+			{
+				t->ru_stime = duration_t{0};
+			}
+
+			uint32_t const src_tag_count = tag_count_r.next_uint32();
+			if (src_tag_count > n_src_tags - src_tag_offset)
+				return invalid(request_validate_result::not_enough_tag_names);
+
+			t->tag_count     = 0; // incremented when scanning tags (as we can skip)
+			t->hit_count     = hit_count;
+			t->tag_name_ids  = timer_tag_name_ids + dst_tag_offset;
+			t->tag_value_ids = timer_tag_value_ids + dst_tag_offset;
+
+			for (uint32_t tag_i = 0; tag_i < src_tag_count; tag_i++)
+			{
+				uint32_t const tag_name_off  = tag_name_r.next_uint32();
+				uint32_t const tag_value_off = tag_value_r.next_uint32();
+
+				if (tag_name_off >= n_dictionary || tag_value_off >= n_dictionary)
+					return invalid(request_validate_result::bad_dictionary_offset);
+
+				// find name, it must be present
+				// if not present - just skip the tag completely, and don't check or add the value
+				dict_entry_t& name = name_by_offset(tag_name_off);
+				if (name.name_status != dict_entry_t::ok)
+					continue;
+
+				t->tag_name_ids[t->tag_count]  = name.name_id;
+				t->tag_value_ids[t->tag_count] = value_id_by_offset(tag_value_off);
+				t->tag_count++;
+
+				// timer bloom always, packet bloom - once per name
+				p->timers_blooms[timer_i].add_hashed(name.bloom_hashed);
+
+				if (0 == name.bloom_added)
+				{
+					name.bloom_added = 1;
+					p->bloom.add_hashed(name.bloom_hashed);
+				}
+			}
+
+			src_tag_offset += src_tag_count;
+			dst_tag_offset += t->tag_count;
+		}
+
+		// all tags must belong to some timer
+		if (src_tag_offset != n_src_tags)
+			return invalid(request_validate_result::not_enough_tag_names);
+	}
+
+	// request tags
+	if (r.tag_name.count > 0)
+	{
+		p->tag_count     = 0; // incremented below (as we can skip tags)
+		p->tag_name_ids  = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r.tag_name.count);
+		p->tag_value_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r.tag_name.count);
+
+		repeated_reader_t tag_name_r  { r.tag_name };
+		repeated_reader_t tag_value_r { r.tag_value };
+
+		for (uint32_t tag_i = 0; tag_i < r.tag_name.count; tag_i++)
+		{
+			uint32_t const tag_name_off  = tag_name_r.next_uint32();
+			uint32_t const tag_value_off = tag_value_r.next_uint32();
+
+			if (tag_name_off >= n_dictionary || tag_value_off >= n_dictionary)
+				return invalid(request_validate_result::bad_dictionary_offset);
+
+			dict_entry_t const& name = name_by_offset(tag_name_off);
+			if (name.name_status != dict_entry_t::ok)
+				continue;
+
+			p->tag_name_ids[p->tag_count]  = name.name_id;
+			p->tag_value_ids[p->tag_count] = value_id_by_offset(tag_value_off);
+			p->tag_count++;
+		}
+	}
+
+	return packet_decode_result_t { p, request_validate_result::okay };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_DECODER_H_
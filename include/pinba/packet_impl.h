@@ -1,11 +1,13 @@
 #ifndef PINBA__PACKET_IMPL_H_
 #define PINBA__PACKET_IMPL_H_
 
+#include <algorithm>
 #include <vector>
 #include <string>
 
 #include "pinba/globals.h"
 #include "pinba/packet.h"
+#include "pinba/packet_simd.h"
 #include "pinba/bloom.h"
 #include "pinba/hash.h"
 #include "pinba/dictionary.h"
@@ -82,9 +84,9 @@ inline void for_each_timer(Pinba__Request const *r, Function const& cb)
 			.id            = static_cast<uint16_t>(i),
 			.tag_count     = static_cast<uint16_t>(tag_count),
 			.hit_count     = r->timer_hit_count[i],
-			.value         = duration_from_float(r->timer_value[i]),
-			.ru_utime      = (i < r->n_timer_ru_utime) ? duration_from_float(r->timer_ru_utime[i]) : duration_t{0},
-			.ru_stime      = (i < r->n_timer_ru_stime) ? duration_from_float(r->timer_ru_stime[i]) : duration_t{0},
+			.value         = pinba_duration_from_float(r->timer_value[i]),
+			.ru_utime      = (i < r->n_timer_ru_utime) ? pinba_duration_from_float(r->timer_ru_utime[i]) : duration_t{0},
+			.ru_stime      = (i < r->n_timer_ru_stime) ? pinba_duration_from_float(r->timer_ru_stime[i]) : duration_t{0},
 			.tag_name_ids  = meow::ref_array(&r->timer_tag_name[current_tag_offset], tag_count),
 			.tag_value_ids = meow::ref_array(&r->timer_tag_value[current_tag_offset], tag_count),
 		};
@@ -96,8 +98,30 @@ inline void for_each_timer(Pinba__Request const *r, Function const& cb)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// hashes of all r->dictionary words, in one go (see hash_dictionary_words())
+// hashes must have room for r->n_dictionary elements
+inline void pinba_request_hash_dictionary(Pinba__Request const *r, uint64_t *hashes)
+{
+	// dictionary size comes from the network, so words are collected in fixed size chunks, not on stack all at once
+	constexpr size_t const chunk_size = 32;
+	str_ref words[chunk_size];
+
+	for (size_t offset = 0; offset < r->n_dictionary; offset += chunk_size)
+	{
+		size_t const n = std::min(chunk_size, r->n_dictionary - offset);
+
+		for (size_t i = 0; i < n; i++)
+			words[i] = pb_string_as_str_ref(r->dictionary[offset + i]);
+
+		hash_dictionary_words(words, n, hashes + offset);
+	}
+}
+
+// dictionary_hashes - precalculated with pinba_request_hash_dictionary(), for r->dictionary, required
+//  (nested requests share outer request dictionary, so that's where it comes from)
+// every string is hashed once, and hashes are passed down to all dictionaries
 template<class D>
-inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dictionary_t *nw_d, D *d, struct nmpa_s *nmpa)
+inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dictionary_t const *nw_d, D *d, struct nmpa_s *nmpa, uint64_t const *dictionary_hashes)
 {
 	auto *p = (packet_t*)nmpa_calloc(nmpa, sizeof(packet_t)); // NOTE: no ctor is called here!
 
@@ -125,7 +149,7 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 		{
 			// uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]));
 			// dictionary_t::nameword_t const nw = d->get_nameword(pb_string_as_str_ref(r->dictionary[dict_offset]));
-			nameword_dictionary_t::nameword_t const *nw = nw_d->get(pb_string_as_str_ref(r->dictionary[dict_offset]));
+			nameword_dictionary_t::nameword_t const *nw = nw_d->get(pb_string_as_str_ref(r->dictionary[dict_offset]), dictionary_hashes[dict_offset]);
 
 			nid.status += (nw != nullptr) + 1;
 			if (nid.status == name_id_t::ok)
@@ -159,7 +183,7 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 
 		if (vid.status == value_id_t::not_checked)
 		{
-			uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]));
+			uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]), dictionary_hashes[dict_offset]);
 			vid.status  = value_id_t::ok;
 			vid.word_id = word_id;
 		}
@@ -169,16 +193,28 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 		return vid;
 	};
 
-	p->host_id      = d->get_or_add(pb_string_as_str_ref(r->hostname));
-	p->server_id    = d->get_or_add(pb_string_as_str_ref(r->server_name));
-	p->script_id    = d->get_or_add(pb_string_as_str_ref(r->script_name));
-	p->schema_id    = d->get_or_add(pb_string_as_str_ref(r->schema));
-	p->status       = d->get_or_add(pinba_request_status_to_str_ref_tmp(r->status)); // TODO: can avoid get_or_add for small values (cache in perm dict)
+	{
+		str_ref const fields[] = {
+			pb_string_as_str_ref(r->hostname),
+			pb_string_as_str_ref(r->server_name),
+			pb_string_as_str_ref(r->script_name),
+			pb_string_as_str_ref(r->schema),
+			pinba_request_status_to_str_ref_tmp(r->status),
+		};
+		uint64_t field_hashes[sizeof(fields) / sizeof(fields[0])];
+		hash_dictionary_words(fields, sizeof(fields) / sizeof(fields[0]), field_hashes);
+
+		p->host_id      = d->get_or_add(fields[0], field_hashes[0]);
+		p->server_id    = d->get_or_add(fields[1], field_hashes[1]);
+		p->script_id    = d->get_or_add(fields[2], field_hashes[2]);
+		p->schema_id    = d->get_or_add(fields[3], field_hashes[3]);
+		p->status       = d->get_or_add(fields[4], field_hashes[4]); // TODO: can avoid get_or_add for small values (cache in perm dict)
+	}
 	p->traffic      = r->document_size;
 	p->mem_used     = r->memory_footprint;
-	p->request_time = duration_from_float(r->request_time);
-	p->ru_utime     = duration_from_float(r->ru_utime);
-	p->ru_stime     = duration_from_float(r->ru_stime);
+	p->request_time = pinba_duration_from_float(r->request_time);
+	p->ru_utime     = pinba_duration_from_float(r->ru_utime);
+	p->ru_stime     = pinba_duration_from_float(r->ru_stime);
 
 	// timers
 	p->timer_count = r->n_timer_value;
@@ -191,6 +227,17 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 		uint32_t *timer_tag_name_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_timer_tag_name);
 		uint32_t *timer_tag_value_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_timer_tag_value);
 
+		// float -> duration for all timers at once, written straight into timer structs (hence the stride)
+		// timers without ru data get zeroes in the loop below
+		size_t const n_ru_utime = std::min(r->n_timer_value, r->n_timer_ru_utime);
+		size_t const n_ru_stime = std::min(r->n_timer_value, r->n_timer_ru_stime);
+		{
+			pinba_simd_kernels_t const *simd = pinba_simd();
+			simd->floats_to_durations(r->timer_value, r->n_timer_value, &p->timers[0].value, sizeof(packed_timer_t));
+			simd->floats_to_durations(r->timer_ru_utime, n_ru_utime, &p->timers[0].ru_utime, sizeof(packed_timer_t));
+			simd->floats_to_durations(r->timer_ru_stime, n_ru_stime, &p->timers[0].ru_stime, sizeof(packed_timer_t));
+		}
+
 		unsigned src_tag_offset = 0;
 		unsigned dst_tag_offset = 0;
 
@@ -199,9 +246,11 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 			packed_timer_t *t = &p->timers[timer_i];
 			t->tag_count     = 0; // see it's incremented when scanning tags (as we can skip)
 			t->hit_count     = r->timer_hit_count[timer_i];
-			t->value         = duration_from_float(r->timer_value[timer_i]);
-			t->ru_utime      = (timer_i < r->n_timer_ru_utime) ? duration_from_float(r->timer_ru_utime[timer_i]) : duration_t{0};
-			t->ru_stime      = (timer_i < r->n_timer_ru_stime) ? duration_from_float(r->timer_ru_stime[timer_i]) : duration_t{0};
+
+			if (timer_i >= n_ru_utime)
+				t->ru_utime = duration_t{0};
+			if (timer_i >= n_ru_stime)
+				t->ru_stime = duration_t{0};
 
 			t->tag_name_ids  = timer_tag_name_ids + dst_tag_offset;
 			t->tag_value_ids = timer_tag_value_ids + dst_tag_offset;
@@ -0,0 +1,47 @@
+#ifndef PINBA__PACKET_SIMD_H_
+#define PINBA__PACKET_SIMD_H_
+
+#include <cmath>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vectorized kernels for bulk packet field decoding
+// implementation is picked once at startup by cpuid: avx2 -> sse4 -> scalar
+
+// float seconds -> duration, truncated towards zero and clamped to +-(2^51 - 1) nsec (~26 days)
+// the clamp keeps conversion exact for simd kernels (that go via double -> int64 magic number trick)
+// NaN converts to the upper clamp value, but these are rejected by validation anyway
+// every float -> duration conversion on the packet path goes through this or the bulk kernel below,
+// so results don't depend on decoder or kernel being used
+static constexpr double pinba_float_duration_limit_nsec = 2251799813685247.0; // 2^51 - 1
+
+inline duration_t pinba_duration_from_float(float f)
+{
+	double d = double(f) * double(nsec_in_sec);
+	d = (d < pinba_float_duration_limit_nsec) ? d : pinba_float_duration_limit_nsec;   // same operand order as minpd
+	d = (d > -pinba_float_duration_limit_nsec) ? d : -pinba_float_duration_limit_nsec; // same operand order as maxpd
+	return duration_t { (int64_t)std::trunc(d) };
+}
+
+struct pinba_simd_kernels_t
+{
+	char const *name;
+
+	// decode up to max_n varints from [*p, end) into dst, advance *p past them
+	// returns the number of values decoded, less than max_n only when input is exhausted
+	// input must be validated already: every varint is complete and is at most 5 bytes long (truncated to 32 bits)
+	size_t (*decode_varint32)(uint8_t const **p, uint8_t const *end, uint32_t *dst, size_t max_n);
+
+	// convert n floats (little endian, possibly unaligned) at src to durations,
+	// written dst_stride bytes apart (to fill a field in an array of structs)
+	// results are bit-exact with pinba_duration_from_float()
+	void (*floats_to_durations)(void const *src, size_t n, duration_t *dst, size_t dst_stride);
+};
+
+// kernels for the cpu we're running on, selected on first call
+pinba_simd_kernels_t const* pinba_simd();
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_SIMD_H_
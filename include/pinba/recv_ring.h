@@ -0,0 +1,197 @@
+#ifndef PINBA__RECV_RING_H_
+#define PINBA__RECV_RING_H_
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// network receive buffers memory, anonymous mapping, optionally backed by huge pages
+// explicit ones (MAP_HUGETLB, need vm.nr_hugepages reserved) are tried first, then transparent ones
+struct recv_memory_t : private boost::noncopyable
+{
+	static constexpr size_t const huge_page_size = 2 * 1024 * 1024;
+
+	char    *data;
+	size_t  size;
+	char const *backing; // for logging
+
+	recv_memory_t(size_t sz, bool hugepages)
+		: data(NULL)
+		, size(sz)
+		, backing("4k pages")
+	{
+		if (hugepages)
+		{
+			size_t const huge_sz = (sz + huge_page_size - 1) & ~(huge_page_size - 1);
+
+			void *p = mmap(NULL, huge_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED)
+			{
+				data    = (char*)p;
+				size    = huge_sz;
+				backing = "hugetlb";
+				return;
+			}
+		}
+
+		void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::runtime_error(ff::fmt_str("mmap({0}) failed: {1}:{2}", sz, errno, strerror(errno)));
+
+		data = (char*)p;
+
+		if (hugepages && (0 == madvise(p, sz, MADV_HUGEPAGE)))
+			backing = "transparent huge pages";
+	}
+
+	~recv_memory_t()
+	{
+		if (data)
+			munmap(data, size);
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// recvmmsg receive ring, see collector_conf_t::recv_slot_size
+//
+// datagrams are received into compact slots of typical size (memory provided by caller, i.e. recv_memory_t, touched in advance)
+// every message gets 2 iovecs: [own slot] + [own overflow tail], so that oversized datagram is split between the two
+// and is glued together in its overflow area for processing, no datagram is ever lost, however many are big
+//
+// overflow areas are 64k per message, but that's address space only (MAP_NORESERVE, never touched in advance)
+// pages get backed by memory only when big datagrams are written there, i.e. typical traffic stays in compact slots
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct recv_ring_t : private boost::noncopyable
+{
+	static constexpr size_t const max_message_size = 64 * 1024; // max udp message size
+
+	// 0 (or too large) = every message gets a full size slot, no overflow needed
+	static size_t effective_slot_size(size_t slot_size)
+	{
+		if (slot_size == 0)
+			return max_message_size;
+
+		return std::min((slot_size + 63) & ~size_t(63), size_t(max_message_size)); // keep slots cacheline aligned
+	}
+
+	// memory caller must provide, slots and control buffers
+	static size_t memory_size(size_t n_messages, size_t slot_size, size_t control_size)
+	{
+		return n_messages * (effective_slot_size(slot_size) + control_size);
+	}
+
+	// memory - memory_size() bytes, must outlive the ring
+	// names - sender addresses for every message, or NULL if not needed
+	recv_ring_t(size_t n_messages, size_t slot_size, size_t control_size, char *memory, struct sockaddr_storage *names)
+		: n_messages_(n_messages)
+		, slot_size_(effective_slot_size(slot_size))
+		, control_size_(control_size)
+		, slots_(memory)
+		, overflow_(NULL)
+		, overflow_size_(0)
+		, hdr_(new struct mmsghdr[n_messages])
+		, iov_(new struct iovec[n_messages * 2])
+	{
+		if (slot_size_ < max_message_size)
+		{
+			overflow_size_ = n_messages_ * max_message_size;
+
+			void *p = mmap(NULL, overflow_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::runtime_error(ff::fmt_str("mmap({0}) failed: {1}:{2}", overflow_size_, errno, strerror(errno)));
+
+			overflow_ = (char*)p;
+		}
+
+		char *control = slots_ + n_messages_ * slot_size_;
+
+		memset(hdr_.get(), 0, n_messages_ * sizeof(hdr_[0]));
+		memset(iov_.get(), 0, n_messages_ * 2 * sizeof(iov_[0]));
+
+		for (size_t i = 0; i < n_messages_; i++)
+		{
+			struct iovec *msg_iov = &iov_[i * 2];
+
+			msg_iov[0].iov_base = slots_ + i * slot_size_;
+			msg_iov[0].iov_len  = slot_size_;
+
+			if (overflow_ != NULL)
+			{
+				msg_iov[1].iov_base = overflow_ + i * max_message_size + slot_size_;
+				msg_iov[1].iov_len  = max_message_size - slot_size_;
+			}
+
+			struct msghdr& mh = hdr_[i].msg_hdr;
+			mh.msg_iov        = msg_iov;
+			mh.msg_iovlen     = (overflow_ != NULL) ? 2 : 1;
+			mh.msg_control    = control + i * control_size_;
+			mh.msg_controllen = control_size_;
+
+			if (names != NULL)
+			{
+				mh.msg_name    = &names[i];
+				mh.msg_namelen = sizeof(names[i]);
+			}
+		}
+	}
+
+	~recv_ring_t()
+	{
+		if (overflow_ != NULL)
+			munmap(overflow_, overflow_size_);
+	}
+
+	struct mmsghdr* headers()       { return hdr_.get(); }
+	size_t n_messages() const       { return n_messages_; }
+	size_t slot_size() const        { return slot_size_; }
+	size_t overflow_size() const    { return overflow_size_; } // address space, see above
+
+	// bytes of i-th received message, contiguous
+	// caller checks MSG_TRUNC, data is cut short then (can only happen with full size slots and > 64k GRO buffers)
+	str_ref message_bytes(size_t i)
+	{
+		size_t const len = hdr_[i].msg_len;
+
+		if (len <= slot_size_)
+			return str_ref { slots_ + i * slot_size_, len };
+
+		// glue the head in, overflow area has room for it right before the tail
+		char *overflow = overflow_ + i * max_message_size;
+		memcpy(overflow, slots_ + i * slot_size_, slot_size_);
+		return str_ref { overflow, len };
+	}
+
+	// kernel shrinks controllen and namelen to what it has written, restore for the next call
+	void reset_message(size_t i)
+	{
+		hdr_[i].msg_hdr.msg_controllen = control_size_;
+		if (hdr_[i].msg_hdr.msg_name != NULL)
+			hdr_[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+	}
+
+private:
+	size_t                             n_messages_;
+	size_t                             slot_size_;
+	size_t                             control_size_;
+	char                               *slots_;
+	char                               *overflow_;
+	size_t                             overflow_size_;
+	std::unique_ptr<struct mmsghdr[]>  hdr_;
+	std::unique_ptr<struct iovec[]>    iov_;
+};
+
+#endif // PINBA__RECV_RING_H_
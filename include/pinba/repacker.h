@@ -4,7 +4,11 @@
 #include <string>
 
 #include "pinba/globals.h"
-#include "pinba/nmsg_socket.h" // nmsg_message_ex_t
+#include "pinba/cpu_affinity.h"
+#include "pinba/nmsg_pool.h"   // nmsg_pooled_message_t
+#include "pinba/collector.h"   // raw_request_ptr
+
+#include "proto/pinba.pb-c.h"   // Pinba__Request
 
 #include "misc/nmpa.h"
 
@@ -12,17 +16,20 @@
 
 struct packet_t;
 
-struct packet_batch_t : public nmsg_message_ex_t<packet_batch_t>
+// recycled by repacker threads, see pinba/nmsg_pool.h
+struct packet_batch_t : public nmsg_pooled_message_t<packet_batch_t>
 {
 	struct nmpa_s       nmpa;
 	uint32_t            packet_count;
 	packet_t            **packets;
+	size_t              max_packets;
 
 	repacker_state_ptr  repacker_state; // can be empty
 
 
 	packet_batch_t(size_t max_packets, size_t nmpa_block_sz)
 		: packet_count{0}
+		, max_packets{max_packets}
 	{
 		PINBA_STATS_(objects).n_packet_batches++;
 
@@ -30,6 +37,22 @@ struct packet_batch_t : public nmsg_message_ex_t<packet_batch_t>
 		packets = (packet_t**)nmpa_alloc(&nmpa, sizeof(packets[0]) * max_packets);
 	}
 
+	// back from the pool, on the repacker thread that has allocated all the memory
+	void pool_reuse()
+	{
+		PINBA_STATS_(objects).n_packet_batches_reused++;
+
+		nmpa_empty(&nmpa);
+		packet_count = 0;
+		packets = (packet_t**)nmpa_alloc(&nmpa, sizeof(packets[0]) * max_packets);
+	}
+
+	// dictionary wordslice is referenced from here, let it go as soon as reports are done with the batch
+	void pool_return()
+	{
+		repacker_state.reset();
+	}
+
 	~packet_batch_t()
 	{
 		nmpa_free(&nmpa);
@@ -43,23 +66,66 @@ typedef boost::intrusive_ptr<packet_batch_t> packet_batch_ptr;
 
 struct repacker_conf_t
 {
-	std::string  nn_input;         // read raw_request_t from this nanomsg pipe
+	std::string  nn_input;         // every thread reads raw_request_t from its own pipe, named "{nn_input}/{thread_id}", see dispatch()
 	std::string  nn_output;        // send batched repacked packets to this nanomsg pipe
 	std::string  nn_shutdown;      // bind on this socket, receive shutdown signal here (user should call shutdown())
 
-	size_t       nn_input_buffer;  // NN_RCVBUF for nn_input connection
+	size_t       nn_input_buffer;  // NN_RCVBUF for every nn_input pipe
 
 	uint32_t     n_threads;        // threads to start
 
 	uint32_t     batch_size;       // max packets in batch
 	duration_t   batch_timeout;    // max delay between batches
+
+	thread_affinity_t affinity;    // cpus + priority for worker threads
+
+	// run-to-completion ingest, no repacker threads are started, nn_input is not used (and dispatch() must not be called)
+	// collector reader threads repack datagrams themselves (see create_worker()) and send batches straight to nn_output
+	// saves a queue hop (and cross-cpu cache misses on whole batches) and one batching delay
+	bool         fused;
 };
 
+// repacking state of a single thread, turns requests into packets and sends them to repacker output in batches
+// not thread safe, every thread needs its own
+struct repacker_worker_t : private boost::noncopyable
+{
+	virtual ~repacker_worker_t() {}
+
+	// request protobuf bytes (datagram without header, decompressed)
+	// data is not referenced after the call, returns true if current batch has been sent as a result (i.e. it became full)
+	virtual bool process_request_data(str_ref data) = 0;
+
+	// unpacked request, along with nested ones (request is modified, by validation)
+	virtual bool process_request(Pinba__Request *request) = 0;
+
+	virtual bool has_pending_batch() const = 0;
+	virtual void flush() = 0;  // send current batch, if not empty
+
+	// dictionary maintenance, must be called every tick_interval()
+	// 250ms is hand-tuned with a synthetic test at ~400k random 32byte strings/sec
+	// might be made tunable, but no need for now
+	static duration_t tick_interval() { return 250 * d_millisecond; }
+	virtual void tick(timeval_t now) = 0;
+};
+using repacker_worker_ptr = std::unique_ptr<repacker_worker_t>;
+
 struct repacker_t : private boost::noncopyable
 {
 	virtual ~repacker_t() {}
 	virtual void startup() = 0;
 	virtual void shutdown() = 0;
+
+	virtual bool is_fused() const = 0;
+
+	// hand raw_request_t batch over to repacker threads, can be called from any thread, after startup(), never blocks
+	// load-aware: batch goes to the shorter queue of two threads picked round-robin,
+	// and threads that have run out of work steal batches from the longest queue (see repacker_queue.h)
+	// returns false when all queues are full, batch is dropped then
+	virtual bool dispatch(raw_request_ptr const& req) = 0;
+
+	// fused mode (repacker_conf_t::fused), repacking happens on the caller's thread, results go to nn_output
+	// can be called from any thread, after startup(), workers must be destroyed before repacker
+	virtual repacker_worker_ptr create_worker() = 0;
 };
 using repacker_ptr = std::unique_ptr<repacker_t>;
 
@@ -116,7 +116,15 @@ public:
 		if (!word)
 			return 0;
 
-		uint64_t const word_hash = dictionary_word_hasher_t()(word);
+		return this->get_or_add(word, dictionary_word_hasher_t()(word));
+	}
+
+	// same as above, with precalculated word_hash (see hash_dictionary_words())
+	// the hash is passed down to global dictionary as well, on cache miss
+	uint32_t get_or_add(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return 0;
 
 		// NOTE(antoxa): a hack, to avoid extra hash lookup *on slowpath*
 		//  (and use emplace with precomputed hash, that operator[] does not support)
@@ -0,0 +1,119 @@
+#ifndef PINBA__REPACKER_QUEUE_H_
+#define PINBA__REPACKER_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// batch placement and work stealing over repacker threads input queues (see repacker_impl_t)
+// generic over the queue, repacker uses nanomsg push/pull socket pairs, tests use in-memory ones
+//
+// Queue must have:
+//   using batch_t = ...;
+//   std::atomic<uint32_t> depth;         // batches sent and not yet received, maintained by functions below
+//   bool try_send(batch_t const&);       // non-blocking, false = queue is full
+//   bool try_recv(batch_t*);             // non-blocking, false = queue is empty, any thread can call it
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<class Queue>
+inline bool repacker_queue___send(Queue& q, typename Queue::batch_t const& batch)
+{
+	// count before sending, receiver might get the batch before send returns
+	++q.depth;
+
+	if (q.try_send(batch))
+		return true;
+
+	--q.depth; // queue is full
+	return false;
+}
+
+template<class Queue>
+inline bool repacker_queue___recv(Queue& q, typename Queue::batch_t *batch)
+{
+	if (!q.try_recv(batch))
+		return false;
+
+	--q.depth;
+	return true;
+}
+
+// two choices: next one round-robin (rr is a dispatch counter), and some other one (offset cycles through all the others over time)
+// the one with less batches queued is tried first
+// round-robin alone is what nanomsg PUSH does, and is blind to a thread being stuck (on dictionary write lock, etc.)
+//
+// when both are full - all the others are tried, batch is dropped (false returned) only when all queues are full
+template<class Queue>
+inline bool repacker_queues___dispatch(Queue *queues, uint32_t n_queues, uint32_t rr, typename Queue::batch_t const& batch)
+{
+	uint32_t first  = rr % n_queues;
+	uint32_t second = (n_queues > 1) ? (first + 1 + (rr / n_queues) % (n_queues - 1)) % n_queues : first;
+
+	if (queues[second].depth.load(std::memory_order_relaxed) < queues[first].depth.load(std::memory_order_relaxed))
+		std::swap(first, second);
+
+	if (repacker_queue___send(queues[first], batch))
+		return true;
+
+	if (first == second)
+		return false;
+
+	if (repacker_queue___send(queues[second], batch))
+		return true;
+
+	for (uint32_t i = 1; i < n_queues; i++)
+	{
+		uint32_t const q = (first + i) % n_queues;
+		if (q == second)
+			continue;
+
+		if (repacker_queue___send(queues[q], batch))
+			return true;
+	}
+
+	return false;
+}
+
+// take some batches from the longest queue of other threads, if it has at least min_depth batches
+// half of the backlog at most (owner might be about to get to it as well), and no more than max_to_steal
+// func is called for every batch taken, returns the number of batches stolen
+template<class Queue, class Function>
+inline uint32_t repacker_queues___steal(Queue *queues, uint32_t n_queues, uint32_t thread_id, uint32_t min_depth, uint32_t max_to_steal, Function const& func)
+{
+	uint32_t victim_id    = thread_id;
+	uint32_t victim_depth = 0;
+
+	for (uint32_t i = 0; i < n_queues; i++)
+	{
+		if (i == thread_id)
+			continue;
+
+		uint32_t const depth = queues[i].depth.load(std::memory_order_relaxed);
+		if (depth > victim_depth)
+		{
+			victim_id    = i;
+			victim_depth = depth;
+		}
+	}
+
+	if (victim_depth == 0 || victim_depth < min_depth)
+		return 0;
+
+	Queue& q = queues[victim_id];
+	uint32_t const n_to_steal = std::min(victim_depth / 2, max_to_steal);
+
+	uint32_t n_stolen = 0;
+	for (; n_stolen < n_to_steal; ++n_stolen)
+	{
+		typename Queue::batch_t batch;
+		if (!repacker_queue___recv(q, &batch)) // owner got there first
+			break;
+
+		func(batch);
+	}
+
+	return n_stolen;
+}
+
+#endif // PINBA__REPACKER_QUEUE_H_
@@ -137,6 +137,125 @@ struct nmpa_autofree_t : public nmpa_s
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// finds a fixed set of tags (by name) among packet or timer tags, with a single pass over tags
+// instead of a scan over all tags for every name we're looking for
+// tag name ids are dense and small (see nameword_dictionary_t), so name -> slot is a direct lookup table
+// slot = distinct name, first tag with that name gives the value (same as a scan would find)
+// not thread safe, find() uses internal scratch state
+// GenerationT is a parameter for tests only, small one wraps around quickly
+template<class GenerationT = uint32_t>
+struct tag_name_slots_impl_t
+{
+	static constexpr uint32_t const no_slot = std::numeric_limits<uint32_t>::max();
+
+	struct find_result_t
+	{
+		uint32_t n_found;           // distinct slots found
+		uint32_t n_found_required;  // of these - slots with required value
+		bool     value_mismatch;    // some tag in a slot with required value has a different one
+	};
+
+	// returns slot for the name, existing one if the name has been added already
+	uint32_t add(uint32_t name_id)
+	{
+		if (name_id >= slot_by_name_id_.size())
+			slot_by_name_id_.resize(name_id + 1, uint32_t(no_slot));
+
+		uint32_t& slot = slot_by_name_id_[name_id];
+		if (slot == no_slot)
+		{
+			slot = slots_.size();
+			slots_.emplace_back();
+		}
+
+		return slot;
+	}
+
+	// all tags with this slot name must have this value (and at least one must be present)
+	void require_value(uint32_t slot, uint32_t value_id)
+	{
+		slot_t& s = slots_[slot];
+
+		// same name, different values -> can never match
+		if (s.has_required_value && s.required_value != value_id)
+			unsatisfiable_ = true;
+
+		if (!s.has_required_value)
+			n_required_++;
+
+		s.has_required_value = true;
+		s.required_value     = value_id;
+	}
+
+	uint32_t size() const         { return slots_.size(); }
+	uint32_t n_required() const   { return n_required_; }
+
+	// value of the slot, as found by last find() call, only valid when the slot has been found
+	uint32_t value(uint32_t slot) const { return slots_[slot].value; }
+
+	find_result_t find(uint32_t const *name_ids, uint32_t const *value_ids, uint32_t n_tags)
+	{
+		find_result_t result = { 0, 0, unsatisfiable_ };
+
+		// new generation, instead of clearing all 'seen' marks
+		if (++generation_ == 0)
+		{
+			for (auto& s : slots_)
+				s.seen_generation = 0;
+			generation_ = 1;
+		}
+
+		uint32_t const table_size = slot_by_name_id_.size();
+
+		for (uint32_t i = 0; i < n_tags; i++)
+		{
+			uint32_t const name_id = name_ids[i];
+			if (name_id >= table_size)
+				continue;
+
+			uint32_t const slot = slot_by_name_id_[name_id];
+			if (slot == no_slot)
+				continue;
+
+			slot_t& s = slots_[slot];
+
+			if (s.has_required_value && s.required_value != value_ids[i])
+				result.value_mismatch = true;
+
+			if (s.seen_generation == generation_)
+				continue;
+
+			s.seen_generation = generation_;
+			s.value           = value_ids[i];
+
+			result.n_found          += 1;
+			result.n_found_required += s.has_required_value;
+		}
+
+		return result;
+	}
+
+private:
+
+	struct slot_t
+	{
+		uint32_t    value              = 0;
+		GenerationT seen_generation    = 0;
+		uint32_t    required_value     = 0;
+		bool        has_required_value = false;
+	};
+
+	std::vector<uint32_t>  slot_by_name_id_;
+	std::vector<slot_t>    slots_;
+	uint32_t               n_required_    = 0;
+	GenerationT            generation_    = 0;
+	bool                   unsatisfiable_ = false;
+};
+
+using tag_name_slots_t = tag_name_slots_impl_t<>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 /*
 struct report_snapshot_traits___example
 {
@@ -0,0 +1,235 @@
+#ifndef PINBA__SOURCE_ADMISSION_H_
+#define PINBA__SOURCE_ADMISSION_H_
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>  // inet_ntop
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/std_unique_ptr.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/collector.h"
+#include "pinba/recv_ring.h"  // recv_memory_t
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// xorshift64*, cheap per-thread randomness for sampling decisions
+inline uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// per-source admission, see collector_conf_t::admission_*
+//
+// token bucket in GCRA form: every source has 'theoretical arrival time' (tat), that moves emission interval (1/rate) forward
+// with every admitted packet, and the source is over the limit when tat is more than burst intervals ahead of now
+// (so it's a single integer per source, and there is no need to refill anything periodically)
+//
+// table is an array of 2-way groups, source address hashes to a group and takes the matching or least recently seen entry there
+// every group has its own spinlock, held for a few dozen instructions, so readers contend only when they get packets
+// from sources in the same group at the same time
+struct source_admission_t : private boost::noncopyable
+{
+	enum class verdict_t { pass, sample, drop };
+
+	struct entry_t
+	{
+		uint64_t key[2];     // ipv6 address, ipv4 ones are v4-mapped, all zeroes = free entry
+		uint64_t tat;        // nsec, monotonic
+		uint64_t last_seen;  // nsec, monotonic
+		uint64_t n_passed;
+		uint64_t n_sampled;
+		uint64_t n_dropped;
+	};
+
+	struct alignas(64) group_t
+	{
+		std::atomic<bool> locked;
+		entry_t           e[2];
+	};
+
+	source_admission_t(collector_conf_t const *conf)
+		: n_groups_(1)
+		, emission_ns_(std::max<uint64_t>(nsec_in_sec / conf->admission_rate, 1))
+		, limit_ns_(emission_ns_ * ((conf->admission_burst > 0) ? conf->admission_burst : conf->admission_rate))
+		, sample_n_(conf->admission_sample_n)
+	{
+		while (n_groups_ * 2 < conf->admission_slots && n_groups_ < (1u << 24))
+			n_groups_ <<= 1;
+
+		// page aligned and zeroed, i.e. all entries are free and all locks are unlocked
+		memory_ = meow::make_unique<recv_memory_t>(n_groups_ * sizeof(group_t), false);
+		groups_ = new (memory_->data) group_t[n_groups_];
+	}
+
+	// now = monotonic nsec, rng = caller thread's random state
+	verdict_t admit(struct sockaddr const *sa, uint64_t now, uint64_t *rng)
+	{
+		uint64_t key[2];
+		if (!key_from_sockaddr(sa, key))
+			return verdict_t::pass;
+
+		group_t& g = groups_[hash_key(key) & (n_groups_ - 1)];
+
+		while (g.locked.exchange(true, std::memory_order_acquire))
+		{
+			while (g.locked.load(std::memory_order_relaxed))
+				__builtin_ia32_pause();
+		}
+
+		entry_t *e = &g.e[0];
+		if (!key_equal(g.e[0].key, key))
+		{
+			if (key_equal(g.e[1].key, key))
+			{
+				e = &g.e[1];
+			}
+			else
+			{
+				// free entries have last_seen = 0, so are taken first
+				e = (g.e[0].last_seen <= g.e[1].last_seen) ? &g.e[0] : &g.e[1];
+				*e = entry_t { .key = { key[0], key[1] }, .tat = now, .last_seen = now, .n_passed = 0, .n_sampled = 0, .n_dropped = 0 };
+			}
+		}
+
+		e->last_seen = now;
+
+		verdict_t result;
+
+		uint64_t const tat = std::max(e->tat, now);
+		if (tat + emission_ns_ - now <= limit_ns_)
+		{
+			e->tat = tat + emission_ns_;
+			e->n_passed++;
+			result = verdict_t::pass;
+		}
+		else if (sample_n_ > 0 && (next_random(rng) % sample_n_) == 0)
+		{
+			e->n_sampled++;
+			result = verdict_t::sample;
+		}
+		else
+		{
+			e->n_dropped++;
+			result = verdict_t::drop;
+		}
+
+		g.locked.store(false, std::memory_order_release);
+		return result;
+	}
+
+	std::vector<collector_source_stats_t> get_stats(uint64_t now)
+	{
+		std::vector<entry_t> entries;
+
+		for (uint32_t i = 0; i < n_groups_; i++)
+		{
+			group_t& g = groups_[i];
+
+			while (g.locked.exchange(true, std::memory_order_acquire))
+				__builtin_ia32_pause();
+
+			for (auto const& e : g.e)
+			{
+				if (e.key[0] != 0 || e.key[1] != 0)
+					entries.push_back(e);
+			}
+
+			g.locked.store(false, std::memory_order_release);
+		}
+
+		std::vector<collector_source_stats_t> result;
+		result.reserve(entries.size());
+
+		for (auto const& e : entries)
+		{
+			result.push_back(collector_source_stats_t {
+				.address         = key_to_string(e.key),
+				.packets_passed  = e.n_passed,
+				.packets_sampled = e.n_sampled,
+				.packets_dropped = e.n_dropped,
+				.idle_time       = duration_t { int64_t(now - std::min(now, e.last_seen)) },
+			});
+		}
+
+		return result;
+	}
+
+private:
+
+	static bool key_from_sockaddr(struct sockaddr const *sa, uint64_t *key)
+	{
+		if (sa->sa_family == AF_INET6)
+		{
+			memcpy(key, &((struct sockaddr_in6 const*)sa)->sin6_addr, 16);
+			return true;
+		}
+
+		if (sa->sa_family == AF_INET)
+		{
+			uint8_t v4mapped[16] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+			memcpy(v4mapped + 12, &((struct sockaddr_in const*)sa)->sin_addr, 4);
+			memcpy(key, v4mapped, 16);
+			return true;
+		}
+
+		return false;
+	}
+
+	static std::string key_to_string(uint64_t const *key)
+	{
+		struct in6_addr addr;
+		memcpy(&addr, key, sizeof(addr));
+
+		char buf[INET6_ADDRSTRLEN];
+
+		if (IN6_IS_ADDR_V4MAPPED(&addr))
+			inet_ntop(AF_INET, &addr.s6_addr[12], buf, sizeof(buf));
+		else
+			inet_ntop(AF_INET6, &addr, buf, sizeof(buf));
+
+		return buf;
+	}
+
+	static bool key_equal(uint64_t const *a, uint64_t const *b)
+	{
+		return (a[0] == b[0]) && (a[1] == b[1]);
+	}
+
+	static uint64_t hash_key(uint64_t const *key)
+	{
+		uint64_t h = (key[0] * 0x9e3779b97f4a7c15ULL) ^ key[1];
+		h ^= h >> 31;
+		h *= 0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 29;
+		return h;
+	}
+
+private:
+	uint32_t  n_groups_;
+	uint64_t  emission_ns_;
+	uint64_t  limit_ns_;
+	uint32_t  sample_n_;
+
+	std::unique_ptr<recv_memory_t> memory_;
+	group_t                        *groups_;
+};
+
+#endif // PINBA__SOURCE_ADMISSION_H_
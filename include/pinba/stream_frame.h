@@ -0,0 +1,100 @@
+#ifndef PINBA__STREAM_FRAME_H_
+#define PINBA__STREAM_FRAME_H_
+
+#include <cstring>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// receive buffer of a stream connection (see collector_conf_t::stream_listen)
+// datagrams are [length:4, network byte order][datagram bytes], and can be split between reads in any way
+//
+// usage: read into [write_ptr(), write_ptr() + write_space()), commit() what's been read
+//        then take datagrams with next() till it says there is nothing more
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct stream_frame_buffer_t : private boost::noncopyable
+{
+	static constexpr size_t const max_datagram_size = 64 * 1024; // same as udp
+	static constexpr size_t const buffer_size       = 256 * 1024;
+
+	enum next_result_t
+	{
+		next_datagram   = 0, // got one
+		next_need_more  = 1, // partial datagram (or nothing at all), read more
+		next_bad_length = 2, // length is 0 or > max_datagram_size, connection must be closed
+	};
+
+	stream_frame_buffer_t()
+		: buf_(new char[buffer_size])
+		, begin_(0)
+		, end_(0)
+	{
+	}
+
+	// there is always enough space for at least one max size datagram (received data is moved to buffer start if needed)
+	char* write_ptr()
+	{
+		if (begin_ == end_)
+		{
+			begin_ = end_ = 0;
+		}
+		else if (buffer_size - end_ < max_datagram_size + 4)
+		{
+			memmove(buf_.get(), buf_.get() + begin_, end_ - begin_);
+			end_  -= begin_;
+			begin_ = 0;
+		}
+
+		return buf_.get() + end_;
+	}
+
+	size_t write_space() const
+	{
+		return buffer_size - end_;
+	}
+
+	void commit(size_t n)
+	{
+		end_ += n;
+	}
+
+	// datagram points into the buffer, and is valid till the next write_ptr() call
+	next_result_t next(str_ref *dgram, uint32_t *bad_length)
+	{
+		if (end_ - begin_ < 4)
+			return next_need_more;
+
+		uint8_t const *p = (uint8_t const*)buf_.get() + begin_;
+		uint32_t const len = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+
+		if (len == 0 || len > max_datagram_size)
+		{
+			*bad_length = len;
+			return next_bad_length;
+		}
+
+		if (end_ - begin_ - 4 < len)
+			return next_need_more;
+
+		*dgram = str_ref { (char const*)p + 4, len };
+		begin_ += 4 + len;
+		return next_datagram;
+	}
+
+	// received bytes that are not a complete datagram yet
+	bool has_partial() const
+	{
+		return begin_ != end_;
+	}
+
+private:
+	std::unique_ptr<char[]>  buf_;
+	size_t                   begin_;  // first byte of the datagram being received
+	size_t                   end_;    // end of received bytes
+};
+
+#endif // PINBA__STREAM_FRAME_H_
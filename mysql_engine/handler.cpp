@@ -173,39 +173,55 @@ struct pinba_view___stats_t : public pinba_view___base_t
 				STORE_FIELD(5,  vars_->udp_recv_eagain);
 				STORE_FIELD(6,  vars_->udp_recv_bytes);
 				STORE_FIELD(7,  vars_->udp_recv_packets);
-				STORE_FIELD(8,  vars_->udp_packet_decode_err);
-				STORE_FIELD(9,  vars_->udp_batch_send_total);
-				STORE_FIELD(10, vars_->udp_batch_send_err);
-				STORE_FIELD(11, vars_->udp_packet_send_total);
-				STORE_FIELD(12, vars_->udp_packet_send_err);
-				STORE_FIELD(13, vars_->udp_ru_utime);
-				STORE_FIELD(14, vars_->udp_ru_stime);
-
-				STORE_FIELD(15, vars_->repacker_poll_total);
-				STORE_FIELD(16, vars_->repacker_recv_total);
-				STORE_FIELD(17, vars_->repacker_recv_eagain);
-				STORE_FIELD(18, vars_->repacker_recv_packets);
-				STORE_FIELD(19, vars_->repacker_packet_validate_err);
-				STORE_FIELD(20, vars_->repacker_batch_send_total);
-				STORE_FIELD(21, vars_->repacker_batch_send_by_timer);
-				STORE_FIELD(22, vars_->repacker_batch_send_by_size);
-				STORE_FIELD(23, vars_->repacker_ru_utime);
-				STORE_FIELD(24, vars_->repacker_ru_stime);
-
-				STORE_FIELD(25, vars_->coordinator_batches_received);
-				STORE_FIELD(26, vars_->coordinator_batch_send_total);
-				STORE_FIELD(27, vars_->coordinator_batch_send_err);
-				STORE_FIELD(28, vars_->coordinator_control_requests);
-				STORE_FIELD(29, vars_->coordinator_ru_utime);
-				STORE_FIELD(30, vars_->coordinator_ru_stime);
-
-				STORE_FIELD(31, vars_->dictionary_size);
-				STORE_FIELD(32, vars_->dictionary_mem_hash);
-				STORE_FIELD(33, vars_->dictionary_mem_list);
-				STORE_FIELD(34, vars_->dictionary_mem_strings);
-
-				STORE_FIELD(35, vars_->version_info, strlen(vars_->version_info), &my_charset_bin);
-				STORE_FIELD(36, vars_->build_string, strlen(vars_->build_string), &my_charset_bin);
+				STORE_FIELD(8,  vars_->udp_recv_kernel_drops);
+				STORE_FIELD(9,  vars_->udp_recv_gro_segments);
+				STORE_FIELD(10, vars_->udp_recv_truncated);
+				STORE_FIELD(11, vars_->udp_packet_decode_err);
+				STORE_FIELD(12, vars_->udp_packet_decompress_err);
+				STORE_FIELD(13, vars_->udp_admission_dropped);
+				STORE_FIELD(14, vars_->udp_admission_sampled);
+				STORE_FIELD(15, vars_->udp_batch_send_total);
+				STORE_FIELD(16, vars_->udp_batch_send_err);
+				STORE_FIELD(17, vars_->udp_packet_send_total);
+				STORE_FIELD(18, vars_->udp_packet_send_err);
+				STORE_FIELD(19, vars_->udp_ru_utime);
+				STORE_FIELD(20, vars_->udp_ru_stime);
+				STORE_FIELD(21, vars_->udp_idle_time);
+
+				STORE_FIELD(22, vars_->stream_connections_total);
+				STORE_FIELD(23, vars_->stream_connections_err);
+				STORE_FIELD(24, vars_->stream_recv_bytes);
+				STORE_FIELD(25, vars_->stream_recv_packets);
+
+				STORE_FIELD(26, vars_->repacker_poll_total);
+				STORE_FIELD(27, vars_->repacker_recv_total);
+				STORE_FIELD(28, vars_->repacker_recv_eagain);
+				STORE_FIELD(29, vars_->repacker_recv_packets);
+				STORE_FIELD(30, vars_->repacker_recv_nested_packets);
+				STORE_FIELD(31, vars_->repacker_decode_fallback);
+				STORE_FIELD(32, vars_->repacker_packet_decode_err);
+				STORE_FIELD(33, vars_->repacker_packet_validate_err);
+				STORE_FIELD(34, vars_->repacker_batch_send_total);
+				STORE_FIELD(35, vars_->repacker_batch_send_by_timer);
+				STORE_FIELD(36, vars_->repacker_batch_send_by_size);
+				STORE_FIELD(37, vars_->repacker_batches_stolen);
+				STORE_FIELD(38, vars_->repacker_ru_utime);
+				STORE_FIELD(39, vars_->repacker_ru_stime);
+
+				STORE_FIELD(40, vars_->coordinator_batches_received);
+				STORE_FIELD(41, vars_->coordinator_batch_send_total);
+				STORE_FIELD(42, vars_->coordinator_batch_send_err);
+				STORE_FIELD(43, vars_->coordinator_control_requests);
+				STORE_FIELD(44, vars_->coordinator_ru_utime);
+				STORE_FIELD(45, vars_->coordinator_ru_stime);
+
+				STORE_FIELD(46, vars_->dictionary_size);
+				STORE_FIELD(47, vars_->dictionary_mem_hash);
+				STORE_FIELD(48, vars_->dictionary_mem_list);
+				STORE_FIELD(49, vars_->dictionary_mem_strings);
+
+				STORE_FIELD(50, vars_->version_info, strlen(vars_->version_info), &my_charset_bin);
+				STORE_FIELD(51, vars_->build_string, strlen(vars_->build_string), &my_charset_bin);
 
 			default:
 				break;
@@ -489,6 +505,138 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// per-source admission state, a row per udp sender address tracked by collector
+struct pinba_view___sources_t : public pinba_view___base_t
+{
+	using view_t     = std::vector<collector_source_stats_t>;
+	using position_t = view_t::const_iterator;
+
+	view_t      data_;
+	position_t  next_pos_; // to read NEXT row, aka rnd_next()
+	position_t  curr_pos_; // last returned row pos, for position()
+
+	virtual int rnd_init(pinba_handler_t *handler, bool scan) override
+	{
+		LOG_DEBUG(P_L_, "sources::{0}; handler: {1}, scan: {2}, got_data: {3}", __func__, handler, scan, !data_.empty());
+
+		if (data_.empty())
+		{
+			int const r = this->init_for_new_select(handler);
+			if (r != 0)
+				return r;
+		}
+
+		curr_pos_ = data_.begin();
+		next_pos_ = curr_pos_;
+
+		return 0;
+	}
+
+	virtual int rnd_end(pinba_handler_t *handler) override
+	{
+		// no cleanup here, see pinba_view___active_reports_t
+		return 0;
+	}
+
+	virtual int rnd_next(pinba_handler_t *handler, uchar *buf) override
+	{
+		if (next_pos_ == data_.end())
+			return HA_ERR_END_OF_FILE;
+
+		MEOW_DEFER(
+			curr_pos_ = next_pos_;
+			next_pos_ = std::next(curr_pos_);
+		);
+
+		return this->fill_row_at_position(handler, next_pos_);
+	}
+
+	virtual unsigned ref_length() const override
+	{
+		return (unsigned)sizeof(curr_pos_);
+	}
+
+	virtual int  rnd_pos(pinba_handler_t *handler, uchar *buf, uchar *pos_bytes) const override
+	{
+		auto const& pos = *(reinterpret_cast<position_t const*>(pos_bytes));
+		return this->fill_row_at_position(handler, pos);
+	}
+
+	virtual void position(pinba_handler_t *handler, const uchar *record) const override
+	{
+		memcpy(handler->ref, &curr_pos_, sizeof(curr_pos_));
+	}
+
+	virtual int  extra(pinba_handler_t *handler, enum ha_extra_function operation) override
+	{
+		return 0;
+	}
+
+	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
+	{
+		if (lock_type == F_UNLCK)
+		{
+			data_.clear();
+			data_.shrink_to_fit();
+		}
+
+		return 0;
+	}
+
+	virtual int  info(pinba_handler_t *handler, uint) const override
+	{
+		handler->stats.records = data_.size();
+		return 0;
+	}
+
+private:
+
+	int init_for_new_select(pinba_handler_t *handler)
+	try
+	{
+		data_ = P_E_->get_source_stats();
+		return 0;
+	}
+	catch (std::exception const& e)
+	{
+		LOG_WARN(P_L_, "sources::{0}; internal error: {1}", __func__, e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	int fill_row_at_position(pinba_handler_t *handler, position_t const& row_pos) const
+	{
+		auto const *row   = &(*row_pos);
+		auto       *table = handler->current_table();
+
+		// mark all fields as writeable to avoid assert() in ::store() calls
+		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->write_set, old_map);
+		);
+
+		for (Field **field = table->field; *field; field++)
+		{
+			unsigned const field_index = (*field)->field_index;
+
+			if (!bitmap_is_set(table->read_set, field_index))
+				continue;
+
+			switch (field_index)
+			{
+				STORE_FIELD (0, row->address.c_str(), row->address.length(), &my_charset_bin);
+				STORE_FIELD (1, row->packets_passed);
+				STORE_FIELD (2, row->packets_sampled);
+				STORE_FIELD (3, row->packets_dropped);
+				STORE_FIELD (4, duration_seconds_as_double(row->idle_time));
+			}
+		} // field for
+
+		return 0;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 struct pinba_view___report_snapshot_t : public pinba_view___base_t
 {
 	pinba_share_data_ptr           share_data_; // copied from share
@@ -669,6 +817,7 @@ private:
 			{
 				case pinba_view_kind::stats:
 				case pinba_view_kind::active_reports:
+				case pinba_view_kind::sources:
 					assert(!"must not happen");
 				break;
 
@@ -1064,6 +1213,9 @@ pinba_view_ptr pinba_view_create(pinba_view_conf_t const& vcf)
 		case pinba_view_kind::active_reports:
 			return meow::make_unique<pinba_view___active_reports_t>();
 
+		case pinba_view_kind::sources:
+			return meow::make_unique<pinba_view___sources_t>();
+
 		case pinba_view_kind::report_by_request_data:
 		case pinba_view_kind::report_by_timer_data:
 		case pinba_view_kind::report_by_packet_data:
@@ -1082,6 +1234,7 @@ pinba_report_ptr pinba_view_report_create(pinba_view_conf_t const& vcf)
 	{
 		case pinba_view_kind::stats:
 		case pinba_view_kind::active_reports:
+		case pinba_view_kind::sources:
 			return {};
 
 		case pinba_view_kind::report_by_packet_data:
@@ -63,7 +63,13 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 	vars->udp_recv_eagain       = stats->udp.recv_eagain;
 	vars->udp_recv_bytes        = stats->udp.recv_bytes;
 	vars->udp_recv_packets      = stats->udp.recv_packets;
+	vars->udp_recv_kernel_drops = stats->udp.recv_kernel_drops;
+	vars->udp_recv_gro_segments = stats->udp.recv_gro_segments;
+	vars->udp_recv_truncated    = stats->udp.recv_truncated;
 	vars->udp_packet_decode_err = stats->udp.packet_decode_err;
+	vars->udp_packet_decompress_err = stats->udp.packet_decompress_err;
+	vars->udp_admission_dropped = stats->udp.admission_dropped;
+	vars->udp_admission_sampled = stats->udp.admission_sampled;
 	vars->udp_batch_send_total  = stats->udp.batch_send_total;
 	vars->udp_batch_send_err    = stats->udp.batch_send_err;
 	vars->udp_packet_send_total = stats->udp.packet_send_total;
@@ -72,26 +78,39 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 	{
 		std::lock_guard<std::mutex> lk_(stats->mtx);
 
-		vars->udp_ru_utime = 0;
-		vars->udp_ru_stime = 0;
+		vars->udp_ru_utime  = 0;
+		vars->udp_ru_stime  = 0;
+		vars->udp_idle_time = 0;
 
 		for (auto const& curr : stats->collector_threads)
 		{
-			vars->udp_ru_utime += timeval_to_double(curr.ru_utime);
-			vars->udp_ru_stime += timeval_to_double(curr.ru_stime);
+			vars->udp_ru_utime  += timeval_to_double(curr.ru_utime);
+			vars->udp_ru_stime  += timeval_to_double(curr.ru_stime);
+			vars->udp_idle_time += (double)curr.idle_time.nsec / nsec_in_sec;
 		}
 	}
 
+	// stream
+
+	vars->stream_connections_total = stats->stream.connections_total;
+	vars->stream_connections_err   = stats->stream.connections_err;
+	vars->stream_recv_bytes        = stats->stream.recv_bytes;
+	vars->stream_recv_packets      = stats->stream.recv_packets;
+
 	// repacker
 
 	vars->repacker_poll_total          = stats->repacker.poll_total;
 	vars->repacker_recv_total          = stats->repacker.recv_total;
 	vars->repacker_recv_eagain         = stats->repacker.recv_eagain;
 	vars->repacker_recv_packets        = stats->repacker.recv_packets;
+	vars->repacker_recv_nested_packets = stats->repacker.recv_nested_packets;
+	vars->repacker_decode_fallback     = stats->repacker.decode_fallback;
+	vars->repacker_packet_decode_err   = stats->repacker.packet_decode_err;
 	vars->repacker_packet_validate_err = stats->repacker.packet_validate_err;
 	vars->repacker_batch_send_total    = stats->repacker.batch_send_total;
 	vars->repacker_batch_send_by_timer = stats->repacker.batch_send_by_timer;
 	vars->repacker_batch_send_by_size  = stats->repacker.batch_send_by_size;
+	vars->repacker_batches_stolen      = stats->repacker.batches_stolen;
 
 	{
 		std::lock_guard<std::mutex> lk_(stats->mtx);
@@ -144,10 +163,63 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 		std::string result;
 		ff::fmt(result, "n_handlers: {0}, n_shares: {1}, n_views: {2}\n", cnt.n_handlers, cnt.n_shares, cnt.n_handlers);
 		ff::fmt(result, "n_raw_batches: {0}, n_packet_batches: {1}\n", (uint64_t)obj.n_raw_batches, (uint64_t)obj.n_packet_batches);
+		ff::fmt(result, "n_raw_batches_reused: {0}, n_packet_batches_reused: {1}\n", (uint64_t)obj.n_raw_batches_reused, (uint64_t)obj.n_packet_batches_reused);
 		ff::fmt(result, "n_repacker_words: {0}, n_repacker_wordslices: {1}\n", (uint64_t)obj.n_repacker_dict_words, (uint64_t)obj.n_repacker_dict_ws);
 		ff::fmt(result, "n_report_snapshots: {0}, n_report_ticks: {1}\n", (uint64_t)obj.n_report_snapshots, (uint64_t)obj.n_report_ticks);
 		ff::fmt(result, "n_coord_requests: {0}\n", (uint64_t)obj.n_coord_requests);
 
+		// packets per wakeup histograms, non-empty buckets only, as "<bucket lower bound>:<count>"
+		{
+			std::lock_guard<std::mutex> lk_(stats->mtx);
+
+			for (size_t i = 0; i < stats->collector_threads.size(); i++)
+			{
+				auto const& hist = stats->collector_threads[i].packets_per_wakeup;
+
+				ff::fmt(result, "udp_reader/{0} packets_per_wakeup:", i);
+				for (size_t b = 0; b < collector_stats_t::wakeup_hist_buckets; b++)
+				{
+					if (hist[b] == 0)
+						continue;
+
+					uint64_t const lower_bound = (b == 0) ? 0 : (1ULL << (b - 1));
+					ff::fmt(result, " {0}:{1}", lower_bound, hist[b]);
+				}
+				ff::fmt(result, "\n");
+			}
+
+			ff::fmt(result, "udp_reader kernel_drops:");
+			for (size_t i = 0; i < stats->collector_threads.size(); i++)
+				ff::fmt(result, " {0}:{1}", i, stats->collector_threads[i].kernel_drops);
+			ff::fmt(result, "\n");
+
+			ff::fmt(result, "repacker queue_depth:");
+			for (size_t i = 0; i < stats->repacker_threads.size(); i++)
+				ff::fmt(result, " {0}:{1}", i, stats->repacker_threads[i].queue_depth);
+			ff::fmt(result, "\n");
+
+			ff::fmt(result, "repacker batches_stolen:");
+			for (size_t i = 0; i < stats->repacker_threads.size(); i++)
+				ff::fmt(result, " {0}:{1}", i, stats->repacker_threads[i].batches_stolen);
+			ff::fmt(result, "\n");
+		}
+
+		// same format as packets_per_wakeup above, takes dictionary shard locks, so not under stats lock
+		{
+			auto const hist = P_G_->dictionary()->insert_latency_histogram();
+
+			ff::fmt(result, "dictionary insert_latency_us:");
+			for (size_t b = 0; b < hist.size(); b++)
+			{
+				if (hist[b] == 0)
+					continue;
+
+				uint64_t const lower_bound = (b == 0) ? 0 : (1ULL << (b - 1));
+				ff::fmt(result, " {0}:{1}", lower_bound, hist[b]);
+			}
+			ff::fmt(result, "\n");
+		}
+
 		return result;
 	}();
 	snprintf(vars->extra, sizeof(vars->extra), "%s", extra_str.c_str());
@@ -266,6 +338,9 @@ static int pinba_engine_init(void *p)
 
 	try
 	{
+		// string sysvars without a default are NULL
+		auto const str_or_empty = [](char const *s) { return std::string{(s) ? s : ""}; };
+
 		// TODO: take more values from global mysql config (aka pinba_variables)
 		static pinba_options_t options = {
 			.net_address              = pinba_variables()->address,
@@ -274,15 +349,55 @@ static int pinba_engine_init(void *p)
 			.udp_threads              = pinba_variables()->udp_reader_threads,
 			.udp_batch_messages       = 256,
 			.udp_batch_timeout        = 50 * d_millisecond,
+			.udp_idle_spin_count      = pinba_variables()->udp_idle_spin_count,
+			.udp_idle_yield_count     = pinba_variables()->udp_idle_yield_count,
+			.udp_idle_park_min        = pinba_variables()->udp_idle_park_min_us * d_microsecond,
+			.udp_idle_park_max        = pinba_variables()->udp_idle_park_max_us * d_microsecond,
+			.udp_busy_poll_usec       = pinba_variables()->udp_busy_poll_us,
+			.udp_rcvbuf_absorb_time   = pinba_variables()->udp_rcvbuf_absorb_ms * d_millisecond,
+			.udp_rcvbuf_absorb_mbps   = pinba_variables()->udp_rcvbuf_absorb_mbps,
+			.udp_gro                  = (bool)pinba_variables()->udp_gro,
+			.udp_recv_max_dgrams      = pinba_variables()->udp_recv_max_datagrams,
+			.udp_recv_slot_size       = pinba_variables()->udp_recv_slot_size,
+			.udp_recv_hugepages       = (bool)pinba_variables()->udp_recv_hugepages,
+			.udp_reuseport_cpu_steering = (bool)pinba_variables()->udp_reuseport_cpu_steering,
+			.udp_zstd_dictionaries    = str_or_empty(pinba_variables()->udp_zstd_dictionaries),
+
+			.stream_listen            = str_or_empty(pinba_variables()->stream_listen),
+			.stream_threads           = pinba_variables()->stream_reader_threads,
+
+			.admission_rate           = pinba_variables()->admission_rate,
+			.admission_burst          = pinba_variables()->admission_burst,
+			.admission_sample_n       = pinba_variables()->admission_sample_n,
+			.admission_slots          = pinba_variables()->admission_slots,
+
+			.capture_file             = str_or_empty(pinba_variables()->capture_file),
+			.capture_sample_n         = pinba_variables()->capture_sample_n,
+			.replay_file              = str_or_empty(pinba_variables()->replay_file),
+			.replay_speed             = pinba_variables()->replay_speed,
+			.replay_loops             = pinba_variables()->replay_loops,
+			.inject_only              = false,
 
 			.repacker_threads         = pinba_variables()->repacker_threads,
 			.repacker_input_buffer    = pinba_variables()->repacker_input_buffer,
 			.repacker_batch_messages  = pinba_variables()->repacker_batch_messages,
 			.repacker_batch_timeout   = pinba_variables()->repacker_batch_timeout_ms * d_millisecond,
+			.repacker_fast_decode     = (bool)pinba_variables()->repacker_fast_decode,
+			.repacker_fused           = (bool)pinba_variables()->repacker_fused,
 
 			.coordinator_input_buffer = pinba_variables()->coordinator_input_buffer,
 			.report_input_buffer      = pinba_variables()->report_input_buffer,
 
+			.numa_node                = str_or_empty(pinba_variables()->numa_node),
+			.udp_cpu_list             = str_or_empty(pinba_variables()->udp_cpu_list),
+			.udp_nice                 = pinba_variables()->udp_nice,
+			.repacker_cpu_list        = str_or_empty(pinba_variables()->repacker_cpu_list),
+			.repacker_nice            = pinba_variables()->repacker_nice,
+			.coordinator_cpu_list     = str_or_empty(pinba_variables()->coordinator_cpu_list),
+			.coordinator_nice         = pinba_variables()->coordinator_nice,
+			.report_cpu_list          = str_or_empty(pinba_variables()->report_cpu_list),
+			.report_nice              = pinba_variables()->report_nice,
+
 			.logger                   = logger,
 
 			.packet_debug             = (bool)pinba_variables()->packet_debug,
@@ -419,6 +534,249 @@ static MYSQL_SYSVAR_UINT(udp_reader_threads,
 	16,
 	0);
 
+static MYSQL_SYSVAR_UINT(udp_idle_spin_count,
+	pinba_variables()->udp_idle_spin_count,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of immediate recv retries after UDP sockets are drained (only under heavy traffic), 0 to disable spinning",
+	NULL,
+	NULL,
+	64,
+	0,
+	64 * 1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_idle_yield_count,
+	pinba_variables()->udp_idle_yield_count,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of recv retries with sched_yield() after spinning (only under heavy traffic), 0 to disable",
+	NULL,
+	NULL,
+	4,
+	0,
+	1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_idle_park_min_us,
+	pinba_variables()->udp_idle_park_min_us,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Min time UDP reader sleeps before polling sockets again (in microseconds!)",
+	NULL,
+	NULL,
+	50,
+	0,
+	1000 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_idle_park_max_us,
+	pinba_variables()->udp_idle_park_max_us,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Max time UDP reader sleeps before polling sockets again, reached when traffic is light (in microseconds!)",
+	NULL,
+	NULL,
+	1000,
+	0,
+	1000 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_busy_poll_us,
+	pinba_variables()->udp_busy_poll_us,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"SO_BUSY_POLL value for UDP sockets (also sets SO_PREFER_BUSY_POLL), 0 to disable",
+	NULL,
+	NULL,
+	0,
+	0,
+	1000 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_rcvbuf_absorb_ms,
+	pinba_variables()->udp_rcvbuf_absorb_ms,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Size UDP receive buffers to absorb this many milliseconds of traffic at pinba_udp_rcvbuf_absorb_mbps, 0 to keep kernel defaults",
+	NULL,
+	NULL,
+	0,
+	0,
+	60 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_rcvbuf_absorb_mbps,
+	pinba_variables()->udp_rcvbuf_absorb_mbps,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Incoming traffic rate (in Mbit/s) UDP receive buffers are sized for, see pinba_udp_rcvbuf_absorb_ms, 0 to keep kernel defaults",
+	NULL,
+	NULL,
+	0,
+	0,
+	100 * 1000,
+	0);
+
+static MYSQL_SYSVAR_BOOL(udp_gro,
+	pinba_variables()->udp_gro,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Enable UDP_GRO on UDP sockets, kernel delivers many coalesced packets per receive call (linux 5.0+)",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_recv_max_datagrams,
+	pinba_variables()->udp_recv_max_datagrams,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Max packets UDP reader receives with a single recvmmsg() call, 0 = same as batch size",
+	NULL,
+	NULL,
+	0,
+	0,
+	64 * 1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_recv_slot_size,
+	pinba_variables()->udp_recv_slot_size,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Typical UDP packet size, UDP reader receive buffer is sized for these, bigger ones overflow into memory allocated on demand, 0 = 64k for every packet",
+	NULL,
+	NULL,
+	2048,
+	0,
+	64 * 1024,
+	0);
+
+static MYSQL_SYSVAR_BOOL(udp_recv_hugepages,
+	pinba_variables()->udp_recv_hugepages,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Back UDP reader receive buffers with huge pages (explicit if reserved, transparent otherwise)",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_BOOL(udp_reuseport_cpu_steering,
+	pinba_variables()->udp_reuseport_cpu_steering,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Deliver packets to UDP reader by the cpu they are received on (reuseport bpf program), pins readers to these cpus",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_STR(udp_zstd_dictionaries,
+	pinba_variables()->udp_zstd_dictionaries,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"comma separated list of zstd dictionary files, for packets compressed with a shared dictionary, empty to disable",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_STR(stream_listen,
+	pinba_variables()->stream_listen,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"comma separated endpoints to accept length-prefixed packet streams on (tcp:<host>:<port>, unix:<path>, unix-seqpacket:<path>), empty to disable",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_UINT(stream_reader_threads,
+	pinba_variables()->stream_reader_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"number of threads reading packet streams (see pinba_stream_listen)",
+	NULL,
+	NULL,
+	1,
+	1,
+	64,
+	0);
+
+static MYSQL_SYSVAR_UINT(admission_rate,
+	pinba_variables()->admission_rate,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"per source address udp packet rate limit (packets/sec), 0 to disable",
+	NULL,
+	NULL,
+	0,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(admission_burst,
+	pinba_variables()->admission_burst,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"per source address burst size (packets), 0 = same as pinba_admission_rate",
+	NULL,
+	NULL,
+	0,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(admission_sample_n,
+	pinba_variables()->admission_sample_n,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"let 1 in N packets over the per source limit through, 0 to drop them all",
+	NULL,
+	NULL,
+	100,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(admission_slots,
+	pinba_variables()->admission_slots,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"max number of source addresses tracked for admission",
+	NULL,
+	NULL,
+	4096,
+	2,
+	(1 << 25),
+	0);
+
+static MYSQL_SYSVAR_STR(capture_file,
+	pinba_variables()->capture_file,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"append received datagrams to this file (for replay later), empty to disable",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_UINT(capture_sample_n,
+	pinba_variables()->capture_sample_n,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"capture random 1 in N datagrams, 1 to capture all of them",
+	NULL,
+	NULL,
+	1,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_STR(replay_file,
+	pinba_variables()->replay_file,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"replay datagrams from this capture (or pcap) file instead of listening for udp traffic, empty for normal operation",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_UINT(replay_speed,
+	pinba_variables()->replay_speed,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"replay speed, percent of original rate (100 = as captured), 0 for as fast as possible",
+	NULL,
+	NULL,
+	100,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(replay_loops,
+	pinba_variables()->replay_loops,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"times to replay the file, 0 for forever",
+	NULL,
+	NULL,
+	1,
+	0,
+	INT_MAX,
+	0);
+
 static MYSQL_SYSVAR_UINT(repacker_threads,
 	pinba_variables()->repacker_threads,
 	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
@@ -463,6 +821,22 @@ static MYSQL_SYSVAR_UINT(repacker_batch_timeout_ms,
 	1000,
 	0);
 
+static MYSQL_SYSVAR_BOOL(repacker_fast_decode,
+	pinba_variables()->repacker_fast_decode,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Decode incoming packets in packet-repack threads with a specialized single pass decoder (falls back to generic one when needed)",
+	NULL,
+	NULL,
+	1);
+
+static MYSQL_SYSVAR_BOOL(repacker_fused,
+	pinba_variables()->repacker_fused,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Repack incoming packets right in udp reader threads, no packet-repack threads are started",
+	NULL,
+	NULL,
+	0);
+
 static MYSQL_SYSVAR_UINT(coordinator_input_buffer,
 	pinba_variables()->coordinator_input_buffer,
 	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
@@ -485,6 +859,90 @@ static MYSQL_SYSVAR_UINT(report_input_buffer,
 	8 * 1024,
 	0);
 
+static MYSQL_SYSVAR_STR(numa_node,
+	pinba_variables()->numa_node,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"numa node for udp reader and repacker threads that have no cpu list set, 'auto' = node of the network card serving pinba_address, 'none' to disable",
+	NULL,
+	NULL,
+	"auto");
+
+static MYSQL_SYSVAR_STR(udp_cpu_list,
+	pinba_variables()->udp_cpu_list,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"cpus to bind udp reader threads to, one cpu per thread round-robin (taskset -c format, example: '0-3,8'), empty to not bind",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_INT(udp_nice,
+	pinba_variables()->udp_nice,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"nice value for udp reader threads, 0 to keep default priority (negative values require CAP_SYS_NICE)",
+	NULL,
+	NULL,
+	0,
+	-20,
+	19,
+	0);
+
+static MYSQL_SYSVAR_STR(repacker_cpu_list,
+	pinba_variables()->repacker_cpu_list,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"cpus to bind packet-repack threads to, one cpu per thread round-robin (taskset -c format, example: '0-3,8'), empty to not bind",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_INT(repacker_nice,
+	pinba_variables()->repacker_nice,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"nice value for packet-repack threads, 0 to keep default priority (negative values require CAP_SYS_NICE)",
+	NULL,
+	NULL,
+	0,
+	-20,
+	19,
+	0);
+
+static MYSQL_SYSVAR_STR(coordinator_cpu_list,
+	pinba_variables()->coordinator_cpu_list,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"cpus to bind coordinator (packet relay) thread to, one cpu per thread round-robin (taskset -c format, example: '0-3,8'), empty to not bind",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_INT(coordinator_nice,
+	pinba_variables()->coordinator_nice,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"nice value for coordinator (packet relay) thread, 0 to keep default priority (negative values require CAP_SYS_NICE)",
+	NULL,
+	NULL,
+	0,
+	-20,
+	19,
+	0);
+
+static MYSQL_SYSVAR_STR(report_cpu_list,
+	pinba_variables()->report_cpu_list,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"cpus to bind report threads (report id is used as thread number) to, one cpu per thread round-robin (taskset -c format, example: '0-3,8'), empty to not bind",
+	NULL,
+	NULL,
+	NULL);
+
+static MYSQL_SYSVAR_INT(report_nice,
+	pinba_variables()->report_nice,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"nice value for report threads (report id is used as thread number), 0 to keep default priority (negative values require CAP_SYS_NICE)",
+	NULL,
+	NULL,
+	0,
+	-20,
+	19,
+	0);
+
 static MYSQL_SYSVAR_BOOL(packet_debug,
 	pinba_variables()->packet_debug,
 	PLUGIN_VAR_RQCMDARG,
@@ -539,12 +997,47 @@ static struct st_mysql_sys_var* system_variables[]= {
 	MYSQL_SYSVAR(log_level),
 	MYSQL_SYSVAR(default_history_time_sec),
 	MYSQL_SYSVAR(udp_reader_threads),
+	MYSQL_SYSVAR(udp_idle_spin_count),
+	MYSQL_SYSVAR(udp_idle_yield_count),
+	MYSQL_SYSVAR(udp_idle_park_min_us),
+	MYSQL_SYSVAR(udp_idle_park_max_us),
+	MYSQL_SYSVAR(udp_busy_poll_us),
+	MYSQL_SYSVAR(udp_rcvbuf_absorb_ms),
+	MYSQL_SYSVAR(udp_rcvbuf_absorb_mbps),
+	MYSQL_SYSVAR(udp_gro),
+	MYSQL_SYSVAR(udp_recv_max_datagrams),
+	MYSQL_SYSVAR(udp_recv_slot_size),
+	MYSQL_SYSVAR(udp_recv_hugepages),
+	MYSQL_SYSVAR(udp_reuseport_cpu_steering),
+	MYSQL_SYSVAR(udp_zstd_dictionaries),
+	MYSQL_SYSVAR(stream_listen),
+	MYSQL_SYSVAR(stream_reader_threads),
+	MYSQL_SYSVAR(admission_rate),
+	MYSQL_SYSVAR(admission_burst),
+	MYSQL_SYSVAR(admission_sample_n),
+	MYSQL_SYSVAR(admission_slots),
+	MYSQL_SYSVAR(capture_file),
+	MYSQL_SYSVAR(capture_sample_n),
+	MYSQL_SYSVAR(replay_file),
+	MYSQL_SYSVAR(replay_speed),
+	MYSQL_SYSVAR(replay_loops),
 	MYSQL_SYSVAR(repacker_threads),
 	MYSQL_SYSVAR(repacker_input_buffer),
 	MYSQL_SYSVAR(repacker_batch_messages),
 	MYSQL_SYSVAR(repacker_batch_timeout_ms),
+	MYSQL_SYSVAR(repacker_fast_decode),
+	MYSQL_SYSVAR(repacker_fused),
 	MYSQL_SYSVAR(coordinator_input_buffer),
 	MYSQL_SYSVAR(report_input_buffer),
+	MYSQL_SYSVAR(numa_node),
+	MYSQL_SYSVAR(udp_cpu_list),
+	MYSQL_SYSVAR(udp_nice),
+	MYSQL_SYSVAR(repacker_cpu_list),
+	MYSQL_SYSVAR(repacker_nice),
+	MYSQL_SYSVAR(coordinator_cpu_list),
+	MYSQL_SYSVAR(coordinator_nice),
+	MYSQL_SYSVAR(report_cpu_list),
+	MYSQL_SYSVAR(report_nice),
 	MYSQL_SYSVAR(packet_debug),
 	MYSQL_SYSVAR(packet_debug_fraction),
 	NULL
@@ -567,21 +1060,36 @@ static void status_variables_show_func(THD*, SHOW_VAR *var, char *buf)
 		SVAR(udp_recv_eagain,                   SHOW_LONGLONG)
 		SVAR(udp_recv_bytes,                    SHOW_LONGLONG)
 		SVAR(udp_recv_packets,                  SHOW_LONGLONG)
+		SVAR(udp_recv_kernel_drops,             SHOW_LONGLONG)
+		SVAR(udp_recv_gro_segments,             SHOW_LONGLONG)
+		SVAR(udp_recv_truncated,                SHOW_LONGLONG)
 		SVAR(udp_packet_decode_err,             SHOW_LONGLONG)
+		SVAR(udp_packet_decompress_err,         SHOW_LONGLONG)
+		SVAR(udp_admission_dropped,             SHOW_LONGLONG)
+		SVAR(udp_admission_sampled,             SHOW_LONGLONG)
 		SVAR(udp_batch_send_total,              SHOW_LONGLONG)
 		SVAR(udp_batch_send_err,                SHOW_LONGLONG)
 		SVAR(udp_packet_send_total,             SHOW_LONGLONG)
 		SVAR(udp_packet_send_err,               SHOW_LONGLONG)
 		SVAR(udp_ru_utime,                      SHOW_DOUBLE)
 		SVAR(udp_ru_stime,                      SHOW_DOUBLE)
+		SVAR(udp_idle_time,                     SHOW_DOUBLE)
+		SVAR(stream_connections_total,          SHOW_LONGLONG)
+		SVAR(stream_connections_err,            SHOW_LONGLONG)
+		SVAR(stream_recv_bytes,                 SHOW_LONGLONG)
+		SVAR(stream_recv_packets,               SHOW_LONGLONG)
 		SVAR(repacker_poll_total,               SHOW_LONGLONG)
 		SVAR(repacker_recv_total,               SHOW_LONGLONG)
 		SVAR(repacker_recv_eagain,              SHOW_LONGLONG)
 		SVAR(repacker_recv_packets,             SHOW_LONGLONG)
+		SVAR(repacker_recv_nested_packets,      SHOW_LONGLONG)
+		SVAR(repacker_decode_fallback,          SHOW_LONGLONG)
+		SVAR(repacker_packet_decode_err,        SHOW_LONGLONG)
 		SVAR(repacker_packet_validate_err,      SHOW_LONGLONG)
 		SVAR(repacker_batch_send_total,         SHOW_LONGLONG)
 		SVAR(repacker_batch_send_by_timer,      SHOW_LONGLONG)
 		SVAR(repacker_batch_send_by_size,       SHOW_LONGLONG)
+		SVAR(repacker_batches_stolen,           SHOW_LONGLONG)
 		SVAR(repacker_ru_utime,                 SHOW_DOUBLE)
 		SVAR(repacker_ru_stime,                 SHOW_DOUBLE)
 		SVAR(coordinator_batches_received,      SHOW_LONGLONG)
@@ -21,12 +21,47 @@ struct pinba_variables_t
 	char      *log_level                = nullptr;
 	unsigned  default_history_time_sec  = 0;
 	unsigned  udp_reader_threads        = 0;
+	unsigned  udp_idle_spin_count       = 0;
+	unsigned  udp_idle_yield_count      = 0;
+	unsigned  udp_idle_park_min_us      = 0;
+	unsigned  udp_idle_park_max_us      = 0;
+	unsigned  udp_busy_poll_us          = 0;
+	unsigned  udp_rcvbuf_absorb_ms      = 0;
+	unsigned  udp_rcvbuf_absorb_mbps    = 0;
+	char      udp_gro                   = 0;
+	unsigned  udp_recv_max_datagrams    = 0;
+	unsigned  udp_recv_slot_size        = 0;
+	char      udp_recv_hugepages        = 0;
+	char      udp_reuseport_cpu_steering = 0;
+	char      *udp_zstd_dictionaries    = nullptr;
+	char      *stream_listen            = nullptr;
+	unsigned  stream_reader_threads     = 0;
+	unsigned  admission_rate            = 0;
+	unsigned  admission_burst           = 0;
+	unsigned  admission_sample_n        = 0;
+	unsigned  admission_slots           = 0;
+	char      *capture_file             = nullptr;
+	unsigned  capture_sample_n          = 0;
+	char      *replay_file              = nullptr;
+	unsigned  replay_speed              = 0;
+	unsigned  replay_loops              = 0;
 	unsigned  repacker_threads          = 0;
 	unsigned  repacker_input_buffer     = 0;
 	unsigned  repacker_batch_messages   = 0;
 	unsigned  repacker_batch_timeout_ms = 0;
+	char      repacker_fast_decode      = 1;
+	char      repacker_fused            = 0;
 	unsigned  coordinator_input_buffer  = 0;
 	unsigned  report_input_buffer       = 0;
+	char      *numa_node                = nullptr;
+	char      *udp_cpu_list             = nullptr;
+	int       udp_nice                  = 0;
+	char      *repacker_cpu_list        = nullptr;
+	int       repacker_nice             = 0;
+	char      *coordinator_cpu_list     = nullptr;
+	int       coordinator_nice          = 0;
+	char      *report_cpu_list          = nullptr;
+	int       report_nice               = 0;
 	char      packet_debug              = 0;
 	double    packet_debug_fraction     = 0.01;
 };
@@ -50,22 +85,38 @@ struct pinba_status_variables_t
 	unsigned long long  udp_recv_eagain;
 	unsigned long long  udp_recv_bytes;
 	unsigned long long  udp_recv_packets;
+	unsigned long long  udp_recv_kernel_drops;
+	unsigned long long  udp_recv_gro_segments;
+	unsigned long long  udp_recv_truncated;
 	unsigned long long  udp_packet_decode_err;
+	unsigned long long  udp_packet_decompress_err;
+	unsigned long long  udp_admission_dropped;
+	unsigned long long  udp_admission_sampled;
 	unsigned long long  udp_batch_send_total;
 	unsigned long long  udp_batch_send_err;
 	unsigned long long  udp_packet_send_total;
 	unsigned long long  udp_packet_send_err;
 	double              udp_ru_utime;
 	double              udp_ru_stime;
+	double              udp_idle_time;
+
+	unsigned long long  stream_connections_total;
+	unsigned long long  stream_connections_err;
+	unsigned long long  stream_recv_bytes;
+	unsigned long long  stream_recv_packets;
 
 	unsigned long long  repacker_poll_total;
 	unsigned long long  repacker_recv_total;
 	unsigned long long  repacker_recv_eagain;
 	unsigned long long  repacker_recv_packets;
+	unsigned long long  repacker_recv_nested_packets;
+	unsigned long long  repacker_decode_fallback;
+	unsigned long long  repacker_packet_decode_err;
 	unsigned long long  repacker_packet_validate_err;
 	unsigned long long  repacker_batch_send_total;
 	unsigned long long  repacker_batch_send_by_timer;
 	unsigned long long  repacker_batch_send_by_size;
+	unsigned long long  repacker_batches_stolen;
 	double              repacker_ru_utime;
 	double              repacker_ru_stime;
 
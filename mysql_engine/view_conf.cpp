@@ -264,6 +264,12 @@ namespace { namespace aux {
 			return result;
 		}
 
+		if (report_type == "sources")
+		{
+			result->kind = pinba_view_kind::sources;
+			return result;
+		}
+
 		if (report_type == "packet" || report_type == "info") // support 'info' here for 'compatibility' with pinba_engine
 		{
 			result->kind = pinba_view_kind::report_by_packet_data;
@@ -697,6 +703,7 @@ namespace { namespace aux {
 		{
 			case pinba_view_kind::stats:
 			case pinba_view_kind::active_reports:
+			case pinba_view_kind::sources:
 				return {};
 
 			case pinba_view_kind::report_by_request_data:
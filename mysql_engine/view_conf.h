@@ -18,6 +18,7 @@ struct report_conf___by_timer_t;
 MEOW_DEFINE_SMART_ENUM_STRUCT(pinba_view_kind,
 								((stats,                   "stats"))
 								((active_reports,          "active_reports"))
+								((sources,                 "sources"))
 								((report_by_request_data,  "report_by_request_data"))
 								((report_by_timer_data,    "report_by_timer_data"))
 								((report_by_packet_data,   "report_by_packet_data"))
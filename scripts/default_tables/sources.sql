@@ -0,0 +1,7 @@
+CREATE TABLE IF NOT EXISTS `pinba`.`sources` (
+  `address` varchar(64) NOT NULL,
+  `packets_passed` bigint(20) unsigned NOT NULL,
+  `packets_sampled` bigint(20) unsigned NOT NULL,
+  `packets_dropped` bigint(20) unsigned NOT NULL,
+  `idle_time` double NOT NULL
+) ENGINE=PINBA DEFAULT CHARSET=latin1 COMMENT='v2/sources';
@@ -7,21 +7,36 @@ CREATE TABLE IF NOT EXISTS `pinba`.`stats` (
   `udp_recv_eagain` bigint(20) unsigned NOT NULL,
   `udp_recv_bytes` bigint(20) unsigned NOT NULL,
   `udp_recv_packets` bigint(20) unsigned NOT NULL,
+  `udp_recv_kernel_drops` bigint(20) unsigned NOT NULL,
+  `udp_recv_gro_segments` bigint(20) unsigned NOT NULL,
+  `udp_recv_truncated` bigint(20) unsigned NOT NULL,
   `udp_packet_decode_err` bigint(20) unsigned NOT NULL,
+  `udp_packet_decompress_err` bigint(20) unsigned NOT NULL,
+  `udp_admission_dropped` bigint(20) unsigned NOT NULL,
+  `udp_admission_sampled` bigint(20) unsigned NOT NULL,
   `udp_batch_send_total` bigint(20) unsigned NOT NULL,
   `udp_batch_send_err` bigint(20) unsigned NOT NULL,
   `udp_packet_send_total` bigint(20) unsigned NOT NULL,
   `udp_packet_send_err` bigint(20) unsigned NOT NULL,
   `udp_ru_utime` double NOT NULL,
   `udp_ru_stime` double NOT NULL,
+  `udp_idle_time` double NOT NULL,
+  `stream_connections_total` bigint(20) unsigned NOT NULL,
+  `stream_connections_err` bigint(20) unsigned NOT NULL,
+  `stream_recv_bytes` bigint(20) unsigned NOT NULL,
+  `stream_recv_packets` bigint(20) unsigned NOT NULL,
   `repacker_poll_total` bigint(20) unsigned NOT NULL,
   `repacker_recv_total` bigint(20) unsigned NOT NULL,
   `repacker_recv_eagain` bigint(20) unsigned NOT NULL,
   `repacker_recv_packets` bigint(20) unsigned NOT NULL,
+  `repacker_recv_nested_packets` bigint(20) unsigned NOT NULL,
+  `repacker_decode_fallback` bigint(20) unsigned NOT NULL,
+  `repacker_packet_decode_err` bigint(20) unsigned NOT NULL,
   `repacker_packet_validate_err` bigint(20) unsigned NOT NULL,
   `repacker_batch_send_total` bigint(20) unsigned NOT NULL,
   `repacker_batch_send_by_timer` bigint(20) unsigned NOT NULL,
   `repacker_batch_send_by_size` bigint(20) unsigned NOT NULL,
+  `repacker_batches_stolen` bigint(20) unsigned NOT NULL,
   `repacker_ru_utime` double NOT NULL,
   `repacker_ru_stime` double NOT NULL,
   `coordinator_batches_received` bigint(20) unsigned NOT NULL,
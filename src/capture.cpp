@@ -0,0 +1,472 @@
+#include "pinba_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <meow/std_unique_ptr.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/capture.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline size_t align8(size_t sz)
+	{
+		return (sz + 7) & ~size_t(7);
+	}
+
+	inline uint32_t pcap_u32(uint8_t const *p, bool swapped)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return (swapped) ? __builtin_bswap32(v) : v;
+	}
+
+	inline uint16_t be_u16(uint8_t const *p)
+	{
+		return uint16_t(p[0]) << 8 | p[1];
+	}
+
+	// read-only mapping of the whole file
+	struct mapped_file_t : private boost::noncopyable
+	{
+		uint8_t const  *data = NULL;
+		size_t          size = 0;
+
+		explicit mapped_file_t(std::string const& path)
+		{
+			int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error(ff::fmt_str("can't open {0}: {1}:{2}", path, errno, strerror(errno)));
+
+			struct stat st;
+			if (0 != fstat(fd, &st))
+			{
+				int const e = errno;
+				close(fd);
+				throw std::runtime_error(ff::fmt_str("fstat({0}) failed: {1}:{2}", path, e, strerror(e)));
+			}
+
+			size = st.st_size;
+
+			if (size > 0)
+			{
+				void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p == MAP_FAILED)
+				{
+					int const e = errno;
+					close(fd);
+					throw std::runtime_error(ff::fmt_str("mmap({0}) failed: {1}:{2}", path, e, strerror(e)));
+				}
+
+				madvise(p, size, MADV_SEQUENTIAL);
+				data = (uint8_t const*)p;
+			}
+
+			close(fd);
+		}
+
+		~mapped_file_t()
+		{
+			if (data)
+				munmap((void*)data, size);
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct capture_reader___native_t : public capture_reader_t
+	{
+		mapped_file_t  file_;
+		size_t         start_;
+		size_t         pos_;
+
+		capture_reader___native_t(std::string const& path)
+			: file_(path)
+		{
+			capture_file_header_t hdr;
+			if (file_.size < sizeof(hdr))
+				throw std::runtime_error(ff::fmt_str("{0}: can't read capture file header", path));
+
+			memcpy(&hdr, file_.data, sizeof(hdr));
+
+			if (hdr.version != PINBA_CAPTURE_FILE_VERSION || hdr.header_size < sizeof(hdr) || hdr.header_size > file_.size)
+				throw std::runtime_error(ff::fmt_str("{0}: unsupported capture file version {1}, header size {2}", path, hdr.version, hdr.header_size));
+
+			start_ = hdr.header_size;
+			pos_   = start_;
+		}
+
+		virtual char const* format() const override
+		{
+			return "pinba capture";
+		}
+
+		virtual bool next(capture_packet_t *packet) override
+		{
+			capture_record_header_t rec;
+			if (file_.size - pos_ < sizeof(rec))
+				return false;
+
+			memcpy(&rec, file_.data + pos_, sizeof(rec));
+
+			if (file_.size - pos_ - sizeof(rec) < rec.size)
+				return false;
+
+			packet->ts_ns = rec.ts_ns;
+			packet->data  = str_ref { (char const*)file_.data + pos_ + sizeof(rec), rec.size };
+
+			pos_ += sizeof(rec) + align8(rec.size);
+			pos_ = std::min(pos_, file_.size); // last record's padding might be cut short
+			return true;
+		}
+
+		virtual void rewind() override
+		{
+			pos_ = start_;
+		}
+
+		virtual uint64_t n_skipped() const override
+		{
+			return 0;
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct capture_reader___pcap_t : public capture_reader_t
+	{
+		mapped_file_t  file_;
+		bool           swapped_;
+		bool           nsec_;
+		uint32_t       linktype_;
+		uint16_t       udp_port_;
+		size_t         pos_;
+		uint64_t       n_skipped_;
+
+		static constexpr size_t const file_header_size   = 24;
+		static constexpr size_t const record_header_size = 16;
+
+		capture_reader___pcap_t(std::string const& path, uint16_t udp_port)
+			: file_(path)
+			, udp_port_(udp_port)
+			, pos_(file_header_size)
+			, n_skipped_(0)
+		{
+			if (file_.size < file_header_size)
+				throw std::runtime_error(ff::fmt_str("{0}: can't read pcap header", path));
+
+			uint32_t magic;
+			memcpy(&magic, file_.data, sizeof(magic));
+
+			switch (magic)
+			{
+				case 0xa1b2c3d4: swapped_ = false; nsec_ = false; break;
+				case 0xa1b23c4d: swapped_ = false; nsec_ = true;  break;
+				case 0xd4c3b2a1: swapped_ = true;  nsec_ = false; break;
+				case 0x4d3cb2a1: swapped_ = true;  nsec_ = true;  break;
+				default:
+					throw std::runtime_error(ff::fmt_str("{0}: not a pcap file (pcapng is not supported, convert with editcap -F pcap)", path));
+			}
+
+			linktype_ = pcap_u32(file_.data + 20, swapped_);
+
+			switch (linktype_)
+			{
+				case 1:   // DLT_EN10MB
+				case 101: // DLT_RAW
+				case 113: // DLT_LINUX_SLL
+					break;
+
+				default:
+					throw std::runtime_error(ff::fmt_str("{0}: unsupported pcap link type {1}", path, linktype_));
+			}
+		}
+
+		virtual char const* format() const override
+		{
+			return "pcap";
+		}
+
+		virtual bool next(capture_packet_t *packet) override
+		{
+			while (file_.size - pos_ >= record_header_size)
+			{
+				uint8_t const *rec = file_.data + pos_;
+
+				uint32_t const ts_sec  = pcap_u32(rec + 0, swapped_);
+				uint32_t const ts_frac = pcap_u32(rec + 4, swapped_);
+				uint32_t const caplen  = pcap_u32(rec + 8, swapped_);
+
+				if (file_.size - pos_ - record_header_size < caplen)
+					return false; // capture cut short
+
+				pos_ += record_header_size + caplen;
+
+				if (!this->udp_payload_from_frame(rec + record_header_size, caplen, &packet->data))
+				{
+					n_skipped_++;
+					continue;
+				}
+
+				packet->ts_ns = uint64_t(ts_sec) * nsec_in_sec + ((nsec_) ? ts_frac : uint64_t(ts_frac) * 1000);
+				return true;
+			}
+
+			return false;
+		}
+
+		virtual void rewind() override
+		{
+			pos_ = file_header_size;
+		}
+
+		virtual uint64_t n_skipped() const override
+		{
+			return n_skipped_;
+		}
+
+	private:
+
+		// udp payload from link layer frame, false if it's not a udp datagram we want
+		bool udp_payload_from_frame(uint8_t const *p, size_t sz, str_ref *payload) const
+		{
+			uint16_t ethertype = 0;
+
+			switch (linktype_)
+			{
+				case 1: // DLT_EN10MB
+					if (sz < 14) return false;
+					ethertype = be_u16(p + 12);
+					p += 14; sz -= 14;
+
+					if (ethertype == 0x8100 && sz >= 4) // single vlan tag
+					{
+						ethertype = be_u16(p + 2);
+						p += 4; sz -= 4;
+					}
+					break;
+
+				case 113: // DLT_LINUX_SLL
+					if (sz < 16) return false;
+					ethertype = be_u16(p + 14);
+					p += 16; sz -= 16;
+					break;
+
+				case 101: // DLT_RAW
+					if (sz < 1) return false;
+					ethertype = ((p[0] >> 4) == 6) ? 0x86dd : 0x0800;
+					break;
+			}
+
+			uint8_t proto = 0;
+
+			if (ethertype == 0x0800)
+			{
+				if (sz < 20) return false;
+
+				size_t const hdr_len = (p[0] & 0x0f) * 4;
+				bool const fragment = (be_u16(p + 6) & 0x3fff) != 0; // MF flag or non-zero offset
+				if (fragment || hdr_len < 20 || sz < hdr_len)
+					return false;
+
+				proto = p[9];
+				p += hdr_len; sz -= hdr_len;
+			}
+			else if (ethertype == 0x86dd)
+			{
+				if (sz < 40) return false;
+
+				proto = p[6]; // extension headers (and fragments) are not supported, skipped as not udp
+				p += 40; sz -= 40;
+			}
+			else
+			{
+				return false;
+			}
+
+			if (proto != 17 || sz < 8) // IPPROTO_UDP
+				return false;
+
+			uint16_t const dst_port = be_u16(p + 2);
+			uint16_t const udp_len  = be_u16(p + 4);
+
+			if (udp_port_ != 0 && dst_port != udp_port_)
+				return false;
+
+			if (udp_len < 8 || udp_len > sz) // truncated by snaplen
+				return false;
+
+			*payload = str_ref { (char const*)p + 8, size_t(udp_len - 8) };
+			return true;
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+capture_writer_t::capture_writer_t(std::string const& path)
+	: path_(path)
+	, fd_(-1)
+	, truncated_(false)
+{
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd_ < 0)
+		throw std::runtime_error(ff::fmt_str("can't open {0}: {1}:{2}", path, errno, strerror(errno)));
+
+	try
+	{
+		struct stat st;
+		if (0 != fstat(fd_, &st))
+			throw std::runtime_error(ff::fmt_str("fstat({0}) failed: {1}:{2}", path, errno, strerror(errno)));
+
+		if (st.st_size == 0)
+		{
+			capture_file_header_t hdr = {};
+			memcpy(hdr.magic, PINBA_CAPTURE_FILE_MAGIC, sizeof(hdr.magic));
+			hdr.version     = PINBA_CAPTURE_FILE_VERSION;
+			hdr.header_size = sizeof(hdr);
+
+			if (!this->write((char const*)&hdr, sizeof(hdr)))
+				throw std::runtime_error(ff::fmt_str("can't write {0}: {1}:{2}", path, errno, strerror(errno)));
+
+			return;
+		}
+
+		// appending to existing capture, must be ours and end on a record boundary
+		capture_file_header_t hdr;
+		if (sizeof(hdr) != pread(fd_, &hdr, sizeof(hdr), 0) || 0 != memcmp(hdr.magic, PINBA_CAPTURE_FILE_MAGIC, sizeof(hdr.magic)))
+			throw std::runtime_error(ff::fmt_str("{0} exists and is not a pinba capture file", path));
+
+		if (hdr.version != PINBA_CAPTURE_FILE_VERSION || (st.st_size % 8) != 0)
+			throw std::runtime_error(ff::fmt_str("{0}: can't append, unsupported version {1} or truncated file", path, hdr.version));
+	}
+	catch (...)
+	{
+		close(fd_);
+		throw;
+	}
+}
+
+capture_writer_t::~capture_writer_t()
+{
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+bool capture_writer_t::write(char const *data, size_t size)
+{
+	// O_APPEND makes every single write() go to the end of file, but a short write leaves the rest of the buffer
+	// to the next call, and another thread's write might get between them, lock makes the whole loop atomic
+	// it's taken once per capture_buffer_t::flush(), i.e. per few hundred kilobytes (or a second) per thread
+	std::lock_guard<std::mutex> lock_(write_mtx_);
+
+	if (truncated_)
+	{
+		errno = EIO;
+		return false;
+	}
+
+	bool written_some = false;
+
+	while (size > 0)
+	{
+		ssize_t const n = ::write(fd_, data, size);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			// file ends with a partial record, anything appended after it would be unreadable
+			if (written_some)
+				truncated_ = true;
+
+			return false;
+		}
+
+		written_some = true;
+		data += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+capture_buffer_t::capture_buffer_t(capture_writer_t *writer)
+	: writer_(writer)
+	, first_ts_ns_(0)
+	, n_write_errors_(0)
+{
+	buf_.reserve(flush_size + 64 * 1024);
+}
+
+capture_buffer_t::~capture_buffer_t()
+{
+	this->flush();
+}
+
+void capture_buffer_t::append(uint64_t ts_ns, str_ref data)
+{
+	if (buf_.empty())
+		first_ts_ns_ = ts_ns;
+
+	capture_record_header_t const rec = {
+		.ts_ns    = ts_ns,
+		.size     = (uint32_t)data.size(),
+		.reserved = 0,
+	};
+
+	static char const zeroes[8] = {};
+
+	buf_.append((char const*)&rec, sizeof(rec));
+	buf_.append(data.data(), data.size());
+	buf_.append(zeroes, aux::align8(data.size()) - data.size());
+
+	if (buf_.size() >= flush_size || ts_ns - first_ts_ns_ >= flush_age_ns)
+		this->flush();
+}
+
+bool capture_buffer_t::flush()
+{
+	if (buf_.empty())
+		return true;
+
+	bool const success = writer_->write(buf_.data(), buf_.size());
+	if (!success)
+		n_write_errors_++;
+
+	buf_.clear();
+	return success;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+capture_reader_ptr capture_reader_open(std::string const& path, uint16_t udp_port)
+{
+	// sniff the magic, pcap ones are 4 bytes
+	char magic[8] = {};
+	{
+		aux::mapped_file_t const file { path };
+		if (file.size > 0)
+			memcpy(magic, file.data, std::min(file.size, sizeof(magic)));
+	}
+
+	if (0 == memcmp(magic, PINBA_CAPTURE_FILE_MAGIC, sizeof(magic)))
+		return meow::make_unique<aux::capture_reader___native_t>(path);
+
+	return meow::make_unique<aux::capture_reader___pcap_t>(path, udp_port);
+}
@@ -1,11 +1,28 @@
 #include "pinba_config.h"
 
 #include <fcntl.h>
+#include <limits.h>     // INT_MAX
+#include <stddef.h>     // offsetof
+#include <sched.h>      // sched_yield
 #include <sys/types.h>
 #include <sys/socket.h> // setsockopt
-
+#include <sys/mman.h>   // mmap, madvise
+#include <sys/epoll.h>
+#include <sys/stat.h>   // lstat
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>  // inet_ntop
+#include <netinet/udp.h> // UDP_GRO
+#include <linux/filter.h> // sock_filter, SKF_AD_CPU
+
+#include <algorithm>
+#include <atomic>
+
+#include <memory>
 #include <stdexcept>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <nanomsg/nn.h>
@@ -21,6 +38,11 @@
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
 #include "pinba/collector.h"
+#include "pinba/capture.h"
+#include "pinba/stream_frame.h"
+#include "pinba/recv_ring.h"
+#include "pinba/source_admission.h"
+#include "pinba/repacker.h"
 #include "pinba/nmsg_socket.h"
 #include "pinba/nmsg_poller.h"
 
@@ -33,6 +55,35 @@
 #include <lz4.h>
 #endif
 
+#ifdef PINBA_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef PINBA_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// older libc headers, value is from linux/udp.h (5.0+)
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL // linux 5.11+, might be missing in older headers
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF // linux 4.5+
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#ifndef EPOLLEXCLUSIVE // linux 4.5+
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace ff = meow::format;
@@ -167,6 +218,309 @@ namespace { namespace aux {
 #endif
 	}
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// what udp reader does when it has drained the sockets (got EAGAIN)
+	//  1. spin: retry recv right away
+	//  2. yield: retry recv after sched_yield()
+	//  3. park: sleep for a while, and go back to poll
+	//
+	// spinning and yielding is only worth it when the traffic is heavy (i.e. next packet is microseconds away)
+	// so they are enabled only after 'busy' wakeups (the ones that brought at least busy_threshold packets)
+	// park time doubles from park_min to park_max while wakeups bring few packets (save on syscalls)
+	// and drops back to park_min after a busy wakeup (don't let kernel buffers overflow on bursts)
+	struct udp_idle_policy_t
+	{
+		udp_idle_policy_t(collector_conf_t const *conf)
+			: conf_(conf)
+			, busy_threshold_(1)
+			, park_for_(conf->idle_park_min)
+			, last_wakeup_busy_(false)
+			, wakeup_packets_(0)
+			, n_spins_(0)
+			, n_yields_(0)
+			, idle_start_tv_({0,0})
+			, idle_time_({0})
+		{
+		}
+
+		// how many packets per wakeup should be considered heavy traffic
+		void set_busy_threshold(uint32_t n)
+		{
+			busy_threshold_ = std::max(n, 1u);
+		}
+
+		// got some packets in current wakeup
+		void on_packets(uint32_t n)
+		{
+			wakeup_packets_ += n;
+
+			n_spins_  = 0;
+			n_yields_ = 0;
+
+			this->stop_idle_clock();
+		}
+
+		// got EAGAIN
+		// returns true if caller should retry recv right away, false - should end this wakeup
+		bool should_retry()
+		{
+			bool const busy = last_wakeup_busy_ || (wakeup_packets_ >= busy_threshold_);
+			if (!busy)
+				return false;
+
+			if (n_spins_ < conf_->idle_spin_count)
+			{
+				this->start_idle_clock();
+				n_spins_++;
+				__builtin_ia32_pause();
+				return true;
+			}
+
+			if (n_yields_ < conf_->idle_yield_count)
+			{
+				this->start_idle_clock();
+				n_yields_++;
+				sched_yield();
+				return true;
+			}
+
+			return false;
+		}
+
+		// done with current wakeup, park before polling again (if allowed)
+		void end_wakeup(bool can_park)
+		{
+			hist_[hist_bucket(wakeup_packets_)]++;
+
+			bool const busy = (wakeup_packets_ >= busy_threshold_);
+
+			park_for_ = (busy)
+						? conf_->idle_park_min
+						: std::min(std::max(park_for_ * 2, d_microsecond), conf_->idle_park_max);
+
+			if (can_park && (park_for_ > duration_t{0}))
+			{
+				this->start_idle_clock();
+
+				timeval_t const sleep_for = timeval_from_duration(park_for_);
+				nanosleep(&sleep_for, NULL);
+			}
+
+			this->stop_idle_clock();
+
+			last_wakeup_busy_ = busy;
+			wakeup_packets_   = 0;
+			n_spins_          = 0;
+			n_yields_         = 0;
+		}
+
+		// copy accumulated stats to shared (thread) stats, caller must hold the lock
+		void export_stats(collector_stats_t *stats) const
+		{
+			std::copy(std::begin(hist_), std::end(hist_), std::begin(stats->packets_per_wakeup));
+			stats->idle_time = idle_time_;
+		}
+
+	private:
+
+		static size_t hist_bucket(uint32_t n_packets)
+		{
+			if (n_packets == 0)
+				return 0;
+
+			size_t const bucket = 1 + (31 - __builtin_clz(n_packets)); // 1 -> 1, [2,3] -> 2, [4,7] -> 3, etc.
+			return std::min(bucket, collector_stats_t::wakeup_hist_buckets - 1);
+		}
+
+		void start_idle_clock()
+		{
+			if (idle_start_tv_.tv_sec == 0 && idle_start_tv_.tv_nsec == 0)
+				idle_start_tv_ = os_unix::clock_monotonic_now();
+		}
+
+		void stop_idle_clock()
+		{
+			if (idle_start_tv_.tv_sec == 0 && idle_start_tv_.tv_nsec == 0)
+				return;
+
+			idle_time_ += duration_from_timeval(os_unix::clock_monotonic_now() - idle_start_tv_);
+			idle_start_tv_ = {0,0};
+		}
+
+	private:
+		collector_conf_t const  *conf_;
+
+		uint32_t    busy_threshold_;
+		duration_t  park_for_;
+		bool        last_wakeup_busy_;
+
+		uint32_t    wakeup_packets_;
+		uint32_t    n_spins_;
+		uint32_t    n_yields_;
+
+		timeval_t   idle_start_tv_;
+		duration_t  idle_time_;
+		uint64_t    hist_[collector_stats_t::wakeup_hist_buckets] = {};
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// stream endpoint, see collector_conf_t::stream_listen
+	struct stream_listener_t
+	{
+		std::string  endpoint;
+		fd_handle_t  fd;
+		bool         seqpacket;
+	};
+
+	stream_listener_t stream_listen_on(std::string const& endpoint)
+	{
+		auto const starts_with = [&](str_ref prefix)
+		{
+			return 0 == endpoint.compare(0, prefix.size(), prefix.data(), prefix.size());
+		};
+
+		stream_listener_t result = { .endpoint = endpoint, .fd = {}, .seqpacket = false };
+
+		if (starts_with("tcp:"))
+		{
+			std::string const hostport = endpoint.substr(4);
+
+			size_t const colon = hostport.rfind(':');
+			if (colon == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad stream endpoint '{0}', expected tcp:<host>:<port>", endpoint));
+
+			// [::1]:30003
+			std::string host = hostport.substr(0, colon);
+			if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+				host = host.substr(1, host.size() - 2);
+
+			os_addrinfo_list_ptr const ai_list = os_unix::getaddrinfo_ex(host.c_str(), hostport.substr(colon + 1).c_str(), AF_UNSPEC, SOCK_STREAM, 0);
+			os_addrinfo_t const *ai = ai_list.get(); // take 1st item, same as udp
+
+			result.fd = fd_handle_t { os_unix::socket_ex(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol) };
+			os_unix::setsockopt_ex(*result.fd, SOL_SOCKET, SO_REUSEADDR, 1);
+			os_unix::bind_ex(*result.fd, ai->ai_addr, ai->ai_addrlen);
+		}
+		else if (starts_with("unix:") || starts_with("unix-seqpacket:"))
+		{
+			result.seqpacket = starts_with("unix-seqpacket:");
+
+			std::string const path = endpoint.substr(endpoint.find(':') + 1);
+
+			struct sockaddr_un sun = {};
+			sun.sun_family = AF_UNIX;
+
+			if (path.empty() || path.size() >= sizeof(sun.sun_path))
+				throw std::runtime_error(ff::fmt_str("bad stream endpoint '{0}', path must be 1 to {1} bytes long", endpoint, sizeof(sun.sun_path) - 1));
+
+			memcpy(sun.sun_path, path.data(), path.size());
+			socklen_t sun_len = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+
+			if (path[0] == '@') // abstract namespace, no file, not nul-terminated
+			{
+				sun.sun_path[0] = '\0';
+				sun_len -= 1;
+			}
+			else
+			{
+				// stale socket from previous run, but never remove anything else
+				struct stat st;
+				if (0 == lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+					unlink(path.c_str());
+			}
+
+			result.fd = fd_handle_t { os_unix::socket_ex(AF_UNIX, (result.seqpacket ? SOCK_SEQPACKET : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) };
+			os_unix::bind_ex(*result.fd, (struct sockaddr*)&sun, sun_len);
+		}
+		else
+		{
+			throw std::runtime_error(ff::fmt_str("bad stream endpoint '{0}', expected tcp:<host>:<port>, unix:<path> or unix-seqpacket:<path>", endpoint));
+		}
+
+		if (0 != listen(*result.fd, SOMAXCONN))
+			throw std::runtime_error(ff::fmt_str("listen() on '{0}' failed: {1}:{2}", endpoint, errno, strerror(errno)));
+
+		return result;
+	}
+
+	// accepted stream connection, see stream_frame_buffer_t for framing
+	// seqpacket messages must contain whole datagrams (any number of them), and fit into the buffer
+	struct stream_conn_t : private boost::noncopyable
+	{
+		fd_handle_t            fd;
+		bool                   seqpacket;
+		stream_frame_buffer_t  frames;
+
+		stream_conn_t(int f, bool seqpacket)
+			: fd(f)
+			, seqpacket(seqpacket)
+		{
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef PINBA_HAVE_ZSTD
+	// pre-trained zstd dictionaries, see collector_conf_t::zstd_dictionaries
+	// loaded once at startup and read-only after that, so shared by all reader threads (decompression contexts are per thread)
+	struct zstd_dictionaries_t : private boost::noncopyable
+	{
+		std::vector<std::pair<uint32_t, ZSTD_DDict*>> dicts; // id -> dictionary, there are just a few
+
+		~zstd_dictionaries_t()
+		{
+			for (auto const& d : dicts)
+				ZSTD_freeDDict(d.second);
+		}
+
+		// NULL if not found, frames without dictionary have id 0, and that one is never loaded
+		ZSTD_DDict const* find(uint32_t id) const
+		{
+			for (auto const& d : dicts)
+			{
+				if (d.first == id)
+					return d.second;
+			}
+			return NULL;
+		}
+
+		uint32_t load(std::string const& path)
+		{
+			std::string data;
+			{
+				FILE *f = fopen(path.c_str(), "rb");
+				if (!f)
+					throw std::runtime_error(ff::fmt_str("can't open zstd dictionary '{0}': {1}", path, strerror(errno)));
+				MEOW_DEFER(fclose(f););
+
+				char buf[64 * 1024];
+				while (size_t const n = fread(buf, 1, sizeof(buf), f))
+					data.append(buf, n);
+
+				if (ferror(f))
+					throw std::runtime_error(ff::fmt_str("can't read zstd dictionary '{0}'", path));
+			}
+
+			// raw content dictionaries have id 0, can't pick those by frame dictionary id
+			uint32_t const id = ZSTD_getDictID_fromDict(data.data(), data.size());
+			if (id == 0)
+				throw std::runtime_error(ff::fmt_str("zstd dictionary '{0}' has no id, train it with zstd --train or pinba2_train_dict", path));
+
+			if (this->find(id) != NULL)
+				throw std::runtime_error(ff::fmt_str("zstd dictionary '{0}' has the same id {1} as one of the others", path, id));
+
+			ZSTD_DDict *ddict = ZSTD_createDDict(data.data(), data.size());
+			if (ddict == NULL)
+				throw std::runtime_error(ff::fmt_str("can't load zstd dictionary '{0}'", path));
+
+			dicts.emplace_back(id, ddict);
+			return id;
+		}
+	};
+#endif // PINBA_HAVE_ZSTD
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	struct collector_impl_t : public collector_t
@@ -179,9 +533,25 @@ namespace { namespace aux {
 			if (conf_->n_threads == 0 || conf_->n_threads > 1024)
 				throw std::runtime_error(ff::fmt_str("collector_conf_t::n_threads must be within [1, 1023]"));
 
-			out_sock_
-				.open(AF_SP, NN_PUSH)
-				.bind(conf_->nn_output);
+			// traffic is spread over all reader sockets by SO_REUSEPORT, so split the target between them
+			if (conf_->rcvbuf_absorb_mbps > 0 && conf_->rcvbuf_absorb_time > duration_t{0})
+			{
+				uint64_t const bytes_per_sec = uint64_t(conf_->rcvbuf_absorb_mbps) * 1000 * 1000 / 8;
+				uint64_t const bytes_total   = bytes_per_sec * conf_->rcvbuf_absorb_time.nsec / nsec_in_sec;
+				uint64_t const bytes         = bytes_total / conf_->n_threads;
+
+				// kernel doubles the value internally, keep it within int after that
+				rcvbuf_bytes_ = (int)std::min<uint64_t>(bytes, INT_MAX / 2);
+
+				LOG_INFO(globals_->logger(), "udp_reader; to absorb {0}ms at {1} Mbit/s, need {2} bytes of receive buffer, {3} per socket",
+					conf_->rcvbuf_absorb_time.nsec / d_millisecond.nsec, conf_->rcvbuf_absorb_mbps, bytes_total, rcvbuf_bytes_);
+			}
+
+			if (conf_->reuseport_cpu_steering && conf_->n_threads > 1)
+				this->make_cpu_steering_program();
+
+			if (!conf_->stream_listen.empty() && (conf_->stream_threads == 0 || conf_->stream_threads > 1024))
+				throw std::runtime_error(ff::fmt_str("collector_conf_t::stream_threads must be within [1, 1024]"));
 
 			shutdown_sock_
 				.open(AF_SP, NN_PULL)
@@ -191,6 +561,40 @@ namespace { namespace aux {
 				.open(AF_SP, NN_PUSH)
 				.connect(conf_->nn_shutdown);
 
+			if (!conf_->zstd_dictionaries.empty())
+				this->load_zstd_dictionaries();
+
+			if (conf_->admission_rate > 0)
+			{
+				admission_ = meow::make_unique<source_admission_t>(conf_);
+
+				LOG_INFO(globals_->logger(), "udp_reader; per-source admission: {0} packets/sec, burst {1}, sampling 1/{2} above that, {3} slots",
+					conf_->admission_rate, conf_->admission_burst, conf_->admission_sample_n, conf_->admission_slots);
+			}
+
+			if (!conf_->capture_file.empty())
+			{
+				capture_ = meow::make_unique<capture_writer_t>(conf_->capture_file);
+
+				LOG_INFO(globals_->logger(), "udp_reader; capturing 1/{0} of datagrams to {1}", std::max(conf_->capture_sample_n, 1u), conf_->capture_file);
+			}
+
+			// replay mode, no sockets, open the file here to fail early
+			if (!conf_->replay_file.empty())
+			{
+				capture_reader_ptr const reader = capture_reader_open(conf_->replay_file, 0);
+
+				LOG_INFO(globals_->logger(), "udp_replay; replaying {0} file {1}, {2} times at {3}% speed",
+					reader->format(), conf_->replay_file, conf_->replay_loops, conf_->replay_speed);
+				return;
+			}
+
+			if (conf_->inject_only)
+			{
+				LOG_INFO(globals_->logger(), "udp_reader; inject only mode, not listening on anything");
+				return;
+			}
+
 			this->try_resolve_listen_addr_port();
 		}
 
@@ -204,7 +608,18 @@ namespace { namespace aux {
 			if (!threads_.empty())
 				throw std::logic_error("collector_t::startup(): already started");
 
-			stats_->collector_threads.resize(conf_->n_threads);
+			// stream readers' stats go after udp readers'
+			uint32_t const n_stream_threads = (conf_->stream_listen.empty()) ? 0 : conf_->stream_threads;
+			stats_->collector_threads.resize(conf_->n_threads + n_stream_threads);
+
+			if (!conf_->replay_file.empty())
+			{
+				this->start_replay_threads();
+				return;
+			}
+
+			if (conf_->inject_only)
+				return;
 
 			for (uint32_t i = 0; i < conf_->n_threads; i++)
 			{
@@ -213,7 +628,7 @@ namespace { namespace aux {
 				// per-thread SO_REUSEPORT bind
 				MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(curr_ai, ai_list_)
 				{
-					auto fd_h = this->try_bind_to_addr(curr_ai);
+					auto fd_h = this->try_bind_to_addr(curr_ai, i);
 					fds.push_back(std::move(fd_h));
 				}
 
@@ -223,6 +638,7 @@ namespace { namespace aux {
 					std::string const thr_name = ff::fmt_str("udp_reader/{0}", i);
 
 					PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+					pinba_thread_affinity___apply(globals_, conf_->affinity, i, thr_name);
 
 					MEOW_DEFER(
 						LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
@@ -233,6 +649,8 @@ namespace { namespace aux {
 
 				threads_.push_back(move(t));
 			}
+
+			this->start_stream_readers();
 		}
 
 		virtual void shutdown() override
@@ -253,8 +671,125 @@ namespace { namespace aux {
 			threads_.clear();
 		}
 
+		virtual std::vector<collector_source_stats_t> get_source_stats() override
+		{
+			if (!admission_)
+				return {};
+
+			return admission_->get_stats(duration_from_timeval(os_unix::clock_monotonic_now()).nsec);
+		}
+
+		virtual collector_injector_ptr create_injector() override
+		{
+			// ids after reader threads (udp and stream), only used for logging
+			uint32_t const id = conf_->n_threads + conf_->stream_threads + injector_id_.fetch_add(1, std::memory_order_relaxed);
+			return meow::make_unique<injector_impl_t>(this, id);
+		}
+
 	private:
 
+		void start_replay_threads()
+		{
+			for (uint32_t i = 0; i < conf_->n_threads; i++)
+			{
+				std::thread t([this, i]()
+				{
+					std::string const thr_name = ff::fmt_str("udp_replay/{0}", i);
+
+					PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+					pinba_thread_affinity___apply(globals_, conf_->affinity, i, thr_name);
+
+					MEOW_DEFER(
+						LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+					);
+
+					this->eat_replay(i);
+				});
+
+				threads_.push_back(move(t));
+			}
+		}
+
+		void start_stream_readers()
+		{
+			std::string const& list = conf_->stream_listen;
+
+			for (size_t pos = 0; pos <= list.size(); )
+			{
+				size_t end = list.find(',', pos);
+				if (end == std::string::npos)
+					end = list.size();
+
+				std::string const endpoint = list.substr(pos, end - pos);
+				pos = end + 1;
+
+				if (endpoint.empty())
+					continue;
+
+				stream_listeners_.push_back(stream_listen_on(endpoint));
+				LOG_INFO(globals_->logger(), "stream_reader; listening on {0}", endpoint);
+			}
+
+			if (stream_listeners_.empty())
+				return;
+
+			// udp reader cpus are not shared with stream readers, these get cpus listed after the udp reader ones
+			// no extra cpus -> not bound (but a single cpuset, like numa node cpus, is for all reader threads)
+			thread_affinity_t stream_affinity = conf_->affinity;
+			{
+				auto const& cpusets = conf_->affinity.cpusets;
+
+				if (cpusets.size() > conf_->n_threads)
+					stream_affinity.cpusets.assign(cpusets.begin() + conf_->n_threads, cpusets.end());
+				else if (cpusets.size() > 1)
+					stream_affinity.cpusets.clear();
+			}
+
+			for (uint32_t i = 0; i < conf_->stream_threads; i++)
+			{
+				std::thread t([this, i, stream_affinity]()
+				{
+					std::string const thr_name = ff::fmt_str("stream_reader/{0}", i);
+
+					PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+					pinba_thread_affinity___apply(globals_, stream_affinity, i, thr_name);
+
+					MEOW_DEFER(
+						LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+					);
+
+					this->eat_stream(conf_->n_threads + i, thr_name);
+				});
+
+				threads_.push_back(move(t));
+			}
+		}
+
+		void load_zstd_dictionaries()
+		{
+#ifdef PINBA_HAVE_ZSTD
+			std::string const& list = conf_->zstd_dictionaries;
+
+			for (size_t pos = 0; pos <= list.size(); )
+			{
+				size_t end = list.find(',', pos);
+				if (end == std::string::npos)
+					end = list.size();
+
+				std::string const path = list.substr(pos, end - pos);
+				pos = end + 1;
+
+				if (path.empty())
+					continue;
+
+				uint32_t const id = zstd_dicts_.load(path);
+				LOG_INFO(globals_->logger(), "udp_reader; loaded zstd dictionary {0}, id {1}", path, id);
+			}
+#else
+			throw std::runtime_error(ff::fmt_str("zstd dictionaries are set, but pinba is built without zstd support (--with-zstd)"));
+#endif
+		}
+
 		void try_resolve_listen_addr_port()
 		{
 			os_addrinfo_list_ptr ai_list = os_unix::getaddrinfo_ex(conf_->address.c_str(), conf_->port.c_str(), AF_UNSPEC, SOCK_DGRAM, 0);
@@ -269,146 +804,1028 @@ namespace { namespace aux {
 			ai_list_ = std::move(ai_list);
 		}
 
-		fd_handle_t try_bind_to_addr(os_addrinfo_t *ai)
+		// thread_id is also the socket index in SO_REUSEPORT group, as sockets are bound in thread order
+		fd_handle_t try_bind_to_addr(os_addrinfo_t *ai, uint32_t thread_id)
 		{
 			fd_handle_t fd { os_unix::socket_ex(ai->ai_family, ai->ai_socktype, ai->ai_protocol) };
 			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEADDR, 1);
 			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEPORT, 1);
 			if (ai->ai_family == AF_INET6)
 				os_unix::setsockopt_ex(*fd, IPPROTO_IPV6, IPV6_V6ONLY, 1);
-			os_unix::bind_ex(*fd, ai->ai_addr, ai->ai_addrlen);
 
-			return fd;
-		}
+			// busy polling is an optimization, raising it above net.core.busy_read requires CAP_NET_ADMIN
+			// so just warn on failures
+			if (conf_->busy_poll_usec > 0)
+			{
+				int const busy_poll_usec = conf_->busy_poll_usec;
+				if (0 != setsockopt(*fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_usec, sizeof(busy_poll_usec)))
+					LOG_WARN(globals_->logger(), "udp_reader; setsockopt(SO_BUSY_POLL, {0}) failed: {1}:{2}", busy_poll_usec, errno, strerror(errno));
 
-	private: // per-thread stuff
+				int const prefer_busy_poll = 1;
+				if (0 != setsockopt(*fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer_busy_poll, sizeof(prefer_busy_poll)))
+					LOG_WARN(globals_->logger(), "udp_reader; setsockopt(SO_PREFER_BUSY_POLL) failed: {0}:{1}", errno, strerror(errno));
+			}
 
-		void send_current_batch(uint32_t thread_id, raw_request_ptr& req)
-		{
-			stats_->udp.batch_send_total++;
-			stats_->udp.packet_send_total += req->request_count;
+			// kernel attaches socket drop counter to received datagrams, see account_kernel_drops()
+			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_RXQ_OVFL, 1);
 
-			bool const success = out_sock_.send_message(req, NN_DONTWAIT);
-			if (!success)
+			if (rcvbuf_bytes_ > 0)
+				this->try_set_rcvbuf(*fd);
+
+			// old kernels don't have it, everything works without, just slower
+			if (conf_->gro)
 			{
-				stats_->udp.batch_send_err++;
-				stats_->udp.packet_send_err += req->request_count;
+				int const enable = 1;
+				if (0 != setsockopt(*fd, SOL_UDP, UDP_GRO, &enable, sizeof(enable)))
+					LOG_WARN(globals_->logger(), "udp_reader; setsockopt(UDP_GRO) failed: {0}:{1}", errno, strerror(errno));
 			}
 
-			req.reset(); // signal the need to reinit
-		}
+			os_unix::bind_ex(*fd, ai->ai_addr, ai->ai_addrlen);
 
-		void eat_udp(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
-		{
-			if (globals_->os_symbols()->has_recvmmsg())
-				this->eat_udp_recvmmsg(thread_id, fds);
+			// program is shared by the whole reuseport group, attach it once, to the first socket
+			// on failure kernel keeps distributing packets by flow hash
+			if (thread_id == 0 && !steering_prog_.empty())
+			{
+				sock_fprog const fprog = {
+					.len    = (unsigned short)steering_prog_.size(),
+					.filter = steering_prog_.data(),
+				};
+
+				if (0 != setsockopt(*fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)))
+					LOG_WARN(globals_->logger(), "udp_reader; setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed: {0}:{1}", errno, strerror(errno));
+			}
+
+			return fd;
+		}
+
+		// reuseport cpu steering, see collector_conf_t::reuseport_cpu_steering
+		// classic bpf program returns socket index in reuseport group (== reader thread id) for the cpu packet is received on
+		//
+		//   A = cpu
+		//   if (A == cpu_0) return reader_0   // readers pinned to single cpus, one check per reader
+		//   ...
+		//   return A % n_threads              // everything else
+		//
+		// kernel falls back to flow hash if returned index is out of range, i.e. while not all sockets are bound yet
+		void make_cpu_steering_program()
+		{
+			auto& prog = steering_prog_;
+			auto const& cpusets = conf_->affinity.cpusets;
+
+			prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+
+			bool const single_cpu_readers = !cpusets.empty() && std::all_of(cpusets.begin(), cpusets.end(), [](cpu_set_t const& cpuset)
+			{
+				return CPU_COUNT(&cpuset) == 1;
+			});
+
+			if (single_cpu_readers)
+			{
+				cpu_set_t seen;
+				CPU_ZERO(&seen);
+
+				std::string mapping;
+
+				for (uint32_t i = 0; i < conf_->n_threads; i++)
+				{
+					cpu_set_t const& cpuset = cpusets[i % cpusets.size()];
+
+					int cpu = 0;
+					while (!CPU_ISSET(cpu, &cpuset))
+						cpu++;
+
+					// same cpu given to multiple readers, first one gets all its packets
+					if (CPU_ISSET(cpu, &seen))
+						continue;
+					CPU_SET(cpu, &seen);
+
+					prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpu, 0, 1));
+					prog.push_back(BPF_STMT(BPF_RET | BPF_K, i));
+
+					mapping += ff::fmt_str("{0}{1}->{2}", (mapping.empty() ? "" : ", "), cpu, i);
+				}
+
+				LOG_INFO(globals_->logger(), "udp_reader; reuseport cpu steering, cpu -> reader: {0}, other cpus: cpu % {1}", mapping, conf_->n_threads);
+			}
 			else
-				this->eat_udp_recv(thread_id, fds);
+			{
+				LOG_INFO(globals_->logger(), "udp_reader; reuseport cpu steering, reader = cpu % {0}", conf_->n_threads);
+			}
+
+			prog.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, conf_->n_threads));
+			prog.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+		}
+
+		// rcvbuf sizing, see collector_conf_t::rcvbuf_absorb_*
+		// default kernel limits (net.core.rmem_default, rmem_max) are usually too small to survive even short stalls at high rates
+		//
+		// SO_RCVBUFFORCE ignores net.core.rmem_max, but needs CAP_NET_ADMIN, fall back to SO_RCVBUF that is silently capped
+		// kernel doubles the value for bookkeeping overhead, and reports it doubled as well
+		void try_set_rcvbuf(int fd)
+		{
+			int const wanted = rcvbuf_bytes_;
+
+			if (0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &wanted, sizeof(wanted)))
+			{
+				if (0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &wanted, sizeof(wanted)))
+				{
+					LOG_WARN(globals_->logger(), "udp_reader; setsockopt(SO_RCVBUF, {0}) failed: {1}:{2}", wanted, errno, strerror(errno));
+					return;
+				}
+			}
+
+			int       got    = 0;
+			socklen_t got_sz = sizeof(got);
+			if (0 != getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &got, &got_sz))
+				return;
+
+			got /= 2;
+
+			// all sockets get the same treatment, no need to repeat ourselves
+			if (rcvbuf_reported_)
+				return;
+			rcvbuf_reported_ = true;
+
+			if (got >= wanted)
+			{
+				LOG_INFO(globals_->logger(), "udp_reader; SO_RCVBUF set to {0} bytes per socket", got);
+				return;
+			}
+
+			std::string const rmem_max = [&]() -> std::string
+			{
+				FILE *f = fopen("/proc/sys/net/core/rmem_max", "r");
+				if (!f)
+					return "unknown";
+				MEOW_DEFER(
+					fclose(f);
+				);
+
+				unsigned long v = 0;
+				return (fscanf(f, "%lu", &v) == 1) ? ff::fmt_str("{0}", v) : "unknown";
+			}();
+
+			LOG_WARN(globals_->logger(), "udp_reader; SO_RCVBUF capped at {0} bytes per socket (wanted {1}), net.core.rmem_max = {2}; "
+				"raise it with 'sysctl -w net.core.rmem_max={1}' or give CAP_NET_ADMIN to use SO_RCVBUFFORCE",
+				got, wanted, rmem_max);
+		}
+
+	private: // per-thread stuff
+
+		// control messages we ask for: SO_RXQ_OVFL (uint32_t) and UDP_GRO (int)
+		static constexpr size_t const control_buffer_size = CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+
+		// state shared by all receive loops of a single reader thread
+		struct reader_thread_t
+		{
+			uint32_t            thread_id;              // index in pinba_stats_t::collector_threads
+			std::string         name;                   // for logging
+			nmsg_pool_ptr<raw_request_t> req_pool;  // sent batches come back here, when repackers are done with them
+			raw_request_ptr     req;
+			ProtobufCAllocator  request_unpack_pba;
+			udp_idle_policy_t   idle;
+			char                decompress_buf[64 * 1024]; // re-used buffer for decompression
+#ifdef PINBA_HAVE_ZSTD
+			std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> zstd_dctx = { NULL, ZSTD_freeDCtx }; // created on first use
+#endif
+
+			std::vector<uint32_t> last_drops;           // last seen SO_RXQ_OVFL counter, per socket
+			uint64_t            kernel_drops;           // total drops on all sockets
+
+			uint64_t            rng;                    // admission and capture sampling random state
+			uint64_t            recv_time_ns;           // monotonic time of last recv call, maintained only when admission is on
+
+			std::unique_ptr<capture_buffer_t> capture;  // NULL = not capturing
+			uint64_t            capture_time_ns;        // realtime of last recv call, maintained only when capturing
+
+			repacker_worker_ptr repacker;               // fused mode, datagrams are repacked right here, NULL otherwise
+
+			reader_thread_t(uint32_t id, collector_conf_t const *conf, size_t n_fds, capture_writer_t *capture_writer)
+				: thread_id(id)
+				, name(ff::fmt_str("udp_reader/{0}", id))
+				, req_pool(nmsg_pool_t<raw_request_t>::create())
+				, idle(conf)
+				, last_drops(n_fds, 0)
+				, kernel_drops(0)
+				, rng(0x9e3779b97f4a7c15ULL * (id + 1))
+				, recv_time_ns(0)
+				, capture((capture_writer) ? meow::make_unique<capture_buffer_t>(capture_writer) : nullptr)
+				, capture_time_ns(0)
+				, repacker((conf->repacker->is_fused()) ? conf->repacker->create_worker() : nullptr)
+			{
+				request_unpack_pba = {
+					.alloc = nmpa___pba_alloc,
+					.free = nmpa___pba_free,
+					.allocator_data = NULL, // changed in progress
+				};
+			}
+		};
+
+		bool send_current_batch(uint32_t thread_id, raw_request_ptr& req)
+		{
+			stats_->udp.batch_send_total++;
+			stats_->udp.packet_send_total += req->request_count;
+
+			bool const success = conf_->repacker->dispatch(req);
+			if (!success)
+			{
+				stats_->udp.batch_send_err++;
+				stats_->udp.packet_send_err += req->request_count;
+			}
+
+			req.reset(); // signal the need to reinit
+			return success;
+		}
+
+		// current batch is either raw_request_t, or packet_batch_t being built by fused repacker
+		static bool has_pending_batch(reader_thread_t const *rt)
+		{
+			if (rt->repacker)
+				return rt->repacker->has_pending_batch();
+
+			return rt->req && rt->req->request_count > 0;
+		}
+
+		void send_pending_batch(reader_thread_t *rt)
+		{
+			if (rt->repacker)
+				rt->repacker->flush();
+			else
+				this->send_current_batch(rt->thread_id, rt->req);
+		}
+
+		// see collector_injector_t, it's a reader thread without sockets and poller
+		// datagrams go through the same path as received ones, i.e. are counted in udp stats, admitted, captured, etc.
+		struct injector_impl_t : public collector_injector_t
+		{
+			collector_impl_t  *self_;
+			reader_thread_t   rt_;
+			uint64_t          n_datagrams_;
+			timeval_t         next_tick_tv_;  // fused repacker maintenance, there is no poller to call it
+
+			injector_impl_t(collector_impl_t *self, uint32_t id)
+				: self_(self)
+				, rt_(id, self->conf_, 0, self->capture_.get())
+				, n_datagrams_(0)
+				, next_tick_tv_(os_unix::clock_monotonic_now() + repacker_worker_t::tick_interval())
+			{
+			}
+
+			void maybe_tick_repacker()
+			{
+				timeval_t const now = os_unix::clock_monotonic_now();
+				if (now < next_tick_tv_)
+					return;
+
+				rt_.repacker->tick(now);
+				next_tick_tv_ = now + repacker_worker_t::tick_interval();
+			}
+
+			~injector_impl_t()
+			{
+				this->flush();
+			}
+
+			virtual bool inject_batch(raw_request_ptr req) override
+			{
+				self_->stats_->udp.recv_packets += req->request_count;
+
+				if (!rt_.repacker)
+					return self_->send_current_batch(rt_.thread_id, req);
+
+				// fused mode, nobody reads collector output, repack right here
+				// repacker worker results are "packet batch has been sent", not errors, nothing is dropped on this path
+				this->maybe_tick_repacker();
+
+				for (uint32_t i = 0; i < req->request_count; i++)
+				{
+					if (req->request_data != NULL)
+					{
+						ProtobufCBinaryData const& data = req->request_data[i];
+						rt_.repacker->process_request_data(str_ref { (char const*)data.data, data.len });
+					}
+					else
+					{
+						rt_.repacker->process_request(req->requests[i]);
+					}
+				}
+				return true;
+			}
+
+			virtual bool inject_datagram(str_ref bytes) override
+			{
+				++self_->stats_->udp.recv_packets;
+
+				if (rt_.repacker && (++n_datagrams_ % 1024) == 0)
+					this->maybe_tick_repacker();
+
+				self_->update_recv_time(&rt_);
+				return self_->handle_received_bytes(&rt_, bytes, 0, NULL);
+			}
+
+			virtual void flush() override
+			{
+				if (rt_.capture)
+					rt_.capture->flush();
+
+				if (!self_->has_pending_batch(&rt_))
+					return;
+
+				self_->send_pending_batch(&rt_);
+			}
+		};
+
+		// decompress PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT datagram into rt->decompress_buf
+		// dictionary is picked by id from frame header, unknown ids (and frames without dictionary) are errors
+		bool decompress_zstd_dict(reader_thread_t *rt, net_datagram_t *dgram)
+		{
+#ifdef PINBA_HAVE_ZSTD
+			ZSTD_DDict const *ddict = zstd_dicts_.find(ZSTD_getDictID_fromFrame(dgram->data.data(), dgram->data.size()));
+			if (ddict == NULL)
+				return false;
+
+			if (!rt->zstd_dctx)
+			{
+				rt->zstd_dctx.reset(ZSTD_createDCtx());
+				if (!rt->zstd_dctx)
+					return false;
+			}
+
+			size_t const n = ZSTD_decompress_usingDDict(rt->zstd_dctx.get(), rt->decompress_buf, sizeof(rt->decompress_buf), dgram->data.data(), dgram->data.size(), ddict);
+			if (ZSTD_isError(n) || n == 0)
+				return false;
+
+			dgram->data = str_ref { rt->decompress_buf, n };
+			return true;
+#else
+			// no dictionaries can be loaded without zstd, so this is just an unknown one
+			return false;
+#endif
+		}
+
+		// parse incoming bytes, maybe decompress them, unpack protobuf and push request into current batch
+		//  returns true if current batch has been sent as a result (i.e. it became full)
+		bool handle_datagram(reader_thread_t *rt, str_ref network_bytes)
+		{
+			if (rt->capture)
+				this->maybe_capture_datagram(rt, network_bytes);
+
+			net_datagram_t dgram = parse_network_datagram(network_bytes);
+
+			// maybe decompress, use thread-local tmp buffer as destination
+			if (dgram.version == 1)
+			{
+				bool ok = true;
+
+				if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT) != 0)
+					ok = this->decompress_zstd_dict(rt, &dgram);
+				else if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0)
+					ok = decompress_network_datagram(&dgram, rt->decompress_buf, sizeof(rt->decompress_buf));
+
+				if (!ok)
+				{
+					++stats_->udp.packet_decompress_err;
+					++stats_->udp.packet_decode_err;
+					return false;
+				}
+			}
+
+			// fused mode, no raw_request_t at all, straight to packets
+			if (rt->repacker)
+				return rt->repacker->process_request_data(dgram.data);
+
+			if (!rt->req)
+			{
+				constexpr size_t nmpa_block_size = 16 * 1024;
+				rt->req = rt->req_pool->get(conf_->batch_size, nmpa_block_size, conf_->raw_requests);
+				rt->request_unpack_pba.allocator_data = &rt->req->nmpa;
+			}
+
+			if (conf_->raw_requests)
+			{
+				// receive and decompress buffers are reused, so need a copy
+				// that's still way cheaper than unpacking, decode errors are counted by repacker
+				uint8_t *data = (uint8_t*)nmpa_alloc(&rt->req->nmpa, dgram.data.size());
+				memcpy(data, dgram.data.data(), dgram.data.size());
+
+				rt->req->request_data[rt->req->request_count] = ProtobufCBinaryData { .len = dgram.data.size(), .data = data };
+			}
+			else
+			{
+				// unpack protobuf into current batch's nmpa and push parsed request
+				Pinba__Request *request = pinba__request__unpack(&rt->request_unpack_pba, dgram.data.c_length(), (uint8_t*)dgram.data.data());
+				if (request == NULL) {
+					++stats_->udp.packet_decode_err;
+					return false;
+				}
+
+				rt->req->requests[rt->req->request_count] = request;
+			}
+			rt->req->request_count++;
+
+			if (rt->req->request_count >= conf_->batch_size)
+			{
+				this->send_current_batch(rt->thread_id, rt->req);
+				return true;
+			}
+
+			return false;
+		}
+
+		// SO_RXQ_OVFL control message carries socket drop counter (as of the time datagram has been queued)
+		// it's cumulative and 32bit, so track deltas per socket, unsigned arithmetic takes care of wraparound
+		// note that kernel only attaches it when the counter is non-zero
+		void account_kernel_drops(reader_thread_t *rt, size_t fd_index, struct cmsghdr const *cmsg)
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL)
+				return;
+
+			uint32_t drops;
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+
+			uint32_t const delta = drops - rt->last_drops[fd_index];
+			if (delta == 0)
+				return;
+
+			rt->last_drops[fd_index] = drops;
+			rt->kernel_drops += delta;
+			stats_->udp.recv_kernel_drops += delta;
+		}
+
+		// UDP_GRO control message carries segment size of a coalesced datagram, 0 if it's some other message
+		// kernel attaches it only when datagram is actually made of multiple segments
+		static int gro_segment_size(struct cmsghdr const *cmsg)
+		{
+			if (cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+				return 0;
+
+			int gso_size;
+			memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+			return gso_size;
+		}
+
+		// all control messages we're interested in, returns gro segment size (0 = not coalesced)
+		int handle_control_messages(reader_thread_t *rt, size_t fd_index, struct msghdr *msg)
+		{
+			int gso_size = 0;
+
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+			{
+				this->account_kernel_drops(rt, fd_index, cmsg);
+
+				if (int const sz = gro_segment_size(cmsg))
+					gso_size = sz;
+			}
+
+			return gso_size;
+		}
+
+		// receive loops call this once per recv*() call, clocks are read only when admission or capture need them
+		void update_recv_time(reader_thread_t *rt)
+		{
+			if (admission_)
+				rt->recv_time_ns = duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+
+			if (rt->capture)
+				rt->capture_time_ns = duration_from_timeval(os_unix::clock_gettime_ex(CLOCK_REALTIME)).nsec;
+		}
+
+		void maybe_capture_datagram(reader_thread_t *rt, str_ref network_bytes)
+		{
+			if (conf_->capture_sample_n > 1 && (next_random(&rt->rng) % conf_->capture_sample_n) != 0)
+				return;
+
+			rt->capture->append(rt->capture_time_ns, network_bytes);
+		}
+
+		// per-source rate limit, packets over the limit are sampled or dropped before decoding
+		//  returns true if packet should be processed
+		bool admit_packet(reader_thread_t *rt, struct sockaddr const *src)
+		{
+			if (!admission_ || src == NULL)
+				return true;
+
+			switch (admission_->admit(src, rt->recv_time_ns, &rt->rng))
+			{
+				case source_admission_t::verdict_t::pass:
+					return true;
+
+				case source_admission_t::verdict_t::sample:
+					stats_->udp.admission_sampled++;
+					return true;
+
+				case source_admission_t::verdict_t::drop:
+					stats_->udp.admission_dropped++;
+					return false;
+			}
+
+			return true;
+		}
+
+		// receive buffer, as returned by recv*() call, might hold many datagrams when UDP_GRO is on
+		// all of them are gso_size bytes long, except maybe the last one
+		// receive loops count buffers in recv_packets, account for the rest of the segments here
+		// src is sender address, used for admission (NULL = not known, always admitted)
+		//  returns true if current batch has been sent as a result (at least once)
+		bool handle_received_bytes(reader_thread_t *rt, str_ref bytes, int gso_size, struct sockaddr const *src)
+		{
+			stats_->udp.recv_bytes += bytes.size();
+
+			if (gso_size <= 0 || bytes.size() <= size_t(gso_size))
+				return this->admit_packet(rt, src) && this->handle_datagram(rt, bytes);
+
+			size_t const n_segments = (bytes.size() + gso_size - 1) / gso_size;
+
+			stats_->udp.recv_packets      += n_segments - 1;
+			stats_->udp.recv_gro_segments += n_segments;
+			rt->idle.on_packets(n_segments - 1);
+
+			bool batch_sent = false;
+			for (size_t offset = 0; offset < bytes.size(); offset += gso_size)
+			{
+				size_t const segment_size = std::min(size_t(gso_size), bytes.size() - offset);
+
+				if (!this->admit_packet(rt, src))
+					continue;
+
+				batch_sent |= this->handle_datagram(rt, str_ref { bytes.data() + offset, segment_size });
+			}
+
+			return batch_sent;
+		}
+
+		// stuff common to all receive loops: stats, rusage and shutdown handling
+		void setup_reader_poller(reader_thread_t *rt, nmsg_poller_t& poller)
+		{
+			uint32_t const thread_id = rt->thread_id;
+
+			// extra stats
+			poller.before_poll([this](timeval_t now, duration_t wait_for)
+			{
+				++stats_->udp.poll_total;
+			});
+
+			// periodic rusage and idle stats
+			poller.ticker(1 * d_second, [this, rt, thread_id](timeval_t now)
+			{
+				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+				std::lock_guard<std::mutex> lk_(stats_->mtx);
+				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
+				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+				rt->idle.export_stats(&stats_->collector_threads[thread_id]);
+				stats_->collector_threads[thread_id].kernel_drops = rt->kernel_drops;
+
+				// do not keep captured datagrams for too long, when there are just a few
+				if (rt->capture && !rt->capture->flush())
+					LOG_ERROR(globals_->logger(), "{0}; capture write to {1} failed: {2}:{3}", rt->name, capture_->path(), errno, strerror(errno));
+			});
+
+			// fused mode, repacker dictionary maintenance
+			if (rt->repacker)
+			{
+				poller.ticker(repacker_worker_t::tick_interval(), [rt](timeval_t now)
+				{
+					rt->repacker->tick(now);
+				});
+			}
+
+			// shutdown
+			poller.read_nn_socket(shutdown_sock_, [this, rt, &poller](timeval_t)
+			{
+				LOG_INFO(globals_->logger(), "{0}; received shutdown request", rt->name);
+				poller.set_shutdown_flag();
+			});
+		}
+
+		void eat_udp(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		{
+			reader_thread_t rt { thread_id, conf_, fds.size(), capture_.get() };
+
+#ifdef PINBA_HAVE_LIBURING
+			if (globals_->os_symbols()->has_io_uring_recvmsg_multishot())
+			{
+				if (this->eat_udp_io_uring(&rt, fds))
+					return;
+			}
+#endif
+
+			if (globals_->os_symbols()->has_recvmmsg())
+				this->eat_udp_recvmmsg(&rt, fds);
+			else
+				this->eat_udp_recv(&rt, fds);
+		}
+
+		// replay mode, see collector_conf_t::replay_*
+		// every thread walks the whole file and takes every n_threads-th datagram, much like SO_REUSEPORT would spread them
+		// datagrams are paced by their timestamps with a timerfd, so that poller keeps serving shutdown and tickers in between
+		// replayed traffic is never captured (it might even be the same file)
+		void eat_replay(uint32_t const thread_id)
+		{
+			reader_thread_t rt { thread_id, conf_, 0, NULL };
+			rt.name = ff::fmt_str("udp_replay/{0}", thread_id);
+
+			capture_reader_ptr reader;
+			try
+			{
+				reader = capture_reader_open(conf_->replay_file, 0);
+			}
+			catch (std::exception const& e)
+			{
+				LOG_ERROR(globals_->logger(), "udp_replay/{0}; exiting: {1}", thread_id, e.what());
+				return;
+			}
+
+			fd_handle_t const tfd { timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) };
+			if (*tfd < 0)
+			{
+				LOG_ERROR(globals_->logger(), "udp_replay/{0}; timerfd_create() failed, exiting: {1}:{2}", thread_id, errno, strerror(errno));
+				return;
+			}
+
+			// wake up at given monotonic time, 0 = right away
+			auto const arm_timer = [&](uint64_t when_ns)
+			{
+				struct itimerspec its = {};
+
+				if (when_ns == 0)
+				{
+					its.it_value.tv_nsec = 1;
+					timerfd_settime(*tfd, 0, &its, NULL);
+				}
+				else
+				{
+					its.it_value.tv_sec  = when_ns / nsec_in_sec;
+					its.it_value.tv_nsec = when_ns % nsec_in_sec;
+					timerfd_settime(*tfd, TFD_TIMER_ABSTIME, &its, NULL);
+				}
+			};
+
+			capture_packet_t packet;
+			bool     have_packet    = false;  // read from file, but not yet handled (as it's not due yet)
+			uint64_t file_idx       = 0;      // packet index within the file, in current loop
+			uint32_t loop_n         = 0;
+			uint64_t first_ts_ns    = 0;      // file time span, to shift timestamps for every next loop
+			uint64_t last_ts_ns     = 0;
+			uint64_t loop_offset_ns = 0;
+			uint64_t n_replayed     = 0;
+
+			uint64_t const start_ns = duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+
+			auto const next_packet = [&]() -> bool
+			{
+				if (have_packet)
+					return true;
+
+				while (true)
+				{
+					if (reader->next(&packet))
+					{
+						if (loop_n == 0 && file_idx == 0)
+							first_ts_ns = packet.ts_ns;
+						last_ts_ns = std::max(last_ts_ns, packet.ts_ns);
+
+						if ((file_idx++ % conf_->n_threads) != thread_id)
+							continue;
+
+						have_packet = true;
+						return true;
+					}
+
+					loop_n++;
+
+					if (file_idx == 0 || (conf_->replay_loops > 0 && loop_n >= conf_->replay_loops))
+						return false;
+
+					reader->rewind();
+					file_idx       = 0;
+					loop_offset_ns = loop_n * (last_ts_ns - first_ts_ns + 1);
+				}
+			};
+
+			nmsg_poller_t poller;
+			this->setup_reader_poller(&rt, poller);
+
+			// resetable periodic event, to 'idly' send batch at regular intervals
+			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			{
+				if (!this->has_pending_batch(&rt))
+					return;
+
+				this->send_pending_batch(&rt);
+			});
+
+			poller.read_plain_fd(*tfd, [&](timeval_t now)
+			{
+				uint64_t expirations;
+				ssize_t const r = read(*tfd, &expirations, sizeof(expirations));
+				(void)r; // just resetting the timer, EAGAIN is fine as well
+
+				++stats_->udp.recv_total;
+
+				uint64_t const now_ns = duration_from_timeval(now).nsec;
+
+				for (size_t i = 0; i < conf_->batch_size; i++)
+				{
+					if (!next_packet())
+					{
+						if (this->has_pending_batch(&rt))
+							this->send_pending_batch(&rt);
+
+						LOG_INFO(globals_->logger(), "udp_replay/{0}; done, {1} datagrams replayed in {2} loops, {3} pcap frames skipped",
+							thread_id, n_replayed, loop_n, reader->n_skipped());
+						return; // not re-arming, idle till shutdown
+					}
+
+					if (conf_->replay_speed > 0)
+					{
+						int64_t  const file_delta_ns = std::max<int64_t>(int64_t(packet.ts_ns + loop_offset_ns - first_ts_ns), 0);
+						uint64_t const due_ns        = start_ns + uint64_t(file_delta_ns) * 100 / conf_->replay_speed;
+
+						if (due_ns > now_ns)
+						{
+							arm_timer(due_ns);
+							return;
+						}
+					}
+
+					have_packet = false;
+					n_replayed++;
+
+					++stats_->udp.recv_packets;
+					if (this->handle_received_bytes(&rt, packet.data, 0, NULL))
+						poller.reset_ticker(batch_send_tick, now);
+				}
+
+				// batch worth of datagrams handled, let the poller serve shutdown and tickers
+				arm_timer(0);
+			});
+
+			arm_timer(0);
+			poller.loop();
 		}
 
-		void eat_udp_recv(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		// stream readers, all threads wait for connections on all listeners (EPOLLEXCLUSIVE wakes up just one)
+		// and serve connections they've accepted till these are closed
+		// datagrams from all connections go into the same batches, that are sent when there is nothing more to read
+		void eat_stream(uint32_t const thread_id, std::string const& thr_name)
 		{
-			static constexpr size_t const read_buffer_size = 64 * 1024; // max udp message size
-			char buf[read_buffer_size];
+			reader_thread_t rt { thread_id, conf_, 0, capture_.get() };
+			rt.name = thr_name;
+
+			fd_handle_t const epfd { epoll_create1(EPOLL_CLOEXEC) };
+			if (*epfd < 0)
+			{
+				LOG_ERROR(globals_->logger(), "{0}; epoll_create1() failed, exiting: {1}:{2}", thr_name, errno, strerror(errno));
+				return;
+			}
 
-			raw_request_ptr req;
+			// epoll data is listener index (with listener_tag bit set) or connection fd
+			static constexpr uint64_t const listener_tag = (1ULL << 32);
 
-			ProtobufCAllocator request_unpack_pba = {
-				.alloc = nmpa___pba_alloc,
-				.free = nmpa___pba_free,
-				.allocator_data = NULL, // changed in progress
-			};
+			std::unordered_map<int, std::unique_ptr<stream_conn_t>> conns;
+
+			for (size_t i = 0; i < stream_listeners_.size(); i++)
+			{
+				struct epoll_event ev = {};
+				ev.events   = EPOLLIN | EPOLLEXCLUSIVE;
+				ev.data.u64 = listener_tag | i;
+
+				if (0 != epoll_ctl(*epfd, EPOLL_CTL_ADD, *stream_listeners_[i].fd, &ev))
+				{
+					LOG_ERROR(globals_->logger(), "{0}; epoll_ctl({1}) failed, exiting: {2}:{3}", thr_name, stream_listeners_[i].endpoint, errno, strerror(errno));
+					return;
+				}
+			}
 
 			nmsg_poller_t poller;
+			this->setup_reader_poller(&rt, poller);
 
-			// extra stats
-			poller.before_poll([this](timeval_t now, duration_t wait_for)
+			poller.read_plain_fd(*epfd, [&](timeval_t now)
 			{
-				++stats_->udp.poll_total;
+				static constexpr int const max_events = 64;
+				struct epoll_event events[max_events];
+
+				while (true)
+				{
+					int const n = epoll_wait(*epfd, events, max_events, 0);
+					if (n < 0 && errno == EINTR)
+						continue;
+
+					for (int i = 0; i < n; i++)
+					{
+						uint64_t const data = events[i].data.u64;
+
+						if (data & listener_tag)
+						{
+							this->stream_accept(&rt, *epfd, stream_listeners_[data & ~listener_tag], conns);
+							continue;
+						}
+
+						auto const it = conns.find(int(data));
+						if (it == conns.end()) // closed while handling this batch of events
+							continue;
+
+						if (!this->stream_read(&rt, it->second.get()))
+						{
+							epoll_ctl(*epfd, EPOLL_CTL_DEL, it->first, NULL);
+							conns.erase(it);
+						}
+					}
+
+					if (n < max_events)
+						break;
+				}
+
+				if (this->has_pending_batch(&rt))
+					this->send_pending_batch(&rt);
 			});
 
-			// periodic rusage
-			poller.ticker(1 * d_second, [&](timeval_t now)
+			poller.loop();
+		}
+
+		void stream_accept(reader_thread_t *rt, int epfd, stream_listener_t const& listener, std::unordered_map<int, std::unique_ptr<stream_conn_t>>& conns)
+		{
+			while (true)
 			{
-				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+				int const fd = accept4(*listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd < 0)
+				{
+					if (errno == EINTR || errno == ECONNABORTED)
+						continue;
 
-				std::lock_guard<std::mutex> lk_(stats_->mtx);
-				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
-				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
-			});
+					// EAGAIN - nothing more to accept, or another thread got it
+					if (errno != EAGAIN && errno != EWOULDBLOCK)
+						LOG_WARN(globals_->logger(), "{0}; accept() on {1} failed: {2}:{3}", rt->name, listener.endpoint, errno, strerror(errno));
+					return;
+				}
 
-			// shutdown
-			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+				auto conn = meow::make_unique<stream_conn_t>(fd, listener.seqpacket);
+
+				struct epoll_event ev = {};
+				ev.events   = EPOLLIN;
+				ev.data.u64 = uint64_t(fd);
+
+				if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+				{
+					LOG_WARN(globals_->logger(), "{0}; epoll_ctl() for connection on {1} failed: {2}:{3}", rt->name, listener.endpoint, errno, strerror(errno));
+					continue;
+				}
+
+				++stats_->stream.connections_total;
+				LOG_DEBUG(globals_->logger(), "{0}; accepted connection on {1}, fd {2}", rt->name, listener.endpoint, fd);
+
+				conns.emplace(fd, std::move(conn));
+			}
+		}
+
+		// read what's available and handle all complete datagrams
+		//  returns false if connection should be closed
+		bool stream_read(reader_thread_t *rt, stream_conn_t *conn)
+		{
+			// a few reads at most, level triggered epoll brings us back, and other connections get their turn
+			for (unsigned n_reads = 0; n_reads < 4; n_reads++)
 			{
-				LOG_DEBUG(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
-				poller.set_shutdown_flag();
-			});
+				struct iovec iov = { .iov_base = conn->frames.write_ptr(), .iov_len = conn->frames.write_space() };
+
+				struct msghdr msg = {};
+				msg.msg_iov    = &iov;
+				msg.msg_iovlen = 1;
+
+				ssize_t const n = recvmsg(*conn->fd, &msg, MSG_DONTWAIT);
+				if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						return true;
+
+					LOG_DEBUG(globals_->logger(), "{0}; recvmsg() failed, closing connection: {1}:{2}", rt->name, errno, strerror(errno));
+					++stats_->stream.connections_err;
+					return false;
+				}
+
+				if (n == 0) // closed by peer, in the middle of a datagram is an error
+				{
+					if (conn->frames.has_partial())
+						++stats_->stream.connections_err;
+					return false;
+				}
+
+				if (msg.msg_flags & MSG_TRUNC) // seqpacket message did not fit
+				{
+					LOG_DEBUG(globals_->logger(), "{0}; message truncated, closing connection", rt->name);
+					++stats_->stream.connections_err;
+					return false;
+				}
+
+				stats_->stream.recv_bytes += n;
+				conn->frames.commit(n);
+				this->update_recv_time(rt);
+
+				while (true)
+				{
+					str_ref  dgram;
+					uint32_t bad_length;
+
+					auto const nr = conn->frames.next(&dgram, &bad_length);
+					if (nr == stream_frame_buffer_t::next_need_more)
+						break;
+
+					if (nr == stream_frame_buffer_t::next_bad_length)
+					{
+						LOG_DEBUG(globals_->logger(), "{0}; bad datagram length {1}, closing connection", rt->name, bad_length);
+						++stats_->stream.connections_err;
+						return false;
+					}
+
+					++stats_->stream.recv_packets;
+					this->handle_datagram(rt, dgram);
+				}
+
+				if (conn->seqpacket && conn->frames.has_partial())
+				{
+					LOG_DEBUG(globals_->logger(), "{0}; partial datagram at the end of message, closing connection", rt->name);
+					++stats_->stream.connections_err;
+					return false;
+				}
+
+				// most likely drained the socket
+				if (size_t(n) < iov.iov_len)
+					return true;
+			}
+
+			return true;
+		}
+
+		void eat_udp_recv(reader_thread_t *rt, std::vector<fd_handle_t> const& fds)
+		{
+			uint32_t const thread_id = rt->thread_id;
+
+			static constexpr size_t const read_buffer_size = 64 * 1024; // max udp message size
+			char buf[read_buffer_size];
+
+			// recvmsg() instead of plain recv(), to get SO_RXQ_OVFL and UDP_GRO
+			char control_buf[control_buffer_size];
+			struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+			struct sockaddr_storage src_addr;
+
+			nmsg_poller_t poller;
+			this->setup_reader_poller(rt, poller);
+
+			rt->idle.set_busy_threshold(16); // no natural vector size here, just a guess
 #if 0
 			// resetable periodic event, to 'idly' send batch at regular intervals
 			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
 			{
-				if (!req || req->request_count == 0)
+				if (!this->has_pending_batch(rt))
 					return;
 
-				this->send_current_batch(thread_id, req);
+				this->send_pending_batch(rt);
 			});
 #endif
 			// process udp packets from the network
-			for (auto const& fd : fds)
+			for (size_t fd_index = 0; fd_index < fds.size(); fd_index++)
 			{
-				poller.read_plain_fd(*fd, [&](timeval_t now)
-				{
-					char decompress_buf[read_buffer_size]; // re-used buffer for decompression
+				auto const& fd = fds[fd_index];
 
+				poller.read_plain_fd(*fd, [&, fd_index](timeval_t now)
+				{
 					// try receiving as much as possible without blocking
 					while (true)
 					{
 						++stats_->udp.recv_total;
 
-						int const n = recv(*fd, buf, sizeof(buf), MSG_DONTWAIT);
+						struct msghdr msg = {};
+						msg.msg_iov        = &iov;
+						msg.msg_iovlen     = 1;
+						msg.msg_control    = control_buf;
+						msg.msg_controllen = sizeof(control_buf);
+
+						if (admission_)
+						{
+							msg.msg_name    = &src_addr;
+							msg.msg_namelen = sizeof(src_addr);
+						}
+
+						int const n = recvmsg(*fd, &msg, MSG_DONTWAIT);
 						if (n > 0)
 						{
 							++stats_->udp.recv_packets;
-							stats_->udp.recv_bytes += uint64_t(n);
+							rt->idle.on_packets(1);
+							this->update_recv_time(rt);
 
-							// parse incoming bytes, and maybe decompress them
-							net_datagram_t dgram = parse_network_datagram(str_ref{ buf, size_t(n) });
-							if (dgram.version == 1)
-							{
-								if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0)
-								{
-									bool const ok = decompress_network_datagram(&dgram, decompress_buf, sizeof(decompress_buf));
-									if (!ok)
-									{
-										// TODO: ++stats_->udp.packet_decompress_err;
-										++stats_->udp.packet_decode_err;
-										continue;
-									}
-								}
-							}
+							int const gso_size = this->handle_control_messages(rt, fd_index, &msg);
 
-							// unpack protobuf and push packet into batch
-							if (!req)
+							if (msg.msg_flags & MSG_TRUNC)
 							{
-								constexpr size_t nmpa_block_size = 16 * 1024;
-								req = meow::make_intrusive<raw_request_t>(conf_->batch_size, nmpa_block_size);
-								request_unpack_pba.allocator_data = &req->nmpa;
-							}
-
-							Pinba__Request *request = pinba__request__unpack(&request_unpack_pba, dgram.data.c_length(), (uint8_t*)dgram.data.data());
-							if (request == NULL) {
-								++stats_->udp.packet_decode_err;
+								++stats_->udp.recv_truncated;
 								continue;
 							}
 
-							req->requests[req->request_count] = request;
-							req->request_count++;
-
-							if (req->request_count >= conf_->batch_size)
-							{
-								this->send_current_batch(thread_id, req);
-								// poller.reset_ticker(batch_send_tick, now);
-							}
+							this->handle_received_bytes(rt, str_ref{ buf, size_t(n) }, gso_size, (msg.msg_namelen > 0) ? (struct sockaddr const*)msg.msg_name : NULL);
+							// poller.reset_ticker(batch_send_tick, now);
 
 							continue;
 						}
@@ -421,25 +1838,25 @@ namespace { namespace aux {
 							{
 								++stats_->udp.recv_eagain;
 
+								// heavy traffic, next packet is likely to arrive very soon
+								if (rt->idle.should_retry())
+									continue;
+
 								// need to send current batch if we've got anything
-								if (req && req->request_count > 0)
+								if (this->has_pending_batch(rt))
 								{
-									this->send_current_batch(thread_id, req);
+									this->send_pending_batch(rt);
 									// poller.reset_ticker(batch_send_tick, now);
 								}
 
-								// sleep for at least 1ms, before polling again, to let more packets arrive
+								// maybe sleep before polling again, to let more packets arrive
 								// and save a ton on system calls
-								constexpr struct timespec const sleep_for = {
-									.tv_sec = 0,
-									.tv_nsec = 1 * 1000 * 1000,
-								};
-								nanosleep(&sleep_for, NULL);
+								rt->idle.end_wakeup(true);
 
 								return;
 							}
 
-							LOG_ERROR(globals_->logger(), "udp_reader/{0}; recv() failed, exiting: {1}:{2}", thread_id, errno, strerror(errno));
+							LOG_ERROR(globals_->logger(), "udp_reader/{0}; recvmsg() failed, exiting: {1}:{2}", thread_id, errno, strerror(errno));
 							poller.set_shutdown_flag();
 							return;
 						}
@@ -458,82 +1875,54 @@ namespace { namespace aux {
 			poller.loop();
 		}
 
-		void eat_udp_recvmmsg(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		void eat_udp_recvmmsg(reader_thread_t *rt, std::vector<fd_handle_t> const& fds)
 		{
-			size_t const max_message_size   = 64 * 1024; // max udp message size
-			size_t const max_dgrams_to_recv = conf_->batch_size; // FIXME: make a special setting for this
+			uint32_t const thread_id = rt->thread_id;
 
-			std::unique_ptr<struct mmsghdr[]> hdr_p { new struct mmsghdr[max_dgrams_to_recv] };
-			struct mmsghdr *hdr = hdr_p.get();
+			size_t const max_dgrams_to_recv = (conf_->recv_max_dgrams > 0) ? conf_->recv_max_dgrams : conf_->batch_size;
 
-			std::unique_ptr<struct iovec[]> iov_p { new struct iovec[max_dgrams_to_recv] };
-			struct iovec *iov = iov_p.get();
+			// receive ring, see collector_conf_t::recv_slot_size
+			// GRO-coalesced datagrams are up to 64k and are the norm, not the exception, so no compact slots then
+			size_t const slot_size = (conf_->gro) ? 0 : conf_->recv_slot_size;
 
-			std::unique_ptr<char[]> recv_buffer_p { new char[max_dgrams_to_recv * max_message_size] };
-			char *recv_buffer = recv_buffer_p.get();
-
-			// touch all network memory in advance
-			memset(hdr, 0, max_dgrams_to_recv * sizeof(*hdr));
-			memset(iov, 0, max_dgrams_to_recv * sizeof(*iov));
-			memset(recv_buffer, 0, max_dgrams_to_recv * max_message_size);
+			// SO_RXQ_OVFL drop counter and UDP_GRO segment size
+			size_t const control_size = control_buffer_size;
 
-			for (unsigned i = 0; i < max_dgrams_to_recv; i++)
-			{
-				iov[i].iov_base           = recv_buffer + i * max_message_size;
-				iov[i].iov_len            = max_message_size;
+			// touch all network memory in advance, overflow areas are left alone on purpose
+			recv_memory_t recv_memory { recv_ring_t::memory_size(max_dgrams_to_recv, slot_size, control_size), conf_->recv_hugepages };
+			memset(recv_memory.data, 0, recv_memory.size);
 
-				hdr[i].msg_hdr.msg_iov    = &iov[i];
-				hdr[i].msg_hdr.msg_iovlen = 1;
-			}
+			// sender addresses, needed only for admission
+			std::unique_ptr<struct sockaddr_storage[]> src_addr_p { (admission_) ? new struct sockaddr_storage[max_dgrams_to_recv] : nullptr };
+			struct sockaddr_storage *src_addr = src_addr_p.get();
 
-			raw_request_ptr req;
+			recv_ring_t ring { max_dgrams_to_recv, slot_size, control_size, recv_memory.data, src_addr };
+			struct mmsghdr *hdr = ring.headers();
 
-			ProtobufCAllocator request_unpack_pba = {
-				.alloc = nmpa___pba_alloc,
-				.free = nmpa___pba_free,
-				.allocator_data = NULL, // changed in progress
-			};
+			LOG_INFO(globals_->logger(), "udp_reader/{0}; recvmmsg ring: {1} x {2} bytes slots, {3}KB total, {4}; {5}KB overflow address space",
+				thread_id, max_dgrams_to_recv, ring.slot_size(), recv_memory.size / 1024, recv_memory.backing, ring.overflow_size() / 1024);
 
 			nmsg_poller_t poller;
+			this->setup_reader_poller(rt, poller);
 
-			// extra stats
-			poller.before_poll([this](timeval_t now, duration_t wait_for)
-			{
-				++stats_->udp.poll_total;
-			});
-
-			// periodic rusage
-			poller.ticker(1 * d_second, [&](timeval_t now)
-			{
-				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
-
-				std::lock_guard<std::mutex> lk_(stats_->mtx);
-				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
-				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
-			});
-
-			// shutdown
-			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
-			{
-				LOG_INFO(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
-				poller.set_shutdown_flag();
-			});
+			// got a full recvmmsg worth of packets in one wakeup -> traffic is heavy
+			rt->idle.set_busy_threshold(max_dgrams_to_recv);
 
 			// resetable periodic event, to 'idly' send batch at regular intervals
 			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
 			{
-				if (!req || req->request_count == 0)
+				if (!this->has_pending_batch(rt))
 					return;
 
-				this->send_current_batch(thread_id, req);
+				this->send_pending_batch(rt);
 			});
 
-			for (auto const& fd : fds)
+			for (size_t fd_index = 0; fd_index < fds.size(); fd_index++)
 			{
-				poller.read_plain_fd(*fd, [&](timeval_t now)
-				{
-					char decompress_buf[max_message_size]; // re-used buffer for decompression
+				auto const& fd = fds[fd_index];
 
+				poller.read_plain_fd(*fd, [&, fd_index](timeval_t now)
+				{
 					// recv as much as possible without blocking
 					// but see comments in EAGAIN handling on sleep() and saving syscalls
 					while (true)
@@ -544,52 +1933,31 @@ namespace { namespace aux {
 						if (n > 0)
 						{
 							stats_->udp.recv_packets += uint64_t(n);
+							rt->idle.on_packets(n);
+							this->update_recv_time(rt);
 
 							for (int i = 0; i < n; i++)
 							{
-								str_ref const network_bytes = { (char*)iov[i].iov_base, (size_t)hdr[i].msg_len };
-
-								stats_->udp.recv_bytes += network_bytes.size();
+								int const gso_size = this->handle_control_messages(rt, fd_index, &hdr[i].msg_hdr);
 
-								net_datagram_t dgram = parse_network_datagram(network_bytes);
+								struct sockaddr const *src = NULL;
+								if (src_addr != NULL && hdr[i].msg_hdr.msg_namelen > 0)
+									src = (struct sockaddr const*)&src_addr[i];
 
-								// maybe decompress, use thread-local tmp buffer as destination
-								if (dgram.version == 1)
-								{
-									if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0)
-									{
-										bool const ok = decompress_network_datagram(&dgram, decompress_buf, sizeof(decompress_buf));
-										if (!ok)
-										{
-											// TODO: ++stats_->udp.packet_decompress_err;
-											++stats_->udp.packet_decode_err;
-											continue;
-										}
-									}
-								}
+								ring.reset_message(i);
 
-								// unpack protobuf into current batch's nmpa and push parsed request
-								if (!req)
+								if (hdr[i].msg_hdr.msg_flags & MSG_TRUNC)
 								{
-									constexpr size_t nmpa_block_size = 16 * 1024;
-									req = meow::make_intrusive<raw_request_t>(conf_->batch_size, nmpa_block_size);
-									request_unpack_pba.allocator_data = &req->nmpa;
-								}
-
-								Pinba__Request *request = pinba__request__unpack(&request_unpack_pba, dgram.data.c_length(), (uint8_t*)dgram.data.data());
-								if (request == NULL) {
-									++stats_->udp.packet_decode_err;
+									++stats_->udp.recv_truncated;
 									continue;
 								}
 
-								req->requests[req->request_count] = request;
-								req->request_count++;
+								str_ref const network_bytes = ring.message_bytes(i);
+								if (network_bytes.size() == 0)
+									continue;
 
-								if (req->request_count >= conf_->batch_size)
-								{
-									this->send_current_batch(thread_id, req);
+								if (this->handle_received_bytes(rt, network_bytes, gso_size, src))
 									poller.reset_ticker(batch_send_tick, now);
-								}
 							}
 
 							continue;
@@ -604,20 +1972,20 @@ namespace { namespace aux {
 							{
 								++stats_->udp.recv_eagain;
 
+								// heavy traffic, next packet is likely to arrive very soon
+								if (rt->idle.should_retry())
+									continue;
+
 								// need to send current batch if we've got anything
-								if (req && req->request_count > 0)
+								if (this->has_pending_batch(rt))
 								{
-									this->send_current_batch(thread_id, req);
+									this->send_pending_batch(rt);
 									poller.reset_ticker(batch_send_tick, now);
 								}
 
-								// sleep for at least 1ms, before polling again, to let more packets arrive
+								// maybe sleep before polling again, to let more packets arrive
 								// and save a ton on system calls
-								constexpr struct timespec const sleep_for = {
-									.tv_sec = 0,
-									.tv_nsec = 1 * 1000 * 1000,
-								};
-								nanosleep(&sleep_for, NULL);
+								rt->idle.end_wakeup(true);
 
 								return;
 							}
@@ -641,11 +2009,205 @@ namespace { namespace aux {
 			poller.loop();
 		}
 
+#ifdef PINBA_HAVE_LIBURING
+		// multishot recvmsg (linux 6.0+) with a ring of kernel-provided buffers
+		// a single armed request per socket keeps delivering datagrams without any syscalls on our side,
+		// so there is no need for recv-until-EAGAIN and sleep heuristics of the loops above
+		// completions are waited for by polling io_uring fd, along with shutdown socket and tickers
+		//
+		// returns false if io_uring could not be set up, caller should fall back to another loop
+		bool eat_udp_io_uring(reader_thread_t *rt, std::vector<fd_handle_t> const& fds)
+		{
+			uint32_t const thread_id = rt->thread_id;
+
+			// every buffer holds io_uring_recvmsg_out header + control messages + payload
+			// max udp payload is 65507 (a bit more for GRO-coalesced ones, as headers are shared), leave room for the rest
+			size_t   const buffer_size     = 64 * 1024 + 256;
+			int      const buffer_group_id = 0;
+
+			// buffer ring size must be a power of 2, kernel limits it to 32k entries
+			unsigned const n_buffers = [&]()
+			{
+				unsigned n = 1;
+				while (n < conf_->batch_size && n < 32768)
+					n <<= 1;
+				return n;
+			}();
+
+			// must outlive the ring, as kernel writes here until all requests are cancelled
+			recv_memory_t recv_memory { n_buffers * buffer_size, conf_->recv_hugepages };
+			char *recv_buffer = recv_memory.data;
+
+			// touch all network memory in advance
+			memset(recv_memory.data, 0, recv_memory.size);
+
+			struct io_uring ring;
+
+			// every provided buffer might produce a completion, size completion queue for that
+			struct io_uring_params params = {};
+			params.flags      = IORING_SETUP_CQSIZE;
+			params.cq_entries = n_buffers;
+
+			int const init_r = io_uring_queue_init_params(fds.size(), &ring, &params);
+			if (init_r < 0)
+			{
+				LOG_ERROR(globals_->logger(), "udp_reader/{0}; io_uring_queue_init() failed, falling back: {1}:{2}", thread_id, -init_r, strerror(-init_r));
+				return false;
+			}
+			MEOW_DEFER(
+				io_uring_queue_exit(&ring);
+			);
+
+			int br_err = 0;
+			struct io_uring_buf_ring *br = io_uring_setup_buf_ring(&ring, n_buffers, buffer_group_id, 0, &br_err);
+			if (br == NULL)
+			{
+				LOG_ERROR(globals_->logger(), "udp_reader/{0}; io_uring_setup_buf_ring() failed, falling back: {1}:{2}", thread_id, -br_err, strerror(-br_err));
+				return false;
+			}
+			MEOW_DEFER(
+				io_uring_free_buf_ring(&ring, br, n_buffers, buffer_group_id);
+			);
+
+			int const br_mask = io_uring_buf_ring_mask(n_buffers);
+
+			for (unsigned i = 0; i < n_buffers; i++)
+				io_uring_buf_ring_add(br, recv_buffer + i * buffer_size, buffer_size, i, br_mask, i);
+			io_uring_buf_ring_advance(br, n_buffers);
+
+			// kernel takes only name and control lengths from here, control is for SO_RXQ_OVFL drop counter and UDP_GRO
+			// name (sender address) is needed only for admission
+			struct msghdr recv_msg = {};
+			recv_msg.msg_controllen = control_buffer_size;
+			recv_msg.msg_namelen    = (admission_) ? sizeof(struct sockaddr_storage) : 0;
+
+			auto const arm_recv = [&](uint64_t fd_index)
+			{
+				struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+				assert((sqe != NULL) && "submission queue is sized for all sockets");
+
+				io_uring_prep_recvmsg_multishot(sqe, *fds[fd_index], &recv_msg, 0);
+				sqe->flags    |= IOSQE_BUFFER_SELECT;
+				sqe->buf_group = buffer_group_id;
+				io_uring_sqe_set_data64(sqe, fd_index);
+			};
+
+			for (size_t i = 0; i < fds.size(); i++)
+				arm_recv(i);
+			io_uring_submit(&ring);
+
+			LOG_INFO(globals_->logger(), "udp_reader/{0}; using io_uring multishot recvmsg, {1} buffers, {2}KB total, {3}",
+				thread_id, n_buffers, recv_memory.size / 1024, recv_memory.backing);
+
+			nmsg_poller_t poller;
+			this->setup_reader_poller(rt, poller);
+
+			// resetable periodic event, to 'idly' send batch at regular intervals
+			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			{
+				if (!this->has_pending_batch(rt))
+					return;
+
+				this->send_pending_batch(rt);
+			});
+
+			poller.read_plain_fd(ring.ring_fd, [&](timeval_t now)
+			{
+				++stats_->udp.recv_total;
+				this->update_recv_time(rt);
+
+				unsigned n_completions = 0;
+				unsigned n_buffers_returned = 0;
+				unsigned n_rearmed = 0;
+
+				unsigned head;
+				struct io_uring_cqe *cqe;
+				io_uring_for_each_cqe(&ring, head, cqe)
+				{
+					n_completions++;
+
+					uint64_t const fd_index = io_uring_cqe_get_data64(cqe);
+
+					// multishot request has been terminated (error, or no buffers left), arm it again
+					// buffers are returned below, so ENOBUFS is transient here
+					if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+					{
+						if ((cqe->res < 0) && (cqe->res != -ENOBUFS))
+						{
+							LOG_ERROR(globals_->logger(), "udp_reader/{0}; io_uring recvmsg failed, exiting: {1}:{2}", thread_id, -cqe->res, strerror(-cqe->res));
+							poller.set_shutdown_flag();
+							continue;
+						}
+
+						arm_recv(fd_index);
+						n_rearmed++;
+					}
+
+					if ((cqe->res < 0) || (cqe->flags & IORING_CQE_F_BUFFER) == 0)
+						continue;
+
+					unsigned const buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+					char *buf = recv_buffer + buffer_id * buffer_size;
+
+					struct io_uring_recvmsg_out *msg_out = io_uring_recvmsg_validate(buf, cqe->res, &recv_msg);
+					if ((msg_out != NULL) && (msg_out->flags & MSG_TRUNC) == 0)
+					{
+						++stats_->udp.recv_packets;
+						rt->idle.on_packets(1);
+
+						int gso_size = 0;
+						for (struct cmsghdr *cmsg = io_uring_recvmsg_cmsg_firsthdr(msg_out, &recv_msg); cmsg != NULL; cmsg = io_uring_recvmsg_cmsg_nexthdr(msg_out, &recv_msg, cmsg))
+						{
+							this->account_kernel_drops(rt, fd_index, cmsg);
+
+							if (int const sz = gro_segment_size(cmsg))
+								gso_size = sz;
+						}
+
+						str_ref const network_bytes = {
+							(char*)io_uring_recvmsg_payload(msg_out, &recv_msg),
+							(size_t)io_uring_recvmsg_payload_length(msg_out, cqe->res, &recv_msg),
+						};
+
+						// datagram is always copied out (unpacked or decompressed) here,
+						// so it's safe to give the buffer back to the kernel right away
+						struct sockaddr const *src = (msg_out->namelen > 0) ? (struct sockaddr const*)io_uring_recvmsg_name(msg_out) : NULL;
+
+						if ((network_bytes.size() > 0) && this->handle_received_bytes(rt, network_bytes, gso_size, src))
+							poller.reset_ticker(batch_send_tick, now);
+					}
+					else if (msg_out != NULL)
+					{
+						++stats_->udp.recv_truncated;
+					}
+					else
+					{
+						++stats_->udp.packet_decode_err;
+					}
+
+					io_uring_buf_ring_add(br, buf, buffer_size, buffer_id, br_mask, n_buffers_returned);
+					n_buffers_returned++;
+				}
+
+				io_uring_buf_ring_advance(br, n_buffers_returned);
+				io_uring_cq_advance(&ring, n_completions);
+
+				if (n_rearmed > 0)
+					io_uring_submit(&ring);
+
+				// kernel keeps receiving while we're polling, so no need to park here, just collect stats
+				rt->idle.end_wakeup(false);
+			});
+
+			poller.loop();
+
+			return true;
+		}
+#endif // PINBA_HAVE_LIBURING
+
 	private:
 		os_addrinfo_list_ptr  ai_list_;
 
-		nmsg_socket_t         out_sock_;
-
 		nmsg_socket_t         shutdown_sock_;
 		nmsg_socket_t         shutdown_cli_sock_;
 		std::mutex            shutdown_mtx_;
@@ -654,6 +2216,22 @@ namespace { namespace aux {
 		pinba_stats_t         *stats_;
 		collector_conf_t      *conf_;
 
+		int                   rcvbuf_bytes_ = 0;         // per socket, 0 = keep kernel default
+		bool                  rcvbuf_reported_ = false;
+
+		std::vector<sock_filter> steering_prog_;         // empty = no cpu steering
+
+#ifdef PINBA_HAVE_ZSTD
+		zstd_dictionaries_t   zstd_dicts_;
+#endif
+
+		std::vector<stream_listener_t> stream_listeners_;
+
+		std::unique_ptr<source_admission_t> admission_;  // NULL = disabled
+		std::unique_ptr<capture_writer_t>   capture_;    // NULL = disabled
+
+		std::atomic<uint32_t>  injector_id_ = {0};
+
 		std::vector<std::thread> threads_;
 	};
 
@@ -35,6 +35,8 @@ namespace { namespace aux {
 
 		std::string nn_packets;         // get packet_batch_ptr from this endpoint as fast as possible (SUB, pair to coodinator PUB)
 		size_t      nn_packets_buffer;  // NN_RCVBUF on nn_packets
+
+		thread_affinity_t affinity;     // thread is bound to affinity.cpusets[id % size]
 	};
 
 	struct report_host_t;
@@ -163,6 +165,7 @@ namespace { namespace aux {
 			std::thread t([this, tick_interval]()
 			{
 				PINBA___OS_CALL(globals_, set_thread_name, conf_.thread_name);
+				pinba_thread_affinity___apply(globals_, conf_.affinity, conf_.id, conf_.thread_name);
 
 				MEOW_DEFER(
 					LOG_DEBUG(globals_->logger(), "{0}; exiting", conf_.thread_name);
@@ -384,6 +387,7 @@ namespace { namespace aux {
 			std::string const thr_name = ff::fmt_str("packet-relay");
 
 			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_thread_affinity___apply(globals_, conf_->relay_affinity, 0, thr_name);
 
 			MEOW_DEFER(
 				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
@@ -533,6 +537,7 @@ namespace { namespace aux {
 				.nn_shutdown       = ff::fmt_str("inproc://{0}/shutdown", rh_name),
 				.nn_packets        = ff::fmt_str("inproc://{0}/packets", rh_name),
 				.nn_packets_buffer = conf_->nn_report_input_buffer,
+				.affinity          = conf_->report_affinity,
 			};
 
 			auto  rh = meow::make_unique<report_host___new_thread_t>(globals_, rh_conf);
@@ -0,0 +1,289 @@
+#include "pinba_config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>        // IFF_LOOPBACK
+#include <netinet/in.h>
+#include <sys/resource.h>  // setpriority
+#include <sys/syscall.h>   // SYS_gettid
+
+#include <stdexcept>
+
+#include <meow/format/format.hpp>
+#include <meow/unix/netdb.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/cpu_affinity.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// parse "0-3,8" into (inclusive) ranges, calling func(from, to) for each
+	template<class Function>
+	void cpu_list_for_each_range(str_ref list, Function const& func)
+	{
+		std::string const s = list.str(); // need NUL-terminated for strtoul
+
+		char const *p = s.c_str();
+		while (*p != '\0')
+		{
+			char *end = nullptr;
+
+			errno = 0;
+			unsigned long const from = strtoul(p, &end, 10);
+			if (end == p || errno != 0)
+				throw std::runtime_error(ff::fmt_str("bad cpu list '{0}', expected number at offset {1}", list, p - s.c_str()));
+			p = end;
+
+			unsigned long to = from;
+			if (*p == '-')
+			{
+				++p;
+				errno = 0;
+				to = strtoul(p, &end, 10);
+				if (end == p || errno != 0 || to < from)
+					throw std::runtime_error(ff::fmt_str("bad cpu list '{0}', bad range end at offset {1}", list, p - s.c_str()));
+				p = end;
+			}
+
+			if (to >= CPU_SETSIZE)
+				throw std::runtime_error(ff::fmt_str("bad cpu list '{0}', cpu {1} is out of range, max: {2}", list, to, CPU_SETSIZE - 1));
+
+			func(from, to);
+
+			if (*p == ',')
+				++p;
+			else if (*p == '\n') // sysfs files end with newline
+				break;
+			else if (*p != '\0')
+				throw std::runtime_error(ff::fmt_str("bad cpu list '{0}', unexpected '{1}' at offset {2}", list, *p, p - s.c_str()));
+		}
+	}
+
+	// first line of a small sysfs file, empty string if it can't be read
+	std::string read_sysfs_line(std::string const& path)
+	{
+		FILE *f = fopen(path.c_str(), "r");
+		if (!f)
+			return {};
+
+		char buf[4096];
+		char const *r = fgets(buf, sizeof(buf), f);
+		fclose(f);
+
+		return (r) ? std::string{buf} : std::string{};
+	}
+
+	// -1 if device is virtual (no device/ link), or is not bound to a node
+	int numa_node_for_interface(char const *ifname)
+	{
+		std::string const s = read_sysfs_line(ff::fmt_str("/sys/class/net/{0}/device/numa_node", ifname));
+		if (s.empty())
+			return -1;
+
+		return atoi(s.c_str());
+	}
+
+	bool sockaddr_is_any(struct sockaddr const *sa)
+	{
+		if (sa->sa_family == AF_INET)
+			return ((struct sockaddr_in const*)sa)->sin_addr.s_addr == htonl(INADDR_ANY);
+
+		if (sa->sa_family == AF_INET6)
+			return IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 const*)sa)->sin6_addr);
+
+		return false;
+	}
+
+	bool sockaddr_same_host(struct sockaddr const *a, struct sockaddr const *b)
+	{
+		if (a->sa_family != b->sa_family)
+			return false;
+
+		if (a->sa_family == AF_INET)
+			return ((struct sockaddr_in const*)a)->sin_addr.s_addr == ((struct sockaddr_in const*)b)->sin_addr.s_addr;
+
+		if (a->sa_family == AF_INET6)
+			return IN6_ARE_ADDR_EQUAL(&((struct sockaddr_in6 const*)a)->sin6_addr, &((struct sockaddr_in6 const*)b)->sin6_addr);
+
+		return false;
+	}
+
+	struct ifaddrs_deleter_t
+	{
+		void operator()(struct ifaddrs *ifa) const { freeifaddrs(ifa); }
+	};
+	using ifaddrs_ptr = std::unique_ptr<struct ifaddrs, ifaddrs_deleter_t>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<cpu_set_t> pinba_cpu_list___parse(str_ref list)
+{
+	std::vector<cpu_set_t> result;
+
+	aux::cpu_list_for_each_range(list, [&](unsigned long from, unsigned long to)
+	{
+		for (unsigned long cpu = from; cpu <= to; cpu++)
+		{
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu, &cpuset);
+			result.push_back(cpuset);
+		}
+	});
+
+	return result;
+}
+
+cpu_set_t pinba_numa_node___cpuset(int node)
+{
+	std::string const s = aux::read_sysfs_line(ff::fmt_str("/sys/devices/system/node/node{0}/cpulist", node));
+	if (s.empty())
+		throw std::runtime_error(ff::fmt_str("numa node {0} not found in /sys/devices/system/node", node));
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	aux::cpu_list_for_each_range(s, [&](unsigned long from, unsigned long to)
+	{
+		for (unsigned long cpu = from; cpu <= to; cpu++)
+			CPU_SET(cpu, &cpuset);
+	});
+
+	if (CPU_COUNT(&cpuset) == 0)
+		throw std::runtime_error(ff::fmt_str("numa node {0} has no cpus", node));
+
+	return cpuset;
+}
+
+int pinba_numa_node___for_address(pinba_globals_t *globals, str_ref address, str_ref port)
+{
+	struct ifaddrs *ifa_raw = nullptr;
+	if (getifaddrs(&ifa_raw) < 0)
+	{
+		LOG_WARN(globals->logger(), "numa; getifaddrs() failed: {0}", strerror(errno));
+		return -1;
+	}
+	aux::ifaddrs_ptr const ifa_list { ifa_raw };
+
+	os_addrinfo_list_ptr const ai_list = os_unix::getaddrinfo_ex(address.str().c_str(), port.str().c_str(), AF_UNSPEC, SOCK_DGRAM, 0);
+
+	// exact match first, interface that has the listen address assigned
+	MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(ai, ai_list)
+	{
+		if (aux::sockaddr_is_any(ai->ai_addr))
+			continue;
+
+		for (struct ifaddrs *ifa = ifa_list.get(); ifa != nullptr; ifa = ifa->ifa_next)
+		{
+			if (!ifa->ifa_addr || !aux::sockaddr_same_host(ifa->ifa_addr, ai->ai_addr))
+				continue;
+
+			int const node = aux::numa_node_for_interface(ifa->ifa_name);
+			LOG_INFO(globals->logger(), "numa; {0} is on {1}, numa node {2}", address, ifa->ifa_name, node);
+
+			if (node >= 0)
+				return node;
+
+			// vlan, bond, bridge, etc. - no device to look at, try the physical ones below
+		}
+	}
+
+	// wildcard listen address (or a virtual interface), all physical devices must agree
+	int result = -1;
+	for (struct ifaddrs *ifa = ifa_list.get(); ifa != nullptr; ifa = ifa->ifa_next)
+	{
+		if (ifa->ifa_flags & IFF_LOOPBACK)
+			continue;
+
+		int const node = aux::numa_node_for_interface(ifa->ifa_name);
+		if (node < 0)
+			continue;
+
+		if (result >= 0 && result != node)
+		{
+			LOG_INFO(globals->logger(), "numa; network devices are on different numa nodes ({0} vs {1}), can't pick one for {2}", result, node, address);
+			return -1;
+		}
+
+		result = node;
+	}
+
+	return result;
+}
+
+std::string pinba_cpuset___to_string(cpu_set_t const& cpuset)
+{
+	std::string result;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &cpuset))
+			continue;
+
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpuset))
+			last++;
+
+		if (!result.empty())
+			result += ",";
+
+		result += (last == cpu)
+				? ff::fmt_str("{0}", cpu)
+				: ff::fmt_str("{0}-{1}", cpu, last);
+
+		cpu = last;
+	}
+
+	return result;
+}
+
+std::vector<cpu_set_t> pinba_cpuset___split_modulo(cpu_set_t const& cpuset, uint32_t n_threads)
+{
+	std::vector<cpu_set_t> result(n_threads);
+
+	for (auto& thread_cpuset : result)
+		CPU_ZERO(&thread_cpuset);
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &cpuset))
+			CPU_SET(cpu, &result[cpu % n_threads]);
+	}
+
+	return result;
+}
+
+void pinba_thread_affinity___apply(pinba_globals_t *globals, thread_affinity_t const& aff, uint32_t thread_idx, str_ref thread_name)
+{
+	if (!aff.cpusets.empty())
+	{
+		cpu_set_t const& cpuset = aff.cpusets[thread_idx % aff.cpusets.size()];
+
+		// returns error number, not -1 + errno
+		int const err = PINBA___OS_CALL(globals, set_thread_affinity, sizeof(cpuset), &cpuset);
+		if (err != 0)
+			LOG_WARN(globals->logger(), "{0}; can't bind to cpus {1}: {2}", thread_name, pinba_cpuset___to_string(cpuset), strerror(err));
+		else
+			LOG_DEBUG(globals->logger(), "{0}; bound to cpus {1}", thread_name, pinba_cpuset___to_string(cpuset));
+	}
+
+	if (aff.nice != 0)
+	{
+		// linux applies PRIO_PROCESS with a thread id to that single thread only
+		pid_t const tid = (pid_t)syscall(SYS_gettid);
+
+		if (setpriority(PRIO_PROCESS, tid, aff.nice) < 0)
+			LOG_WARN(globals->logger(), "{0}; can't set nice to {1}: {2}", thread_name, aff.nice, strerror(errno));
+		else
+			LOG_DEBUG(globals->logger(), "{0}; nice set to {1}", thread_name, aff.nice);
+	}
+}
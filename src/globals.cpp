@@ -1,5 +1,9 @@
 #include "pinba_config.h"
 
+#include <errno.h>
+#include <string.h> // strerror
+
+#include <algorithm>
 #include <string>
 
 #include <nanomsg/pipeline.h>
@@ -11,6 +15,7 @@
 
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
+#include "pinba/cpu_affinity.h"
 #include "pinba/engine.h"
 #include "pinba/dictionary.h"
 #include "pinba/coordinator.h"
@@ -113,33 +118,161 @@ namespace { namespace aux {
 		{
 			auto const *options = this->options();
 
-			static collector_conf_t collector_conf = {
-				.address       = options->net_address,
-				.port          = options->net_port,
-				.nn_output     = "inproc://udp-collector",
-				.nn_shutdown   = "inproc://udp-collector/shutdown",
-				.n_threads     = options->udp_threads,
-				.batch_size    = options->udp_batch_messages,
-				.batch_timeout = options->udp_batch_timeout,
+			// default placement for udp readers and repackers, keep them on the node that owns the nic
+			// so that packet data is not dragged over the interconnect between receive and repack
+			std::vector<cpu_set_t> const numa_cpusets = [&]() -> std::vector<cpu_set_t>
+			{
+				int node = -1;
+
+				if (options->numa_node == "auto")
+				{
+					node = pinba_numa_node___for_address(globals_, options->net_address, options->net_port);
+					if (node < 0)
+					{
+						LOG_INFO(globals_->logger(), "numa; can't find node for {0}, threads are not bound by default", options->net_address);
+						return {};
+					}
+				}
+				else if (!options->numa_node.empty() && options->numa_node != "none")
+				{
+					char *end = nullptr;
+					node = (int)strtol(options->numa_node.c_str(), &end, 10);
+					if (*end != '\0' || node < 0)
+						throw std::runtime_error(ff::fmt_str("bad numa_node '{0}', expected 'auto', 'none' or node number", options->numa_node));
+				}
+				else
+				{
+					return {};
+				}
+
+				cpu_set_t const cpuset = pinba_numa_node___cpuset(node);
+				LOG_INFO(globals_->logger(), "numa; udp readers and repackers default to node {0}, cpus {1}", node, pinba_cpuset___to_string(cpuset));
+
+				return { cpuset };
+			}();
+
+			auto const make_affinity = [](std::string const& cpu_list, int nice, std::vector<cpu_set_t> const& default_cpusets)
+			{
+				thread_affinity_t result;
+				result.cpusets = (cpu_list.empty()) ? default_cpusets : pinba_cpu_list___parse(cpu_list);
+				result.nice    = nice;
+				return result;
 			};
-			collector_ = create_collector(this->globals(), &collector_conf);
 
+			// with reuseport cpu steering reader N gets packets received on cpus (cpu % udp_threads == N)
+			// so unless cpus are given explicitly, keep each reader on exactly these cpus (within numa node, if possible)
+			thread_affinity_t const udp_affinity = [&]()
+			{
+				thread_affinity_t result = make_affinity(options->udp_cpu_list, options->udp_nice, numa_cpusets);
+				if (!options->udp_reuseport_cpu_steering || !options->udp_cpu_list.empty() || options->udp_threads == 0)
+					return result;
+
+				cpu_set_t allowed;
+				if (0 != sched_getaffinity(0, sizeof(allowed), &allowed))
+				{
+					LOG_WARN(globals_->logger(), "udp_reader; sched_getaffinity() failed: {0}, readers are not pinned for cpu steering", strerror(errno));
+					return result;
+				}
+
+				auto const all_non_empty = [](std::vector<cpu_set_t> const& cpusets)
+				{
+					return std::all_of(cpusets.begin(), cpusets.end(), [](cpu_set_t const& cpuset) { return CPU_COUNT(&cpuset) > 0; });
+				};
+
+				if (!numa_cpusets.empty())
+				{
+					cpu_set_t node_allowed;
+					CPU_AND(&node_allowed, &allowed, &numa_cpusets[0]);
+
+					auto cpusets = pinba_cpuset___split_modulo(node_allowed, options->udp_threads);
+					if (all_non_empty(cpusets))
+					{
+						result.cpusets = std::move(cpusets);
+						return result;
+					}
+
+					LOG_INFO(globals_->logger(), "udp_reader; numa node has not enough cpus for {0} readers with cpu steering, using all cpus", options->udp_threads);
+				}
+
+				auto cpusets = pinba_cpuset___split_modulo(allowed, options->udp_threads);
+				if (!all_non_empty(cpusets))
+				{
+					LOG_WARN(globals_->logger(), "udp_reader; {0} readers is more than available cpus, readers are not pinned for cpu steering", options->udp_threads);
+					return result;
+				}
+
+				result.cpusets = std::move(cpusets);
+				return result;
+			}();
+
+			// created before collector, as collector threads hand batches over to it directly (or repack with it in fused mode)
 			static repacker_conf_t repacker_conf = {
-				.nn_input        = collector_conf.nn_output,
+				.nn_input        = "inproc://repacker/input",
 				.nn_output       = "inproc://repacker",
 				.nn_shutdown     = "inproc://repacker/shutdown",
 				.nn_input_buffer = options->repacker_input_buffer,
 				.n_threads       = options->repacker_threads,
 				.batch_size      = options->repacker_batch_messages,
 				.batch_timeout   = options->repacker_batch_timeout,
+				.affinity        = make_affinity(options->repacker_cpu_list, options->repacker_nice, numa_cpusets),
+				.fused           = options->repacker_fused,
 			};
 			repacker_ = create_repacker(this->globals(), &repacker_conf);
 
+			static collector_conf_t collector_conf = {
+				.address       = options->net_address,
+				.port          = options->net_port,
+				.nn_shutdown   = "inproc://udp-collector/shutdown",
+				.n_threads     = options->udp_threads,
+				.batch_size    = options->udp_batch_messages,
+				.batch_timeout = options->udp_batch_timeout,
+
+				.idle_spin_count  = options->udp_idle_spin_count,
+				.idle_yield_count = options->udp_idle_yield_count,
+				.idle_park_min    = options->udp_idle_park_min,
+				.idle_park_max    = options->udp_idle_park_max,
+				.busy_poll_usec   = options->udp_busy_poll_usec,
+
+				.rcvbuf_absorb_time = options->udp_rcvbuf_absorb_time,
+				.rcvbuf_absorb_mbps = options->udp_rcvbuf_absorb_mbps,
+				.gro                = options->udp_gro,
+
+				.recv_max_dgrams    = options->udp_recv_max_dgrams,
+				.recv_slot_size     = options->udp_recv_slot_size,
+				.recv_hugepages     = options->udp_recv_hugepages,
+
+				.reuseport_cpu_steering = options->udp_reuseport_cpu_steering,
+				.zstd_dictionaries      = options->udp_zstd_dictionaries,
+
+				.stream_listen      = options->stream_listen,
+				.stream_threads     = options->stream_threads,
+
+				.admission_rate     = options->admission_rate,
+				.admission_burst    = options->admission_burst,
+				.admission_sample_n = options->admission_sample_n,
+				.admission_slots    = options->admission_slots,
+
+				.capture_file       = options->capture_file,
+				.capture_sample_n   = options->capture_sample_n,
+				.replay_file        = options->replay_file,
+				.replay_speed       = options->replay_speed,
+				.replay_loops       = options->replay_loops,
+				.inject_only        = options->inject_only,
+
+				.raw_requests       = options->repacker_fast_decode,
+				.repacker           = repacker_.get(),
+
+				.affinity         = udp_affinity,
+			};
+			collector_ = create_collector(this->globals(), &collector_conf);
+
 			static coordinator_conf_t coordinator_conf = {
 				.nn_input               = repacker_conf.nn_output,
 				.nn_input_buffer        = options->coordinator_input_buffer,
 				.nn_control             = "inproc://coordinator/control",
 				.nn_report_input_buffer = options->report_input_buffer,
+				.relay_affinity         = make_affinity(options->coordinator_cpu_list, options->coordinator_nice, {}),
+				.report_affinity        = make_affinity(options->report_cpu_list, options->report_nice, {}),
 			};
 			coordinator_ = create_coordinator(this->globals(), &coordinator_conf);
 
@@ -190,6 +323,16 @@ namespace { namespace aux {
 			return coordinator_->get_report_snapshot(name.str());
 		}
 
+		virtual std::vector<collector_source_stats_t> get_source_stats() override
+		{
+			return collector_->get_source_stats();
+		}
+
+		virtual collector_injector_ptr create_injector() override
+		{
+			return collector_->create_injector();
+		}
+
 	private:
 		// std::unique_ptr<pinba_globals_t>  globals_;
 		pinba_globals_t                   *globals_;
@@ -28,15 +28,55 @@ int main(int argc, char const *argv[])
 		.udp_threads              = 4,
 		.udp_batch_messages       = 256,
 		.udp_batch_timeout        = 10 * d_millisecond,
+		.udp_idle_spin_count      = 64,
+		.udp_idle_yield_count     = 4,
+		.udp_idle_park_min        = 50 * d_microsecond,
+		.udp_idle_park_max        = 1 * d_millisecond,
+		.udp_busy_poll_usec       = 0,
+		.udp_rcvbuf_absorb_time   = 500 * d_millisecond,
+		.udp_rcvbuf_absorb_mbps   = 1000,
+		.udp_gro                  = false,
+		.udp_recv_max_dgrams      = 0,
+		.udp_recv_slot_size       = 2048,
+		.udp_recv_hugepages       = false,
+		.udp_reuseport_cpu_steering = false,
+		.udp_zstd_dictionaries    = "",
+
+		.stream_listen            = "",
+		.stream_threads           = 1,
+
+		.admission_rate           = 0,
+		.admission_burst          = 0,
+		.admission_sample_n       = 100,
+		.admission_slots          = 4096,
+
+		.capture_file             = "",
+		.capture_sample_n         = 1,
+		.replay_file              = "",
+		.replay_speed             = 100,
+		.replay_loops             = 1,
+		.inject_only              = false,
 
 		.repacker_threads         = 12,
 		.repacker_input_buffer    = 16 * 1024,
 		.repacker_batch_messages  = 1024,
 		.repacker_batch_timeout   = 100 * d_millisecond,
+		.repacker_fast_decode     = true,
+		.repacker_fused           = false,
 
 		.coordinator_input_buffer = 128,
 		.report_input_buffer      = 32,
 
+		.numa_node                = "auto",
+		.udp_cpu_list             = "",
+		.udp_nice                 = 0,
+		.repacker_cpu_list        = "",
+		.repacker_nice            = 0,
+		.coordinator_cpu_list     = "",
+		.coordinator_nice         = 0,
+		.report_cpu_list          = "",
+		.report_nice              = 0,
+
 		.logger                   = {},
 	};
 
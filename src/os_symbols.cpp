@@ -1,9 +1,15 @@
 #include "pinba_config.h"
 
 #include <dlfcn.h>
+#include <sys/utsname.h>
+
+#ifdef PINBA_HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
+#include "pinba/packet_simd.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
@@ -19,6 +25,7 @@ namespace { namespace aux {
 				throw std::runtime_error(ff::fmt_str("dlopen(self): {0}", dlerror()));
 
 			this->resolve_builtin_symbols();
+			this->probe_kernel_features();
 		}
 
 		virtual ~pinba_os_symbols_impl_t()
@@ -80,6 +87,11 @@ namespace { namespace aux {
 			return (fp_recvmmsg_ != NULL);
 		}
 
+		virtual bool has_io_uring_recvmsg_multishot() const override
+		{
+			return has_io_uring_recvmsg_multishot_;
+		}
+
 	private:
 
 		void resolve_builtin_symbols()
@@ -103,6 +115,49 @@ namespace { namespace aux {
 			#endif
 		}
 
+		void probe_kernel_features()
+		{
+			has_io_uring_recvmsg_multishot_ = this->probe_io_uring_recvmsg_multishot();
+			LOG_INFO(globals_->logger(), "io_uring multishot recvmsg... {0}", (has_io_uring_recvmsg_multishot_) ? "OK" : "not available");
+
+			// not a kernel feature, but selected by cpuid once, the same way
+			LOG_INFO(globals_->logger(), "packet decoding simd kernels... {0}", pinba_simd()->name);
+		}
+
+		bool probe_io_uring_recvmsg_multishot()
+		{
+		#ifdef PINBA_HAVE_LIBURING
+			// io_uring probe can only tell that RECVMSG opcode is supported,
+			// multishot mode for it is not probe-able and has appeared in 6.0, so check kernel version
+			struct utsname uts;
+			if (uname(&uts) != 0)
+				return false;
+
+			unsigned major = 0, minor = 0;
+			if (sscanf(uts.release, "%u.%u", &major, &minor) != 2)
+				return false;
+
+			if (major < 6)
+				return false;
+
+			// io_uring might still be disabled by sysctl or seccomp (containers)
+			struct io_uring ring;
+			if (io_uring_queue_init(2, &ring, 0) < 0)
+				return false;
+
+			struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+			bool const supported = (probe != NULL) && io_uring_opcode_supported(probe, IORING_OP_RECVMSG);
+
+			if (probe)
+				io_uring_free_probe(probe);
+			io_uring_queue_exit(&ring);
+
+			return supported;
+		#else
+			return false;
+		#endif
+		}
+
 	private:
 		pinba_globals_t  *globals_;
 		void             *dl_self_;
@@ -111,6 +166,8 @@ namespace { namespace aux {
 		funcp___pthread_setname_np_t      fp_pthread_setname_np_;
 		funcp___pthread_setaffinity_np_t  fp_pthread_setaffinity_np_;
 		funcp___recvmmsg_t                fp_recvmmsg_;
+
+		bool                              has_io_uring_recvmsg_multishot_;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
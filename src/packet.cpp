@@ -50,6 +50,27 @@ request_validate_result_t pinba_validate_request(Pinba__Request *r)
 	if (total_tag_count != r->n_timer_tag_value) // all tags have values
 		return request_validate_result::not_enough_tag_values;
 
+	if (r->n_tag_value < r->n_tag_name) // all request tags have values
+		return request_validate_result::not_enough_request_tag_values;
+
+	// tag names and values are offsets in r->dictionary, pinba_request_to_packet() doesn't check them
+	{
+		auto const offsets_ok = [&](uint32_t const *offsets, size_t n)
+		{
+			for (size_t i = 0; i < n; i++) {
+				if (offsets[i] >= r->n_dictionary)
+					return false;
+			}
+			return true;
+		};
+
+		if (!offsets_ok(r->timer_tag_name, r->n_timer_tag_name) || !offsets_ok(r->timer_tag_value, r->n_timer_tag_value))
+			return request_validate_result::bad_dictionary_offset;
+
+		if (!offsets_ok(r->tag_name, r->n_tag_name) || !offsets_ok(r->tag_value, r->n_tag_name))
+			return request_validate_result::bad_dictionary_offset;
+	}
+
 
 
 	// request_time should be > 0, reset to 0 when < 0
@@ -0,0 +1,258 @@
+#include "pinba_config.h"
+
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "pinba/globals.h"
+#include "pinba/packet_simd.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// double with these bits set at 2^51, adding it to an integer-valued double with |x| < 2^51
+	// leaves x as two's complement in the low mantissa bits, so (bits(x + magic) - bits(magic)) == int64(x)
+	static constexpr double const d2i_magic = 6755399441055744.0; // 2^52 + 2^51
+
+	inline uint32_t next_varint32(uint8_t const *& p)
+	{
+		uint32_t v = 0;
+		for (unsigned shift = 0; ; shift += 7)
+		{
+			uint8_t const b = *p++;
+			v |= uint32_t(b & 0x7f) << shift;
+
+			if ((b & 0x80) == 0)
+				return v;
+		}
+	}
+
+	inline void store_duration(duration_t *dst, size_t dst_stride, size_t i, int64_t nsec)
+	{
+		memcpy((char*)dst + i * dst_stride, &nsec, sizeof(nsec));
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// scalar
+
+	size_t decode_varint32___scalar(uint8_t const **pp, uint8_t const *end, uint32_t *dst, size_t max_n)
+	{
+		uint8_t const *p = *pp;
+		size_t n = 0;
+
+		while (n < max_n && p < end)
+			dst[n++] = next_varint32(p);
+
+		*pp = p;
+		return n;
+	}
+
+	void floats_to_durations___scalar(void const *src, size_t n, duration_t *dst, size_t dst_stride)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			float f;
+			memcpy(&f, (char const*)src + i * sizeof(f), sizeof(f));
+			store_duration(dst, dst_stride, i, pinba_duration_from_float(f).nsec);
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// sse4.1
+// varints: real world arrays are mostly single byte values (hit counts, tag counts, small dictionary offsets)
+//          so look at 16 bytes at a time, and if none has continuation bit set - just zero-extend them all
+//          otherwise take single-byte run up to the first multibyte varint, decode that one and repeat
+
+	__attribute__((target("sse4.1")))
+	size_t decode_varint32___sse4(uint8_t const **pp, uint8_t const *end, uint32_t *dst, size_t max_n)
+	{
+		uint8_t const *p = *pp;
+		size_t n = 0;
+
+		while (n < max_n && p < end)
+		{
+			if ((end - p) >= 16 && (max_n - n) >= 16)
+			{
+				__m128i const v = _mm_loadu_si128((__m128i const*)p);
+				uint32_t const mask = _mm_movemask_epi8(v);
+
+				if (mask == 0)
+				{
+					_mm_storeu_si128((__m128i*)(dst + n +  0), _mm_cvtepu8_epi32(v));
+					_mm_storeu_si128((__m128i*)(dst + n +  4), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+					_mm_storeu_si128((__m128i*)(dst + n +  8), _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+					_mm_storeu_si128((__m128i*)(dst + n + 12), _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)));
+					p += 16;
+					n += 16;
+					continue;
+				}
+
+				unsigned const run = __builtin_ctz(mask);
+				for (unsigned i = 0; i < run; i++)
+					dst[n + i] = p[i];
+				p += run;
+				n += run;
+			}
+
+			dst[n++] = next_varint32(p);
+		}
+
+		*pp = p;
+		return n;
+	}
+
+	__attribute__((target("sse4.1")))
+	void floats_to_durations___sse4(void const *src, size_t n, duration_t *dst, size_t dst_stride)
+	{
+		char const *s = (char const*)src;
+
+		__m128d const scale = _mm_set1_pd(double(nsec_in_sec));
+		__m128d const upper = _mm_set1_pd(pinba_float_duration_limit_nsec);
+		__m128d const lower = _mm_set1_pd(-pinba_float_duration_limit_nsec);
+		__m128d const magic = _mm_set1_pd(d2i_magic);
+
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			__m128 const f = _mm_castsi128_ps(_mm_loadl_epi64((__m128i const*)(s + i * sizeof(float))));
+
+			__m128d x = _mm_mul_pd(_mm_cvtps_pd(f), scale);
+			x = _mm_min_pd(x, upper);
+			x = _mm_max_pd(x, lower);
+			x = _mm_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+			__m128i const r = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(x, magic)), _mm_castpd_si128(magic));
+
+			store_duration(dst, dst_stride, i + 0, _mm_cvtsi128_si64(r));
+			store_duration(dst, dst_stride, i + 1, _mm_extract_epi64(r, 1));
+		}
+
+		floats_to_durations___scalar(s + i * sizeof(float), n - i, (duration_t*)((char*)dst + i * dst_stride), dst_stride);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// avx2, same as sse4, but twice as wide
+
+	__attribute__((target("avx2")))
+	size_t decode_varint32___avx2(uint8_t const **pp, uint8_t const *end, uint32_t *dst, size_t max_n)
+	{
+		uint8_t const *p = *pp;
+		size_t n = 0;
+
+		while ((end - p) >= 32 && (max_n - n) >= 32)
+		{
+			__m256i const v = _mm256_loadu_si256((__m256i const*)p);
+			uint32_t const mask = _mm256_movemask_epi8(v);
+
+			if (mask == 0)
+			{
+				__m128i const lo = _mm256_castsi256_si128(v);
+				__m128i const hi = _mm256_extracti128_si256(v, 1);
+
+				_mm256_storeu_si256((__m256i*)(dst + n +  0), _mm256_cvtepu8_epi32(lo));
+				_mm256_storeu_si256((__m256i*)(dst + n +  8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+				_mm256_storeu_si256((__m256i*)(dst + n + 16), _mm256_cvtepu8_epi32(hi));
+				_mm256_storeu_si256((__m256i*)(dst + n + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+				p += 32;
+				n += 32;
+				continue;
+			}
+
+			unsigned const run = __builtin_ctz(mask);
+			for (unsigned i = 0; i < run; i++)
+				dst[n + i] = p[i];
+			p += run;
+			n += run;
+
+			dst[n++] = next_varint32(p);
+		}
+
+		// tail, 16 bytes at a time
+		n += decode_varint32___sse4(&p, end, dst + n, max_n - n);
+
+		*pp = p;
+		return n;
+	}
+
+	__attribute__((target("avx2")))
+	void floats_to_durations___avx2(void const *src, size_t n, duration_t *dst, size_t dst_stride)
+	{
+		char const *s = (char const*)src;
+
+		__m256d const scale = _mm256_set1_pd(double(nsec_in_sec));
+		__m256d const upper = _mm256_set1_pd(pinba_float_duration_limit_nsec);
+		__m256d const lower = _mm256_set1_pd(-pinba_float_duration_limit_nsec);
+		__m256d const magic = _mm256_set1_pd(d2i_magic);
+
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 const f = _mm_loadu_ps((float const*)(s + i * sizeof(float)));
+
+			__m256d x = _mm256_mul_pd(_mm256_cvtps_pd(f), scale);
+			x = _mm256_min_pd(x, upper);
+			x = _mm256_max_pd(x, lower);
+			x = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+			__m256i const r = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(x, magic)), _mm256_castpd_si256(magic));
+
+			if (dst_stride == sizeof(duration_t))
+			{
+				_mm256_storeu_si256((__m256i*)(dst + i), r);
+				continue;
+			}
+
+			__m128i const lo = _mm256_castsi256_si128(r);
+			__m128i const hi = _mm256_extracti128_si256(r, 1);
+			store_duration(dst, dst_stride, i + 0, _mm_cvtsi128_si64(lo));
+			store_duration(dst, dst_stride, i + 1, _mm_extract_epi64(lo, 1));
+			store_duration(dst, dst_stride, i + 2, _mm_cvtsi128_si64(hi));
+			store_duration(dst, dst_stride, i + 3, _mm_extract_epi64(hi, 1));
+		}
+
+		floats_to_durations___scalar(s + i * sizeof(float), n - i, (duration_t*)((char*)dst + i * dst_stride), dst_stride);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	static pinba_simd_kernels_t const kernels___scalar = {
+		.name                = "scalar",
+		.decode_varint32     = decode_varint32___scalar,
+		.floats_to_durations = floats_to_durations___scalar,
+	};
+
+	static pinba_simd_kernels_t const kernels___sse4 = {
+		.name                = "sse4",
+		.decode_varint32     = decode_varint32___sse4,
+		.floats_to_durations = floats_to_durations___sse4,
+	};
+
+	static pinba_simd_kernels_t const kernels___avx2 = {
+		.name                = "avx2",
+		.decode_varint32     = decode_varint32___avx2,
+		.floats_to_durations = floats_to_durations___avx2,
+	};
+
+	pinba_simd_kernels_t const* select_kernels()
+	{
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))
+			return &kernels___avx2;
+
+		if (__builtin_cpu_supports("sse4.1"))
+			return &kernels___sse4;
+
+		return &kernels___scalar;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+pinba_simd_kernels_t const* pinba_simd()
+{
+	static pinba_simd_kernels_t const *const kernels = aux::select_kernels();
+	return kernels;
+}
@@ -1,5 +1,7 @@
 #include "pinba_config.h"
 
+#include <cstdlib> // posix_memalign
+#include <atomic>
 #include <thread>
 // #include <vector>
 
@@ -15,12 +17,16 @@
 #include "pinba/repacker_dictionary.h"
 #include "pinba/collector.h"
 #include "pinba/repacker.h"
+#include "pinba/repacker_queue.h"
 #include "pinba/packet.h"
 #include "pinba/packet_impl.h"
+#include "pinba/packet_decoder.h"
 
 #include "pinba/nmsg_socket.h"
 #include "pinba/nmsg_poller.h"
 
+#include "misc/nmpa_pba.h"
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -259,8 +265,306 @@ namespace { namespace aux {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+	// repacking state of a single thread: validates requests, repacks them into packets
+	// and sends these in batches to repacker output (i.e. coordinator)
+	// runs on repacker threads, or right on collector reader threads in fused mode (see repacker_t::create_worker())
+	struct repack_worker_impl_t : public repacker_worker_t
+	{
+		repack_worker_impl_t(pinba_globals_t *globals, repacker_conf_t const *conf, nmsg_socket_t *out_sock)
+			: globals_(globals)
+			, stats_(globals->stats())
+			, conf_(conf)
+			, out_sock_(out_sock)
+			, r_dictionary_(globals->dictionary())
+			, nw_dictionary_(globals->dictionary()->nameword_dictionary())
+			, batch_pool_(nmsg_pool_t<packet_batch_t>::create())
+			, debug_fraction_(1.0) // to start dumping immediately
+		{
+			nmpa_init(&unpack_nmpa_, 16 * 1024);
+			batch_ = this->create_batch();
+		}
+
+		~repack_worker_impl_t()
+		{
+			batch_.reset();
+			nmpa_free(&unpack_nmpa_);
+		}
+
+		virtual bool has_pending_batch() const override
+		{
+			return batch_->packet_count > 0;
+		}
+
+		virtual void flush() override
+		{
+			if (batch_->packet_count == 0)
+				return;
+
+			this->send_batch();
+		}
+
+		virtual void tick(timeval_t now) override
+		{
+			r_dictionary_.reap_unused_wordslices();
+		}
+
+		// protobuf bytes, decoded right into the batch, or through protobuf-c if that's not possible
+		virtual bool process_request_data(str_ref data) override
+		{
+			++stats_->repacker.recv_packets;
+
+			auto const dr = pinba_decode_request_to_packet(data, nw_dictionary_, &r_dictionary_, &batch_->nmpa, &decoder_scratch_);
+			if (dr.packet != NULL)
+				return this->append_packet(dr.packet);
+
+			if (dr.validate != request_validate_result::okay)
+				return this->on_validate_error(dr.validate);
+
+			++stats_->repacker.decode_fallback;
+
+			// packets are self-contained, so unpacked request is needed only till it's repacked
+			nmpa_empty(&unpack_nmpa_);
+
+			ProtobufCAllocator request_unpack_pba = {
+				.alloc          = nmpa___pba_alloc,
+				.free           = nmpa___pba_free,
+				.allocator_data = &unpack_nmpa_,
+			};
+
+			Pinba__Request *pb_req = pinba__request__unpack(&request_unpack_pba, data.size(), (uint8_t const*)data.data());
+			if (pb_req == NULL)
+			{
+				++stats_->repacker.packet_decode_err;
+				return false;
+			}
+
+			return this->process_request_with_nested(pb_req);
+		}
+
+		virtual bool process_request(Pinba__Request *pb_req) override
+		{
+			++stats_->repacker.recv_packets;
+			return this->process_request_with_nested(pb_req);
+		}
+
+		// batch from collector, either unpacked requests or protobuf bytes
+		//  returns true if a batch has been sent as a result
+		bool process_raw_request(raw_request_t *req)
+		{
+			bool batch_sent = false;
+
+			for (uint32_t i = 0; i < req->request_count; i++)
+			{
+				if (req->request_data != NULL)
+				{
+					batch_sent |= this->process_request_data(pb_string_as_str_ref(req->request_data[i]));
+				}
+				else
+				{
+					batch_sent |= this->process_request(req->requests[i]);
+				}
+			}
+
+			return batch_sent;
+		}
+
+	private:
+
+		packet_batch_ptr create_batch()
+		{
+			constexpr size_t nmpa_block_size = 64 * 1024;
+			auto batch = batch_pool_->get(conf_->batch_size, nmpa_block_size);
+			batch->repacker_state = std::make_shared<repacker_state_impl_t>(r_dictionary_.current_wordslice());
+			return batch;
+		}
+
+		void send_batch()
+		{
+			r_dictionary_.start_new_wordslice(); // make sure batch has only one wordslice
+
+			++stats_->repacker.batch_send_total;
+			out_sock_->send_message(batch_);
+
+			batch_ = this->create_batch();
+		}
+
+		// append repacked packet to current batch, returns true if batch has been sent as a result
+		bool append_packet(packet_t *packet)
+		{
+			if (globals_->options()->packet_debug)
+			{
+				if (debug_fraction_ >= 1.0)
+				{
+					auto sink = meow::logging::logger_as_sink(*globals_->logger(), meow::logging::log_level::info, meow::line_mode::prefix);
+					debug_dump_packet(sink, packet, globals_->dictionary(), &batch_->nmpa);
+
+					debug_fraction_ = globals_->options()->packet_debug_fraction;
+				}
+				else
+				{
+					debug_fraction_ += globals_->options()->packet_debug_fraction;
+				}
+			}
+
+			batch_->packets[batch_->packet_count] = packet;
+			batch_->packet_count++;
+
+			if (batch_->packet_count < conf_->batch_size)
+				return false;
+
+			++stats_->repacker.batch_send_by_size;
+			this->send_batch();
+			return true;
+		}
+
+		// validation should not fail, generally.
+		// pinba is expected to be mostly receiving traffic from trusted sources (your code, mon!)
+		bool on_validate_error(request_validate_result_t vr)
+		{
+			++stats_->repacker.packet_validate_err;
+			LOG_DEBUG(globals_->logger(), "request validation failed: {0}: {1}", vr, enum_as_str_ref(vr));
+			return false;
+		}
+
+		// validate, repack and append single unpacked request to current batch
+		// non-const, since pinba_validate_request() might change the packet
+		// dictionary_hashes - see pinba_request_to_packet()
+		bool repack_request(Pinba__Request *pb_req, uint64_t const *dictionary_hashes)
+		{
+			auto const vr = pinba_validate_request(pb_req);
+			if (vr != request_validate_result::okay)
+				return this->on_validate_error(vr);
+
+			packet_t *packet = pinba_request_to_packet(pb_req, nw_dictionary_, &r_dictionary_, &batch_->nmpa, dictionary_hashes);
+			return this->append_packet(packet);
+		}
+
+		// unpacked request, along with nested ones
+		bool process_request_with_nested(Pinba__Request *pb_req)
+		{
+			// outer dictionary is hashed once, for all requests using it
+			dictionary_hashes_.resize(pb_req->n_dictionary);
+			pinba_request_hash_dictionary(pb_req, dictionary_hashes_.data());
+
+			bool batch_sent = this->repack_request(pb_req, dictionary_hashes_.data());
+
+			// clients can pack multiple requests into one datagram, as nested requests
+			// outer one is a normal request itself, nested ones become separate packets
+			// nested requests without a dictionary of their own use outer dictionary
+			// (both live in the same nmpa, so it's safe to share pointers)
+			// only one level of nesting is supported, deeper ones are ignored
+			for (size_t j = 0; j < pb_req->n_requests; j++)
+			{
+				++stats_->repacker.recv_packets;
+				++stats_->repacker.recv_nested_packets;
+
+				auto *nested_req = pb_req->requests[j];
+				bool const shares_dictionary = (nested_req->n_dictionary == 0);
+				if (shares_dictionary)
+				{
+					nested_req->n_dictionary = pb_req->n_dictionary;
+					nested_req->dictionary   = pb_req->dictionary;
+				}
+
+				if (shares_dictionary)
+				{
+					batch_sent |= this->repack_request(nested_req, dictionary_hashes_.data());
+				}
+				else
+				{
+					nested_dictionary_hashes_.resize(nested_req->n_dictionary);
+					pinba_request_hash_dictionary(nested_req, nested_dictionary_hashes_.data());
+
+					batch_sent |= this->repack_request(nested_req, nested_dictionary_hashes_.data());
+				}
+			}
+
+			return batch_sent;
+		}
+
+	private:
+		pinba_globals_t                *globals_;
+		pinba_stats_t                  *stats_;
+		repacker_conf_t const          *conf_;
+		nmsg_socket_t                  *out_sock_;      // shared by all workers, nn_send() is thread safe
+
+		repacker_dictionary_t          r_dictionary_;   // thread-local cache for global shared dictionary
+		nameword_dictionary_t const    *nw_dictionary_; // global one, lock-free, sees new names immediately
+
+		nmsg_pool_ptr<packet_batch_t>  batch_pool_;     // sent batches come back here, when reports are done with them
+		packet_batch_ptr               batch_;          // never NULL
+
+		packet_decoder_scratch_t       decoder_scratch_;
+		std::vector<uint64_t>          dictionary_hashes_;        // of the request being repacked, see process_request_with_nested()
+		std::vector<uint64_t>          nested_dictionary_hashes_; // of nested request with its own dictionary
+		struct nmpa_s                  unpack_nmpa_;    // requests that could not be decoded directly, see process_request_data()
+		double                         debug_fraction_; // see pinba_options_t::packet_debug_fraction
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// input queue of a single repacker thread, see repacker_t::dispatch() and pinba/repacker_queue.h
+	// nanomsg sockets are thread safe, so other threads can steal from pull_sock, just like the owner reads from it
+	struct alignas(64) repacker_input_queue_t
+	{
+		using batch_t = raw_request_ptr;
+
+		nmsg_socket_t          push_sock;   // dispatch() sends here
+		nmsg_socket_t          pull_sock;   // owner thread receives from here
+		std::string            endpoint;
+		std::atomic<uint32_t>  depth = {0}; // batches sent and not yet received (by owner or thieves)
+
+		bool try_send(raw_request_ptr const& req)
+		{
+			return push_sock.send_message(req, NN_DONTWAIT);
+		}
+
+		bool try_recv(raw_request_ptr *req)
+		{
+			return pull_sock.recv(req, endpoint, NN_DONTWAIT);
+		}
+	};
+
+	// operator new[] does not honour over-alignment before c++17, so queues are constructed in posix_memalign-ed memory
+	struct repacker_input_queues_deleter_t
+	{
+		uint32_t n_queues;
+
+		void operator()(repacker_input_queue_t *queues) const
+		{
+			for (uint32_t i = 0; i < n_queues; i++)
+				queues[i].~repacker_input_queue_t();
+			free(queues);
+		}
+	};
+
+	using repacker_input_queues_ptr = std::unique_ptr<repacker_input_queue_t[], repacker_input_queues_deleter_t>;
+
+	inline repacker_input_queues_ptr repacker_input_queues_create(uint32_t n_queues)
+	{
+		void *mem = NULL;
+		if (0 != posix_memalign(&mem, alignof(repacker_input_queue_t), n_queues * sizeof(repacker_input_queue_t)))
+			throw std::bad_alloc();
+
+		repacker_input_queue_t *queues = (repacker_input_queue_t*)mem;
+		for (uint32_t i = 0; i < n_queues; i++)
+			new (&queues[i]) repacker_input_queue_t();
+
+		return repacker_input_queues_ptr { queues, repacker_input_queues_deleter_t { n_queues } };
+	}
+
 	struct repacker_impl_t : public repacker_t
 	{
+		// do not steal single batches, owner is going to get to those soon enough
+		// and taking them away just moves cache misses to another cpu
+		static constexpr uint32_t const steal_min_depth = 2;
+
+		// when own queue is empty (and there are no incoming batches to wake us up)
+		// check other threads for a backlog this often
+		static duration_t steal_interval() { return 10 * d_millisecond; }
+
+		static constexpr size_t const max_batches_per_poll_iteration = 4;
+
 	public:
 
 		repacker_impl_t(pinba_globals_t *globals, repacker_conf_t *conf)
@@ -289,24 +593,45 @@ namespace { namespace aux {
 				.open(AF_SP, NN_PUSH)
 				.connect(conf_->nn_shutdown);
 
+			// collector threads do all the work, through create_worker()
+			if (conf_->fused)
+			{
+				LOG_INFO(globals_->logger(), "repacker; fused mode, repacking on udp reader threads");
+				return;
+			}
+
+			if (conf_->n_threads == 0)
+				throw std::runtime_error("repacker_conf_t::n_threads must be > 0");
 
 			stats_->repacker_threads.resize(conf_->n_threads);
 
+			// open and connect all queues in main thread, to make exceptions catch-able easily
+			// and before any thread starts, as threads steal from each other
+			queues_ = repacker_input_queues_create(conf_->n_threads);
+
 			for (uint32_t i = 0; i < conf_->n_threads; i++)
 			{
-				// open and connect to producer in main thread, to make exceptions catch-able easily
-				nmsg_socket_t input_sock;
-				input_sock
+				auto& q = queues_[i];
+				q.endpoint = ff::fmt_str("{0}/{1}", conf_->nn_input, i);
+
+				q.push_sock
+					.open(AF_SP, NN_PUSH)
+					.bind(q.endpoint);
+
+				q.pull_sock
 					.open(AF_SP, NN_PULL)
-					.connect(conf_->nn_input.c_str());
+					.connect(q.endpoint);
 
 				if (conf_->nn_input_buffer > 0)
-					input_sock.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(raw_request_t) * conf_->nn_input_buffer, conf_->nn_input);
+					q.pull_sock.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(raw_request_t) * conf_->nn_input_buffer, q.endpoint);
+			}
 
+			for (uint32_t i = 0; i < conf_->n_threads; i++)
+			{
 				// start worker threads
-				std::thread t([this, i, input_sock = std::move(input_sock)]() mutable
+				std::thread t([this, i]()
 				{
-					this->worker_thread(i, input_sock);
+					this->worker_thread(i);
 				});
 
 				// t.detach();
@@ -332,43 +657,39 @@ namespace { namespace aux {
 			threads_.clear();
 		}
 
+		virtual bool is_fused() const override
+		{
+			return conf_->fused;
+		}
+
+		virtual bool dispatch(raw_request_ptr const& req) override
+		{
+			uint32_t const rr = dispatch_rr_.fetch_add(1, std::memory_order_relaxed);
+			return repacker_queues___dispatch(queues_.get(), conf_->n_threads, rr, req);
+		}
+
+		virtual repacker_worker_ptr create_worker() override
+		{
+			return meow::make_unique<repack_worker_impl_t>(globals_, conf_, &out_sock_);
+		}
+
 	private:
 
-		void worker_thread(uint32_t thread_id, nmsg_socket_t& input_sock)
+		void worker_thread(uint32_t thread_id)
 		{
 			std::string const thr_name = ff::fmt_str("repacker/{0}", thread_id);
 
 			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_thread_affinity___apply(globals_, conf_->affinity, thread_id, thr_name);
 
 			MEOW_DEFER(
 				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
 			);
 
-			// thread-local cache for global shared dictionary
-			repacker_dictionary_t r_dictionary { globals_->dictionary() };
-
-			// thread-local pointer to the global nameword dictionary
-			// periodically reloaded in RCU style
-			nameword_dictionary_ptr nw_dictionary { globals_->dictionary()->load_nameword_dict() };
-
-			// batch state
-			auto const create_batch = [&]()
-			{
-				constexpr size_t nmpa_block_size = 64 * 1024;
-				auto batch = meow::make_intrusive<packet_batch_t>(conf_->batch_size, nmpa_block_size);
-				batch->repacker_state = std::make_shared<repacker_state_impl_t>(r_dictionary.current_wordslice());
-				return batch;
-			};
-
-			auto const try_send_batch = [&](packet_batch_ptr& batch)
-			{
-				r_dictionary.start_new_wordslice(); // make sure batch has only one wordslice
+			repack_worker_impl_t worker { globals_, conf_, &out_sock_ };
 
-				++stats_->repacker.batch_send_total;
-				out_sock_.send_message(batch);
-			};
-
-			packet_batch_ptr batch = create_batch();
+			repacker_input_queue_t& queue = queues_[thread_id];
+			uint64_t n_batches_stolen = 0;
 
 			// processing loop
 			nmsg_poller_t poller;
@@ -382,45 +703,33 @@ namespace { namespace aux {
 			// resetable periodic event, to 'idly' send batch at regular intervals
 			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
 			{
-				if (!batch || batch->packet_count == 0)
+				if (!worker.has_pending_batch())
 					return;
 
 				++stats_->repacker.batch_send_by_timer;
-
-				try_send_batch(batch);
-				batch = create_batch();
+				worker.flush();
 			});
 
 			// periodically get rusage
-			poller.ticker(1 * d_second, [this, thread_id](timeval_t now)
+			poller.ticker(1 * d_second, [this, thread_id, &n_batches_stolen](timeval_t now)
 			{
 				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
 
 				std::lock_guard<std::mutex> lk_(stats_->mtx);
 				stats_->repacker_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
 				stats_->repacker_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
-			});
+				stats_->repacker_threads[thread_id].batches_stolen = n_batches_stolen;
 
-			// periodically re-load nameword dictionary, to see what's updated
-			// this is basically a poor man's RCU scheme (dict is fully copied + appended to on insert)
-			poller.ticker(1 * d_second, [&](timeval_t now)
-			{
-				nw_dictionary = globals_->dictionary()->load_nameword_dict();
-				// LOG_DEBUG(globals_->logger(), "{0}; reloaded nw_dictionary: {1}", thr_name, nw_dictionary.get());
+				// queue depth gauges for all threads, not just this one
+				// as a thread with a backlog is likely to be too busy to report its own
+				for (uint32_t i = 0; i < conf_->n_threads; i++)
+					stats_->repacker_threads[i].queue_depth = queues_[i].depth.load(std::memory_order_relaxed);
 			});
 
-			// reap old dictionary wordslices periodically
-			// 250ms is hand-tuned with a synthetic test at ~400k random 32byte strings/sec
-			// might be made tunable, but no need for now
-			poller.ticker(250 * d_millisecond, [&](timeval_t now)
+			// dictionary maintenance, see repacker_worker_t::tick()
+			poller.ticker(repacker_worker_t::tick_interval(), [&](timeval_t now)
 			{
-				meow::stopwatch_t sw;
-
-				auto const reap_stats = r_dictionary.reap_unused_wordslices();
-
-				// LOG_DEBUG(globals_->logger(),
-				// 	"{0}; reaping old dictionary wordslices; time: {1}, slices: {2}, words_local: {3}, words_global: {4}",
-				// 	thr_name, sw.stamp(), reap_stats.reaped_slices, reap_stats.reaped_words_local, reap_stats.reaped_words_global);
+				worker.tick(now);
 			});
 
 			// shutdown
@@ -430,75 +739,53 @@ namespace { namespace aux {
 				poller.set_shutdown_flag();
 			});
 
-			// process incoming packets
-			poller.read_nn_socket(input_sock, [&](timeval_t now)
+			auto const process_batch = [&](timeval_t now, raw_request_ptr const& req)
+			{
+				// reset idle batch send interval, to keep batch send ticker *interval* intact
+				if (worker.process_raw_request(req.get()))
+					poller.reset_ticker(batch_send_tick, now);
+			};
+
+			// own queue first, other threads' backlog only when there is nothing to do
+			auto const try_steal = [&](timeval_t now)
+			{
+				if (conf_->n_threads < 2 || queue.depth.load(std::memory_order_relaxed) > 0)
+					return;
+
+				uint32_t const n_stolen = repacker_queues___steal(queues_.get(), conf_->n_threads, thread_id, steal_min_depth, max_batches_per_poll_iteration,
+					[&](raw_request_ptr const& req)
+					{
+						process_batch(now, req);
+					});
+
+				stats_->repacker.batches_stolen += n_stolen;
+				n_batches_stolen += n_stolen;
+			};
+
+			// nothing is coming in, but some other thread might be stuck with a backlog
+			poller.ticker(steal_interval(), [&](timeval_t now)
 			{
-				constexpr size_t const max_batches_per_poll_iteration = 4;
+				try_steal(now);
+			});
 
+			// process incoming packets
+			poller.read_nn_socket(queue.pull_sock, [&](timeval_t now)
+			{
 				for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
 				{
 					++stats_->repacker.recv_total;
 
 					// receive in a loop with NN_DONTWAIT to avoid hanging here when we're out of incoming data
-					auto const req = input_sock.recv<raw_request_ptr>(thr_name, NN_DONTWAIT);
-					if (!req) { // EAGAIN
+					raw_request_ptr req;
+					if (!repacker_queue___recv(queue, &req)) { // EAGAIN
 						++stats_->repacker.recv_eagain;
 						break;
 					}
 
-					for (uint32_t i = 0; i < req->request_count; i++)
-					{
-						++stats_->repacker.recv_packets;
-
-						 // non-const, since pinba_validate_request() might change the packet
-						auto *pb_req = req->requests[i];
-
-						// validation should not fail, generally.
-						// pinba is expected to be mostly receiving traffic from trusted sources (your code, mon!)
-						auto const vr = pinba_validate_request(pb_req);
-						if (vr != request_validate_result::okay)
-						{
-							++stats_->repacker.packet_validate_err;
-							LOG_DEBUG(globals_->logger(), "request validation failed: {0}: {1}", vr, enum_as_str_ref(vr));
-							continue;
-						}
-
-						packet_t *packet = pinba_request_to_packet(pb_req, nw_dictionary.get(), &r_dictionary, &batch->nmpa);
-
-						if (globals_->options()->packet_debug)
-						{
-							static double curr_fraction = 1.0; // to start dumping immediately
-
-							if (curr_fraction >= 1.0)
-							{
-								auto sink = meow::logging::logger_as_sink(*globals_->logger(), meow::logging::log_level::info, meow::line_mode::prefix);
-								debug_dump_packet(sink, packet, globals_->dictionary(), &batch->nmpa);
-
-								curr_fraction = globals_->options()->packet_debug_fraction;
-							}
-							else
-							{
-								curr_fraction += globals_->options()->packet_debug_fraction;
-							}
-						}
-
-						// append to current batch
-						batch->packets[batch->packet_count] = packet;
-						batch->packet_count++;
-
-						if (batch->packet_count >= conf_->batch_size)
-						{
-							++stats_->repacker.batch_send_by_size;
-
-							try_send_batch(batch);
-							batch = create_batch();
-
-							// reset idle batch send interval
-							// to keep batch send ticker *interval* intact
-							poller.reset_ticker(batch_send_tick, now);
-						}
-					}
+					process_batch(now, req);
 				}
+
+				try_steal(now);
 			});
 
 			poller.loop();
@@ -517,6 +804,9 @@ namespace { namespace aux {
 		pinba_stats_t    *stats_;
 		repacker_conf_t  *conf_;
 
+		repacker_input_queues_ptr  queues_;          // conf_->n_threads of them, empty in fused mode
+		std::atomic<uint32_t>      dispatch_rr_ = {0};
+
 		std::vector<std::thread> threads_;
 	};
 
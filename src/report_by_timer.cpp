@@ -285,7 +285,19 @@ namespace { namespace aux {
 				// key info
 				ki_.from_config(conf);
 
-				// bloom
+				// tag lookup tables, key tags and filter tags might share names, that's fine
+				{
+					for (uint32_t i = 0; i < ki_.request_tag_r.size(); ++i)
+						request_tag_key_slots_[i] = request_tags_.add(ki_.request_tag_r[i].d.request_tag);
+
+					for (uint32_t i = 0; i < ki_.timer_tag_r.size(); ++i)
+						timer_tag_key_slots_[i] = timer_tags_.add(ki_.timer_tag_r[i].d.timer_tag);
+
+					for (auto const& ttf : conf_.timertag_filters)
+						timer_tags_.require_value(timer_tags_.add(ttf.name_id), ttf.value_id);
+				}
+
+				// bloom, cheap check before looking at tags, no false negatives
 				{
 					for (auto const& kd : conf_.keys)
 					{
@@ -359,83 +371,36 @@ namespace { namespace aux {
 					}
 				}
 
-				// check if timer is interesting (aka satisfies filters)
-				auto const filter_by_timer_tags = [&](packed_timer_t const *t) -> bool
-				{
-					for (auto const& tfd : conf_.timertag_filters)
-					{
-						bool tag_exists = false;
-
-						for (uint32_t tag_i = 0; tag_i < t->tag_count; ++tag_i)
-						{
-							if (t->tag_name_ids[tag_i] != tfd.name_id)
-								continue;
-
-							tag_exists = true;
-
-							if (t->tag_value_ids[tag_i] != tfd.value_id)
-								return false;
-						}
-
-						if (!tag_exists)
-							return false;
-					}
-					return true;
-				};
+				// single pass over timer tags, for all key tags and filters, see tag_name_slots_t
+				enum class timer_tags_result { ok, filtered_out, key_tags_missing };
 
-				// put key data into out_range if timer has all the parts
-				auto const fetch_by_timer_tags = [&](key_info_t const& ki, key_subrange_t out_range, packed_timer_t const *t) -> bool
+				auto const fetch_by_timer_tags = [&](key_subrange_t out_range, packed_timer_t const *t) -> timer_tags_result
 				{
-					uint32_t const n_tags_required = out_range.size();
+					auto const fr = timer_tags_.find(t->tag_name_ids, t->tag_value_ids, t->tag_count);
 
-					for (uint32_t i = 0; i < n_tags_required; ++i)
-					{
-						bool tag_found = false;
+					// filters first: every filtered tag must be present, and have required value
+					if (fr.value_mismatch || fr.n_found_required != timer_tags_.n_required())
+						return timer_tags_result::filtered_out;
 
-						for (uint32_t tag_i = 0; tag_i < t->tag_count; ++tag_i)
-						{
-							if (t->tag_name_ids[tag_i] != ki.timer_tag_r[i].d.timer_tag)
-								continue;
+					if (fr.n_found != timer_tags_.size())
+						return timer_tags_result::key_tags_missing;
 
-							out_range[i] = t->tag_value_ids[tag_i];
-							tag_found = true;
-							break;
-						}
+					for (uint32_t i = 0; i < out_range.size(); ++i)
+						out_range[i] = timer_tags_.value(timer_tag_key_slots_[i]);
 
-						// each full run of inner loop - must get us a tag
-						// so if it didn't -> just return false
-						if (!tag_found)
-							return false;
-					}
-
-					return true;
+					return timer_tags_result::ok;
 				};
 
 				auto const find_request_tags = [&](key_info_t const& ki, key_t *out_key) -> bool
 				{
 					key_subrange_t out_range = ki_.rtag_key_subrange(*out_key);
 
-					uint32_t const n_tags_required = out_range.size();
+					auto const fr = request_tags_.find(packet->tag_name_ids, packet->tag_value_ids, packet->tag_count);
+					if (fr.n_found != request_tags_.size())
+						return false;
 
-					for (uint32_t tag_i = 0; tag_i < n_tags_required; ++tag_i)
-					{
-						bool tag_found = false;
-
-						for (uint16_t i = 0, i_end = packet->tag_count; i < i_end; ++i)
-						{
-							if (packet->tag_name_ids[i] != ki.request_tag_r[tag_i].d.request_tag)
-								continue;
-
-							out_range[tag_i] = packet->tag_value_ids[i];
-							tag_found = true;
-							break;
-						}
-
-						// each full run of inner loop - must get us a tag
-						// so if it didn't -> just return false
-						if (!tag_found)
-							return false;
-					}
+					for (uint32_t i = 0; i < out_range.size(); ++i)
+						out_range[i] = request_tags_.value(request_tag_key_slots_[i]);
 
 					return true;
 				};
@@ -497,14 +462,13 @@ namespace { namespace aux {
 							continue;
 						}
 
-						bool const timer_ok = filter_by_timer_tags(timer);
-						if (!timer_ok) {
+						auto const tags_result = fetch_by_timer_tags(timer_key_range, timer);
+						if (tags_result == timer_tags_result::filtered_out) {
 							timers_skipped_by_filters++;
 							continue;
 						}
 
-						bool const timer_found = fetch_by_timer_tags(ki_, timer_key_range, timer);
-						if (!timer_found) {
+						if (tags_result == timer_tags_result::key_tags_missing) {
 							timers_skipped_by_tags++;
 							continue;
 						}
@@ -552,6 +516,11 @@ namespace { namespace aux {
 
 			key_info_t                   ki_;
 
+			tag_name_slots_t             request_tags_;
+			tag_name_slots_t             timer_tags_;            // key tags + filters
+			std::array<uint32_t, NKeys>  request_tag_key_slots_; // request_tags_ slot, for every request tag key part
+			std::array<uint32_t, NKeys>  timer_tag_key_slots_;   // timer_tags_ slot, for every timer tag key part
+
 			timertag_bloom_t             packet_bloom_;
 			timer_bloom_t                timer_bloom_;
 
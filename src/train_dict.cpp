@@ -0,0 +1,224 @@
+#include "pinba_config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>      // getopt
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define ZDICT_STATIC_LINKING_ONLY // fastCover training with parameter optimization
+#include <zstd.h>
+#include <zdict.h>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/collector.h" // PINBA_NET_DATAGRAM_FLAG___*
+#include "pinba/capture.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// trains zstd dictionary for PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT datagrams
+// from udp traffic captured with tcpdump, like: tcpdump -i eth0 -w pinba.pcap udp dst port 30002
+// or by pinba itself (see collector_conf_t::capture_file)
+//
+// every uncompressed datagram is a sample (v1 header is stripped), compressed ones are skipped
+// see pinba/capture.h for supported pcap link types
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct options_t
+	{
+		std::string  output;
+		size_t       dict_size   = 64 * 1024;
+		uint32_t     dict_id     = 0;         // 0 = random, picked by zstd
+		int          level       = 3;
+		uint16_t     port        = 0;         // 0 = any
+		size_t       max_samples = 100 * 1000;
+	};
+
+	struct samples_t
+	{
+		std::string          data;  // all samples, back to back
+		std::vector<size_t>  sizes;
+
+		uint64_t n_skipped_compressed = 0;
+		uint64_t n_skipped_other      = 0;  // not udp, wrong port, fragments, truncated by snaplen, etc.
+	};
+
+	void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} -o <dict_file> [options] <capture.pcap|pinba capture file>...\n"
+			"  -o <file>   write dictionary to file\n"
+			"  -s <bytes>  max dictionary size (default: 65536)\n"
+			"  -i <id>     dictionary id, must be unique among dictionaries loaded by pinba (default: random)\n"
+			"  -l <level>  zstd compression level, clients are going to use (default: 3)\n"
+			"  -p <port>   take only datagrams sent to this udp port (default: any)\n"
+			"  -n <count>  max number of samples to take (default: 100000)\n"
+			, argv0);
+	}
+
+	// same as parse_network_datagram() in collector.cpp
+	void add_sample(samples_t *samples, str_ref dgram)
+	{
+		if (dgram.size() == 0)
+		{
+			samples->n_skipped_other++;
+			return;
+		}
+
+		uint8_t const version = (uint8_t(dgram[0]) >> 4);
+
+		if (version == 1 && dgram.size() >= 4)
+		{
+			uint32_t const flags = uint32_t(dgram[0] & 0x0f) | uint8_t(dgram[1]);
+			if (flags & (PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4 | PINBA_NET_DATAGRAM_FLAG___COMPRESSED_ZSTD_DICT))
+			{
+				samples->n_skipped_compressed++;
+				return;
+			}
+
+			dgram = str_ref { dgram.begin() + 4, dgram.end() };
+		}
+
+		samples->data.append(dgram.data(), dgram.size());
+		samples->sizes.push_back(dgram.size());
+	}
+
+	void read_capture_file(options_t const& opts, samples_t *samples, char const *path)
+	{
+		capture_reader_ptr reader = capture_reader_open(path, opts.port);
+
+		capture_packet_t packet;
+		while (samples->sizes.size() < opts.max_samples && reader->next(&packet))
+			add_sample(samples, packet.data);
+
+		samples->n_skipped_other += reader->n_skipped();
+	}
+
+	std::string train_dictionary(options_t const& opts, samples_t const& samples)
+	{
+		std::string dict(opts.dict_size, '\0');
+
+		ZDICT_fastCover_params_t params;
+		memset(&params, 0, sizeof(params)); // zeroes = defaults, k and d are optimized
+		params.nbThreads                = 1;
+		params.zParams.compressionLevel = opts.level;
+		params.zParams.dictID           = opts.dict_id;
+
+		size_t const dict_sz = ZDICT_optimizeTrainFromBuffer_fastCover(&dict[0], dict.size(), samples.data.data(), samples.sizes.data(), (unsigned)samples.sizes.size(), &params);
+		if (ZDICT_isError(dict_sz))
+			throw std::runtime_error(ff::fmt_str("training failed: {0}", ZDICT_getErrorName(dict_sz)));
+
+		dict.resize(dict_sz);
+		return dict;
+	}
+
+	// compress all samples with trained dictionary, to see what we're going to get
+	void report_compression(options_t const& opts, samples_t const& samples, std::string const& dict)
+	{
+		ZSTD_CCtx *cctx = ZSTD_createCCtx();
+		ZSTD_CDict *cdict = ZSTD_createCDict(dict.data(), dict.size(), opts.level);
+		MEOW_DEFER(
+			ZSTD_freeCDict(cdict);
+			ZSTD_freeCCtx(cctx);
+		);
+
+		if (!cctx || !cdict)
+			throw std::runtime_error("can't create zstd compression context");
+
+		std::string dst;
+		uint64_t src_total = 0, dst_total = 0;
+
+		char const *src = samples.data.data();
+		for (size_t const src_sz : samples.sizes)
+		{
+			dst.resize(ZSTD_compressBound(src_sz));
+
+			size_t const n = ZSTD_compress_usingCDict(cctx, &dst[0], dst.size(), src, src_sz, cdict);
+			if (ZSTD_isError(n))
+				throw std::runtime_error(ff::fmt_str("compression failed: {0}", ZSTD_getErrorName(n)));
+
+			src_total += src_sz;
+			dst_total += n + 4; // + v1 datagram header
+			src += src_sz;
+		}
+
+		ff::fmt(stdout, "compressed {0} samples: {1} -> {2} bytes ({3}%), {4} bytes per packet on average\n",
+			samples.sizes.size(), src_total, dst_total,
+			(src_total > 0) ? dst_total * 100 / src_total : 0,
+			(samples.sizes.empty()) ? 0 : dst_total / samples.sizes.size());
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+try
+{
+	aux::options_t opts;
+
+	int c;
+	while (-1 != (c = getopt(argc, argv, "o:s:i:l:p:n:h")))
+	{
+		switch (c)
+		{
+			case 'o': opts.output      = optarg; break;
+			case 's': opts.dict_size   = strtoul(optarg, NULL, 10); break;
+			case 'i': opts.dict_id     = strtoul(optarg, NULL, 10); break;
+			case 'l': opts.level       = atoi(optarg); break;
+			case 'p': opts.port        = (uint16_t)strtoul(optarg, NULL, 10); break;
+			case 'n': opts.max_samples = strtoul(optarg, NULL, 10); break;
+			default:
+				aux::usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (opts.output.empty() || optind >= argc || opts.dict_size < 1024)
+	{
+		aux::usage(argv[0]);
+		return 1;
+	}
+
+	aux::samples_t samples;
+
+	for (int i = optind; i < argc; i++)
+		aux::read_capture_file(opts, &samples, argv[i]);
+
+	ff::fmt(stdout, "got {0} samples, {1} bytes; skipped {2} compressed, {3} other packets\n",
+		samples.sizes.size(), samples.data.size(), samples.n_skipped_compressed, samples.n_skipped_other);
+
+	// zstd needs quite a few to find anything useful
+	if (samples.sizes.size() < 100)
+		throw std::runtime_error(ff::fmt_str("not enough samples to train on, need at least 100, got {0}", samples.sizes.size()));
+
+	std::string const dict = aux::train_dictionary(opts, samples);
+
+	FILE *f = fopen(opts.output.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error(ff::fmt_str("can't open {0}: {1}", opts.output, strerror(errno)));
+
+	bool const write_ok = (1 == fwrite(dict.data(), dict.size(), 1, f));
+	if ((0 != fclose(f)) || !write_ok)
+		throw std::runtime_error(ff::fmt_str("can't write {0}: {1}", opts.output, strerror(errno)));
+
+	ff::fmt(stdout, "dictionary written to {0}, {1} bytes, id {2}\n", opts.output, dict.size(), ZSTD_getDictID_fromDict(dict.data(), dict.size()));
+
+	aux::report_compression(opts, samples, dict);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# generates capture reader fixtures for test_capture, run from this directory
+# expected contents are checked in test_capture.cpp, keep them in sync
+
+import struct
+
+PORT = 3002
+
+def native_header():
+    return b'PINBACAP' + struct.pack('<II', 1, 32) + b'\0' * 16
+
+def native_record(ts_ns, data):
+    pad = (8 - len(data) % 8) % 8
+    return struct.pack('<QII', ts_ns, len(data), 0) + data + b'\0' * pad
+
+def udp(payload, dst_port=PORT, udp_len=None):
+    if udp_len is None:
+        udp_len = 8 + len(payload)
+    return struct.pack('>HHHH', 40000, dst_port, udp_len, 0) + payload
+
+def ipv4(l4, proto=17, frag=0):
+    return struct.pack('>BBHHHBBH4s4s', 0x45, 0, 20 + len(l4), 1, frag, 64, proto, 0,
+                       bytes([10, 0, 0, 1]), bytes([10, 0, 0, 2])) + l4
+
+def ipv6(l4, next_header=17):
+    return struct.pack('>IHBB16s16s', 6 << 28, len(l4), next_header, 64,
+                       b'\x20\x01' + b'\0' * 13 + b'\x01', b'\x20\x01' + b'\0' * 13 + b'\x02') + l4
+
+def eth(l3, ethertype):
+    return b'\x02' * 6 + b'\x04' * 6 + struct.pack('>H', ethertype) + l3
+
+def eth_vlan(l3, ethertype, vlan=100):
+    return b'\x02' * 6 + b'\x04' * 6 + struct.pack('>HHH', 0x8100, vlan, ethertype) + l3
+
+def sll(l3, ethertype):
+    return struct.pack('>HHH8sH', 0, 1, 6, b'\x02' * 6 + b'\0\0', ethertype) + l3
+
+def pcap(linktype, frames, endian='<', nsec=False):
+    magic = 0xa1b23c4d if nsec else 0xa1b2c3d4
+    out = struct.pack(endian + 'IHHiIII', magic, 2, 4, 0, 0, 65535, linktype)
+    for ts_sec, ts_frac, frame in frames:
+        out += struct.pack(endian + 'IIII', ts_sec, ts_frac, len(frame), len(frame)) + frame
+    return out
+
+def write(name, data):
+    with open(name, 'wb') as f:
+        f.write(data)
+
+# native: 3 records, last one without padding at the end of file
+native = native_header() + native_record(1000, b'first') + native_record(2000, b'12345678') + native_record(3000, b'third record')
+write('native.cap', native[:-4])
+
+# native, second record cut short
+write('native_truncated.cap', native_header() + native_record(1000, b'first') + native_record(2000, b'12345678')[:20])
+
+# ethernet, little endian, usec
+eth_frames = [
+    (1, 1,  eth(ipv4(udp(b'one')), 0x0800)),
+    (1, 2,  eth_vlan(ipv4(udp(b'two')), 0x0800)),                    # vlan tagged
+    (1, 3,  eth(ipv4(udp(b'dns', dst_port=53)), 0x0800)),            # other port
+    (1, 4,  eth(ipv4(b'\0' * 20, proto=6), 0x0800)),                 # tcp
+    (1, 5,  eth(ipv4(udp(b'frag'), frag=0x2000), 0x0800)),           # more fragments flag
+    (1, 6,  eth(ipv6(udp(b'three')), 0x86dd)),                       # ipv6
+    (1, 7,  eth(ipv4(udp(b'cut', udp_len=100)), 0x0800)),            # truncated by snaplen
+    (1, 8,  eth_vlan(ipv6(udp(b'four')), 0x86dd)),                   # vlan tagged ipv6
+    (1, 9,  eth(b'\0' * 28, 0x0806)),                                # arp
+]
+eth_pcap = pcap(1, eth_frames)
+write('eth_vlan.pcap', eth_pcap)
+
+# same, last frame cut short
+write('eth_truncated.pcap', eth_pcap[:-10])
+
+# raw ip, big endian, nsec
+write('raw_ipv6_be.pcap', pcap(101, [
+    (2, 500, ipv6(udp(b'raw six'))),
+    (2, 600, ipv4(udp(b'raw four'))),
+], endian='>', nsec=True))
+
+# linux cooked
+write('sll.pcap', pcap(113, [
+    (3, 0, sll(ipv4(udp(b'cooked')), 0x0800)),
+]))
@@ -0,0 +1,268 @@
+#include "pinba_config.h"
+
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/capture.h"
+
+#include "test_util.h"
+
+#ifndef PINBA_TEST_FIXTURES_DIR
+#define PINBA_TEST_FIXTURES_DIR "fixtures"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// capture files, reading native and pcap fixtures (see fixtures/make_fixtures.py), and writing from many threads
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	std::string fixture(char const *name)
+	{
+		return std::string(PINBA_TEST_FIXTURES_DIR) + "/" + name;
+	}
+
+	struct expected_packet_t
+	{
+		uint64_t     ts_ns;
+		std::string  data;
+	};
+
+	void check_packets(capture_reader_t *reader, std::vector<expected_packet_t> const& expected)
+	{
+		capture_packet_t packet;
+
+		for (auto const& e : expected)
+		{
+			TEST_CHECK(reader->next(&packet));
+			TEST_CHECK_EQ(packet.ts_ns, e.ts_ns);
+			TEST_CHECK(packet.data == str_ref { e.data });
+		}
+
+		TEST_CHECK(!reader->next(&packet));
+		TEST_CHECK(!reader->next(&packet)); // and stays at the end
+	}
+
+	void test_native()
+	{
+		std::vector<expected_packet_t> const expected = {
+			{ 1000, "first" },
+			{ 2000, "12345678" },
+			{ 3000, "third record" }, // padding is cut from the end of file
+		};
+
+		capture_reader_ptr reader = capture_reader_open(fixture("native.cap"), 0);
+		TEST_CHECK(std::string(reader->format()) == "pinba capture");
+
+		check_packets(reader.get(), expected);
+
+		reader->rewind();
+		check_packets(reader.get(), expected);
+		TEST_CHECK_EQ(reader->n_skipped(), 0);
+
+		// record cut in the middle of data
+		capture_reader_ptr truncated = capture_reader_open(fixture("native_truncated.cap"), 0);
+		check_packets(truncated.get(), { { 1000, "first" } });
+	}
+
+	void test_pcap_ethernet()
+	{
+		uint64_t const sec = nsec_in_sec;
+		uint64_t const usec = 1000;
+
+		// vlan tagged and ipv6 frames are taken, other ports, tcp, fragments, snaplen truncated and arp are skipped
+		{
+			capture_reader_ptr reader = capture_reader_open(fixture("eth_vlan.pcap"), 3002);
+			TEST_CHECK(std::string(reader->format()) == "pcap");
+
+			check_packets(reader.get(), {
+				{ sec + 1 * usec, "one" },
+				{ sec + 2 * usec, "two" },
+				{ sec + 6 * usec, "three" },
+				{ sec + 8 * usec, "four" },
+			});
+			TEST_CHECK_EQ(reader->n_skipped(), 5);
+		}
+
+		// any port
+		{
+			capture_reader_ptr reader = capture_reader_open(fixture("eth_vlan.pcap"), 0);
+			check_packets(reader.get(), {
+				{ sec + 1 * usec, "one" },
+				{ sec + 2 * usec, "two" },
+				{ sec + 3 * usec, "dns" },
+				{ sec + 6 * usec, "three" },
+				{ sec + 8 * usec, "four" },
+			});
+			TEST_CHECK_EQ(reader->n_skipped(), 4);
+		}
+
+		// last frame cut short, it's not even looked at
+		{
+			capture_reader_ptr reader = capture_reader_open(fixture("eth_truncated.pcap"), 3002);
+			check_packets(reader.get(), {
+				{ sec + 1 * usec, "one" },
+				{ sec + 2 * usec, "two" },
+				{ sec + 6 * usec, "three" },
+				{ sec + 8 * usec, "four" },
+			});
+			TEST_CHECK_EQ(reader->n_skipped(), 4);
+		}
+	}
+
+	void test_pcap_other_link_types()
+	{
+		uint64_t const sec = nsec_in_sec;
+
+		// raw ip, big endian file, nanosecond timestamps
+		capture_reader_ptr raw = capture_reader_open(fixture("raw_ipv6_be.pcap"), 3002);
+		check_packets(raw.get(), {
+			{ 2 * sec + 500, "raw six" },
+			{ 2 * sec + 600, "raw four" },
+		});
+
+		// linux cooked, tcpdump -i any
+		capture_reader_ptr sll = capture_reader_open(fixture("sll.pcap"), 3002);
+		check_packets(sll.get(), { { 3 * sec, "cooked" } });
+	}
+
+	void test_open_errors()
+	{
+		auto const open_throws = [](std::string const& path)
+		{
+			try
+			{
+				capture_reader_open(path, 0);
+				return false;
+			}
+			catch (std::runtime_error const&)
+			{
+				return true;
+			}
+		};
+
+		TEST_CHECK(open_throws(fixture("no_such_file.pcap")));
+		TEST_CHECK(open_throws(fixture("make_fixtures.py"))); // not a capture
+	}
+
+	// all threads append to the same file, every record must be intact, and in order within a thread
+	void test_writer()
+	{
+		std::string const path = "test_capture." + std::to_string(getpid()) + ".cap";
+		unlink(path.c_str());
+
+		uint32_t const n_threads = 4;
+		uint32_t const n_records = 20000;
+
+		auto const record_data = [](uint32_t thread_id, uint32_t i)
+		{
+			std::string data = std::to_string(thread_id) + ":" + std::to_string(i) + ":";
+			data.append(i % 300, char('a' + i % 26));
+			return data;
+		};
+
+		{
+			capture_writer_t writer { path };
+
+			// checks are not thread safe, threads just report their write errors
+			std::vector<uint64_t> n_write_errors(n_threads, 0);
+
+			std::vector<std::thread> threads;
+			for (uint32_t t = 0; t < n_threads; t++)
+			{
+				threads.emplace_back([&, t]()
+				{
+					capture_buffer_t buffer { &writer };
+
+					for (uint32_t i = 0; i < n_records; i++)
+						buffer.append(uint64_t(t) << 32 | i, record_data(t, i));
+
+					buffer.flush();
+					n_write_errors[t] = buffer.n_write_errors();
+				});
+			}
+
+			for (auto& thr : threads)
+				thr.join();
+
+			for (uint32_t t = 0; t < n_threads; t++)
+				TEST_CHECK_EQ(n_write_errors[t], 0);
+		}
+
+		// appending to existing file
+		{
+			capture_writer_t writer { path };
+			capture_buffer_t buffer { &writer };
+			buffer.append(uint64_t(n_threads) << 32, record_data(n_threads, 0));
+		}
+
+		{
+			capture_reader_ptr reader = capture_reader_open(path, 0);
+			TEST_CHECK(std::string(reader->format()) == "pinba capture");
+
+			std::vector<uint32_t> next_i(n_threads + 1, 0);
+			capture_packet_t packet;
+
+			while (reader->next(&packet))
+			{
+				uint32_t const t = packet.ts_ns >> 32;
+				uint32_t const i = packet.ts_ns & 0xffffffff;
+
+				TEST_CHECK(t <= n_threads);
+				if (t > n_threads)
+					break;
+
+				TEST_CHECK_EQ(i, next_i[t]);
+				TEST_CHECK(packet.data == str_ref { record_data(t, i) });
+				next_i[t] = i + 1;
+			}
+
+			for (uint32_t t = 0; t < n_threads; t++)
+				TEST_CHECK_EQ(next_i[t], n_records);
+			TEST_CHECK_EQ(next_i[n_threads], 1);
+		}
+
+		// not a capture file, can't append
+		{
+			FILE *f = fopen(path.c_str(), "w");
+			TEST_CHECK(f != NULL);
+			if (f)
+			{
+				fputs("not a capture file, but long enough to have a header", f);
+				fclose(f);
+			}
+
+			bool thrown = false;
+			try
+			{
+				capture_writer_t writer { path };
+			}
+			catch (std::runtime_error const&)
+			{
+				thrown = true;
+			}
+			TEST_CHECK(thrown);
+		}
+
+		unlink(path.c_str());
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_native();
+	aux::test_pcap_ethernet();
+	aux::test_pcap_other_link_types();
+	aux::test_open_errors();
+	aux::test_writer();
+
+	return test_result();
+}
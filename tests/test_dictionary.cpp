@@ -0,0 +1,553 @@
+#include "pinba_config.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// dictionary building blocks, single threaded, and dictionary_t refcounting from many threads
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	std::string make_word(uint32_t i)
+	{
+		return "word_" + std::to_string(i);
+	}
+
+	void test_segmented_array()
+	{
+		// first segment is 4 elements, then 8, 16, ...
+		segmented_array_t<uint32_t, 2> arr;
+		TEST_CHECK_EQ(arr.size(), 0);
+		TEST_CHECK_EQ(arr.capacity(), 0);
+
+		uint32_t const n = 1000;
+		std::vector<uint32_t const*> ptrs;
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			uint32_t& v = arr.emplace_back();
+			v = i * 7;
+			ptrs.push_back(&v);
+
+			TEST_CHECK_EQ(arr.size(), i + 1);
+		}
+
+		// 4 + 8 + ... + 512 = 1020 >= 1000 > 508
+		TEST_CHECK_EQ(arr.capacity(), 1020);
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			TEST_CHECK_EQ(arr[i], i * 7);
+			TEST_CHECK(&arr[i] == ptrs[i]); // elements never move
+		}
+
+		// segment boundaries exactly
+		segmented_array_t<uint32_t, 2> const& carr = arr;
+		for (uint32_t const i : { 0, 3, 4, 11, 12, 27, 28, 999 })
+			TEST_CHECK_EQ(carr[i], i * 7);
+	}
+
+	void test_nameword_dictionary()
+	{
+		nameword_dictionary_t d;
+		TEST_CHECK_EQ(d.size(), 0);
+		TEST_CHECK(d.get("nothing") == nullptr);
+
+		uint64_t const initial_hash_bytes = d.memory_used().hash_bytes;
+
+		// enough to grow the index table a few times (starts with 64 slots, at most half full)
+		uint32_t const n = 5000;
+		std::vector<nameword_dictionary_t::nameword_t const*> inserted;
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			std::string const word = make_word(i);
+			auto const *nw = d.insert_with_external_locking(word);
+
+			TEST_CHECK(nw != nullptr);
+			TEST_CHECK_EQ(nw->id, i + 1); // dense ids, in insertion order
+			TEST_CHECK_EQ(nw->str_hash, hash_dictionary_word(word));
+			TEST_CHECK_EQ(nw->id_hash, pinba::hash_number(nw->id));
+			TEST_CHECK_EQ(d.size(), i + 1);
+
+			// published, i.e. visible to get() right after insert
+			TEST_CHECK(d.get(word) == nw);
+
+			// oldest word is still found through the newest table
+			TEST_CHECK(d.get(make_word(0)) == (inserted.empty() ? nw : inserted[0]));
+
+			inserted.push_back(nw);
+		}
+
+		TEST_CHECK(d.memory_used().hash_bytes > initial_hash_bytes);
+		TEST_CHECK(d.memory_used().strings_bytes > 0);
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			std::string const word = make_word(i);
+
+			// pointers are stable across table rebuilds
+			TEST_CHECK(d.get(word) == inserted[i]);
+			TEST_CHECK(d.get(word, hash_dictionary_word(word)) == inserted[i]);
+
+			// insert of an existing word returns it
+			TEST_CHECK(d.insert_with_external_locking(word) == inserted[i]);
+		}
+
+		TEST_CHECK_EQ(d.size(), n);
+
+		TEST_CHECK(d.get(make_word(n)) == nullptr);
+		TEST_CHECK(d.get("") == nullptr);
+
+		// empty string is a valid word
+		auto const *empty = d.insert_with_external_locking("");
+		TEST_CHECK_EQ(empty->id, n + 1);
+		TEST_CHECK(d.get("") == empty);
+	}
+
+	// returns true if arena gave memory back, and frees it
+	bool arena_deallocate(dictionary_word_arena_t& arena, str_ref s)
+	{
+		void *to_free = arena.deallocate(s);
+		free(to_free);
+		return (to_free != nullptr);
+	}
+
+	void test_arena_size_classes()
+	{
+		size_t const slab_size = dictionary_word_arena_t::slab_size;
+
+		dictionary_word_arena_t arena;
+		TEST_CHECK_EQ(arena.mem_allocated(), 0);
+
+		// 1 and 16 bytes share the smallest class, i.e. slab
+		str_ref const s1 = arena.allocate(std::string(1, 'a'));
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+
+		str_ref const s16 = arena.allocate(std::string(16, 'b'));
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+		TEST_CHECK(((uintptr_t)s1.data() & ~(slab_size - 1)) == ((uintptr_t)s16.data() & ~(slab_size - 1)));
+
+		// 17 is the next class, 2048 is the last one
+		str_ref const s17 = arena.allocate(std::string(17, 'c'));
+		TEST_CHECK_EQ(arena.mem_allocated(), 2 * slab_size);
+
+		str_ref const s2048 = arena.allocate(std::string(2048, 'd'));
+		TEST_CHECK_EQ(arena.mem_allocated(), 3 * slab_size);
+
+		// larger ones are malloc()-ed one by one
+		str_ref const s2049 = arena.allocate(std::string(2049, 'e'));
+		TEST_CHECK_EQ(arena.mem_allocated(), 3 * slab_size + 2049);
+
+		for (str_ref const s : { s1, s16, s17, s2048 })
+			TEST_CHECK_EQ((uintptr_t)s.data() % 16, 0);
+
+		TEST_CHECK(s1 == str_ref { std::string(1, 'a') });
+		TEST_CHECK(s16 == str_ref { std::string(16, 'b') });
+		TEST_CHECK(s17 == str_ref { std::string(17, 'c') });
+		TEST_CHECK(s2048 == str_ref { std::string(2048, 'd') });
+		TEST_CHECK(s2049 == str_ref { std::string(2049, 'e') });
+
+		TEST_CHECK_EQ(arena.mem_used_by_strings(), 1 + 16 + 17 + 2048 + 2049);
+
+		// large string memory is given back to caller right away
+		void *large = arena.deallocate(s2049);
+		TEST_CHECK(large == (void*)s2049.data());
+		free(large);
+		TEST_CHECK_EQ(arena.mem_allocated(), 3 * slab_size);
+
+		// single slab per class is kept as spare, when it becomes empty
+		for (str_ref const s : { s1, s16, s17, s2048 })
+			TEST_CHECK(!arena_deallocate(arena, s));
+
+		TEST_CHECK_EQ(arena.mem_allocated(), 3 * slab_size);
+		TEST_CHECK_EQ(arena.mem_used_by_strings(), 0);
+	}
+
+	void test_arena_slab_reuse()
+	{
+		size_t const slab_size     = dictionary_word_arena_t::slab_size;
+		size_t const slots_in_slab = (slab_size - dictionary_word_arena_t::slab_header_size) / 128;
+
+		dictionary_word_arena_t arena;
+		std::string const str(100, 'x'); // 128 byte class
+
+		// freed slot is reused first
+		{
+			str_ref const a = arena.allocate(str);
+			str_ref const b = arena.allocate(str);
+			TEST_CHECK(!arena_deallocate(arena, a));
+
+			str_ref const c = arena.allocate(str);
+			TEST_CHECK(c.data() == a.data());
+
+			TEST_CHECK(!arena_deallocate(arena, b));
+			TEST_CHECK(!arena_deallocate(arena, c)); // slab is empty now, becomes a spare one
+		}
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+
+		// fill 3 slabs exactly
+		std::vector<str_ref> strings;
+		for (size_t i = 0; i < 3 * slots_in_slab; i++)
+			strings.push_back(arena.allocate(str));
+
+		TEST_CHECK_EQ(arena.mem_allocated(), 3 * slab_size);
+
+		// one more takes another slab
+		strings.push_back(arena.allocate(str));
+		TEST_CHECK_EQ(arena.mem_allocated(), 4 * slab_size);
+
+		// free everything, one empty slab is kept, others are returned
+		unsigned n_returned = 0;
+		for (str_ref const s : strings)
+			n_returned += arena_deallocate(arena, s);
+
+		TEST_CHECK_EQ(n_returned, 3);
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+		TEST_CHECK_EQ(arena.mem_used_by_strings(), 0);
+
+		// and spare slab is used again, without taking new memory
+		strings.clear();
+		for (size_t i = 0; i < slots_in_slab; i++)
+			strings.push_back(arena.allocate(str));
+
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+
+		// partially free a full slab, it's reused before taking a new one
+		for (size_t i = 0; i < slots_in_slab; i += 2)
+			TEST_CHECK(!arena_deallocate(arena, strings[i]));
+
+		for (size_t i = 0; i < slots_in_slab; i += 2)
+			strings[i] = arena.allocate(str);
+
+		TEST_CHECK_EQ(arena.mem_allocated(), slab_size);
+
+		for (str_ref const s : strings)
+			TEST_CHECK(s == str_ref { str });
+	}
+
+	// random sizes, across all classes and large strings, interleaved frees
+	void test_arena_contents()
+	{
+		dictionary_word_arena_t arena;
+
+		struct live_t
+		{
+			str_ref      s;
+			std::string  expected;
+		};
+		std::vector<live_t> live;
+
+		uint64_t rnd = 12345;
+		auto const next_rnd = [&rnd]() -> uint32_t
+		{
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			return uint32_t(rnd >> 33);
+		};
+
+		uint64_t expected_bytes = 0;
+
+		for (uint32_t i = 0; i < 20000; i++)
+		{
+			if (!live.empty() && (next_rnd() % 3) == 0)
+			{
+				size_t const idx = next_rnd() % live.size();
+				TEST_CHECK(live[idx].s == str_ref { live[idx].expected });
+
+				expected_bytes -= live[idx].s.size();
+				arena_deallocate(arena, live[idx].s);
+
+				live[idx] = live.back();
+				live.pop_back();
+				continue;
+			}
+
+			size_t const size = ((next_rnd() % 64) == 0)
+								? dictionary_word_arena_t::max_class_size + 1 + next_rnd() % 4096
+								: next_rnd() % (dictionary_word_arena_t::max_class_size + 1);
+
+			std::string str(size, char('a' + i % 26));
+			if (size > 0)
+				str[size - 1] = '$';
+
+			live.push_back(live_t { arena.allocate(str), str });
+			expected_bytes += size;
+		}
+
+		TEST_CHECK_EQ(arena.mem_used_by_strings(), expected_bytes);
+		TEST_CHECK(arena.mem_allocated() >= expected_bytes);
+
+		for (auto const& l : live)
+		{
+			TEST_CHECK(l.s == str_ref { l.expected });
+			arena_deallocate(arena, l.s);
+		}
+
+		TEST_CHECK_EQ(arena.mem_used_by_strings(), 0);
+		TEST_CHECK(arena.mem_allocated() <= dictionary_word_arena_t::n_classes * dictionary_word_arena_t::slab_size); // spares only
+	}
+
+	// dictionary_t::hash_t, through a few incremental migrations
+	// inserts, erases and lookups interleaved, checked against std::unordered_map
+	void test_incremental_hash()
+	{
+		using word_t      = dictionary_t::word_t;
+		using hash_t      = dictionary_t::hash_t;
+		using hashtable_t = dictionary_t::hashtable_t;
+
+		uint32_t const n_words = 8 * hash_t::incremental_min_size;
+
+		std::deque<std::string>   strings; // never move
+		std::unique_ptr<word_t[]> words { new word_t[n_words] };
+
+		hash_t hash;
+		std::unordered_map<std::string, word_t*> expected;
+
+		uint64_t rnd = 54321;
+		auto const next_rnd = [&rnd]() -> uint32_t
+		{
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			return uint32_t(rnd >> 33);
+		};
+
+		size_t n_retired = 0;
+		auto const take_retired = [&]()
+		{
+			hashtable_t retired;
+			hash.take_retired(&retired);
+			n_retired += !retired.empty();
+		};
+
+		auto const check_find = [&](uint32_t i)
+		{
+			std::string const& str = strings[i];
+			auto const it = expected.find(str);
+
+			word_t *w = hash.find(str, words[i].hash);
+			TEST_CHECK(w == ((it == expected.end()) ? nullptr : it->second));
+		};
+
+		// existing word must be found, and never inserted again
+		// that's also done right before inserting a new word, i.e. exactly when the table is about to grow
+		auto const check_existing_emplace = [&](uint32_t i)
+		{
+			if (expected.count(strings[i]) == 0)
+				return;
+
+			auto const res = hash.emplace_hash(words[i].hash, strings[i], nullptr);
+			TEST_CHECK(!res.second);
+			TEST_CHECK(res.first->second == &words[i]);
+		};
+
+		for (uint32_t i = 0; i < n_words; i++)
+		{
+			strings.push_back(make_word(i));
+
+			word_t& w = words[i];
+			w.id   = i + 1;
+			w.hash = hash_dictionary_word(strings[i]);
+			w.str  = strings[i];
+
+			if (i > 0)
+			{
+				check_existing_emplace(i - 1);
+				check_existing_emplace(next_rnd() % i);
+			}
+
+			auto const res = hash.emplace_hash(w.hash, w.str, &w);
+			TEST_CHECK(res.second);
+			TEST_CHECK(res.first->second == &w);
+			expected.emplace(strings[i], &w);
+
+			take_retired();
+
+			// erase about a quarter, recently inserted ones and old ones (those are likely in old table)
+			if ((next_rnd() % 4) == 0)
+			{
+				uint32_t const victim = (next_rnd() % 2) ? i - next_rnd() % std::min(i + 1, 100u) : next_rnd() % (i + 1);
+				bool const exists = (expected.erase(strings[victim]) > 0);
+
+				TEST_CHECK_EQ(hash.erase(strings[victim], words[victim].hash), size_t(exists ? 1 : 0));
+				take_retired();
+			}
+
+			check_find(i);
+			check_find(next_rnd() % (i + 1));
+		}
+
+		// table has grown incrementally a couple of times, and every migration has finished
+		TEST_CHECK(n_retired >= 2);
+
+		for (uint32_t i = 0; i < n_words; i++)
+			check_find(i);
+
+		// erase everything, while possibly still migrating
+		for (uint32_t i = 0; i < n_words; i++)
+		{
+			bool const exists = (expected.erase(strings[i]) > 0);
+			TEST_CHECK_EQ(hash.erase(strings[i], words[i].hash), size_t(exists ? 1 : 0));
+			TEST_CHECK(hash.find(strings[i], words[i].hash) == nullptr);
+			take_retired();
+		}
+
+		TEST_CHECK(expected.empty());
+	}
+
+	// dictionary_t, refcounted words from many threads
+	//
+	// workers take and drop references to a small shared set of words, so that every race shows up often:
+	// lock-free unref (refcount > 1) vs write-locked last unref, and read-locked ref of an existing word vs both
+	// meanwhile another thread keeps adding new words, growing shard word lists under lock-free get_word() readers
+	void test_dictionary_refcount_threads()
+	{
+		using word_t = dictionary_t::word_t;
+
+		dictionary_t d;
+
+		uint32_t const n_workers      = 4;
+		uint32_t const n_ops          = 100000;
+		uint32_t const n_shared_words = 64;
+		uint32_t const max_held       = 8;
+		uint32_t const n_grow_words   = 50000;
+
+		std::vector<std::string> shared_words;
+		for (uint32_t i = 0; i < n_shared_words; i++)
+			shared_words.push_back(make_word(i));
+
+		// checks are not thread safe, threads just count what went wrong
+		std::vector<uint64_t> n_errors(n_workers + 1, 0);
+		std::atomic<bool> workers_done { false };
+
+		std::vector<std::thread> threads;
+		for (uint32_t t = 0; t < n_workers; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				uint64_t rnd = 12345 + t;
+				auto const next_rnd = [&rnd]() -> uint32_t
+				{
+					rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+					return uint32_t(rnd >> 33);
+				};
+
+				struct held_t { uint32_t id; uint32_t word_i; };
+				std::vector<held_t> held;
+
+				for (uint32_t i = 0; i < n_ops; i++)
+				{
+					// mostly drop one when there's plenty held, i.e. refcounts keep going 0 -> N -> 0
+					if (!held.empty() && (held.size() >= max_held || (next_rnd() % 2) == 0))
+					{
+						size_t const victim = next_rnd() % held.size();
+						d.erase_word___ref(held[victim].id);
+						held[victim] = held.back();
+						held.pop_back();
+						continue;
+					}
+
+					uint32_t const word_i = next_rnd() % n_shared_words;
+					word_t const *w = d.get_or_add___ref(shared_words[word_i]);
+
+					if (w == nullptr || w->id == 0 || w->refcount.load() == 0)
+					{
+						n_errors[t]++;
+						continue;
+					}
+
+					held.push_back({ w->id, word_i });
+
+					// every word we hold must stay intact, whatever others do
+					for (auto const& h : held)
+						n_errors[t] += (d.get_word(h.id) != str_ref { shared_words[h.word_i] });
+				}
+
+				for (auto const& h : held)
+					d.erase_word___ref(h.id);
+			});
+		}
+
+		// grow shard word lists, all new words are held till the end, so freelists stay empty
+		std::vector<uint32_t> grow_ids;
+		threads.emplace_back([&]()
+		{
+			uint32_t const t = n_workers;
+
+			for (uint32_t i = 0; i < n_grow_words && !workers_done.load(); i++)
+			{
+				word_t const *w = d.get_or_add___ref(make_word(n_shared_words + i));
+				if (w == nullptr)
+				{
+					n_errors[t]++;
+					continue;
+				}
+
+				grow_ids.push_back(w->id);
+
+				uint32_t const check_i = i / 2;
+				n_errors[t] += (d.get_word(grow_ids[check_i]) != str_ref { make_word(n_shared_words + check_i) });
+			}
+		});
+
+		for (uint32_t t = 0; t < n_workers; t++)
+			threads[t].join();
+		workers_done = true;
+		threads.back().join();
+
+		for (uint32_t t = 0; t < n_workers + 1; t++)
+			TEST_CHECK_EQ(n_errors[t], 0);
+
+		// all shared word references have been dropped, so these words are erased now and are re-added from scratch
+		// anything left over (refcount drift either way) shows up as refcount != 1, or as asan errors when freed twice
+		for (auto const& word : shared_words)
+		{
+			word_t const *w = d.get_or_add___ref(word);
+			TEST_CHECK_EQ(w->refcount.load(), 1);
+			TEST_CHECK(d.get_word(w->id) == str_ref { word });
+			d.erase_word___ref(w->id);
+		}
+
+		// grown words survived everything, and are all distinct
+		for (size_t i = 0; i < grow_ids.size(); i++)
+		{
+			TEST_CHECK(d.get_word(grow_ids[i]) == str_ref { make_word(n_shared_words + i) });
+
+			word_t const *w = d.get_or_add___ref(make_word(n_shared_words + i));
+			TEST_CHECK_EQ(w->id, grow_ids[i]);
+			TEST_CHECK_EQ(w->refcount.load(), 2);
+
+			d.erase_word___ref(w->id);
+			d.erase_word___ref(w->id);
+		}
+
+		// everything is erased, strings are given back to shard arenas
+		TEST_CHECK(d.memory_used().strings_bytes <= dictionary_t::shard_count * dictionary_word_arena_t::n_classes * dictionary_word_arena_t::slab_size);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_segmented_array();
+	aux::test_nameword_dictionary();
+
+	aux::test_arena_size_classes();
+	aux::test_arena_slab_reuse();
+	aux::test_arena_contents();
+
+	aux::test_incremental_hash();
+	aux::test_dictionary_refcount_threads();
+
+	return test_result();
+}
@@ -0,0 +1,359 @@
+#include "pinba_config.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/packet.h"
+#include "pinba/packet_impl.h"
+#include "pinba/packet_decoder.h"
+
+#include "proto/pinba.pb-c.h"
+
+#include "misc/nmpa.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// pinba_decode_request_to_packet() vs generic path (unpack -> validate -> pinba_request_to_packet())
+// both must produce the same packet, or the same validation error, or decoder must ask for a fallback
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Pinba.Request fields, packed with protobuf-c
+	struct request_fixture_t
+	{
+		std::string               hostname     = "host-1";
+		std::string               server_name  = "www.example.com";
+		std::string               script_name  = "/index.php";
+		std::string               schema       = "https";
+		uint32_t                  status       = 200;
+		uint32_t                  document_size = 1234;
+		uint32_t                  memory_footprint = 4 * 1024 * 1024;
+		float                     request_time = 0.25;
+		float                     ru_utime     = 0.125;
+		float                     ru_stime     = 0.0625;
+
+		std::vector<std::string>  dictionary;
+		std::vector<uint32_t>     timer_hit_count;
+		std::vector<float>        timer_value;
+		std::vector<uint32_t>     timer_tag_count;
+		std::vector<uint32_t>     timer_tag_name;
+		std::vector<uint32_t>     timer_tag_value;
+		std::vector<float>        timer_ru_utime;
+		std::vector<float>        timer_ru_stime;
+		std::vector<uint32_t>     tag_name;
+		std::vector<uint32_t>     tag_value;
+
+		std::string pack() const
+		{
+			auto const as_pb_string = [](std::string const& s)
+			{
+				return ProtobufCBinaryData { s.size(), (uint8_t*)s.data() };
+			};
+
+			std::vector<ProtobufCBinaryData> pb_dictionary;
+			for (auto const& word : dictionary)
+				pb_dictionary.push_back(as_pb_string(word));
+
+			Pinba__Request r = PINBA__REQUEST__INIT;
+			r.hostname         = as_pb_string(hostname);
+			r.server_name      = as_pb_string(server_name);
+			r.script_name      = as_pb_string(script_name);
+			r.request_count    = 1;
+			r.document_size    = document_size;
+			r.memory_peak      = memory_footprint;
+			r.request_time     = request_time;
+			r.ru_utime         = ru_utime;
+			r.ru_stime         = ru_stime;
+			r.has_status       = 1;
+			r.status           = status;
+			r.has_memory_footprint = 1;
+			r.memory_footprint = memory_footprint;
+			r.has_schema       = 1;
+			r.schema           = as_pb_string(schema);
+
+			r.n_dictionary      = pb_dictionary.size();
+			r.dictionary        = pb_dictionary.data();
+			r.n_timer_hit_count = timer_hit_count.size();
+			r.timer_hit_count   = (uint32_t*)timer_hit_count.data();
+			r.n_timer_value     = timer_value.size();
+			r.timer_value       = (float*)timer_value.data();
+			r.n_timer_tag_count = timer_tag_count.size();
+			r.timer_tag_count   = (uint32_t*)timer_tag_count.data();
+			r.n_timer_tag_name  = timer_tag_name.size();
+			r.timer_tag_name    = (uint32_t*)timer_tag_name.data();
+			r.n_timer_tag_value = timer_tag_value.size();
+			r.timer_tag_value   = (uint32_t*)timer_tag_value.data();
+			r.n_timer_ru_utime  = timer_ru_utime.size();
+			r.timer_ru_utime    = (float*)timer_ru_utime.data();
+			r.n_timer_ru_stime  = timer_ru_stime.size();
+			r.timer_ru_stime    = (float*)timer_ru_stime.data();
+			r.n_tag_name        = tag_name.size();
+			r.tag_name          = (uint32_t*)tag_name.data();
+			r.n_tag_value       = tag_value.size();
+			r.tag_value         = (uint32_t*)tag_value.data();
+
+			std::string result(pinba__request__get_packed_size(&r), '\0');
+			pinba__request__pack(&r, (uint8_t*)&result[0]);
+			return result;
+		}
+	};
+
+	// 3 timers, one without tags, request tags, one tag name not in nameword dictionary (must be skipped)
+	request_fixture_t valid_request()
+	{
+		request_fixture_t r;
+		r.dictionary      = { "group", "db", "cache", "server", "shard-1", "unknown_tag", "x", "page", "main" };
+		r.timer_hit_count = { 1, 3, 7 };
+		r.timer_value     = { 0.01f, 0.5f, 0.000125f };
+		r.timer_tag_count = { 2, 0, 2 };
+		r.timer_tag_name  = { 0, 3, 0, 5 };
+		r.timer_tag_value = { 1, 4, 2, 6 };
+		r.timer_ru_utime  = { 0.001f, -0.5f };     // last timer has no ru_utime, negative one is zeroed
+		r.timer_ru_stime  = { 0.002f, 0.0f, 0.003f };
+		r.tag_name        = { 7, 5 };
+		r.tag_value       = { 8, 6 };
+		return r;
+	}
+
+	struct decoded_t
+	{
+		packet_t                   *packet;
+		request_validate_result_t  validate;
+		bool                       fallback;
+	};
+
+	struct decoders_t
+	{
+		dictionary_t              dictionary;
+		packet_decoder_scratch_t  scratch;
+		struct nmpa_s             nmpa;
+
+		decoders_t()
+		{
+			nmpa_init(&nmpa, 16 * 1024);
+
+			dictionary.add_nameword("group");
+			dictionary.add_nameword("server");
+			dictionary.add_nameword("page");
+		}
+
+		~decoders_t()
+		{
+			nmpa_free(&nmpa);
+		}
+
+		decoded_t fast(str_ref data)
+		{
+			auto const dr = pinba_decode_request_to_packet(data, dictionary.nameword_dictionary(), &dictionary, &nmpa, &scratch);
+			return decoded_t { dr.packet, dr.validate, (dr.packet == NULL && dr.validate == request_validate_result::okay) };
+		}
+
+		// fallback = protobuf-c could not unpack it
+		decoded_t generic(str_ref data)
+		{
+			Pinba__Request *r = pinba__request__unpack(NULL, data.size(), (uint8_t const*)data.data());
+			if (r == NULL)
+				return decoded_t { NULL, request_validate_result::okay, true };
+
+			decoded_t result = { NULL, pinba_validate_request(r), false };
+			if (result.validate == request_validate_result::okay)
+			{
+				std::vector<uint64_t> hashes(r->n_dictionary);
+				pinba_request_hash_dictionary(r, hashes.data());
+				result.packet = pinba_request_to_packet(r, dictionary.nameword_dictionary(), &dictionary, &nmpa, hashes.data());
+			}
+
+			pinba__request__free_unpacked(r, NULL);
+			return result;
+		}
+	};
+
+	bool same_ids(uint32_t const *a, uint32_t const *b, uint32_t n)
+	{
+		return (n == 0) || (0 == memcmp(a, b, sizeof(*a) * n));
+	}
+
+	void check_same_packet(packet_t const *a, packet_t const *b)
+	{
+		TEST_CHECK_EQ(a->host_id,   b->host_id);
+		TEST_CHECK_EQ(a->server_id, b->server_id);
+		TEST_CHECK_EQ(a->script_id, b->script_id);
+		TEST_CHECK_EQ(a->schema_id, b->schema_id);
+		TEST_CHECK_EQ(a->status,    b->status);
+		TEST_CHECK_EQ(a->traffic,   b->traffic);
+		TEST_CHECK_EQ(a->mem_used,  b->mem_used);
+		TEST_CHECK_EQ(a->request_time.nsec, b->request_time.nsec);
+		TEST_CHECK_EQ(a->ru_utime.nsec,     b->ru_utime.nsec);
+		TEST_CHECK_EQ(a->ru_stime.nsec,     b->ru_stime.nsec);
+		TEST_CHECK(0 == memcmp(&a->bloom, &b->bloom, sizeof(a->bloom)));
+
+		TEST_CHECK_EQ(a->tag_count, b->tag_count);
+		if (a->tag_count == b->tag_count)
+		{
+			TEST_CHECK(same_ids(a->tag_name_ids, b->tag_name_ids, a->tag_count));
+			TEST_CHECK(same_ids(a->tag_value_ids, b->tag_value_ids, a->tag_count));
+		}
+
+		TEST_CHECK_EQ(a->timer_count, b->timer_count);
+		if (a->timer_count != b->timer_count)
+			return;
+
+		for (uint32_t i = 0; i < a->timer_count; i++)
+		{
+			packed_timer_t const& ta = a->timers[i];
+			packed_timer_t const& tb = b->timers[i];
+
+			TEST_CHECK_EQ(ta.hit_count,      tb.hit_count);
+			TEST_CHECK_EQ(ta.value.nsec,     tb.value.nsec);
+			TEST_CHECK_EQ(ta.ru_utime.nsec,  tb.ru_utime.nsec);
+			TEST_CHECK_EQ(ta.ru_stime.nsec,  tb.ru_stime.nsec);
+			TEST_CHECK(0 == memcmp(&a->timers_blooms[i], &b->timers_blooms[i], sizeof(a->timers_blooms[i])));
+
+			TEST_CHECK_EQ(ta.tag_count, tb.tag_count);
+			if (ta.tag_count == tb.tag_count)
+			{
+				TEST_CHECK(same_ids(ta.tag_name_ids, tb.tag_name_ids, ta.tag_count));
+				TEST_CHECK(same_ids(ta.tag_value_ids, tb.tag_value_ids, ta.tag_count));
+			}
+		}
+	}
+
+	// fast decoder must agree with generic one, unless it has asked for a fallback
+	void check_agrees_with_generic(decoders_t& dec, std::string const& data)
+	{
+		decoded_t const fast = dec.fast(str_ref { data });
+		if (fast.fallback)
+			return;
+
+		decoded_t const generic = dec.generic(str_ref { data });
+		TEST_CHECK(!generic.fallback);
+		if (generic.fallback)
+			return;
+
+		TEST_CHECK_EQ(fast.validate, generic.validate);
+		TEST_CHECK_EQ(fast.packet != NULL, generic.packet != NULL);
+
+		if (fast.packet && generic.packet)
+			check_same_packet(fast.packet, generic.packet);
+	}
+
+	void test_valid(decoders_t& dec)
+	{
+		std::string const data = valid_request().pack();
+
+		decoded_t const fast = dec.fast(str_ref { data });
+		TEST_CHECK(fast.packet != NULL);
+		if (!fast.packet)
+			return;
+
+		// tag with name not in nameword dictionary is skipped
+		TEST_CHECK_EQ(fast.packet->timer_count, 3);
+		TEST_CHECK_EQ(fast.packet->timers[0].tag_count, 2);
+		TEST_CHECK_EQ(fast.packet->timers[2].tag_count, 1);
+		TEST_CHECK_EQ(fast.packet->tag_count, 1);
+		TEST_CHECK_EQ(fast.packet->timers[1].ru_utime.nsec, 0);
+		TEST_CHECK_EQ(fast.packet->timers[2].ru_utime.nsec, 0);
+
+		check_agrees_with_generic(dec, data);
+	}
+
+	// every prefix of a valid request, decoder must not read past the end and must agree with the generic path
+	void test_truncated(decoders_t& dec)
+	{
+		std::string const data = valid_request().pack();
+
+		for (size_t len = 0; len < data.size(); len++)
+		{
+			// copy, so that asan catches reads past the end
+			std::vector<char> const truncated(data.begin(), data.begin() + len);
+			check_agrees_with_generic(dec, std::string(truncated.begin(), truncated.end()));
+		}
+	}
+
+	void test_out_of_range(decoders_t& dec)
+	{
+		auto const check_invalid = [&](request_fixture_t const& r, request_validate_result_t expected)
+		{
+			std::string const data = r.pack();
+
+			decoded_t const fast = dec.fast(str_ref { data });
+			TEST_CHECK(fast.packet == NULL);
+			TEST_CHECK_EQ(fast.validate, expected);
+
+			check_agrees_with_generic(dec, data);
+		};
+
+		{
+			auto r = valid_request();
+			r.timer_tag_name[1] = r.dictionary.size();
+			check_invalid(r, request_validate_result::bad_dictionary_offset);
+		}
+		{
+			auto r = valid_request();
+			r.timer_tag_value[3] = 0xFFFFFFFF;
+			check_invalid(r, request_validate_result::bad_dictionary_offset);
+		}
+		{
+			auto r = valid_request();
+			r.tag_value[0] = r.dictionary.size();
+			check_invalid(r, request_validate_result::bad_dictionary_offset);
+		}
+		{
+			auto r = valid_request();
+			r.timer_tag_count[2] = 3; // more tags than there are
+			check_invalid(r, request_validate_result::not_enough_tag_names);
+		}
+		{
+			auto r = valid_request();
+			r.timer_hit_count[1] = 0;
+			check_invalid(r, request_validate_result::bad_timer_hit_count);
+		}
+		{
+			auto r = valid_request();
+			r.status = PINBA_INTERNAL___STATUS_MAX;
+			check_invalid(r, request_validate_result::status_is_too_large);
+		}
+	}
+
+	// dictionary larger than a single hashing chunk, and scratch reuse between requests of different sizes
+	void test_large_dictionary(decoders_t& dec)
+	{
+		auto r = valid_request();
+		for (uint32_t i = 0; i < 1000; i++)
+		{
+			r.dictionary.push_back(ff::fmt_str("value-{0}", i));
+			r.tag_name.push_back(7);
+			r.tag_value.push_back(r.dictionary.size() - 1);
+		}
+
+		std::string const data = r.pack();
+
+		decoded_t const fast = dec.fast(str_ref { data });
+		TEST_CHECK(fast.packet != NULL);
+		if (fast.packet)
+			TEST_CHECK_EQ(fast.packet->tag_count, 1001);
+
+		check_agrees_with_generic(dec, data);
+		check_agrees_with_generic(dec, valid_request().pack());
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::decoders_t dec;
+
+	aux::test_valid(dec);
+	aux::test_truncated(dec);
+	aux::test_out_of_range(dec);
+	aux::test_large_dictionary(dec);
+
+	return test_result();
+}
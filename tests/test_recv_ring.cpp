@@ -0,0 +1,207 @@
+#include "pinba_config.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/recv_ring.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// recvmmsg receive ring, datagrams of all sizes over loopback, many oversized ones in a single call
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	size_t const control_size = 64;
+
+	struct udp_pair_t
+	{
+		int                 rfd;
+		int                 sfd;
+		struct sockaddr_in  raddr;
+		struct sockaddr_in  saddr;
+
+		udp_pair_t()
+		{
+			rfd = socket(AF_INET, SOCK_DGRAM, 0);
+			sfd = socket(AF_INET, SOCK_DGRAM, 0);
+			TEST_CHECK(rfd >= 0 && sfd >= 0);
+
+			int const rcvbuf = 4 * 1024 * 1024; // capped by net.core.rmem_max, datagrams below are sized to fit default
+			setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+			bind_loopback(rfd, &raddr);
+			bind_loopback(sfd, &saddr);
+		}
+
+		~udp_pair_t()
+		{
+			close(rfd);
+			close(sfd);
+		}
+
+		static void bind_loopback(int fd, struct sockaddr_in *addr)
+		{
+			memset(addr, 0, sizeof(*addr));
+			addr->sin_family      = AF_INET;
+			addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr->sin_port        = 0;
+			TEST_CHECK(0 == bind(fd, (struct sockaddr*)addr, sizeof(*addr)));
+
+			socklen_t len = sizeof(*addr);
+			TEST_CHECK(0 == getsockname(fd, (struct sockaddr*)addr, &len));
+		}
+
+		void send(std::string const& data)
+		{
+			ssize_t const n = sendto(sfd, data.data(), data.size(), 0, (struct sockaddr*)&raddr, sizeof(raddr));
+			TEST_CHECK_EQ(n, (ssize_t)data.size());
+		}
+	};
+
+	// every datagram is unique, so that any mixup between slots and overflow areas shows
+	std::string make_datagram(uint32_t i, size_t size)
+	{
+		std::string data = std::to_string(i) + ":";
+		while (data.size() < size)
+			data.push_back(char('a' + (i + data.size()) % 26));
+		data.resize(size);
+		return data;
+	}
+
+	// receive exactly expected.size() datagrams, returns number of recvmmsg calls it took
+	size_t recv_and_check(udp_pair_t& udp, recv_ring_t& ring, struct sockaddr_storage *names, std::vector<std::string> const& expected)
+	{
+		size_t n_received = 0;
+		size_t n_calls = 0;
+
+		while (n_received < expected.size())
+		{
+			int const n = recvmmsg(udp.rfd, ring.headers(), ring.n_messages(), MSG_DONTWAIT, NULL);
+			TEST_CHECK(n > 0);
+			if (n <= 0)
+				break;
+
+			n_calls++;
+
+			for (int i = 0; i < n; i++)
+			{
+				struct mmsghdr const& hdr = ring.headers()[i];
+
+				TEST_CHECK(!(hdr.msg_hdr.msg_flags & MSG_TRUNC));
+				TEST_CHECK(ring.message_bytes(i) == str_ref { expected[n_received] });
+
+				if (names != NULL)
+				{
+					auto const *src = (struct sockaddr_in const*)&names[i];
+					TEST_CHECK_EQ(hdr.msg_hdr.msg_namelen, sizeof(struct sockaddr_in));
+					TEST_CHECK_EQ(src->sin_port, udp.saddr.sin_port);
+				}
+
+				ring.reset_message(i);
+				n_received++;
+			}
+		}
+
+		return n_calls;
+	}
+
+	void test_layout()
+	{
+		TEST_CHECK_EQ(recv_ring_t::effective_slot_size(0), size_t(recv_ring_t::max_message_size));
+		TEST_CHECK_EQ(recv_ring_t::effective_slot_size(1), 64);
+		TEST_CHECK_EQ(recv_ring_t::effective_slot_size(2048), 2048);
+		TEST_CHECK_EQ(recv_ring_t::effective_slot_size(2049), 2048 + 64);
+		TEST_CHECK_EQ(recv_ring_t::effective_slot_size(1024 * 1024), size_t(recv_ring_t::max_message_size));
+
+		TEST_CHECK_EQ(recv_ring_t::memory_size(10, 100, control_size), 10 * (128 + control_size));
+
+		// full size slots need no overflow
+		{
+			std::vector<char> memory(recv_ring_t::memory_size(2, 0, control_size));
+			recv_ring_t ring { 2, 0, control_size, memory.data(), NULL };
+			TEST_CHECK_EQ(ring.overflow_size(), 0);
+			TEST_CHECK_EQ(ring.headers()[0].msg_hdr.msg_iovlen, 1);
+		}
+	}
+
+	// way more oversized datagrams in a single recvmmsg call than there used to be shared large slots
+	void test_many_oversized()
+	{
+		size_t const n_messages = 64;
+		size_t const slot_size  = 512;
+
+		std::vector<char> memory(recv_ring_t::memory_size(n_messages, slot_size, control_size));
+		std::vector<struct sockaddr_storage> names(n_messages);
+		recv_ring_t ring { n_messages, slot_size, control_size, memory.data(), names.data() };
+		TEST_CHECK_EQ(ring.overflow_size(), size_t(n_messages * recv_ring_t::max_message_size));
+
+		udp_pair_t udp;
+
+		// 2 rounds, big ones take different ring positions each time, all slots and overflow areas get reused
+		for (uint32_t round = 0; round < 2; round++)
+		{
+			std::vector<std::string> expected;
+			for (uint32_t i = 0; i < 40; i++)
+			{
+				bool const is_big = ((i + round) % 3 != 0); // 26 or 27 big ones
+				size_t const size = is_big ? 3000 + i * 7 : 100 + i;
+
+				expected.push_back(make_datagram(round * 1000 + i, size));
+				udp.send(expected.back());
+			}
+
+			// exact slot size fits without overflow, one byte more does not
+			expected.push_back(make_datagram(round * 1000 + 100, slot_size));
+			udp.send(expected.back());
+			expected.push_back(make_datagram(round * 1000 + 101, slot_size + 1));
+			udp.send(expected.back());
+
+			// loopback delivers synchronously, everything should be there for a single call
+			size_t const n_calls = recv_and_check(udp, ring, names.data(), expected);
+			TEST_CHECK_EQ(n_calls, 1);
+		}
+
+		// nothing left
+		TEST_CHECK(recvmmsg(udp.rfd, ring.headers(), ring.n_messages(), MSG_DONTWAIT, NULL) < 0);
+	}
+
+	// max size datagrams, the whole overflow area gets used
+	void test_max_size()
+	{
+		size_t const n_messages = 4;
+
+		std::vector<char> memory(recv_ring_t::memory_size(n_messages, 64, control_size));
+		recv_ring_t ring { n_messages, 64, control_size, memory.data(), NULL };
+
+		udp_pair_t udp;
+
+		size_t const max_payload = 65507; // 64k - ip and udp headers
+		std::vector<std::string> expected;
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			expected.push_back(make_datagram(i, max_payload - i));
+			udp.send(expected.back());
+		}
+		recv_and_check(udp, ring, NULL, expected);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_layout();
+	aux::test_many_oversized();
+	aux::test_max_size();
+
+	return test_result();
+}
@@ -0,0 +1,336 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/repacker_queue.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// repacker threads input queues, dispatch and stealing, over in-memory queues instead of nanomsg sockets
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct test_queue_t
+	{
+		using batch_t = uint32_t;
+
+		std::atomic<uint32_t>  depth = {0};
+
+		std::mutex             mtx;
+		std::deque<uint32_t>   items;
+		size_t                 capacity = 0;
+
+		bool try_send(uint32_t const& batch)
+		{
+			std::lock_guard<std::mutex> lk_(mtx);
+			if (items.size() >= capacity)
+				return false;
+
+			items.push_back(batch);
+			return true;
+		}
+
+		bool try_recv(uint32_t *batch)
+		{
+			std::lock_guard<std::mutex> lk_(mtx);
+			if (items.empty())
+				return false;
+
+			*batch = items.front();
+			items.pop_front();
+			return true;
+		}
+
+		size_t size()
+		{
+			std::lock_guard<std::mutex> lk_(mtx);
+			return items.size();
+		}
+	};
+
+	struct test_queues_t
+	{
+		uint32_t                         n;
+		std::unique_ptr<test_queue_t[]>  q;
+
+		test_queues_t(uint32_t n_queues, size_t capacity)
+			: n(n_queues)
+			, q(new test_queue_t[n_queues])
+		{
+			for (uint32_t i = 0; i < n; i++)
+				q[i].capacity = capacity;
+		}
+
+		bool dispatch(uint32_t rr, uint32_t batch)
+		{
+			return repacker_queues___dispatch(q.get(), n, rr, batch);
+		}
+
+		// queue that has got the batch, or n if none
+		uint32_t dispatched_to(uint32_t batch)
+		{
+			for (uint32_t i = 0; i < n; i++)
+			{
+				for (auto const& item : q[i].items)
+				{
+					if (item == batch)
+						return i;
+				}
+			}
+			return n;
+		}
+
+		void fill(uint32_t i)
+		{
+			while (repacker_queue___send(q[i], uint32_t(-1)))
+				;
+		}
+
+		void clear()
+		{
+			uint32_t batch;
+			for (uint32_t i = 0; i < n; i++)
+				while (repacker_queue___recv(q[i], &batch))
+					;
+		}
+
+		bool depths_are_exact()
+		{
+			for (uint32_t i = 0; i < n; i++)
+			{
+				if (q[i].depth.load() != q[i].size())
+					return false;
+			}
+			return true;
+		}
+	};
+
+	// batch goes to the shorter of the two picked queues
+	void test_dispatch_two_choices()
+	{
+		uint32_t const n = 4;
+		test_queues_t qs { n, 100 };
+
+		// first choice is rr % n, second one is some other queue, that changes as rr goes around
+		for (uint32_t rr = 0; rr < n * (n - 1); rr++)
+		{
+			uint32_t const first  = rr % n;
+			uint32_t const second = (first + 1 + (rr / n) % (n - 1)) % n;
+			TEST_CHECK(first != second);
+
+			// empty queues, equal depth, first one wins
+			TEST_CHECK(qs.dispatch(rr, rr));
+			TEST_CHECK_EQ(qs.dispatched_to(rr), first);
+			qs.clear();
+
+			// first one is longer
+			repacker_queue___send(qs.q[first], uint32_t(-1));
+			TEST_CHECK(qs.dispatch(rr, rr));
+			TEST_CHECK_EQ(qs.dispatched_to(rr), second);
+			qs.clear();
+		}
+
+		// single queue
+		test_queues_t one { 1, 2 };
+		TEST_CHECK(one.dispatch(0, 1));
+		TEST_CHECK(one.dispatch(1, 2));
+		TEST_CHECK(!one.dispatch(2, 3));
+		TEST_CHECK_EQ(one.q[0].depth.load(), 2);
+	}
+
+	// whatever the two choices are, batch is dropped only when all queues are full
+	void test_dispatch_never_to_full_queue()
+	{
+		uint32_t const n = 5;
+		test_queues_t qs { n, 3 };
+
+		for (uint32_t rr = 0; rr < 2 * n * (n - 1); rr++)
+		{
+			// all full, but one, and that one has room for just one more
+			for (uint32_t target = 0; target < n; target++)
+			{
+				for (uint32_t i = 0; i < n; i++)
+				{
+					if (i != target)
+						qs.fill(i);
+				}
+
+				repacker_queue___send(qs.q[target], uint32_t(-1));
+				repacker_queue___send(qs.q[target], uint32_t(-1));
+
+				TEST_CHECK(qs.dispatch(rr, rr));
+				TEST_CHECK_EQ(qs.dispatched_to(rr), target);
+
+				// and that one is full now as well
+				TEST_CHECK(!qs.dispatch(rr, rr + 1));
+				TEST_CHECK_EQ(qs.dispatched_to(rr + 1), n);
+
+				TEST_CHECK(qs.depths_are_exact());
+				qs.clear();
+			}
+		}
+
+		// dispatching till everything is full, takes exactly the total capacity
+		uint32_t n_sent = 0;
+		for (uint32_t rr = 0; qs.dispatch(rr, rr); rr++)
+			n_sent++;
+
+		TEST_CHECK_EQ(n_sent, n * 3);
+		TEST_CHECK(qs.depths_are_exact());
+	}
+
+	void test_steal()
+	{
+		uint32_t const n = 4;
+		uint32_t const min_depth = 2;
+		test_queues_t qs { n, 100 };
+
+		std::vector<uint32_t> stolen;
+		auto const steal = [&](uint32_t thread_id, uint32_t max_to_steal)
+		{
+			return repacker_queues___steal(qs.q.get(), n, thread_id, min_depth, max_to_steal, [&](uint32_t batch)
+			{
+				stolen.push_back(batch);
+			});
+		};
+
+		// nothing to steal
+		TEST_CHECK_EQ(steal(0, 4), 0);
+
+		// single batches are left alone
+		repacker_queue___send(qs.q[1], 100);
+		TEST_CHECK_EQ(steal(0, 4), 0);
+
+		// never from own queue
+		for (uint32_t i = 0; i < 10; i++)
+			repacker_queue___send(qs.q[0], i);
+		TEST_CHECK_EQ(steal(0, 4), 0);
+
+		// longest queue is the victim, half of it at most, oldest batches first
+		for (uint32_t i = 0; i < 6; i++)
+			repacker_queue___send(qs.q[2], 200 + i);
+
+		TEST_CHECK_EQ(steal(1, 4), 4); // 10 in queue 0, half is 5, but 4 at most
+		TEST_CHECK((stolen == std::vector<uint32_t> { 0, 1, 2, 3 }));
+		stolen.clear();
+
+		TEST_CHECK_EQ(steal(1, 4), 3); // 6 in both 0 and 2, first one of these wins
+		TEST_CHECK((stolen == std::vector<uint32_t> { 4, 5, 6 }));
+		stolen.clear();
+
+		TEST_CHECK_EQ(steal(3, 100), 3); // 3 in queue 0, 1 in queue 1, 6 in queue 2
+		TEST_CHECK((stolen == std::vector<uint32_t> { 200, 201, 202 }));
+		stolen.clear();
+
+		TEST_CHECK(qs.depths_are_exact());
+
+		// depth says there is more than there actually is (owner is receiving right now), stop on empty queue
+		qs.clear();
+		qs.q[3].depth = 10;
+		TEST_CHECK_EQ(steal(0, 4), 0);
+		TEST_CHECK_EQ(qs.q[3].depth.load(), 10);
+	}
+
+	// a producer keeps dispatching, consumers take from own queues and steal from others, one of them is slow
+	// every batch must be processed exactly once, and some must have been stolen
+	void test_steal_threads()
+	{
+		uint32_t const n = 4;
+		uint32_t const n_batches = 100000;
+		test_queues_t qs { n, 64 };
+
+		std::atomic<uint32_t> n_processed = {0};
+		std::vector<std::vector<uint32_t>> processed(n);
+		std::vector<uint32_t> n_stolen(n, 0);
+
+		std::vector<std::thread> threads;
+		for (uint32_t t = 0; t < n; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				auto const process = [&](uint32_t batch)
+				{
+					processed[t].push_back(batch);
+					n_processed++;
+
+					// slow one, its queue gets a backlog
+					if (t == 0)
+						std::this_thread::sleep_for(std::chrono::microseconds(20));
+				};
+
+				while (n_processed.load() < n_batches)
+				{
+					uint32_t batch;
+					if (repacker_queue___recv(qs.q[t], &batch))
+					{
+						process(batch);
+						continue;
+					}
+
+					uint32_t const n_got = repacker_queues___steal(qs.q.get(), qs.n, t, 2, 4, process);
+					n_stolen[t] += n_got;
+
+					if (n_got == 0)
+						std::this_thread::yield();
+				}
+			});
+		}
+
+		for (uint32_t i = 0, rr = 0; i < n_batches; rr++)
+		{
+			if (qs.dispatch(rr, i))
+				i++;
+			else
+				std::this_thread::yield();
+		}
+
+		for (auto& thr : threads)
+			thr.join();
+
+		std::vector<uint32_t> all;
+		uint32_t total_stolen = 0;
+		for (uint32_t t = 0; t < n; t++)
+		{
+			all.insert(all.end(), processed[t].begin(), processed[t].end());
+			total_stolen += n_stolen[t];
+		}
+
+		std::sort(all.begin(), all.end());
+		TEST_CHECK_EQ(all.size(), n_batches);
+		for (uint32_t i = 0; i < std::min<uint32_t>(all.size(), n_batches); i++)
+		{
+			if (all[i] != i)
+			{
+				TEST_CHECK_EQ(all[i], i);
+				break;
+			}
+		}
+
+		TEST_CHECK(total_stolen > 0);
+
+		for (uint32_t i = 0; i < n; i++)
+			TEST_CHECK_EQ(qs.q[i].depth.load(), 0);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_dispatch_two_choices();
+	aux::test_dispatch_never_to_full_queue();
+	aux::test_steal();
+	aux::test_steal_threads();
+
+	return test_result();
+}
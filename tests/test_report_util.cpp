@@ -0,0 +1,208 @@
+#include "pinba_config.h"
+
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/report.h"
+#include "pinba/report_util.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// report helpers, tag_name_slots_t (finding key tags and filters among timer tags in a single pass)
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct tag_t
+	{
+		uint32_t name_id;
+		uint32_t value_id;
+	};
+
+	template<class Slots>
+	typename Slots::find_result_t find_tags(Slots& slots, std::vector<tag_t> const& tags)
+	{
+		std::vector<uint32_t> name_ids, value_ids;
+		for (auto const& tag : tags)
+		{
+			name_ids.push_back(tag.name_id);
+			value_ids.push_back(tag.value_id);
+		}
+
+		return slots.find(name_ids.data(), value_ids.data(), tags.size());
+	}
+
+	void test_basic()
+	{
+		tag_name_slots_t slots;
+
+		uint32_t const s5 = slots.add(5);
+		uint32_t const s3 = slots.add(3);
+		TEST_CHECK_EQ(s5, 0);
+		TEST_CHECK_EQ(s3, 1);
+		TEST_CHECK_EQ(slots.add(5), s5);
+		TEST_CHECK_EQ(slots.size(), 2);
+		TEST_CHECK_EQ(slots.n_required(), 0);
+
+		auto const res = find_tags(slots, { { 1, 100 }, { 3, 103 }, { 5, 105 } });
+		TEST_CHECK_EQ(res.n_found, 2);
+		TEST_CHECK_EQ(res.n_found_required, 0);
+		TEST_CHECK(!res.value_mismatch);
+		TEST_CHECK_EQ(slots.value(s5), 105);
+		TEST_CHECK_EQ(slots.value(s3), 103);
+
+		// previous call marks are not carried over
+		auto const res2 = find_tags(slots, { { 5, 205 } });
+		TEST_CHECK_EQ(res2.n_found, 1);
+		TEST_CHECK_EQ(slots.value(s5), 205);
+
+		TEST_CHECK_EQ(find_tags(slots, {}).n_found, 0);
+	}
+
+	// same filter name twice, values must agree
+	void test_duplicate_filters()
+	{
+		// same value -> just one requirement
+		{
+			tag_name_slots_t slots;
+			uint32_t const s = slots.add(7);
+			slots.require_value(s, 10);
+			slots.require_value(slots.add(7), 10);
+			TEST_CHECK_EQ(slots.n_required(), 1);
+
+			auto const res = find_tags(slots, { { 7, 10 } });
+			TEST_CHECK_EQ(res.n_found_required, 1);
+			TEST_CHECK(!res.value_mismatch);
+		}
+
+		// conflicting values -> nothing ever matches, whatever the tags are
+		{
+			tag_name_slots_t slots;
+			uint32_t const s = slots.add(7);
+			slots.require_value(s, 10);
+			slots.require_value(slots.add(7), 11);
+			TEST_CHECK_EQ(slots.n_required(), 1);
+
+			TEST_CHECK(find_tags(slots, { { 7, 10 } }).value_mismatch);
+			TEST_CHECK(find_tags(slots, { { 7, 11 } }).value_mismatch);
+			TEST_CHECK(find_tags(slots, { { 7, 10 }, { 7, 11 } }).value_mismatch);
+			TEST_CHECK(find_tags(slots, {}).value_mismatch);
+		}
+	}
+
+	// timer has the same tag name more than once, first one wins (same as a scan would do)
+	void test_repeated_tag_names()
+	{
+		tag_name_slots_t slots;
+		uint32_t const key = slots.add(5);
+		uint32_t const filter = slots.add(6);
+		slots.require_value(filter, 60);
+
+		auto const res = find_tags(slots, { { 5, 1 }, { 6, 60 }, { 5, 2 }, { 6, 60 } });
+		TEST_CHECK_EQ(res.n_found, 2);          // distinct names, not tags
+		TEST_CHECK_EQ(res.n_found_required, 1);
+		TEST_CHECK(!res.value_mismatch);
+		TEST_CHECK_EQ(slots.value(key), 1);
+		TEST_CHECK_EQ(slots.value(filter), 60);
+
+		// every occurrence of a filtered name must have the required value, not just the first one
+		auto const res2 = find_tags(slots, { { 6, 60 }, { 5, 1 }, { 6, 61 } });
+		TEST_CHECK_EQ(res2.n_found, 2);
+		TEST_CHECK(res2.value_mismatch);
+		TEST_CHECK_EQ(slots.value(filter), 60);
+
+		auto const res3 = find_tags(slots, { { 6, 61 }, { 6, 60 } });
+		TEST_CHECK(res3.value_mismatch);
+		TEST_CHECK_EQ(slots.value(filter), 61);
+	}
+
+	// key part and filter on the same tag name share a slot
+	void test_filter_on_key_name()
+	{
+		tag_name_slots_t slots;
+		uint32_t const key = slots.add(9);
+		uint32_t const filter = slots.add(9);
+		TEST_CHECK_EQ(key, filter);
+		TEST_CHECK_EQ(slots.size(), 1);
+
+		slots.require_value(filter, 90);
+		TEST_CHECK_EQ(slots.n_required(), 1);
+
+		auto const res = find_tags(slots, { { 9, 90 } });
+		TEST_CHECK_EQ(res.n_found, 1);
+		TEST_CHECK_EQ(res.n_found_required, 1);
+		TEST_CHECK(!res.value_mismatch);
+		TEST_CHECK_EQ(slots.value(key), 90);
+
+		auto const res2 = find_tags(slots, { { 9, 91 } });
+		TEST_CHECK_EQ(res2.n_found, 1);
+		TEST_CHECK(res2.value_mismatch);
+
+		auto const res3 = find_tags(slots, { { 8, 90 } });
+		TEST_CHECK_EQ(res3.n_found, 0);
+		TEST_CHECK_EQ(res3.n_found_required, 0);
+		TEST_CHECK(!res3.value_mismatch);
+	}
+
+	// 'seen' marks must not leak between calls when generation counter wraps around
+	// a slot seen exactly one generation cycle ago, and not since, must be found again
+	void test_generation_wraparound()
+	{
+		tag_name_slots_impl_t<uint8_t> slots;
+		uint32_t const a = slots.add(1);
+		uint32_t const b = slots.add(2);
+
+		for (uint32_t i = 0; i < 2000; i++)
+		{
+			bool const with_b = (i % 255 == 0) || (i % 256 == 0) || (i % 257 == 0);
+
+			std::vector<tag_t> tags = { { 1, i } };
+			if (with_b)
+				tags.push_back({ 2, i + 1 });
+
+			auto const res = find_tags(slots, tags);
+			TEST_CHECK_EQ(res.n_found, uint32_t(with_b ? 2 : 1));
+			TEST_CHECK_EQ(slots.value(a), i);
+			if (with_b)
+				TEST_CHECK_EQ(slots.value(b), i + 1);
+		}
+	}
+
+	// tags that have never been added, with ids way beyond lookup table, or inside it, but with no slot
+	void test_unknown_names()
+	{
+		tag_name_slots_t slots;
+		uint32_t const s = slots.add(10);
+
+		auto const res = find_tags(slots, {
+			{ 0, 1 },
+			{ 4, 2 },
+			{ 11, 3 },
+			{ 1000000, 4 },
+			{ tag_name_slots_t::no_slot, 5 },
+			{ 10, 6 },
+		});
+		TEST_CHECK_EQ(res.n_found, 1);
+		TEST_CHECK_EQ(slots.value(s), 6);
+
+		// empty set of slots
+		tag_name_slots_t empty;
+		TEST_CHECK_EQ(find_tags(empty, { { 0, 1 }, { 5, 2 } }).n_found, 0);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_basic();
+	aux::test_duplicate_filters();
+	aux::test_repeated_tag_names();
+	aux::test_filter_on_key_name();
+	aux::test_generation_wraparound();
+	aux::test_unknown_names();
+
+	return test_result();
+}
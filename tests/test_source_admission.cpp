@@ -0,0 +1,324 @@
+#include "pinba_config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/collector.h"
+#include "pinba/source_admission.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// per-source admission (GCRA token buckets), with made up monotonic time
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	using verdict_t = source_admission_t::verdict_t;
+
+	uint64_t const msec = nsec_in_sec / 1000;
+
+	collector_conf_t make_conf(uint32_t rate, uint32_t burst, uint32_t sample_n, uint32_t slots)
+	{
+		collector_conf_t conf = {};
+		conf.admission_rate     = rate;
+		conf.admission_burst    = burst;
+		conf.admission_sample_n = sample_n;
+		conf.admission_slots    = slots;
+		return conf;
+	}
+
+	struct sockaddr_storage make_addr(char const *ip)
+	{
+		struct sockaddr_storage ss = {};
+
+		auto *sin = (struct sockaddr_in*)&ss;
+		if (1 == inet_pton(AF_INET, ip, &sin->sin_addr))
+		{
+			sin->sin_family = AF_INET;
+			return ss;
+		}
+
+		auto *sin6 = (struct sockaddr_in6*)&ss;
+		if (1 == inet_pton(AF_INET6, ip, &sin6->sin6_addr))
+		{
+			sin6->sin6_family = AF_INET6;
+			return ss;
+		}
+
+		TEST_CHECK(!"bad address");
+		return ss;
+	}
+
+	struct source_t
+	{
+		source_admission_t       *admission;
+		struct sockaddr_storage  addr;
+		uint64_t                 rng;
+
+		source_t(source_admission_t *a, char const *ip)
+			: admission(a)
+			, addr(make_addr(ip))
+			, rng(12345)
+		{
+		}
+
+		verdict_t admit(uint64_t now)
+		{
+			return admission->admit((struct sockaddr const*)&addr, now, &rng);
+		}
+
+		// packets passed in a row, at the same time
+		uint32_t n_pass_at(uint64_t now, uint32_t max_tries = 100000)
+		{
+			uint32_t n = 0;
+			while (n < max_tries && this->admit(now) == verdict_t::pass)
+				n++;
+			return n;
+		}
+	};
+
+	collector_source_stats_t const* find_stats(std::vector<collector_source_stats_t> const& stats, std::string const& address)
+	{
+		for (auto const& s : stats)
+		{
+			if (s.address == address)
+				return &s;
+		}
+		return nullptr;
+	}
+
+	// burst is let through right away, then the bucket is empty
+	void test_burst()
+	{
+		uint64_t const t0 = 10 * nsec_in_sec;
+
+		{
+			auto const conf = make_conf(100, 10, 0, 16);
+			source_admission_t admission { &conf };
+			source_t src { &admission, "10.0.0.1" };
+
+			TEST_CHECK_EQ(src.n_pass_at(t0), 10);
+			TEST_CHECK(src.admit(t0) == verdict_t::drop);
+			TEST_CHECK(src.admit(t0 + 1 * msec) == verdict_t::drop);
+
+			// full emission interval later - exactly one more
+			TEST_CHECK_EQ(src.n_pass_at(t0 + 10 * msec), 1);
+
+			// idle for a while, bucket is full again, but not more than full
+			TEST_CHECK_EQ(src.n_pass_at(t0 + 10 * nsec_in_sec), 10);
+		}
+
+		// burst = 0 is one second worth of packets
+		{
+			auto const conf = make_conf(50, 0, 0, 16);
+			source_admission_t admission { &conf };
+			source_t src { &admission, "10.0.0.1" };
+
+			TEST_CHECK_EQ(src.n_pass_at(t0), 50);
+		}
+	}
+
+	// sending at twice the rate for a while, after the burst exactly the rate goes through
+	void test_steady_rate()
+	{
+		uint32_t const rate = 100;
+		uint64_t const t0 = 10 * nsec_in_sec;
+
+		auto const conf = make_conf(rate, 5, 0, 16);
+		source_admission_t admission { &conf };
+		source_t src { &admission, "192.168.1.1" };
+
+		uint32_t n_passed = 0, n_dropped = 0;
+		for (uint64_t now = t0; now < t0 + 10 * nsec_in_sec; now += 5 * msec)
+		{
+			verdict_t const v = src.admit(now);
+			TEST_CHECK(v != verdict_t::sample);
+
+			n_passed  += (v == verdict_t::pass);
+			n_dropped += (v == verdict_t::drop);
+		}
+
+		TEST_CHECK_EQ(n_passed + n_dropped, 2000);
+		TEST_CHECK(n_passed >= 10 * rate && n_passed <= 10 * rate + 5);
+
+		// below the rate - nothing is dropped
+		source_t slow { &admission, "192.168.1.2" };
+		for (uint64_t now = t0; now < t0 + 10 * nsec_in_sec; now += 20 * msec)
+			TEST_CHECK(slow.admit(now) == verdict_t::pass);
+
+		auto const stats = admission.get_stats(t0 + 11 * nsec_in_sec);
+		auto const *s = find_stats(stats, "192.168.1.1");
+		TEST_CHECK(s != nullptr);
+		if (s)
+		{
+			TEST_CHECK_EQ(s->packets_passed, n_passed);
+			TEST_CHECK_EQ(s->packets_dropped, n_dropped);
+			TEST_CHECK_EQ(s->packets_sampled, 0);
+			TEST_CHECK_EQ(s->idle_time.nsec, int64_t(1 * nsec_in_sec + 5 * msec));
+		}
+	}
+
+	// over the limit, 1 in sample_n is let through (randomly)
+	void test_sampling()
+	{
+		uint64_t const t0 = 10 * nsec_in_sec;
+
+		auto const conf = make_conf(100, 10, 4, 16);
+		source_admission_t admission { &conf };
+		source_t src { &admission, "10.1.1.1" };
+
+		for (uint32_t i = 0; i < 10; i++)
+			TEST_CHECK(src.admit(t0) == verdict_t::pass);
+
+		uint32_t n_sampled = 0;
+		for (uint32_t i = 0; i < 4000; i++)
+		{
+			verdict_t const v = src.admit(t0);
+			TEST_CHECK(v != verdict_t::pass);
+			n_sampled += (v == verdict_t::sample);
+		}
+
+		TEST_CHECK(n_sampled > 800 && n_sampled < 1200);
+
+		auto const stats = admission.get_stats(t0);
+		auto const *s = find_stats(stats, "10.1.1.1");
+		TEST_CHECK(s != nullptr);
+		if (s)
+		{
+			TEST_CHECK_EQ(s->packets_sampled, n_sampled);
+			TEST_CHECK_EQ(s->packets_dropped, 4000 - n_sampled);
+		}
+	}
+
+	// every source has its own bucket, one source going over the limit does not affect others
+	void test_isolation()
+	{
+		uint64_t const t0 = 10 * nsec_in_sec;
+
+		// big table, so that no 3 of these sources hash to the same 2-way group
+		auto const conf = make_conf(100, 10, 0, 64 * 1024);
+		source_admission_t admission { &conf };
+
+		std::vector<source_t> sources;
+		for (uint32_t i = 0; i < 100; i++)
+			sources.emplace_back(&admission, ("10.0." + std::to_string(i / 10) + "." + std::to_string(i % 10 + 1)).c_str());
+
+		source_t noisy { &admission, "10.9.9.9" };
+		TEST_CHECK_EQ(noisy.n_pass_at(t0), 10);
+
+		for (auto& src : sources)
+		{
+			TEST_CHECK_EQ(src.n_pass_at(t0), 10);
+			TEST_CHECK(noisy.admit(t0) == verdict_t::drop);
+		}
+
+		// ipv6 is a different source, v4-mapped ipv6 is the same one as ipv4
+		source_t v6 { &admission, "2001:db8::1" };
+		TEST_CHECK_EQ(v6.n_pass_at(t0), 10);
+
+		source_t v4mapped { &admission, "::ffff:10.9.9.9" };
+		TEST_CHECK(v4mapped.admit(t0) == verdict_t::drop);
+
+		auto const stats = admission.get_stats(t0);
+		TEST_CHECK_EQ(stats.size(), sources.size() + 2);
+		TEST_CHECK(find_stats(stats, "2001:db8::1") != nullptr);
+
+		auto const *s = find_stats(stats, "10.9.9.9");
+		TEST_CHECK(s != nullptr);
+		if (s)
+			TEST_CHECK_EQ(s->packets_dropped, sources.size() + 2); // + the one that ended its burst, + v4-mapped one
+
+		// not an ip address, no limits
+		struct sockaddr_un sun = {};
+		sun.sun_family = AF_UNIX;
+		uint64_t rng = 1;
+		for (uint32_t i = 0; i < 1000; i++)
+			TEST_CHECK(admission.admit((struct sockaddr const*)&sun, t0, &rng) == verdict_t::pass);
+	}
+
+	// table is full, least recently seen source is evicted, and starts from scratch when it comes back
+	void test_eviction()
+	{
+		uint64_t const t0 = 10 * nsec_in_sec;
+
+		// 2 slots = a single 2-way group, every source competes for the same two entries
+		auto const conf = make_conf(100, 10, 0, 2);
+		source_admission_t admission { &conf };
+
+		source_t a { &admission, "10.0.0.1" };
+		source_t b { &admission, "10.0.0.2" };
+		source_t c { &admission, "10.0.0.3" };
+
+		TEST_CHECK_EQ(a.n_pass_at(t0 + 1 * msec), 10);
+		TEST_CHECK_EQ(b.n_pass_at(t0 + 2 * msec), 10);
+		TEST_CHECK(a.admit(t0 + 3 * msec) == verdict_t::drop); // a is most recently seen now
+
+		// takes b's entry
+		TEST_CHECK_EQ(c.n_pass_at(t0 + 4 * msec), 10);
+		{
+			auto const stats = admission.get_stats(t0 + 4 * msec);
+			TEST_CHECK_EQ(stats.size(), 2);
+			TEST_CHECK(find_stats(stats, "10.0.0.1") != nullptr);
+			TEST_CHECK(find_stats(stats, "10.0.0.2") == nullptr);
+			TEST_CHECK(find_stats(stats, "10.0.0.3") != nullptr);
+		}
+
+		// a is still tracked and over the limit
+		TEST_CHECK(a.admit(t0 + 5 * msec) == verdict_t::drop);
+
+		// b is back, evicts c, and has a full bucket again (forgotten sources are not limited)
+		TEST_CHECK_EQ(b.n_pass_at(t0 + 6 * msec), 10);
+		{
+			auto const stats = admission.get_stats(t0 + 6 * msec);
+			TEST_CHECK_EQ(stats.size(), 2);
+			TEST_CHECK(find_stats(stats, "10.0.0.3") == nullptr);
+
+			auto const *s = find_stats(stats, "10.0.0.2");
+			TEST_CHECK(s != nullptr);
+			if (s)
+			{
+				TEST_CHECK_EQ(s->packets_passed, 10); // counters start over too
+				TEST_CHECK_EQ(s->packets_dropped, 1);
+			}
+		}
+
+		// sources are spread over 2-way groups by hash, so a full table keeps most of them, but not all
+		{
+			auto const big_conf = make_conf(100, 10, 0, 1000);
+			source_admission_t big { &big_conf };
+
+			std::vector<source_t> sources;
+			for (uint32_t i = 0; i < 1000; i++)
+				sources.emplace_back(&big, ("10.1." + std::to_string(i / 250) + "." + std::to_string(i % 250 + 1)).c_str());
+
+			for (auto& src : sources)
+				src.admit(t0);
+
+			// 1024 entries in 512 groups, about 3/4 of sources is expected to fit
+			size_t const n_tracked = big.get_stats(t0).size();
+			TEST_CHECK(n_tracked > 650 && n_tracked < 850);
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	aux::test_burst();
+	aux::test_steady_rate();
+	aux::test_sampling();
+	aux::test_isolation();
+	aux::test_eviction();
+
+	return test_result();
+}
@@ -0,0 +1,177 @@
+#include "pinba_config.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/stream_frame.h"
+
+#include "test_util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// stream_frame_buffer_t, length-prefixed datagrams split between reads in various ways
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	std::string frame(std::string const& dgram)
+	{
+		uint32_t const len = dgram.size();
+		char const hdr[4] = { char(len >> 24), char(len >> 16), char(len >> 8), char(len) };
+		return std::string(hdr, sizeof(hdr)) + dgram;
+	}
+
+	std::string make_datagram(size_t size, char c)
+	{
+		std::string result(size, c);
+		if (size > 0)
+			result[size - 1] = '$'; // to see the end is in place
+		return result;
+	}
+
+	struct feed_result_t
+	{
+		std::vector<std::string>  datagrams;
+		bool                      bad_length = false;
+		uint32_t                  bad_length_value = 0;
+	};
+
+	// feed stream to buffer, in reads of at most chunk_size bytes, collect datagrams
+	feed_result_t feed(stream_frame_buffer_t& fb, std::string const& stream, size_t chunk_size)
+	{
+		feed_result_t result;
+
+		for (size_t off = 0; off < stream.size(); )
+		{
+			char *const dst = fb.write_ptr();
+			size_t const n = std::min(std::min(chunk_size, fb.write_space()), stream.size() - off);
+			TEST_CHECK(n > 0);
+
+			memcpy(dst, stream.data() + off, n);
+			fb.commit(n);
+			off += n;
+
+			while (true)
+			{
+				str_ref  dgram;
+				uint32_t bad_length;
+
+				auto const nr = fb.next(&dgram, &bad_length);
+				if (nr == stream_frame_buffer_t::next_need_more)
+					break;
+
+				if (nr == stream_frame_buffer_t::next_bad_length)
+				{
+					result.bad_length       = true;
+					result.bad_length_value = bad_length;
+					return result;
+				}
+
+				result.datagrams.emplace_back(dgram.data(), dgram.size());
+			}
+		}
+
+		return result;
+	}
+
+	void test_whole_and_split(size_t chunk_size)
+	{
+		std::vector<std::string> const dgrams = {
+			make_datagram(1, 'a'),
+			make_datagram(100, 'b'),
+			make_datagram(stream_frame_buffer_t::max_datagram_size, 'c'),
+			make_datagram(3, 'd'),
+			make_datagram(stream_frame_buffer_t::max_datagram_size - 1, 'e'),
+		};
+
+		// enough to wrap the buffer a few times, so that moving partial data to buffer start is exercised
+		std::vector<std::string> expected;
+		std::string stream;
+		for (unsigned i = 0; i < 3; i++)
+		{
+			for (auto const& d : dgrams)
+			{
+				expected.push_back(d);
+				stream += frame(d);
+			}
+		}
+
+		stream_frame_buffer_t fb;
+		feed_result_t const r = feed(fb, stream, chunk_size);
+
+		TEST_CHECK(!r.bad_length);
+		TEST_CHECK_EQ(r.datagrams.size(), expected.size());
+		TEST_CHECK(r.datagrams == expected);
+		TEST_CHECK(!fb.has_partial());
+	}
+
+	void test_partial()
+	{
+		std::string const d = make_datagram(1000, 'x');
+		std::string const stream = frame(d) + frame(d).substr(0, 500);
+
+		stream_frame_buffer_t fb;
+		feed_result_t const r = feed(fb, stream, 300);
+
+		TEST_CHECK(!r.bad_length);
+		TEST_CHECK_EQ(r.datagrams.size(), 1);
+		TEST_CHECK(fb.has_partial()); // connection closed now would be an error
+
+		// just the header, split too
+		stream_frame_buffer_t fb2;
+		feed_result_t const r2 = feed(fb2, frame(d).substr(0, 3), 1);
+		TEST_CHECK_EQ(r2.datagrams.size(), 0);
+		TEST_CHECK(fb2.has_partial());
+	}
+
+	void test_bad_length()
+	{
+		{
+			stream_frame_buffer_t fb;
+			std::string const stream = frame(make_datagram(10, 'a')) + std::string("\0\0\0\0", 4) + frame(make_datagram(10, 'b'));
+			feed_result_t const r = feed(fb, stream, 7);
+
+			TEST_CHECK(r.bad_length);
+			TEST_CHECK_EQ(r.bad_length_value, 0);
+			TEST_CHECK_EQ(r.datagrams.size(), 1);
+		}
+
+		// oversize is detected from the header alone, without waiting for the data
+		{
+			uint32_t const len = stream_frame_buffer_t::max_datagram_size + 1;
+			char const hdr[4] = { char(len >> 24), char(len >> 16), char(len >> 8), char(len) };
+
+			stream_frame_buffer_t fb;
+			feed_result_t const r = feed(fb, std::string(hdr, sizeof(hdr)), 1);
+
+			TEST_CHECK(r.bad_length);
+			TEST_CHECK_EQ(r.bad_length_value, len);
+		}
+
+		{
+			stream_frame_buffer_t fb;
+			feed_result_t const r = feed(fb, std::string("\xff\xff\xff\xff", 4), 4);
+
+			TEST_CHECK(r.bad_length);
+			TEST_CHECK_EQ(r.bad_length_value, 0xffffffff);
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+	// a datagram per read, frames split at every possible place, odd sized reads, and as much as fits
+	aux::test_whole_and_split(1);
+	aux::test_whole_and_split(3);
+	aux::test_whole_and_split(4093);
+	aux::test_whole_and_split(stream_frame_buffer_t::buffer_size);
+
+	aux::test_partial();
+	aux::test_bad_length();
+
+	return test_result();
+}
@@ -0,0 +1,47 @@
+#ifndef PINBA__TESTS__TEST_UTIL_H_
+#define PINBA__TESTS__TEST_UTIL_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// minimal checks for tests, failures are reported and counted, test continues
+// main() should end with `return test_result();`
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline unsigned& test_failures()
+{
+	static unsigned n = 0;
+	return n;
+}
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			test_failures()++; \
+		} \
+	} while (0)
+
+#define TEST_CHECK_EQ(a, b) \
+	do { \
+		auto const test_a_ = (a); \
+		auto const test_b_ = (b); \
+		if (!(test_a_ == test_b_)) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s (%llu != %llu)\n", __FILE__, __LINE__, #a, #b, \
+				(unsigned long long)test_a_, (unsigned long long)test_b_); \
+			test_failures()++; \
+		} \
+	} while (0)
+
+inline int test_result()
+{
+	if (test_failures() > 0)
+	{
+		fprintf(stderr, "%u checks failed\n", test_failures());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif // PINBA__TESTS__TEST_UTIL_H_